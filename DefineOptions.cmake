@@ -19,6 +19,7 @@ option(BINARY_PACKAGE_BUILD "Sets march optimization to generic" OFF)
 option(USE_XMLLINT "Run xmllint to test if darktableconfig.xml is valid" ON)
 option(USE_OPENJPEG "Enable JPEG 2000 support" ON)
 option(USE_WEBP "Enable WebP export support" ON)
+option(USE_LZ4 "Enable LZ4 compression for the thumbnail disk cache" ON)
 option(USE_AVIF "Enable AVIF support" ON)
 option(USE_XCF "Enable XCF support" ON)
 option(BUILD_CMSTEST "Build a test program to check your system's color management setup" ON)
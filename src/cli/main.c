@@ -83,6 +83,7 @@ static void usage(const char *progname)
   fprintf(stderr, "   --icc-file <file> specify icc filename, default to NONE\n");
   fprintf(stderr, "   --icc-intent <intent> specify icc intent, default to LAST\n");
   fprintf(stderr, "                     use --help icc-intent for list of supported intents\n");
+  fprintf(stderr, "   --trace <file> write per-module pixelpipe timings as chrome trace json\n");
   fprintf(stderr, "   --verbose\n");
   fprintf(stderr, "   --help,-h [option]\n");
   fprintf(stderr, "   --version\n");
@@ -195,6 +196,7 @@ int main(int argc, char *arg[])
   gchar *output_filename = NULL;
   gchar *output_ext = NULL;
   char *style = NULL;
+  char *trace_filename = NULL;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
   gboolean verbose = FALSE, high_quality = TRUE, upscale = FALSE,
@@ -381,6 +383,11 @@ int main(int argc, char *arg[])
           exit(1);
         }
       }
+      else if(!strcmp(arg[k], "--trace") && argc > k + 1)
+      {
+        k++;
+        trace_filename = arg[k];
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -407,12 +414,17 @@ int main(int argc, char *arg[])
   }
 
   int m_argc = 0;
-  char **m_arg = malloc((5 + argc - k + 1) * sizeof(char *));
+  char **m_arg = malloc((7 + argc - k + 1) * sizeof(char *));
   m_arg[m_argc++] = "darktable-cli";
   m_arg[m_argc++] = "--library";
   m_arg[m_argc++] = ":memory:";
   m_arg[m_argc++] = "--conf";
   m_arg[m_argc++] = "write_sidecar_files=FALSE";
+  if(trace_filename)
+  {
+    m_arg[m_argc++] = "--trace";
+    m_arg[m_argc++] = trace_filename;
+  }
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
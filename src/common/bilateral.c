@@ -17,7 +17,8 @@
 */
 
 #include "common/bilateral.h"
-#include "common/darktable.h" // for CLAMPS, dt_alloc_align, dt_free_align
+#include "common/darktable.h" // for CLAMPS
+#include "common/scratch.h"   // for dt_scratch_alloc_float, dt_scratch_free
 #include <glib.h>             // for MIN, MAX
 #include <math.h>             // for roundf
 #include <stdlib.h>           // for size_t, free, malloc, NULL
@@ -148,7 +149,7 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->numslices = darktable.num_openmp_threads;
   b->sliceheight = (height + b->numslices - 1) / b->numslices;
   b->slicerows = (b->size_y + b->numslices - 1) / b->numslices + 2;
-  b->buf = dt_alloc_align(64, b->size_x * b->size_z * b->numslices * b->slicerows * sizeof(float));
+  b->buf = dt_scratch_alloc_float(b->size_x * b->size_z * b->numslices * b->slicerows);
   if (b->buf)
   {
     memset(b->buf, 0, b->size_x * b->size_z * b->numslices * b->slicerows * sizeof(float));
@@ -453,7 +454,7 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
 void dt_bilateral_free(dt_bilateral_t *b)
 {
   if(!b) return;
-  dt_free_align(b->buf);
+  dt_scratch_free(b->buf);
   free(b);
 }
 
@@ -26,81 +26,176 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-// this implements a concurrent LRU cache
+// this implements a concurrent LRU cache.
+// the key space is split over a number of shards, each with its own lock, hashtable
+// and lru list. the cost accounting is global, so the quota has the same meaning
+// as with a single partition.
 
-void dt_cache_init(
+static inline size_t _cache_cost(const dt_cache_t *cache)
+{
+  return __atomic_load_n(&cache->cost, __ATOMIC_RELAXED);
+}
+
+static inline dt_cache_shard_t *_cache_shard(const dt_cache_t *cache, const uint32_t key)
+{
+  // mipmap keys carry the mip level in the top bits and image ids in the bottom bits,
+  // so mix everything before picking the shard (fibonacci hashing).
+  const uint32_t h = (key ^ (key >> 16)) * 0x9e3779b1u;
+  return cache->shards + ((h >> 16) & (cache->num_shards - 1));
+}
+
+static inline void _cache_stats_add(uint64_t *counter, const uint64_t value)
+{
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t _usec(const double seconds)
+{
+  return seconds > 0.0 ? (uint64_t)(seconds * 1e6) : 0;
+}
+
+void dt_cache_stats_latency(dt_cache_stats_t *stats, const double seconds)
+{
+  const uint64_t usec = _usec(seconds);
+  int k = 0;
+  while(k < DT_CACHE_LATENCY_BUCKETS - 1 && (1ull << k) <= usec) k++;
+  _cache_stats_add(&stats->latency[k], 1);
+}
+
+void dt_cache_stats_copy(dt_cache_stats_t *dst, const dt_cache_stats_t *src)
+{
+  dst->hits = __atomic_load_n(&src->hits, __ATOMIC_RELAXED);
+  dst->misses = __atomic_load_n(&src->misses, __ATOMIC_RELAXED);
+  dst->evictions = __atomic_load_n(&src->evictions, __ATOMIC_RELAXED);
+  dst->lock_wait = __atomic_load_n(&src->lock_wait, __ATOMIC_RELAXED);
+  dst->resident = __atomic_load_n(&src->resident, __ATOMIC_RELAXED);
+  for(int k = 0; k < DT_CACHE_LATENCY_BUCKETS; k++)
+    dst->latency[k] = __atomic_load_n(&src->latency[k], __ATOMIC_RELAXED);
+}
+
+static void _cache_free_entry(dt_cache_t *cache, dt_cache_entry_t *entry)
+{
+  if(cache->cleanup)
+  {
+    assert(entry->data_size);
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+
+    cache->cleanup(cache->cleanup_data, entry);
+  }
+  else
+    dt_free_align(entry->data);
+}
+
+void dt_cache_init_sharded(
     dt_cache_t *cache,
     size_t entry_size,
-    size_t cost_quota)
+    size_t cost_quota,
+    uint32_t num_shards)
 {
+  uint32_t n = 1;
+  while(n < num_shards && n < 1024) n <<= 1;
+
   cache->cost = 0;
-  cache->lru = 0;
   cache->entry_size = entry_size;
   cache->cost_quota = cost_quota;
-  dt_pthread_mutex_init(&cache->lock, 0);
   cache->allocate = 0;
   cache->allocate_data = 0;
   cache->cleanup = 0;
   cache->cleanup_data = 0;
-  cache->hashtable = g_hash_table_new(0, 0);
+  memset(&cache->stats, 0, sizeof(cache->stats));
+  cache->num_shards = n;
+  cache->shards = (dt_cache_shard_t *)dt_alloc_align(64, sizeof(dt_cache_shard_t) * n);
+  for(uint32_t k = 0; k < n; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_init(&shard->lock, 0);
+    shard->hashtable = g_hash_table_new(0, 0);
+    shard->lru = 0;
+  }
+}
+
+void dt_cache_init(
+    dt_cache_t *cache,
+    size_t entry_size,
+    size_t cost_quota)
+{
+  dt_cache_init_sharded(cache, entry_size, cost_quota, DT_CACHE_DEFAULT_SHARDS);
 }
 
 void dt_cache_cleanup(dt_cache_t *cache)
 {
-  g_hash_table_destroy(cache->hashtable);
-  GList *l = cache->lru;
-  while(l)
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-
-    if(cache->cleanup)
+    dt_cache_shard_t *shard = cache->shards + k;
+    g_hash_table_destroy(shard->hashtable);
+    GList *l = shard->lru;
+    while(l)
     {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
 
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
+      _cache_free_entry(cache, entry);
 
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-    l = g_list_next(l);
+      dt_pthread_rwlock_destroy(&entry->lock);
+      g_slice_free1(sizeof(*entry), entry);
+      l = g_list_next(l);
+    }
+    g_list_free(shard->lru);
+    dt_pthread_mutex_destroy(&shard->lock);
   }
-  g_list_free(cache->lru);
-  dt_pthread_mutex_destroy(&cache->lock);
+  dt_free_align(cache->shards);
+  cache->shards = 0;
+  cache->num_shards = 0;
 }
 
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  int32_t result = g_hash_table_contains(cache->hashtable, GINT_TO_POINTER(key));
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
+  dt_pthread_mutex_lock(&shard->lock);
+  int32_t result = g_hash_table_contains(shard->hashtable, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&shard->lock);
   return result;
 }
 
+uint32_t dt_cache_size(dt_cache_t *cache)
+{
+  uint32_t size = 0;
+  for(uint32_t k = 0; k < cache->num_shards; k++)
+  {
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    size += g_hash_table_size(shard->hashtable);
+    dt_pthread_mutex_unlock(&shard->lock);
+  }
+  return size;
+}
+
 int dt_cache_for_all(
     dt_cache_t *cache,
     int (*process)(const uint32_t key, const void *data, void *user_data),
     void *user_data)
 {
-  dt_pthread_mutex_lock(&cache->lock);
-  GHashTableIter iter;
-  gpointer key, value;
-
-  g_hash_table_iter_init (&iter, cache->hashtable);
-  while (g_hash_table_iter_next (&iter, &key, &value))
+  for(uint32_t k = 0; k < cache->num_shards; k++)
   {
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
-    const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
-    if(err)
+    dt_cache_shard_t *shard = cache->shards + k;
+    dt_pthread_mutex_lock(&shard->lock);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init (&iter, shard->hashtable);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      dt_pthread_mutex_unlock(&cache->lock);
-      return err;
+      dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
+      const int err = process(GPOINTER_TO_INT(key), entry->data, user_data);
+      if(err)
+      {
+        dt_pthread_mutex_unlock(&shard->lock);
+        return err;
+      }
     }
+    dt_pthread_mutex_unlock(&shard->lock);
   }
-  dt_pthread_mutex_unlock(&cache->lock);
   return 0;
 }
 
@@ -110,10 +205,11 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 {
   gpointer orig_key, value;
   gboolean res;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
   double start = dt_get_wtime();
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   {
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -123,13 +219,13 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       return 0;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    shard->lru = g_list_remove_link(shard->lru, entry->link);
+    shard->lru = g_list_concat(shard->lru, entry->link);
+    dt_pthread_mutex_unlock(&shard->lock);
     double end = dt_get_wtime();
     if(end - start > 0.1)
       fprintf(stderr, "try+ wait time %.06fs mode %c \n", end - start, mode);
@@ -144,13 +240,67 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 
     return entry;
   }
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "try- wait time %.06fs\n", end - start);
   return 0;
 }
 
+// evict entries from the lru list of one shard, the shard mutex has to be held by the caller.
+static void _cache_gc_shard(dt_cache_t *cache, dt_cache_shard_t *shard, const float fill_ratio)
+{
+  GList *l = shard->lru;
+  while(l)
+  {
+    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
+    assert(entry->link->data == entry);
+    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
+    if(_cache_cost(cache) < cache->cost_quota * fill_ratio) break;
+
+    // if still locked by anyone else give up:
+    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
+
+    if(entry->_lock_demoting)
+    {
+      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
+      dt_pthread_rwlock_unlock(&entry->lock);
+      continue;
+    }
+
+    // delete!
+    g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(entry->key));
+    shard->lru = g_list_delete_link(shard->lru, entry->link);
+    __atomic_fetch_sub(&cache->cost, entry->cost, __ATOMIC_RELAXED);
+    _cache_stats_add(&cache->stats.evictions, 1);
+
+    _cache_free_entry(cache, entry);
+
+    dt_pthread_rwlock_unlock(&entry->lock);
+    dt_pthread_rwlock_destroy(&entry->lock);
+    g_slice_free1(sizeof(*entry), entry);
+  }
+}
+
+// walk all shards, starting with the one we already hold (if any). the other shards are
+// only try-locked, so we never wait on another thread and lock order doesn't matter.
+static void _cache_gc(dt_cache_t *cache, dt_cache_shard_t *locked, const float fill_ratio)
+{
+  const uint32_t first = locked ? (uint32_t)(locked - cache->shards) : 0;
+  for(uint32_t k = 0; k < cache->num_shards; k++)
+  {
+    if(_cache_cost(cache) < cache->cost_quota * fill_ratio) break;
+    dt_cache_shard_t *shard = cache->shards + ((first + k) & (cache->num_shards - 1));
+    if(shard == locked)
+      _cache_gc_shard(cache, shard, fill_ratio);
+    else if(!dt_pthread_mutex_trylock(&shard->lock))
+    {
+      _cache_gc_shard(cache, shard, fill_ratio);
+      dt_pthread_mutex_unlock(&shard->lock);
+    }
+  }
+}
+
 // if found, the data void* is returned. if not, it is set to be
 // the given *data and a new hash table entry is created, which can be
 // found using the given key later on.
@@ -159,11 +309,12 @@ dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key
   gpointer orig_key, value;
   gboolean res;
   int result;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
   double start = dt_get_wtime();
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   if(res)
   { // yay, found. read lock and pass on.
     dt_cache_entry_t *entry = (dt_cache_entry_t *)value;
@@ -172,14 +323,16 @@ restart:
     if(result)
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
-      dt_pthread_mutex_unlock(&cache->lock);
+      dt_pthread_mutex_unlock(&shard->lock);
       g_usleep(5);
       goto restart;
     }
     // bubble up in lru list:
-    cache->lru = g_list_remove_link(cache->lru, entry->link);
-    cache->lru = g_list_concat(cache->lru, entry->link);
-    dt_pthread_mutex_unlock(&cache->lock);
+    shard->lru = g_list_remove_link(shard->lru, entry->link);
+    shard->lru = g_list_concat(shard->lru, entry->link);
+    dt_pthread_mutex_unlock(&shard->lock);
+    _cache_stats_add(&cache->stats.hits, 1);
+    _cache_stats_add(&cache->stats.lock_wait, _usec(dt_get_wtime() - start));
 
 #ifdef _DEBUG
     const pthread_t writer = dt_pthread_rwlock_get_writer(&entry->lock);
@@ -205,13 +358,15 @@ restart:
   }
 
   // else, not found, need to allocate.
+  _cache_stats_add(&cache->stats.misses, 1);
+  _cache_stats_add(&cache->stats.lock_wait, _usec(dt_get_wtime() - start));
 
   // first try to clean up.
   // also wait if we can't free more than the requested fill ratio.
-  if(cache->cost > 0.8f * cache->cost_quota)
+  if(_cache_cost(cache) > 0.8f * cache->cost_quota)
   {
     // need to roll back all the way to get a consistent lock state:
-    dt_cache_gc(cache, 0.8f);
+    _cache_gc(cache, shard, 0.8f);
   }
 
   // here dies your 32-bit system:
@@ -225,14 +380,16 @@ restart:
   entry->key = key;
   entry->_lock_demoting = 0;
 
-  g_hash_table_insert(cache->hashtable, GINT_TO_POINTER(key), entry);
+  g_hash_table_insert(shard->hashtable, GINT_TO_POINTER(key), entry);
 
   assert(cache->allocate || entry->data_size);
 
+  const double alloc_start = dt_get_wtime();
   if(cache->allocate)
     cache->allocate(cache->allocate_data, entry);
   else
     entry->data = dt_alloc_align(64, entry->data_size);
+  dt_cache_stats_latency(&cache->stats, dt_get_wtime() - alloc_start);
 
   assert(entry->data_size);
   ASAN_POISON_MEMORY_REGION(entry->data, entry->data_size);
@@ -244,12 +401,12 @@ restart:
   if(write) dt_pthread_rwlock_wrlock_with_caller(&entry->lock, file, line);
   else      dt_pthread_rwlock_rdlock_with_caller(&entry->lock, file, line);
 
-  cache->cost += entry->cost;
+  __atomic_fetch_add(&cache->cost, entry->cost, __ATOMIC_RELAXED);
 
   // put at end of lru list (most recently used):
-  cache->lru = g_list_concat(cache->lru, entry->link);
+  shard->lru = g_list_concat(shard->lru, entry->link);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   double end = dt_get_wtime();
   if(end - start > 0.1)
     fprintf(stderr, "wait time %.06fs\n", end - start);
@@ -265,22 +422,23 @@ int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
   gboolean res;
   int result;
   dt_cache_entry_t *entry;
+  dt_cache_shard_t *shard = _cache_shard(cache, key);
 restart:
-  dt_pthread_mutex_lock(&cache->lock);
+  dt_pthread_mutex_lock(&shard->lock);
 
   res = g_hash_table_lookup_extended(
-      cache->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
+      shard->hashtable, GINT_TO_POINTER(key), &orig_key, &value);
   entry = (dt_cache_entry_t *)value;
   if(!res)
   { // not found in cache, not deleting.
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     return 1;
   }
   // need write lock to be able to delete:
   result = dt_pthread_rwlock_trywrlock(&entry->lock);
   if(result)
   {
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
@@ -289,77 +447,31 @@ restart:
   {
     // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
     dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_mutex_unlock(&cache->lock);
+    dt_pthread_mutex_unlock(&shard->lock);
     g_usleep(5);
     goto restart;
   }
 
-  gboolean removed = g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(key));
+  gboolean removed = g_hash_table_remove(shard->hashtable, GINT_TO_POINTER(key));
   (void)removed; // make non-assert compile happy
   assert(removed);
-  cache->lru = g_list_delete_link(cache->lru, entry->link);
-
-  if(cache->cleanup)
-  {
-    assert(entry->data_size);
-    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+  shard->lru = g_list_delete_link(shard->lru, entry->link);
 
-    cache->cleanup(cache->cleanup_data, entry);
-  }
-  else
-    dt_free_align(entry->data);
+  _cache_free_entry(cache, entry);
 
   dt_pthread_rwlock_unlock(&entry->lock);
   dt_pthread_rwlock_destroy(&entry->lock);
-  cache->cost -= entry->cost;
+  __atomic_fetch_sub(&cache->cost, entry->cost, __ATOMIC_RELAXED);
   g_slice_free1(sizeof(*entry), entry);
 
-  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_unlock(&shard->lock);
   return 0;
 }
 
 // best-effort garbage collection. never blocks, never fails. well, sometimes it just doesn't free anything.
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 {
-  GList *l = cache->lru;
-  int cnt = 0;
-  while(l)
-  {
-    cnt++;
-    dt_cache_entry_t *entry = (dt_cache_entry_t *)l->data;
-    assert(entry->link->data == entry);
-    l = g_list_next(l); // we might remove this element, so walk to the next one while we still have the pointer..
-    if(cache->cost < cache->cost_quota * fill_ratio) break;
-
-    // if still locked by anyone else give up:
-    if(dt_pthread_rwlock_trywrlock(&entry->lock)) continue;
-
-    if(entry->_lock_demoting)
-    {
-      // oops, we are currently demoting (rw -> r) lock to this entry in some thread. do not touch!
-      dt_pthread_rwlock_unlock(&entry->lock);
-      continue;
-    }
-
-    // delete!
-    g_hash_table_remove(cache->hashtable, GINT_TO_POINTER(entry->key));
-    cache->lru = g_list_delete_link(cache->lru, entry->link);
-    cache->cost -= entry->cost;
-
-    if(cache->cleanup)
-    {
-      assert(entry->data_size);
-      ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
-
-      cache->cleanup(cache->cleanup_data, entry);
-    }
-    else
-      dt_free_align(entry->data);
-
-    dt_pthread_rwlock_unlock(&entry->lock);
-    dt_pthread_rwlock_destroy(&entry->lock);
-    g_slice_free1(sizeof(*entry), entry);
-  }
+  _cache_gc(cache, NULL, fill_ratio);
 }
 
 void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, const char *file, int line)
@@ -38,27 +38,60 @@ dt_cache_entry_t;
 typedef void((*dt_cache_allocate_t)(void *userdata, dt_cache_entry_t *entry));
 typedef void((*dt_cache_cleanup_t)(void *userdata, dt_cache_entry_t *entry));
 
+// one independently locked partition of the cache. keys are distributed over
+// the shards by hash, so threads looking up different images only contend if
+// they happen to hit the same shard.
+typedef struct dt_cache_shard_t
+{
+  dt_pthread_mutex_t lock; // protects the hashtable and lru list of this shard only
+
+  GHashTable *hashtable; // stores (key, entry) pairs
+  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
+}
+__attribute__((aligned(64))) dt_cache_shard_t;
+
+// bucket k of a latency histogram counts events which took less than 2^k microseconds,
+// the last one everything longer.
+#define DT_CACHE_LATENCY_BUCKETS 24
+
+// counters to tune the cache sizes by. all of them are only ever updated atomically.
+typedef struct dt_cache_stats_t
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t lock_wait; // microseconds spent waiting for locks
+  uint64_t resident;  // bytes held by the entries, if the owner keeps track of it
+  uint64_t latency[DT_CACHE_LATENCY_BUCKETS]; // time it took to fill the missed entries
+}
+dt_cache_stats_t;
+
 typedef struct dt_cache_t
 {
-  dt_pthread_mutex_t lock; // big fat lock. we're only expecting a couple hand full of cpu threads to use this concurrently.
+  dt_cache_shard_t *shards; // lock-striped partitions of the key space
+  uint32_t num_shards;      // always a power of two
 
   size_t entry_size; // cache line allocation
-  size_t cost;       // user supplied cost per cache line (bytes?)
+  size_t cost;       // user supplied cost per cache line (bytes?), summed over all shards. updated atomically.
   size_t cost_quota; // quota to try and meet. but don't use as hard limit.
 
-  GHashTable *hashtable; // stores (key, entry) pairs
-  GList *lru;            // last element is most recently used, first is about to be kicked from cache.
-
   // callback functions for cache misses/garbage collection
   dt_cache_allocate_t allocate;
   dt_cache_allocate_t cleanup;
   void *allocate_data;
   void *cleanup_data;
+
+  dt_cache_stats_t stats; // the latency is the one of the allocate callback
 }
 dt_cache_t;
 
+// default number of shards used by dt_cache_init()
+#define DT_CACHE_DEFAULT_SHARDS 16
+
 // entry size is only used if alloc callback is 0
 void dt_cache_init(dt_cache_t *cache, size_t entry_size, size_t cost_quota);
+// same, but with an explicit number of shards (rounded up to a power of two)
+void dt_cache_init_sharded(dt_cache_t *cache, size_t entry_size, size_t cost_quota, uint32_t num_shards);
 void dt_cache_cleanup(dt_cache_t *cache);
 
 static inline void dt_cache_set_allocate_callback(dt_cache_t *cache, dt_cache_allocate_t allocate_cb,
@@ -87,12 +120,20 @@ void dt_cache_release_with_caller(dt_cache_t *cache, dt_cache_entry_t *entry, co
 int32_t dt_cache_contains(dt_cache_t *cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
-// removes from the tip of the lru list, until the fill ratio of the hashtable
-// goes below the given parameter, in terms of the user defined cost measure.
-// will never lock and never fail, but sometimes not free memory (in case all
+// removes from the tip of the lru lists of all shards, until the fill ratio of
+// the cache goes below the given parameter, in terms of the user defined cost measure.
+// will never block and never fail, but sometimes not free memory (in case all
 // is locked)
 void dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
+// number of entries currently in the cache.
+uint32_t dt_cache_size(dt_cache_t *cache);
+
+// add an event of the given duration to the latency histogram.
+void dt_cache_stats_latency(dt_cache_stats_t *stats, const double seconds);
+// atomic snapshot of the counters, one by one.
+void dt_cache_stats_copy(dt_cache_stats_t *dst, const dt_cache_stats_t *src);
+
 // iterate over all currently contained data blocks.
 // not thread safe! only use this for init/cleanup!
 // returns non zero the first time process() returns non zero.
@@ -0,0 +1,243 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "common/file_location.h"
+#include "common/trace.h"
+
+#include <glib/gstdio.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// seconds between two lines of the json log
+#define DT_CACHE_STATS_INTERVAL 10
+
+typedef struct dt_cache_stats_client_t
+{
+  gchar *name;
+  dt_cache_stats_fill_t fill;
+  void *data;
+  void *key;      // what the client is unregistered by
+  gboolean owned; // data was allocated by us
+} dt_cache_stats_client_t;
+
+typedef struct dt_cache_stats_cache_t
+{
+  dt_cache_t *cache;
+  gboolean cost_is_bytes;
+} dt_cache_stats_cache_t;
+
+static gboolean _stats_initialized = FALSE;
+static dt_pthread_mutex_t _stats_mutex;
+static GList *_stats_clients = NULL;
+static FILE *_stats_file = NULL;
+static pthread_t _stats_thread;
+static volatile gint _stats_running = 0;
+static double _stats_start = 0.0;
+
+static void _write_line(void)
+{
+  GList *reports = dt_cache_stats_collect();
+  gchar *json = dt_cache_stats_json(reports);
+  fprintf(_stats_file, "%s\n", json);
+  fflush(_stats_file);
+  g_free(json);
+  dt_cache_stats_free(reports);
+}
+
+static void *_stats_writer(void *unused)
+{
+  dt_pthread_setname("cachestats");
+  int ticks = 0;
+  while(g_atomic_int_get(&_stats_running))
+  {
+    // short sleeps so cleanup doesn't have to wait for long
+    g_usleep(100000);
+    if(++ticks % (10 * DT_CACHE_STATS_INTERVAL) == 0) _write_line();
+  }
+  return NULL;
+}
+
+void dt_cache_stats_init(void)
+{
+  if(_stats_initialized) return;
+  dt_pthread_mutex_init(&_stats_mutex, NULL);
+  _stats_start = dt_get_wtime();
+  _stats_initialized = TRUE;
+
+  if(!(darktable.unmuted & DT_DEBUG_CACHE_STATS)) return;
+
+  char cachedir[PATH_MAX] = { 0 };
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  gchar *filename = g_build_filename(cachedir, "cachestats.jsonl", NULL);
+  _stats_file = g_fopen(filename, "ab");
+  if(!_stats_file)
+    fprintf(stderr, "[cache_stats] can't open `%s' for writing\n", filename);
+  else
+  {
+    fprintf(stderr, "[cache_stats] writing cache statistics to `%s'\n", filename);
+    g_atomic_int_set(&_stats_running, 1);
+    if(dt_pthread_create(&_stats_thread, _stats_writer, NULL)) g_atomic_int_set(&_stats_running, 0);
+  }
+  g_free(filename);
+}
+
+static void _client_free(gpointer data)
+{
+  dt_cache_stats_client_t *client = (dt_cache_stats_client_t *)data;
+  if(client->owned) g_free(client->data);
+  g_free(client->name);
+  g_free(client);
+}
+
+void dt_cache_stats_cleanup(void)
+{
+  if(!_stats_initialized) return;
+  if(g_atomic_int_get(&_stats_running))
+  {
+    g_atomic_int_set(&_stats_running, 0);
+    pthread_join(_stats_thread, NULL);
+  }
+  if(_stats_file)
+  {
+    // one last line with the totals of this session
+    _write_line();
+    fclose(_stats_file);
+    _stats_file = NULL;
+  }
+  _stats_initialized = FALSE;
+  g_list_free_full(_stats_clients, _client_free);
+  _stats_clients = NULL;
+  dt_pthread_mutex_destroy(&_stats_mutex);
+}
+
+static void _cache_fill(void *data, dt_cache_report_t *report)
+{
+  dt_cache_stats_cache_t *c = (dt_cache_stats_cache_t *)data;
+  dt_cache_stats_copy(&report->stats, &c->cache->stats);
+  report->entries = dt_cache_size(c->cache);
+  report->quota = c->cache->cost_quota;
+  if(c->cost_is_bytes) report->stats.resident = __atomic_load_n(&c->cache->cost, __ATOMIC_RELAXED);
+}
+
+static void _register(const char *name, dt_cache_stats_fill_t fill, void *data, void *key, const gboolean owned)
+{
+  dt_cache_stats_client_t *client = (dt_cache_stats_client_t *)g_malloc0(sizeof(dt_cache_stats_client_t));
+  client->name = g_strdup(name);
+  client->fill = fill;
+  client->data = data;
+  client->key = key;
+  client->owned = owned;
+  dt_pthread_mutex_lock(&_stats_mutex);
+  _stats_clients = g_list_append(_stats_clients, client);
+  dt_pthread_mutex_unlock(&_stats_mutex);
+}
+
+void dt_cache_stats_register(const char *name, dt_cache_stats_fill_t fill, void *data)
+{
+  if(!_stats_initialized) return;
+  _register(name, fill, data, data, FALSE);
+}
+
+void dt_cache_stats_register_cache(const char *name, dt_cache_t *cache, const gboolean cost_is_bytes)
+{
+  if(!_stats_initialized) return;
+  dt_cache_stats_cache_t *c = (dt_cache_stats_cache_t *)g_malloc(sizeof(dt_cache_stats_cache_t));
+  c->cache = cache;
+  c->cost_is_bytes = cost_is_bytes;
+  _register(name, _cache_fill, c, cache, TRUE);
+}
+
+void dt_cache_stats_unregister(void *data)
+{
+  if(!_stats_initialized) return;
+  dt_pthread_mutex_lock(&_stats_mutex);
+  for(GList *l = _stats_clients; l; l = g_list_next(l))
+  {
+    dt_cache_stats_client_t *client = (dt_cache_stats_client_t *)l->data;
+    if(client->key == data)
+    {
+      _stats_clients = g_list_delete_link(_stats_clients, l);
+      _client_free(client);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&_stats_mutex);
+}
+
+GList *dt_cache_stats_collect(void)
+{
+  if(!_stats_initialized) return NULL;
+  GList *reports = NULL;
+  dt_pthread_mutex_lock(&_stats_mutex);
+  for(GList *l = _stats_clients; l; l = g_list_next(l))
+  {
+    dt_cache_stats_client_t *client = (dt_cache_stats_client_t *)l->data;
+    dt_cache_report_t *report = (dt_cache_report_t *)g_malloc0(sizeof(dt_cache_report_t));
+    report->name = g_strdup(client->name);
+    client->fill(client->data, report);
+    reports = g_list_prepend(reports, report);
+  }
+  dt_pthread_mutex_unlock(&_stats_mutex);
+  return g_list_reverse(reports);
+}
+
+static void _report_free(gpointer data)
+{
+  dt_cache_report_t *report = (dt_cache_report_t *)data;
+  g_free(report->name);
+  g_free(report);
+}
+
+void dt_cache_stats_free(GList *reports)
+{
+  g_list_free_full(reports, _report_free);
+}
+
+gchar *dt_cache_stats_json(GList *reports)
+{
+  // json wants a decimal point, whatever the locale
+  char now[G_ASCII_DTOSTR_BUF_SIZE];
+  g_ascii_formatd(now, sizeof(now), "%.3f", dt_get_wtime() - _stats_start);
+  GString *json = g_string_new(NULL);
+  g_string_append_printf(json, "{\"time\":%s,\"caches\":[", now);
+  for(GList *l = reports; l; l = g_list_next(l))
+  {
+    const dt_cache_report_t *r = (dt_cache_report_t *)l->data;
+    gchar *name = dt_trace_escape(r->name);
+    g_string_append_printf(json,
+                           "%s{\"name\":\"%s\",\"entries\":%" PRIu64 ",\"quota\":%" PRIu64 ",\"hits\":%" PRIu64
+                           ",\"misses\":%" PRIu64 ",\"evictions\":%" PRIu64 ",\"lock_wait_us\":%" PRIu64
+                           ",\"resident\":%" PRIu64 ",\"latency_us_log2\":[",
+                           l == reports ? "" : ",", name, r->entries, r->quota, r->stats.hits, r->stats.misses,
+                           r->stats.evictions, r->stats.lock_wait, r->stats.resident);
+    g_free(name);
+    for(int k = 0; k < DT_CACHE_LATENCY_BUCKETS; k++)
+      g_string_append_printf(json, "%s%" PRIu64, k ? "," : "", r->stats.latency[k]);
+    g_string_append(json, "]}");
+  }
+  g_string_append(json, "]}");
+  return g_string_free(json, FALSE);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,61 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/cache.h"
+
+#include <glib.h>
+
+/**
+ * one place to read the statistics of all caches from: the image cache, the mipmap caches
+ * and each of their levels, and the pixelpipe caches of the darkroom. the caches register
+ * here, lua reads the reports through darktable.cache_stats(), and with -d cachestats they
+ * are appended to cachestats.jsonl in the cache directory every few seconds, one json object
+ * per line.
+ */
+
+typedef struct dt_cache_report_t
+{
+  gchar *name;
+  uint64_t entries;       // lines currently held
+  uint64_t quota;         // the cache's own limit, in its cost unit. 0 for none
+  dt_cache_stats_t stats; // resident is in bytes
+} dt_cache_report_t;
+
+/** fills in everything but the name. called with the registry locked, must not (un)register. */
+typedef void (*dt_cache_stats_fill_t)(void *data, dt_cache_report_t *report);
+
+void dt_cache_stats_init(void);
+void dt_cache_stats_cleanup(void);
+
+/** register a cache, data identifies it for unregistering. */
+void dt_cache_stats_register(const char *name, dt_cache_stats_fill_t fill, void *data);
+/** same for a dt_cache_t. if cost_is_bytes is FALSE the resident bytes are taken from its stats. */
+void dt_cache_stats_register_cache(const char *name, dt_cache_t *cache, const gboolean cost_is_bytes);
+void dt_cache_stats_unregister(void *data);
+
+/** reports of all registered caches, in order of registration. free with dt_cache_stats_free(). */
+GList *dt_cache_stats_collect(void);
+void dt_cache_stats_free(GList *reports);
+/** the reports as one line of json, without the newline. */
+gchar *dt_cache_stats_json(GList *reports);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -21,6 +21,7 @@
 #include "common/image.h"
 #include "common/imageio_rawspeed.h"
 #include "common/metadata.h"
+#include "common/search_index.h"
 #include "common/utility.h"
 #include "common/map_locations.h"
 #include "control/conf.h"
@@ -53,7 +54,8 @@ static const char *comparators[] = {
 };
 
 /* Stores the collection query, returns 1 if changed.. */
-static int _dt_collection_store(const dt_collection_t *collection, gchar *query, gchar *query_no_group);
+static int _dt_collection_store(const dt_collection_t *collection, gchar *query, gchar *query_no_group,
+                                gchar *query_delta, gchar *query_delta_no_group, gchar *query_delta_order);
 /* Counts the number of images in the current collection */
 static uint32_t _dt_collection_compute_count(const dt_collection_t *collection, gboolean no_group);
 /* signal handlers to update the cached count when something interesting might have happened.
@@ -79,6 +81,9 @@ const dt_collection_t *dt_collection_new(const dt_collection_t *clone)
     collection->where_ext = g_strdupv(clone->where_ext);
     collection->query = g_strdup(clone->query);
     collection->query_no_group = g_strdup(clone->query_no_group);
+    collection->query_delta = g_strdup(clone->query_delta);
+    collection->query_delta_no_group = g_strdup(clone->query_delta_no_group);
+    collection->query_delta_order = g_strdup(clone->query_delta_order);
     collection->clone = 1;
     collection->count = clone->count;
     collection->count_no_group = clone->count_no_group;
@@ -114,6 +119,9 @@ void dt_collection_free(const dt_collection_t *collection)
 
   g_free(collection->query);
   g_free(collection->query_no_group);
+  g_free(collection->query_delta);
+  g_free(collection->query_delta_no_group);
+  g_free(collection->query_delta_order);
   g_strfreev(collection->where_ext);
   g_free((dt_collection_t *)collection);
 }
@@ -145,6 +153,9 @@ static char * and_operator(int *term)
   assert(0); // Not reached.
 }
 
+// the query memory.collected_images was filled with
+static gchar *_memory_query = NULL;
+
 void dt_collection_memory_update()
 {
   if(!darktable.collection || !darktable.db) return;
@@ -175,10 +186,264 @@ void dt_collection_memory_update()
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  g_free(query);
+  // the table now holds the result of this query, see dt_collection_memory_update_images()
+  g_free(_memory_query);
+  _memory_query = query;
   g_free(ins_query);
 }
 
+// the collected images are updated in place for no more images than this, otherwise rebuilt
+#define DT_COLLECTION_DELTA_MAX 64
+
+static void _delta_fill(const GList *imgs)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.collection_delta", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR IGNORE INTO memory.collection_delta (imgid) VALUES (?1)", -1, &stmt,
+                              NULL);
+  for(const GList *l = imgs; l; l = g_list_next(l))
+  {
+    sqlite3_reset(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+    sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+// the ids of the restricted query, in collection order
+static GList *_delta_collected(sqlite3_stmt *stmt)
+{
+  GList *ids = NULL;
+  sqlite3_reset(stmt);
+  while(sqlite3_step(stmt) == SQLITE_ROW) ids = g_list_prepend(ids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  return g_list_reverse(ids);
+}
+
+static void _delta_set(sqlite3 *db, const int a, const int b)
+{
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM memory.collection_delta", NULL, NULL, NULL);
+  gchar *query = g_strdup_printf("INSERT INTO memory.collection_delta (imgid) VALUES (%d), (%d)", a, b);
+  DT_DEBUG_SQLITE3_EXEC(db, query, NULL, NULL, NULL);
+  g_free(query);
+}
+
+// the rowid before which imgid goes: the rows of the table from rowid lo on (the table may have gaps) are
+// compared to it in pairs by the collection order. -1 if a row is gone from the library.
+static int _delta_position(sqlite3 *db, sqlite3_stmt *order_stmt, const int imgid, int lo, int hi)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "SELECT rowid, imgid FROM memory.collected_images"
+                              " WHERE rowid >= ?1 ORDER BY rowid LIMIT 1",
+                              -1, &stmt, NULL);
+  while(lo < hi)
+  {
+    const int mid = lo + (hi - lo) / 2;
+    sqlite3_reset(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, mid);
+    if(sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_int(stmt, 0) >= hi)
+    {
+      // no rows in [mid, hi), before mid is the same place as before hi
+      hi = mid;
+      continue;
+    }
+    const int rowid = sqlite3_column_int(stmt, 0);
+    const int other = sqlite3_column_int(stmt, 1);
+
+    _delta_set(db, imgid, other);
+    GList *order = _delta_collected(order_stmt);
+    const int n = g_list_length(order);
+    const int first = order ? GPOINTER_TO_INT(order->data) : -1;
+    g_list_free(order);
+    if(n != 2)
+    {
+      hi = -1;
+      break;
+    }
+
+    if(first == imgid)
+      hi = mid;
+    else
+      lo = rowid + 1;
+  }
+  sqlite3_finalize(stmt);
+  return hi;
+}
+
+typedef struct _delta_event_t
+{
+  int rowid; // rows from here on shift
+  int shift;
+} _delta_event_t;
+
+static gint _delta_event_cmp(gconstpointer a, gconstpointer b)
+{
+  return ((const _delta_event_t *)a)->rowid - ((const _delta_event_t *)b)->rowid;
+}
+
+dt_collection_change_t dt_collection_memory_update_images(const GList *imgs)
+{
+  if(!darktable.collection || !darktable.db || !imgs) return DT_COLLECTION_CHANGE_NONE;
+  const dt_collection_t *collection = darktable.collection;
+  if(!collection->query_delta_order || g_strcmp0(_memory_query, dt_collection_get_query(collection)))
+    return DT_COLLECTION_CHANGE_NONE;
+
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+
+  _delta_fill(imgs);
+
+  // which image of a group is shown depends on the others in the group
+  if(darktable.gui && darktable.gui->grouping)
+    DT_DEBUG_SQLITE3_EXEC(db,
+                          "INSERT OR IGNORE INTO memory.collection_delta (imgid)"
+                          " SELECT id FROM main.images"
+                          " WHERE group_id IN (SELECT group_id FROM main.images"
+                          "                    WHERE id IN (SELECT imgid FROM memory.collection_delta))",
+                          NULL, NULL, NULL);
+
+  // where the images were
+  int count = 0;
+  GHashTable *old = g_hash_table_new(g_direct_hash, g_direct_equal);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "SELECT d.imgid, c.rowid FROM memory.collection_delta AS d"
+                              " LEFT JOIN memory.collected_images AS c ON c.imgid = d.imgid",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+      g_hash_table_insert(old, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)),
+                          GINT_TO_POINTER(sqlite3_column_int(stmt, 1)));
+    count++;
+  }
+  sqlite3_finalize(stmt);
+  if(count > DT_COLLECTION_DELTA_MAX)
+  {
+    g_hash_table_destroy(old);
+    return DT_COLLECTION_CHANGE_NONE;
+  }
+
+  // which of them belong to the collection now, in collection order
+  sqlite3_stmt *collected;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, collection->query_delta, -1, &collected, NULL);
+  GList *ids = _delta_collected(collected);
+  sqlite3_finalize(collected);
+  const int n = g_list_length(ids);
+
+  int rows = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT MAX(rowid) FROM memory.collected_images", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) rows = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  // take them out, the rest is in order and places them
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "DELETE FROM memory.collected_images"
+                        " WHERE imgid IN (SELECT imgid FROM memory.collection_delta)",
+                        NULL, NULL, NULL);
+
+  // the ids are in order, so are their places
+  int *place = g_new(int, n + 1);
+  int k = 0, lo = 1;
+  gboolean stale = FALSE;
+  sqlite3_stmt *order_stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, collection->query_delta_order, -1, &order_stmt, NULL);
+  for(const GList *l = ids; l; l = g_list_next(l), k++)
+  {
+    place[k] = lo = _delta_position(db, order_stmt, GPOINTER_TO_INT(l->data), lo, rows + 1);
+    if(place[k] < 0)
+    {
+      stale = TRUE;
+      break;
+    }
+  }
+  sqlite3_finalize(order_stmt);
+
+  // the table is missing the images now, it has to be rebuilt
+  if(stale)
+  {
+    g_free(place);
+    g_list_free(ids);
+    g_hash_table_destroy(old);
+    return DT_COLLECTION_CHANGE_NONE;
+  }
+
+  // the remaining rows lose one for each image taken out before them and gain one for each image placed
+  // before them
+  GArray *events = g_array_new(FALSE, FALSE, sizeof(_delta_event_t));
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, old);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    const _delta_event_t e = { GPOINTER_TO_INT(value) + 1, -1 };
+    g_array_append_val(events, e);
+  }
+  for(int i = 0; i < k; i++)
+  {
+    const _delta_event_t e = { place[i], 1 };
+    g_array_append_val(events, e);
+  }
+  g_array_sort(events, _delta_event_cmp);
+
+  // moved rows go negative first so they don't collide with the ones still to move
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "UPDATE memory.collected_images SET rowid = -(rowid + ?3)"
+                              " WHERE rowid >= ?1 AND rowid < ?2",
+                              -1, &stmt, NULL);
+  int shift = 0;
+  for(guint i = 0; i < events->len; i++)
+  {
+    const _delta_event_t *e = &g_array_index(events, _delta_event_t, i);
+    shift += e->shift;
+    const int end = i + 1 < events->len ? g_array_index(events, _delta_event_t, i + 1).rowid : rows + 1;
+    if(!shift || end <= e->rowid) continue;
+    sqlite3_reset(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, e->rowid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, end);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, shift);
+    sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  // the images go right before the row at their place, after the ones placed there before them
+  gboolean moved = FALSE;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO memory.collected_images (rowid, imgid) VALUES (?1, ?2)", -1, &stmt,
+                              NULL);
+  k = 0;
+  for(const GList *l = ids; l; l = g_list_next(l), k++)
+  {
+    int removed = 0, placed = 0;
+    for(guint i = 0; i < events->len; i++)
+    {
+      const _delta_event_t *e = &g_array_index(events, _delta_event_t, i);
+      if(e->shift < 0 && e->rowid <= place[k]) removed++;
+      if(e->shift > 0 && e->rowid <= place[k]) placed++;
+    }
+    // placed counts the images at this place following this one, too
+    int after = 0;
+    for(int j = k + 1; j < n && place[j] == place[k]; j++) after++;
+    const int rowid = place[k] - removed + placed - 1 - after;
+    const int imgid = GPOINTER_TO_INT(l->data);
+    if(GPOINTER_TO_INT(g_hash_table_lookup(old, GINT_TO_POINTER(imgid))) != rowid) moved = TRUE;
+    sqlite3_reset(stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, -rowid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+    sqlite3_step(stmt);
+  }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(db, "UPDATE memory.collected_images SET rowid = -rowid WHERE rowid < 0", NULL, NULL, NULL);
+
+  // images which left the collection moved as well
+  if(g_hash_table_size(old) != (guint)k) moved = TRUE;
+
+  g_array_free(events, TRUE);
+  g_free(place);
+  g_list_free(ids);
+  g_hash_table_destroy(old);
+  return moved ? DT_COLLECTION_CHANGE_RELOAD : DT_COLLECTION_CHANGE_DELTA;
+}
+
 static void _dt_collection_set_selq_pre_sort(const dt_collection_t *collection, char **selq_pre)
 {
   const uint32_t tagid = collection->tagid;
@@ -203,7 +468,9 @@ int dt_collection_update(const dt_collection_t *collection)
 {
   uint32_t result;
   gchar *wq, *wq_no_group, *sq, *selq_pre, *selq_post, *query, *query_no_group;
+  gchar *query_delta, *query_delta_no_group, *query_delta_order;
   wq = wq_no_group = sq = selq_pre = selq_post = query = query_no_group = NULL;
+  query_delta = query_delta_no_group = query_delta_order = NULL;
 
   /* build where part */
   gchar *where_ext = dt_collection_get_extended_where(collection, -1);
@@ -447,7 +714,22 @@ int dt_collection_update(const dt_collection_t *collection)
   query_no_group
       = dt_util_dstrcat(query_no_group, "%s%s%s %s%s", selq_pre, wq_no_group, selq_post ? selq_post : "", sq ? sq : "",
                         (collection->params.query_flags & COLLECTION_QUERY_USE_LIMIT) ? " " LIMIT_QUERY : "");
-  result = _dt_collection_store(collection, query, query_no_group);
+  /* and the same restricted to a few images, for updating the memory table in place. the where part
+   * always follows the WHERE of selq_pre except for the extended where alone, which isn't supported */
+  if(!(collection->params.query_flags & COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
+  {
+    query_delta = dt_util_dstrcat(query_delta,
+                                  "%s mi.id IN (SELECT imgid FROM memory.collection_delta) AND (%s)%s %s",
+                                  selq_pre, wq, selq_post ? selq_post : "", sq ? sq : "");
+    query_delta_no_group = dt_util_dstrcat(query_delta_no_group,
+                                           "%s mi.id IN (SELECT imgid FROM memory.collection_delta) AND (%s)%s %s",
+                                           selq_pre, wq_no_group, selq_post ? selq_post : "", sq ? sq : "");
+    query_delta_order = dt_util_dstrcat(query_delta_order,
+                                        "%s mi.id IN (SELECT imgid FROM memory.collection_delta)%s %s",
+                                        selq_pre, selq_post ? selq_post : "", sq ? sq : "");
+  }
+  result = _dt_collection_store(collection, query, query_no_group, query_delta, query_delta_no_group,
+                                query_delta_order);
 
 #ifdef _DEBUG
   printf("SQL Collection for 1st:%d and 2nd:%d: %s\n\n",collection->params.sort,collection->params.sort_second_order,query);/*only for debugging*/
@@ -462,6 +744,9 @@ int dt_collection_update(const dt_collection_t *collection)
   g_free(selq_post);
   g_free(query);
   g_free(query_no_group);
+  g_free(query_delta);
+  g_free(query_delta_no_group);
+  g_free(query_delta_order);
 
   /* update the cached count. collection isn't a real const anyway, we are writing to it in
    * _dt_collection_store, too. */
@@ -961,7 +1246,8 @@ gchar *dt_collection_get_sort_query(const dt_collection_t *collection)
 }
 
 
-static int _dt_collection_store(const dt_collection_t *collection, gchar *query, gchar *query_no_group)
+static int _dt_collection_store(const dt_collection_t *collection, gchar *query, gchar *query_no_group,
+                                gchar *query_delta, gchar *query_delta_no_group, gchar *query_delta_order)
 {
   /* store flags to conf */
   if(collection == darktable.collection)
@@ -983,6 +1269,14 @@ static int _dt_collection_store(const dt_collection_t *collection, gchar *query,
   ((dt_collection_t *)collection)->query = g_strdup(query);
   ((dt_collection_t *)collection)->query_no_group = g_strdup(query_no_group);
 
+  g_free(collection->query_delta);
+  g_free(collection->query_delta_no_group);
+  g_free(collection->query_delta_order);
+
+  ((dt_collection_t *)collection)->query_delta = g_strdup(query_delta);
+  ((dt_collection_t *)collection)->query_delta_no_group = g_strdup(query_delta_no_group);
+  ((dt_collection_t *)collection)->query_delta_order = g_strdup(query_delta_order);
+
   return 1;
 }
 
@@ -1586,15 +1880,27 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
       if ((escaped_length > 0) && (escaped_text[escaped_length-1] == '*')) 
       {
         escaped_text[escaped_length-1] = '\0';
-        query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s' OR name LIKE '%s|%%'))",
-                              escaped_text, escaped_text);
+        if(dt_search_index_tags())
+          // the prefix is what the index can use, the rest picks the hierarchy out of it
+          query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                         "(SELECT rowid FROM memory.tags_text WHERE name LIKE '%s%%' "
+                                         "AND (name LIKE '%s' OR name LIKE '%s|%%'))))",
+                                  escaped_text, escaped_text, escaped_text);
+        else
+          query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
+                                       "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s' OR name LIKE '%s|%%'))",
+                                escaped_text, escaped_text);
       /* default */
       } else
       {
-        query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
-                                     "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
-                              escaped_text);
+        if(dt_search_index_tags())
+          query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN "
+                                         "(SELECT rowid FROM memory.tags_text WHERE name LIKE '%s')))",
+                                  escaped_text);
+        else
+          query = dt_util_dstrcat(query, "(id IN (SELECT imgid FROM main.tagged_images AS a JOIN "
+                                       "data.tags AS b ON a.tagid = b.id WHERE name LIKE '%s'))",
+                                escaped_text);
       }
 
       break;
@@ -1818,7 +2124,10 @@ static gchar *get_query_string(const dt_collection_properties_t property, const
            && property < DT_COLLECTION_PROP_METADATA + DT_METADATA_NUMBER)
         {
           const int keyid = dt_metadata_get_keyid_by_display_order(property - DT_COLLECTION_PROP_METADATA);
-          if(strcmp(escaped_text, _("not defined")) != 0)
+          if(strcmp(escaped_text, _("not defined")) != 0 && dt_search_index_metadata())
+            query = dt_util_dstrcat(query, "(id IN (SELECT id FROM memory.meta_data_text WHERE value "
+                                           "LIKE '%%%s%%' AND key = %d))", escaped_text, keyid);
+          else if(strcmp(escaped_text, _("not defined")) != 0)
             query = dt_util_dstrcat(query, "(id IN (SELECT id FROM main.meta_data WHERE key = %d AND value "
                                            "LIKE '%%%s%%'))", keyid, escaped_text);
           else
@@ -2035,11 +2344,28 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
   /* update query and at last the visual */
   dt_collection_update(collection);
 
+  /* a few images changed and the query is the same: only these images are updated */
+  dt_collection_change_t delta = DT_COLLECTION_CHANGE_NONE;
+  if(!collection->clone && query_change == DT_COLLECTION_CHANGE_RELOAD && list)
+    delta = dt_collection_memory_update_images(list);
+
   // remove from selected images where not in this query.
   sqlite3_stmt *stmt = NULL;
   const gchar *cquery = dt_collection_get_query_no_group(collection);
   gchar *complete_query = NULL;
-  if(cquery && cquery[0] != '\0')
+  if(delta != DT_COLLECTION_CHANGE_NONE)
+  {
+    // only the listed images can have left the collection. the placing used memory.collection_delta, refill it
+    _delta_fill(list);
+    complete_query = dt_util_dstrcat(complete_query,
+                                     "DELETE FROM main.selected_images"
+                                     " WHERE imgid IN (SELECT imgid FROM memory.collection_delta)"
+                                     "   AND imgid NOT IN (%s)",
+                                     collection->query_delta_no_group);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), complete_query, NULL, NULL, NULL);
+    g_free(complete_query);
+  }
+  else if(cquery && cquery[0] != '\0')
   {
     complete_query
         = dt_util_dstrcat(complete_query, "DELETE FROM main.selected_images WHERE imgid NOT IN (%s)", cquery);
@@ -2056,7 +2382,10 @@ void dt_collection_update_query(const dt_collection_t *collection, dt_collection
   /* raise signal of collection change, only if this is an original */
   if(!collection->clone)
   {
-    dt_collection_memory_update();
+    if(delta == DT_COLLECTION_CHANGE_NONE)
+      dt_collection_memory_update();
+    else
+      query_change = delta;
     DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED, query_change, list, next);
   }
 }
@@ -2273,7 +2602,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     dt_collection_shift_image_positions(selected_images_length, target_image_pos, tagid);
 
     sqlite3_stmt *stmt = NULL;
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    dt_database_start_transaction(darktable.db);
 
     // move images to their intended positions
     int64_t new_image_pos = target_image_pos;
@@ -2304,7 +2633,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
       new_image_pos++;
     }
     sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
   }
   else
   {
@@ -2331,7 +2660,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     sqlite3_finalize(stmt);
     sqlite3_stmt *update_stmt = NULL;
 
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "BEGIN", NULL, NULL, NULL);
+    dt_database_start_transaction(darktable.db);
 
     // move images to last position in custom image order table
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -2360,7 +2689,7 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images)
     }
 
     sqlite3_finalize(update_stmt);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "COMMIT", NULL, NULL, NULL);
+    dt_database_release_transaction(darktable.db);
   }
 }
 
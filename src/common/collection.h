@@ -133,7 +133,8 @@ typedef enum dt_collection_change_t
   DT_COLLECTION_CHANGE_NONE      = 0,
   DT_COLLECTION_CHANGE_NEW_QUERY = 1, // a completly different query
   DT_COLLECTION_CHANGE_FILTER    = 2, // base query has been finetuned (filter, ...)
-  DT_COLLECTION_CHANGE_RELOAD    = 3  // we have just reload the collection after images changes (query is identical)
+  DT_COLLECTION_CHANGE_RELOAD    = 3, // we have just reload the collection after images changes (query is identical)
+  DT_COLLECTION_CHANGE_DELTA     = 4  // only the listed images changed, all images kept their place
 } dt_collection_change_t;
 
 typedef struct dt_collection_params_t
@@ -162,6 +163,9 @@ typedef struct dt_collection_t
 {
   int clone;
   gchar *query, *query_no_group;
+  // the same restricted to the images in memory.collection_delta, without limit, and these images in
+  // collection order whether they belong to it or not
+  gchar *query_delta, *query_delta_no_group, *query_delta_order;
   gchar **where_ext;
   unsigned int count, count_no_group;
   unsigned int tagid;
@@ -271,6 +275,10 @@ void dt_collection_move_before(const int32_t image_id, GList * selected_images);
 
 /* initialize memory table */
 void dt_collection_memory_update();
+/* update the memory table for the given images only, the rest of the collection is taken as unchanged.
+ * returns DT_COLLECTION_CHANGE_DELTA if no image moved, DT_COLLECTION_CHANGE_RELOAD if some did, and
+ * DT_COLLECTION_CHANGE_NONE if the table has to be rebuilt instead */
+dt_collection_change_t dt_collection_memory_update_images(const GList *imgs);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -34,11 +34,13 @@
 #include "common/exif.h"
 #include "common/pwstorage/pwstorage.h"
 #include "common/selection.h"
+#include "common/sidecar_queue.h"
 #include "common/system_signal_handling.h"
 #ifdef HAVE_GPHOTO2
 #include "common/camera_control.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/cache_stats.h"
 #include "common/cpuid.h"
 #include "common/file_location.h"
 #include "common/film.h"
@@ -48,11 +50,14 @@
 #include "common/imageio_module.h"
 #include "common/iop_order.h"
 #include "common/l10n.h"
+#include "common/memory_governor.h"
 #include "common/mipmap_cache.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
 #include "common/points.h"
 #include "common/resource_limits.h"
+#include "common/search_index.h"
+#include "common/trace.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -61,6 +66,7 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/stage_cache.h"
 #include "gui/gtk.h"
 #include "gui/guides.h"
 #include "gui/presets.h"
@@ -119,7 +125,7 @@ static int usage(const char *argv0)
   printf("  --cachedir <user cache directory>\n");
   printf("  --conf <key>=<value>\n");
   printf("  --configdir <user config directory>\n");
-  printf("  -d {all,cache,camctl,camsupport,control,dev,fswatch,imageio,input,\n");
+  printf("  -d {all,cache,cachestats,camctl,camsupport,control,dev,fswatch,imageio,input,\n");
   printf("      ioporder,lighttable,lua,masks,memory,nan,opencl,params,perf,\n");
   printf("      pwstorage,print,signal,sql,undo}\n");
   printf("  --d-signal <signal> \n");
@@ -146,6 +152,7 @@ static int usage(const char *argv0)
   printf("  --noiseprofiles <noiseprofiles json file>\n");
   printf("  -t <num openmp threads>\n");
   printf("  --tmpdir <tmp directory>\n");
+  printf("  --trace <chrome trace json file>\n");
   printf("  --version\n");
 #ifdef _WIN32
   printf("\n");
@@ -576,6 +583,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
           darktable.unmuted = 0xffffffff; // enable all debug information
         else if(!strcmp(argv[k + 1], "cache"))
           darktable.unmuted |= DT_DEBUG_CACHE; // enable debugging for lib/film/cache module
+        else if(!strcmp(argv[k + 1], "cachestats"))
+          darktable.unmuted |= DT_DEBUG_CACHE_STATS; // cache statistics as json lines, every few seconds
         else if(!strcmp(argv[k + 1], "control"))
           darktable.unmuted |= DT_DEBUG_CONTROL; // enable debugging for scheduler module
         else if(!strcmp(argv[k + 1], "dev"))
@@ -713,6 +722,12 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
         argv[k-1] = NULL;
         argv[k] = NULL;
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k + 1)
+      {
+        dt_trace_init(argv[++k]);
+        argv[k-1] = NULL;
+        argv[k] = NULL;
+      }
       else if(!strcmp(argv[k], "--conf") && argc > k + 1)
       {
         gchar *keyval = g_strdup(argv[++k]), *c = keyval;
@@ -1034,10 +1049,17 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.noiseprofile_parser = dt_noiseprofile_init(noiseprofiles_from_command);
 
+  // the caches size themselves within its budget
+  dt_memory_governor_init();
+  dt_cache_stats_init();
+  dt_dev_stage_cache_init();
+
   // must come before mipmap_cache, because that one will need to access
   // image dimensions stored in here:
   darktable.image_cache = (dt_image_cache_t *)calloc(1, sizeof(dt_image_cache_t));
   dt_image_cache_init(darktable.image_cache);
+  dt_sidecar_queue_init();
+  dt_search_index_init();
 
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
@@ -1257,6 +1279,12 @@ void dt_cleanup()
     free(darktable.imageio);
     free(darktable.gui);
   }
+  // writes what's still queued, so before the image cache goes
+  dt_sidecar_queue_cleanup();
+  dt_search_index_cleanup();
+  dt_dev_stage_cache_cleanup();
+  dt_cache_stats_cleanup();
+  dt_memory_governor_cleanup();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
@@ -1340,6 +1368,7 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
 
   dt_exif_cleanup();
+  dt_trace_cleanup();
 }
 
 void dt_print(dt_debug_thread_t thread, const char *msg, ...)
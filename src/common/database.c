@@ -23,6 +23,7 @@
 #include "common/database.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/dtpthread.h"
 #include "common/file_location.h"
 #include "common/iop_order.h"
 #include "common/styles.h"
@@ -47,6 +48,11 @@
 #define CURRENT_DATABASE_VERSION_LIBRARY 30
 #define CURRENT_DATABASE_VERSION_DATA     8
 
+// read only connections handed out to worker threads at most
+#define DT_DATABASE_READERS 4
+// wal size in pages at which the checkpointer gets to work, sqlite's default for autocheckpoint
+#define DT_DATABASE_CHECKPOINT_PAGES 1000
+
 typedef struct dt_database_t
 {
   gboolean lock_acquired;
@@ -62,6 +68,24 @@ typedef struct dt_database_t
 
   gchar *error_message, *error_dbfilename;
   int error_other_pid;
+
+  /* library and data are in wal mode, everything below is only there then */
+  gboolean wal;
+
+  /* read only connections, for SELECTs from worker threads */
+  dt_pthread_mutex_t readers_mutex;
+  pthread_cond_t readers_cond; // a connection came back
+  GSList *readers_free;
+  int readers_open;
+  gboolean readers_closing;
+
+  /* checkpoints the wal files in the background, on its own connection */
+  dt_pthread_mutex_t checkpoint_mutex;
+  pthread_cond_t checkpoint_cond;
+  pthread_t checkpoint_thread;
+  sqlite3 *checkpoint_handle;
+  int checkpoint_pending; // 1 for main, 2 for data
+  gboolean checkpoint_quit;
 } dt_database_t;
 
 
@@ -2064,6 +2088,7 @@ static void _create_memory_schema(dt_database_t *db)
       db->handle,
       "CREATE TABLE memory.collected_images (rowid INTEGER PRIMARY KEY AUTOINCREMENT, imgid INTEGER)", NULL,
       NULL, NULL);
+  sqlite3_exec(db->handle, "CREATE TABLE memory.collection_delta (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.tmp_selection (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "CREATE TABLE memory.taglist "
                            "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT IGNORE, count INTEGER)",
@@ -2495,6 +2520,174 @@ gchar* _get_pragma_string_val(sqlite3 *db, const char* pragma)
   return val;
 }
 
+// opens library and data once more, without the memory database
+static sqlite3 *_database_open(const dt_database_t *db, const int flags)
+{
+  sqlite3 *handle = NULL;
+  if(sqlite3_open_v2(db->dbfilename_library, &handle, flags | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK)
+  {
+    sqlite3_close(handle);
+    return NULL;
+  }
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(handle, "ATTACH DATABASE ?1 AS data", -1, &stmt, NULL);
+  if(rc == SQLITE_OK)
+  {
+    sqlite3_bind_text(stmt, 1, db->dbfilename_data, -1, SQLITE_TRANSIENT);
+    rc = sqlite3_step(stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  sqlite3_finalize(stmt);
+  if(rc != SQLITE_OK)
+  {
+    sqlite3_close(handle);
+    return NULL;
+  }
+  // only while a checkpoint restarts the wal, readers don't wait for writers otherwise
+  sqlite3_busy_timeout(handle, 1000);
+  return handle;
+}
+
+static void *_database_checkpoint_worker(void *data)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  dt_pthread_setname("db checkpoint");
+  dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  while(!db->checkpoint_quit)
+  {
+    if(!db->checkpoint_pending)
+    {
+      dt_pthread_cond_wait(&db->checkpoint_cond, &db->checkpoint_mutex);
+      continue;
+    }
+    const int pending = db->checkpoint_pending;
+    db->checkpoint_pending = 0;
+    dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+
+    // passive doesn't wait for readers or the writer, what it can't copy now is left for the next round
+    for(int k = 0; k < 2; k++)
+    {
+      if(!(pending & (1 << k))) continue;
+      const char *schema = k ? "data" : "main";
+      int wal_pages = 0, copied = 0;
+      const double start = dt_get_wtime();
+      const int rc = sqlite3_wal_checkpoint_v2(db->checkpoint_handle, schema, SQLITE_CHECKPOINT_PASSIVE,
+                                               &wal_pages, &copied);
+      dt_print(DT_DEBUG_SQL, "[db checkpoint] %s: %d of %d pages in %.3f secs%s\n", schema, copied, wal_pages,
+               dt_get_wtime() - start, rc == SQLITE_OK ? "" : " (busy)");
+    }
+
+    dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  }
+  dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+  return NULL;
+}
+
+// called after each commit on the shared connection, instead of sqlite checkpointing right there
+static int _database_wal_hook(void *data, sqlite3 *handle, const char *schema, int pages)
+{
+  dt_database_t *db = (dt_database_t *)data;
+  if(pages < DT_DATABASE_CHECKPOINT_PAGES) return SQLITE_OK;
+  dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  db->checkpoint_pending |= strcmp(schema, "data") ? 1 : 2;
+  pthread_cond_signal(&db->checkpoint_cond);
+  dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+  return SQLITE_OK;
+}
+
+static gboolean _database_set_journal_mode(sqlite3 *handle, const char *schema, const char *mode)
+{
+  gchar *pragma = g_strdup_printf("%s.journal_mode = %s", schema, mode);
+  gchar *result = _get_pragma_string_val(handle, pragma);
+  const gboolean set = !g_ascii_strcasecmp(result ? result : "", mode);
+  g_free(result);
+  g_free(pragma);
+  return set;
+}
+
+// library and data in wal mode don't block readers while writing. the shared connection stays the only one
+// to write, a few read only ones serve SELECTs from worker threads and a thread of its own checkpoints.
+static void _database_enable_wal(dt_database_t *db)
+{
+  if(!db || !dt_conf_get_bool("database/wal")) return;
+  if(!g_strcmp0(db->dbfilename_library, ":memory:") || !g_strcmp0(db->dbfilename_data, ":memory:")) return;
+
+  // may not work out, e.g. on file systems without shared memory. the old journal is kept then.
+  if(!_database_set_journal_mode(db->handle, "main", "wal") || !_database_set_journal_mode(db->handle, "data", "wal"))
+  {
+    fprintf(stderr, "[init] can't switch the databases to wal mode, keeping the journal in memory\n");
+    _database_set_journal_mode(db->handle, "main", "memory");
+    _database_set_journal_mode(db->handle, "data", "memory");
+    return;
+  }
+
+  db->checkpoint_handle = _database_open(db, SQLITE_OPEN_READWRITE);
+  if(!db->checkpoint_handle)
+  {
+    fprintf(stderr, "[init] can't open the databases for checkpointing, keeping the journal in memory\n");
+    _database_set_journal_mode(db->handle, "main", "memory");
+    _database_set_journal_mode(db->handle, "data", "memory");
+    return;
+  }
+
+  // a commit is durable once the wal is synced on checkpointing, the database can't get corrupted though
+  sqlite3_exec(db->handle, "PRAGMA main.synchronous = NORMAL", NULL, NULL, NULL);
+  sqlite3_exec(db->handle, "PRAGMA data.synchronous = NORMAL", NULL, NULL, NULL);
+
+  dt_pthread_mutex_init(&db->readers_mutex, NULL);
+  pthread_cond_init(&db->readers_cond, NULL);
+  db->readers_free = NULL;
+  db->readers_open = 0;
+  db->readers_closing = FALSE;
+
+  dt_pthread_mutex_init(&db->checkpoint_mutex, NULL);
+  pthread_cond_init(&db->checkpoint_cond, NULL);
+  db->checkpoint_pending = 0;
+  db->checkpoint_quit = FALSE;
+  dt_pthread_create(&db->checkpoint_thread, _database_checkpoint_worker, db);
+  sqlite3_wal_hook(db->handle, _database_wal_hook, db);
+
+  db->wal = TRUE;
+  dt_print(DT_DEBUG_SQL, "[init sql] library and data in wal mode\n");
+}
+
+static void _database_disable_wal(dt_database_t *db)
+{
+  if(!db->wal) return;
+  sqlite3_wal_hook(db->handle, NULL, NULL);
+
+  dt_pthread_mutex_lock(&db->checkpoint_mutex);
+  db->checkpoint_quit = TRUE;
+  pthread_cond_signal(&db->checkpoint_cond);
+  dt_pthread_mutex_unlock(&db->checkpoint_mutex);
+  pthread_join(db->checkpoint_thread, NULL);
+  sqlite3_close(db->checkpoint_handle);
+  pthread_cond_destroy(&db->checkpoint_cond);
+  dt_pthread_mutex_destroy(&db->checkpoint_mutex);
+
+  // the journal mode can't change while another connection has the wal open, so no new readers and wait for
+  // the ones out there. they are only kept for a query.
+  dt_pthread_mutex_lock(&db->readers_mutex);
+  db->readers_closing = TRUE;
+  if(db->readers_open != g_slist_length(db->readers_free))
+    dt_print(DT_DEBUG_SQL, "[db] waiting for %d read only connections\n",
+             db->readers_open - g_slist_length(db->readers_free));
+  while(db->readers_open != g_slist_length(db->readers_free))
+    dt_pthread_cond_wait(&db->readers_cond, &db->readers_mutex);
+  for(GSList *l = db->readers_free; l; l = g_slist_next(l)) sqlite3_close((sqlite3 *)l->data);
+  g_slist_free(db->readers_free);
+  db->readers_free = NULL;
+  db->readers_open = 0;
+  dt_pthread_mutex_unlock(&db->readers_mutex);
+
+  // back to a journal which leaves nothing beside the files, for backups, snapshots and older versions
+  _database_set_journal_mode(db->handle, "main", "delete");
+  _database_set_journal_mode(db->handle, "data", "delete");
+  db->wal = FALSE;
+
+  pthread_cond_destroy(&db->readers_cond);
+  dt_pthread_mutex_destroy(&db->readers_mutex);
+}
+
 dt_database_t *dt_database_init(const char *alternative, const gboolean load_data, const gboolean has_gui)
 {
   /*  set the threading mode to Serialized */
@@ -3041,6 +3234,9 @@ start:
   // take care of potential bad data in the db.
   _sanitize_db(db);
 
+  // readers and the checkpointer from now on, the schema is settled
+  _database_enable_wal(db);
+
 error:
   g_free(dbname);
 
@@ -3049,6 +3245,7 @@ error:
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  _database_disable_wal((dt_database_t *)db);
   sqlite3_close(db->handle);
   if (db->lockfile_data)
   {
@@ -3072,6 +3269,67 @@ sqlite3 *dt_database_get(const dt_database_t *db)
   return db ? db->handle : NULL;
 }
 
+// transactions this thread has open on the shared connection
+static __thread int _transaction_depth = 0;
+
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  // a savepoint nests in whatever is open, the connection is shared between the threads
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "SAVEPOINT dt_transaction", NULL, NULL, NULL);
+  _transaction_depth++;
+}
+
+void dt_database_release_transaction(const dt_database_t *db)
+{
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "RELEASE dt_transaction", NULL, NULL, NULL);
+  _transaction_depth--;
+}
+
+void dt_database_rollback_transaction(const dt_database_t *db)
+{
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "ROLLBACK TO dt_transaction", NULL, NULL, NULL);
+  dt_database_release_transaction(db);
+}
+
+sqlite3 *dt_database_get_reader(const dt_database_t *db)
+{
+  if(!db || !db->wal) return NULL;
+  // the shared connection sees what this thread wrote in its open transaction, a reader would not. other
+  // threads don't depend on those rows and read what is committed.
+  if(_transaction_depth > 0) return NULL;
+
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3 *handle = NULL;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  if(d->readers_closing)
+  {
+    dt_pthread_mutex_unlock(&d->readers_mutex);
+    return NULL;
+  }
+  if(d->readers_free)
+  {
+    handle = (sqlite3 *)d->readers_free->data;
+    d->readers_free = g_slist_delete_link(d->readers_free, d->readers_free);
+  }
+  else if(d->readers_open < DT_DATABASE_READERS)
+  {
+    handle = _database_open(db, SQLITE_OPEN_READONLY);
+    if(handle) d->readers_open++;
+  }
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+  return handle;
+}
+
+void dt_database_release_reader(const dt_database_t *db, sqlite3 *handle)
+{
+  if(!handle) return;
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->readers_mutex);
+  d->readers_free = g_slist_prepend(d->readers_free, handle);
+  pthread_cond_broadcast(&d->readers_cond);
+  dt_pthread_mutex_unlock(&d->readers_mutex);
+}
+
 const gchar *dt_database_get_path(const struct dt_database_t *db)
 {
   return db->dbfilename_library;
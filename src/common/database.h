@@ -28,6 +28,18 @@ struct dt_database_t *dt_database_init(const char *alternative, const gboolean l
 void dt_database_destroy(const struct dt_database_t *);
 /** get handle */
 struct sqlite3 *dt_database_get(const struct dt_database_t *);
+/** groups the writes on the shared connection up to the matching release, as a savepoint which nests in a
+  * transaction that is open already. the thread gets no reader meanwhile, as it would not see these writes. */
+void dt_database_start_transaction(const struct dt_database_t *db);
+void dt_database_release_transaction(const struct dt_database_t *db);
+/** undoes the writes since the matching start and ends it */
+void dt_database_rollback_transaction(const struct dt_database_t *db);
+/** a read only connection to library and data for SELECTs from worker threads, NULL if there is none to spare,
+  * the databases aren't in wal mode or this thread has a transaction open: use dt_database_get() then. it only
+  * sees what is committed, and has no memory database. */
+struct sqlite3 *dt_database_get_reader(const struct dt_database_t *db);
+/** hands the connection back to the pool, with all its statements finalized */
+void dt_database_release_reader(const struct dt_database_t *db, struct sqlite3 *handle);
 /** Returns database path */
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
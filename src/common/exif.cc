@@ -271,9 +271,10 @@ static const char *_exif_get_exiv2_tag_type(const char *tagname)
   return NULL;
 }
 
-// exiv2's readMetadata is not thread safe in 0.26. so we lock it. since readMetadata might throw an exception we
+// exiv2's readMetadata is not thread safe before 0.27. so we lock it. since readMetadata might throw an exception we
 // wrap it into some c++ magic to make sure we unlock in all cases. well, actually not magic but basic raii.
-// FIXME: check again once we rely on 0.27
+// from 0.27 on only the xmp toolkit below it isn't, exiv2 serializes that through the lock function given to
+// XmpParser::initialize() (see dt_exif_init()) and the files are read in parallel.
 class Lock
 {
 public:
@@ -281,11 +282,29 @@ public:
   ~Lock() { dt_pthread_mutex_unlock(&darktable.exiv2_threadsafe); }
 };
 
+#if EXIV2_VERSION >= EXIV2_MAKE_VERSION(0,27,0)
+#define read_metadata_threadsafe(image)                       \
+{                                                             \
+  image->readMetadata();                                      \
+}
+#else
 #define read_metadata_threadsafe(image)                       \
 {                                                             \
   Lock lock;                                                  \
   image->readMetadata();                                      \
 }
+#endif
+
+// not darktable.exiv2_threadsafe, readMetadata() takes this one while holding that one before 0.27
+static dt_pthread_mutex_t _exif_xmp_mutex;
+
+static void _exif_xmp_lock(void *data, bool lock)
+{
+  if(lock)
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)data);
+  else
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)data);
+}
 
 static void _exif_import_tags(dt_image_t *img, Exiv2::XmpData::iterator &pos);
 static void read_xmp_timestamps(Exiv2::XmpData &xmpData, dt_image_t *img);
@@ -4143,7 +4162,8 @@ void dt_exif_init()
   // preface the exiv2 messages with "[exiv2] "
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
-  Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&_exif_xmp_mutex, NULL);
+  Exiv2::XmpParser::initialize(_exif_xmp_lock, &_exif_xmp_mutex);
   // this has to stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   // check is Exiv2 version already knows these prefixes
@@ -4170,6 +4190,7 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+  dt_pthread_mutex_destroy(&_exif_xmp_mutex);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -30,6 +30,7 @@
 
 #include "common/guided_filter.h"
 #include "common/opencl.h"
+#include "common/scratch.h"
 #include <assert.h>
 #include <float.h>
 #include <stdlib.h>
@@ -71,13 +72,13 @@ typedef struct color_image
 // allocate space for n-component image of size width x height
 static inline color_image new_color_image(int width, int height, int ch)
 {
-  return (color_image){ dt_alloc_align(64, sizeof(float) * width * height * ch), width, height, ch };
+  return (color_image){ dt_scratch_alloc_float((size_t)width * height * ch), width, height, ch };
 }
 
 // free space for n-component image
 static inline void free_color_image(color_image *img_p)
 {
-  dt_free_align(img_p->data);
+  dt_scratch_free(img_p->data);
   img_p->data = NULL;
 }
 
@@ -234,7 +235,7 @@ static inline void box_mean_1d_9ch(int N, const float *x, float *y, size_t strid
 static void box_mean_4ch(color_image img, int w)
 {
   const size_t size = 4 * max_i(img.width, img.height);
-  float *img_bak = dt_alloc_align(64, dt_get_num_threads() * size * sizeof(float));
+  float *img_bak = dt_scratch_alloc_float(dt_get_num_threads() * size);
   const size_t width = 4 * img.width;
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) dt_omp_firstprivate(w, size, width, img_bak) shared(img)
@@ -256,7 +257,7 @@ static void box_mean_4ch(color_image img, int w)
         buf[4*i1+k] = img.data[4*(i0 + (size_t)i1 * img.width)+k];
     box_mean_1d_4ch(img.height, buf, img.data + 4*i0, width, w);
   }
-  dt_free_align(img_bak);
+  dt_scratch_free(img_bak);
 }
 
 // in-place calculate the two-dimensional moving average of a four-channel image over a box of size (2*w+1) x (2*w+1)
@@ -316,7 +317,7 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
   color_image variance = new_color_image(width, height, 9);
   const size_t img_dimen = max_i(mean.width, mean.height);
   const size_t img_bak_sz = 13 * img_dimen;
-  float *img_bak = dt_alloc_align(64, dt_get_num_threads() * img_bak_sz * sizeof(float));
+  float *img_bak = dt_scratch_alloc_float(dt_get_num_threads() * img_bak_sz);
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) shared(img, imgg, mean, variance, img_bak) \
   dt_omp_firstprivate(img_bak_sz, img_dimen, w, guide_weight) dt_omp_sharedconst(source)
@@ -352,7 +353,7 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
     box_mean_1d_9ch(variance.width, varpx, variance.data + 9 * j * variance.width, 9, w);
   }
   box_means_vert(img_bak, w, mean, variance);
-  dt_free_align(img_bak);
+  dt_scratch_free(img_bak);
   // we will recycle memory of 'mean' for the new coefficient arrays a_? and b to reduce memory foot print
   color_image a_b = mean;
   #define A_RED 0
@@ -851,9 +852,9 @@ static void guided_filter_cl_fallback(int devid, cl_mem guide, cl_mem in, cl_mem
 {
   // fall-back implementation: copy data from device memory to host memory and perform filter
   // by CPU until there is a proper OpenCL implementation
-  float *guide_host = dt_alloc_align(64, sizeof(*guide_host) * width * height * ch);
-  float *in_host = dt_alloc_align(64, sizeof(*in_host) * width * height);
-  float *out_host = dt_alloc_align(64, sizeof(*out_host) * width * height);
+  float *guide_host = dt_scratch_alloc(sizeof(*guide_host) * width * height * ch);
+  float *in_host = dt_scratch_alloc(sizeof(*in_host) * width * height);
+  float *out_host = dt_scratch_alloc(sizeof(*out_host) * width * height);
   int err;
   err = dt_opencl_read_host_from_device(devid, guide_host, guide, width, height, ch * sizeof(float));
   if(err != CL_SUCCESS) goto error;
@@ -863,9 +864,9 @@ static void guided_filter_cl_fallback(int devid, cl_mem guide, cl_mem in, cl_mem
   err = dt_opencl_write_host_to_device(devid, out_host, out, width, height, sizeof(float));
   if(err != CL_SUCCESS) goto error;
 error:
-  dt_free_align(guide_host);
-  dt_free_align(in_host);
-  dt_free_align(out_host);
+  dt_scratch_free(guide_host);
+  dt_scratch_free(in_host);
+  dt_scratch_free(out_host);
 }
 
 
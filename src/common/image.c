@@ -34,6 +34,7 @@
 #include "common/undo.h"
 #include "common/history.h"
 #include "common/selection.h"
+#include "common/sidecar_queue.h"
 #include "control/conf.h"
 #include "control/control.h"
 #include "control/jobs.h"
@@ -1081,6 +1082,9 @@ void dt_image_remove(const int32_t imgid)
   int old_group_id = img->group_id;
   dt_image_cache_read_release(darktable.image_cache, img);
 
+  // a sidecar written now would be for an image which is gone
+  dt_sidecar_queue_remove(imgid);
+
   // make sure we remove from the cache first, or else the cache will look for imgid in sql
   dt_image_cache_remove(darktable.image_cache, imgid);
 
@@ -1276,9 +1280,10 @@ static void _image_read_duplicates(const uint32_t id, const char *filename)
   g_list_free_full(files, g_free);
 }
 
-static uint32_t _image_import_internal(const int32_t film_id, const char *filename,
-                                       gboolean override_ignore_jpegs, gboolean lua_locking)
+uint32_t dt_image_import_record(dt_image_import_t *import, const int32_t film_id, const char *filename,
+                                gboolean override_ignore_jpegs)
 {
+  memset(import, 0, sizeof(dt_image_import_t));
   char *normalized_filename = dt_util_normalize_path(filename);
   if(!normalized_filename
      || !g_file_test(normalized_filename, G_FILE_TEST_IS_REGULAR)
@@ -1316,6 +1321,9 @@ static uint32_t _image_import_internal(const int32_t film_id, const char *filena
     g_free(ext);
     return 0;
   }
+  import->filename = normalized_filename;
+  import->ext = ext;
+
   int rc;
   uint32_t id = 0;
   // select from images; if found => return
@@ -1335,14 +1343,8 @@ static uint32_t _image_import_internal(const int32_t film_id, const char *filena
     dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
     img->flags &= ~DT_IMAGE_REMOVE;
     dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
-    _image_read_duplicates(id, normalized_filename);
-    dt_image_synch_all_xmp(normalized_filename);
-    g_free(ext);
-    g_free(normalized_filename);
-    GList *imgs = NULL;
-    imgs = g_list_prepend(imgs, GINT_TO_POINTER(id));
-    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_GEOTAG_CHANGED,
-                                  g_list_copy((GList *)imgs), 0);
+    import->id = id;
+    import->existing = TRUE;
     return id;
   }
   sqlite3_finalize(stmt);
@@ -1486,69 +1488,94 @@ static uint32_t _image_import_internal(const int32_t film_id, const char *filena
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  // printf("[image_import] importing `%s' to img id %d\n", imgfname, id);
+  g_free(imgfname);
+  g_free(basename);
+  g_free(sql_pattern);
+
+  import->id = id;
+  import->group_id = group_id;
+  return id;
+}
+
+void dt_image_import_read(dt_image_import_t *import)
+{
+  if(!import->id || import->existing) return;
+
+  // printf("[image_import] importing `%s' to img id %d\n", import->filename, import->id);
 
   // lock as shortly as possible:
-  dt_image_t *img = dt_image_cache_get(darktable.image_cache, id, 'w');
-  img->group_id = group_id;
+  dt_image_t *img = dt_image_cache_get(darktable.image_cache, import->id, 'w');
+  img->group_id = import->group_id;
 
   // read dttags and exif for database queries!
-  (void)dt_exif_read(img, normalized_filename);
+  (void)dt_exif_read(img, import->filename);
   char dtfilename[PATH_MAX] = { 0 };
-  g_strlcpy(dtfilename, normalized_filename, sizeof(dtfilename));
+  g_strlcpy(dtfilename, import->filename, sizeof(dtfilename));
   // dt_image_path_append_version(id, dtfilename, sizeof(dtfilename));
   g_strlcat(dtfilename, ".xmp", sizeof(dtfilename));
 
-  const int res = dt_exif_xmp_read(img, dtfilename, 0);
+  import->xmp_res = dt_exif_xmp_read(img, dtfilename, 0);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+}
+
+void dt_image_import_finish(dt_image_import_t *import)
+{
+  if(!import->id) return;
+  const uint32_t id = import->id;
 
-  if(res != 0)
+  if(!import->existing)
   {
-    // Search for Lightroom sidecar file, import tags if found
-    dt_lightroom_import(id, NULL, TRUE);
-    // Make sure that lightroom xmp data (label in particular) are saved in dt xmp
-    dt_image_write_sidecar_file(id);
-  }
+    if(import->xmp_res != 0)
+    {
+      // Search for Lightroom sidecar file, import tags if found
+      dt_lightroom_import(id, NULL, TRUE);
+      // Make sure that lightroom xmp data (label in particular) are saved in dt xmp
+      dt_image_write_sidecar_file(id);
+    }
 
-  // add a tag with the file extension
-  guint tagid = 0;
-  char tagname[512];
-  snprintf(tagname, sizeof(tagname), "darktable|format|%s", ext);
-  g_free(ext);
-  dt_tag_new(tagname, &tagid);
-  dt_tag_attach(tagid, id, FALSE, FALSE);
+    // add a tag with the file extension
+    guint tagid = 0;
+    char tagname[512];
+    snprintf(tagname, sizeof(tagname), "darktable|format|%s", import->ext);
+    dt_tag_new(tagname, &tagid);
+    dt_tag_attach(tagid, id, FALSE, FALSE);
 
-  // make sure that there are no stale thumbnails left
-  dt_mipmap_cache_remove(darktable.mipmap_cache, id);
+    // make sure that there are no stale thumbnails left
+    dt_mipmap_cache_remove(darktable.mipmap_cache, id);
+  }
 
   // read all sidecar files
-  _image_read_duplicates(id, normalized_filename);
+  _image_read_duplicates(id, import->filename);
 
   //synch database entries to xmp
-  dt_image_synch_all_xmp(normalized_filename);
+  dt_image_synch_all_xmp(import->filename);
+}
 
-  g_free(imgfname);
-  g_free(basename);
-  g_free(sql_pattern);
-  g_free(normalized_filename);
+void dt_image_import_notify(dt_image_import_t *import, gboolean lua_locking)
+{
+  if(!import->id) return;
+  uint32_t id = import->id;
 
+  if(!import->existing)
+  {
 #ifdef USE_LUA
-  //Synchronous calling of lua post-import-image events
-  if(lua_locking)
-    dt_lua_lock();
+    //Synchronous calling of lua post-import-image events
+    if(lua_locking)
+      dt_lua_lock();
 
-  lua_State *L = darktable.lua_state.state;
+    lua_State *L = darktable.lua_state.state;
 
-  luaA_push(L, dt_lua_image_t, &id);
-  dt_lua_event_trigger(L, "post-import-image", 1);
+    luaA_push(L, dt_lua_image_t, &id);
+    dt_lua_event_trigger(L, "post-import-image", 1);
 
-  if(lua_locking)
-    dt_lua_unlock();
+    if(lua_locking)
+      dt_lua_unlock();
 #endif
 
-  DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
+    DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_IMAGE_IMPORT, id);
+  }
   GList *imgs = NULL;
   imgs = g_list_prepend(imgs, GINT_TO_POINTER(id));
   DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals, DT_SIGNAL_GEOTAG_CHANGED,
@@ -1558,6 +1585,25 @@ static uint32_t _image_import_internal(const int32_t film_id, const char *filena
   // from dt_tag_new above, but this could lead to too rapid signals, being able to lock up the
   // keywords side pane when trying to use it, which can lock up the whole dt GUI ..
   // if (new_tags_set) DT_DEBUG_CONTROL_SIGNAL_RAISE(darktable.signals,DT_SIGNAL_TAG_CHANGED);
+}
+
+void dt_image_import_clear(dt_image_import_t *import)
+{
+  g_free(import->filename);
+  g_free(import->ext);
+  import->filename = NULL;
+  import->ext = NULL;
+}
+
+static uint32_t _image_import_internal(const int32_t film_id, const char *filename,
+                                       gboolean override_ignore_jpegs, gboolean lua_locking)
+{
+  dt_image_import_t import;
+  const uint32_t id = dt_image_import_record(&import, film_id, filename, override_ignore_jpegs);
+  dt_image_import_read(&import);
+  dt_image_import_finish(&import);
+  dt_image_import_notify(&import, lua_locking);
+  dt_image_import_clear(&import);
   return id;
 }
 
@@ -1737,6 +1783,9 @@ int32_t dt_image_rename(const int32_t imgid, const int32_t filmid, const gchar *
         g_strlcat(oldxmp, ".xmp", sizeof(oldxmp));
         g_strlcat(newxmp, ".xmp", sizeof(newxmp));
 
+        // a queued or ongoing write still goes to the old path, have it done before moving
+        dt_sidecar_queue_flush_image(id);
+
         GFile *goldxmp = g_file_new_for_path(oldxmp);
         GFile *gnewxmp = g_file_new_for_path(newxmp);
 
@@ -2229,6 +2278,7 @@ int dt_image_local_copy_reset(const int32_t imgid)
     // first sync the xmp with the original picture
 
     dt_image_write_sidecar_file(imgid);
+    dt_sidecar_queue_flush_image(imgid);
 
     // delete image from cache directory only if there is no other local cache image referencing it
     // for example duplicates are all referencing the same base picture.
@@ -2264,6 +2314,17 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // *******************************************************
 
 void dt_image_write_sidecar_file(const int32_t imgid)
+{
+  if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
+  {
+    if(dt_sidecar_queue_running())
+      dt_sidecar_queue_add(imgid);
+    else
+      dt_image_write_sidecar_file_now(imgid);
+  }
+}
+
+void dt_image_write_sidecar_file_now(const int32_t imgid)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
@@ -276,6 +276,30 @@ GList* dt_image_find_duplicates(const char* filename);
 uint32_t dt_image_import(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. Use from lua thread.*/
 uint32_t dt_image_import_lua(int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+
+/** the steps of dt_image_import(), for importing many files in a pipeline (see dt_film_import1()). */
+typedef struct dt_image_import_t
+{
+  uint32_t id;         // 0 if the file isn't imported
+  gboolean existing;   // it was in the film roll already
+  int32_t group_id;
+  int xmp_res;         // result of reading the sidecar
+  char *filename;      // normalized
+  char *ext;           // lower case
+} dt_image_import_t;
+
+/** checks the file and adds it to the data base, returns its id. the image of a file with the same
+    base name recorded before must have been read already, it may get regrouped. */
+uint32_t dt_image_import_record(dt_image_import_t *import, int32_t film_id, const char *filename,
+                                gboolean override_ignore_jpegs);
+/** reads exif data and the sidecar of a recorded image. this is most of the work, and can run in
+    several threads at once. */
+void dt_image_import_read(dt_image_import_t *import);
+/** the rest of the import: tags, thumbnails and duplicates. */
+void dt_image_import_finish(dt_image_import_t *import);
+/** runs the lua post-import-image event and raises the import signals. */
+void dt_image_import_notify(dt_image_import_t *import, gboolean lua_locking);
+void dt_image_import_clear(dt_image_import_t *import);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
 /** duplicates the given image in the database with the duplicate getting the supplied version number. if that
@@ -367,7 +391,10 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 /* try to sync .xmp for all local copies */
 void dt_image_local_copy_synch(void);
 // xmp functions:
+/* queues the sidecar for writing if the sidecar queue runs, see common/sidecar_queue.h */
 void dt_image_write_sidecar_file(const int32_t imgid);
+/* writes the sidecar right away */
+void dt_image_write_sidecar_file_now(const int32_t imgid);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_xmps(const GList *img);
 void dt_image_synch_all_xmp(const gchar *pathname);
@@ -17,144 +17,167 @@
 */
 
 #include "common/image_cache.h"
+#include "common/cache_stats.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/image.h"
+#include "common/memory_governor.h"
 #include "control/conf.h"
 #include "develop/develop.h"
 
 #include <sqlite3.h>
 #include <inttypes.h>
 
-void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
+#define DT_IMAGE_CACHE_COLUMNS                                                                            \
+  "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure,"                  \
+  "       aperture, iso, focal_length, datetime_taken, flags, crop, orientation,"                        \
+  "       focus_distance, raw_parameters, longitude, latitude, altitude, color_matrix,"                  \
+  "       colorspace, version, raw_black, raw_maximum, aspect_ratio, exposure_bias,"                     \
+  "       import_timestamp, change_timestamp, export_timestamp, print_timestamp"                         \
+  "  FROM main.images"
+
+// the row dt_image_cache_preload() is currently stepping over, so the allocate
+// callback can take the image from there instead of asking the db again.
+static __thread sqlite3_stmt *_preload_row = NULL;
+
+static void _image_cache_read_row(dt_image_t *img, sqlite3_stmt *stmt)
 {
-  entry->cost = sizeof(dt_image_t);
+  img->id = sqlite3_column_int(stmt, 0);
+  img->group_id = sqlite3_column_int(stmt, 1);
+  img->film_id = sqlite3_column_int(stmt, 2);
+  img->width = sqlite3_column_int(stmt, 3);
+  img->height = sqlite3_column_int(stmt, 4);
+  img->crop_x = img->crop_y = img->crop_width = img->crop_height = 0;
+  img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0]
+      = img->exif_datetime_taken[0] = '\0';
+  char *str;
+  str = (char *)sqlite3_column_text(stmt, 5);
+  if(str) g_strlcpy(img->filename, str, sizeof(img->filename));
+  str = (char *)sqlite3_column_text(stmt, 6);
+  if(str) g_strlcpy(img->exif_maker, str, sizeof(img->exif_maker));
+  str = (char *)sqlite3_column_text(stmt, 7);
+  if(str) g_strlcpy(img->exif_model, str, sizeof(img->exif_model));
+  str = (char *)sqlite3_column_text(stmt, 8);
+  if(str) g_strlcpy(img->exif_lens, str, sizeof(img->exif_lens));
+  img->exif_exposure = sqlite3_column_double(stmt, 9);
+  img->exif_aperture = sqlite3_column_double(stmt, 10);
+  img->exif_iso = sqlite3_column_double(stmt, 11);
+  img->exif_focal_length = sqlite3_column_double(stmt, 12);
+  str = (char *)sqlite3_column_text(stmt, 13);
+  if(str) g_strlcpy(img->exif_datetime_taken, str, sizeof(img->exif_datetime_taken));
+  img->flags = sqlite3_column_int(stmt, 14);
+  img->loader = LOADER_UNKNOWN;
+  img->exif_crop = sqlite3_column_double(stmt, 15);
+  img->orientation = sqlite3_column_int(stmt, 16);
+  img->exif_focus_distance = sqlite3_column_double(stmt, 17);
+  if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
+  uint32_t tmp = sqlite3_column_int(stmt, 18);
+  memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
+  if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
+    img->geoloc.longitude = sqlite3_column_double(stmt, 19);
+  else
+    img->geoloc.longitude = NAN;
+  if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
+    img->geoloc.latitude = sqlite3_column_double(stmt, 20);
+  else
+    img->geoloc.latitude = NAN;
+  if(sqlite3_column_type(stmt, 21) == SQLITE_FLOAT)
+    img->geoloc.elevation = sqlite3_column_double(stmt, 21);
+  else
+    img->geoloc.elevation = NAN;
+  const void *color_matrix = sqlite3_column_blob(stmt, 22);
+  if(color_matrix)
+    memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
+  else
+    img->d65_color_matrix[0] = NAN;
+  g_free(img->profile);
+  img->profile = NULL;
+  img->profile_size = 0;
+  img->colorspace = sqlite3_column_int(stmt, 23);
+  img->version = sqlite3_column_int(stmt, 24);
+  img->raw_black_level = sqlite3_column_int(stmt, 25);
+  for(uint8_t i = 0; i < 4; i++) img->raw_black_level_separate[i] = 0;
+  img->raw_white_point = sqlite3_column_int(stmt, 26);
+  if(sqlite3_column_type(stmt, 27) == SQLITE_FLOAT)
+    img->aspect_ratio = sqlite3_column_double(stmt, 27);
+  else
+    img->aspect_ratio = 0.0;
+  if(sqlite3_column_type(stmt, 28) == SQLITE_FLOAT)
+    img->exif_exposure_bias = sqlite3_column_double(stmt, 28);
+  else
+    img->exif_exposure_bias = NAN;
+  img->import_timestamp = sqlite3_column_int(stmt, 29);
+  img->change_timestamp = sqlite3_column_int(stmt, 30);
+  img->export_timestamp = sqlite3_column_int(stmt, 31);
+  img->print_timestamp = sqlite3_column_int(stmt, 32);
 
-  dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
-  dt_image_init(img);
-  entry->data = img;
-  // load stuff from db and store in cache:
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
-      "SELECT id, group_id, film_id, width, height, filename, maker, model, lens, exposure,"
-      "       aperture, iso, focal_length, datetime_taken, flags, crop, orientation,"
-      "       focus_distance, raw_parameters, longitude, latitude, altitude, color_matrix,"
-      "       colorspace, version, raw_black, raw_maximum, aspect_ratio, exposure_bias,"
-      "       import_timestamp, change_timestamp, export_timestamp, print_timestamp"
-      "  FROM main.images"
-      "  WHERE id = ?1",
-      -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  // buffer size? colorspace?
+  if(img->flags & DT_IMAGE_LDR)
   {
-    img->id = sqlite3_column_int(stmt, 0);
-    img->group_id = sqlite3_column_int(stmt, 1);
-    img->film_id = sqlite3_column_int(stmt, 2);
-    img->width = sqlite3_column_int(stmt, 3);
-    img->height = sqlite3_column_int(stmt, 4);
-    img->crop_x = img->crop_y = img->crop_width = img->crop_height = 0;
-    img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0]
-        = img->exif_datetime_taken[0] = '\0';
-    char *str;
-    str = (char *)sqlite3_column_text(stmt, 5);
-    if(str) g_strlcpy(img->filename, str, sizeof(img->filename));
-    str = (char *)sqlite3_column_text(stmt, 6);
-    if(str) g_strlcpy(img->exif_maker, str, sizeof(img->exif_maker));
-    str = (char *)sqlite3_column_text(stmt, 7);
-    if(str) g_strlcpy(img->exif_model, str, sizeof(img->exif_model));
-    str = (char *)sqlite3_column_text(stmt, 8);
-    if(str) g_strlcpy(img->exif_lens, str, sizeof(img->exif_lens));
-    img->exif_exposure = sqlite3_column_double(stmt, 9);
-    img->exif_aperture = sqlite3_column_double(stmt, 10);
-    img->exif_iso = sqlite3_column_double(stmt, 11);
-    img->exif_focal_length = sqlite3_column_double(stmt, 12);
-    str = (char *)sqlite3_column_text(stmt, 13);
-    if(str) g_strlcpy(img->exif_datetime_taken, str, sizeof(img->exif_datetime_taken));
-    img->flags = sqlite3_column_int(stmt, 14);
-    img->loader = LOADER_UNKNOWN;
-    img->exif_crop = sqlite3_column_double(stmt, 15);
-    img->orientation = sqlite3_column_int(stmt, 16);
-    img->exif_focus_distance = sqlite3_column_double(stmt, 17);
-    if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
-    uint32_t tmp = sqlite3_column_int(stmt, 18);
-    memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
-    if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
-      img->geoloc.longitude = sqlite3_column_double(stmt, 19);
-    else
-      img->geoloc.longitude = NAN;
-    if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
-      img->geoloc.latitude = sqlite3_column_double(stmt, 20);
-    else
-      img->geoloc.latitude = NAN;
-    if(sqlite3_column_type(stmt, 21) == SQLITE_FLOAT)
-      img->geoloc.elevation = sqlite3_column_double(stmt, 21);
-    else
-      img->geoloc.elevation = NAN;
-    const void *color_matrix = sqlite3_column_blob(stmt, 22);
-    if(color_matrix)
-      memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
-    else
-      img->d65_color_matrix[0] = NAN;
-    g_free(img->profile);
-    img->profile = NULL;
-    img->profile_size = 0;
-    img->colorspace = sqlite3_column_int(stmt, 23);
-    img->version = sqlite3_column_int(stmt, 24);
-    img->raw_black_level = sqlite3_column_int(stmt, 25);
-    for(uint8_t i = 0; i < 4; i++) img->raw_black_level_separate[i] = 0;
-    img->raw_white_point = sqlite3_column_int(stmt, 26);
-    if(sqlite3_column_type(stmt, 27) == SQLITE_FLOAT)
-      img->aspect_ratio = sqlite3_column_double(stmt, 27);
-    else
-      img->aspect_ratio = 0.0;
-    if(sqlite3_column_type(stmt, 28) == SQLITE_FLOAT)
-      img->exif_exposure_bias = sqlite3_column_double(stmt, 28);
+    img->buf_dsc.channels = 4;
+    img->buf_dsc.datatype = TYPE_FLOAT;
+    img->buf_dsc.cst = iop_cs_rgb;
+  }
+  else if(img->flags & DT_IMAGE_HDR)
+  {
+    if(img->flags & DT_IMAGE_RAW)
+    {
+      img->buf_dsc.channels = 1;
+      img->buf_dsc.datatype = TYPE_FLOAT;
+      img->buf_dsc.cst = iop_cs_RAW;
+    }
     else
-      img->exif_exposure_bias = NAN;
-    img->import_timestamp = sqlite3_column_int(stmt, 29);
-    img->change_timestamp = sqlite3_column_int(stmt, 30);
-    img->export_timestamp = sqlite3_column_int(stmt, 31);
-    img->print_timestamp = sqlite3_column_int(stmt, 32);
-
-    // buffer size? colorspace?
-    if(img->flags & DT_IMAGE_LDR)
     {
       img->buf_dsc.channels = 4;
       img->buf_dsc.datatype = TYPE_FLOAT;
       img->buf_dsc.cst = iop_cs_rgb;
     }
-    else if(img->flags & DT_IMAGE_HDR)
+  }
+  else
+  {
+    // raw
+    img->buf_dsc.channels = 1;
+    img->buf_dsc.datatype = TYPE_UINT16;
+    img->buf_dsc.cst = iop_cs_RAW;
+  }
+}
+
+void dt_image_cache_allocate(void *data, dt_cache_entry_t *entry)
+{
+  entry->cost = sizeof(dt_image_t);
+
+  dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+  dt_image_init(img);
+  entry->data = img;
+
+  if(_preload_row && sqlite3_column_int(_preload_row, 0) == (int32_t)entry->key)
+  {
+    // we got here from dt_image_cache_preload(), the row is already there
+    _image_cache_read_row(img, _preload_row);
+  }
+  else
+  {
+    // load stuff from db and store in cache. thumbnail jobs get here a lot, on a read only connection
+    // they don't queue up behind an import writing.
+    sqlite3 *reader = dt_database_get_reader(darktable.db);
+    sqlite3 *handle = reader ? reader : dt_database_get(darktable.db);
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(handle, DT_IMAGE_CACHE_COLUMNS "  WHERE id = ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, entry->key);
+    if(sqlite3_step(stmt) == SQLITE_ROW)
     {
-      if(img->flags & DT_IMAGE_RAW)
-      {
-        img->buf_dsc.channels = 1;
-        img->buf_dsc.datatype = TYPE_FLOAT;
-        img->buf_dsc.cst = iop_cs_RAW;
-      }
-      else
-      {
-        img->buf_dsc.channels = 4;
-        img->buf_dsc.datatype = TYPE_FLOAT;
-        img->buf_dsc.cst = iop_cs_rgb;
-      }
+      _image_cache_read_row(img, stmt);
     }
     else
     {
-      // raw
-      img->buf_dsc.channels = 1;
-      img->buf_dsc.datatype = TYPE_UINT16;
-      img->buf_dsc.cst = iop_cs_RAW;
+      img->id = -1;
+      fprintf(stderr, "[image_cache_allocate] failed to open image %" PRIu32 " from database: %s\n", entry->key,
+              sqlite3_errmsg(handle));
     }
+    sqlite3_finalize(stmt);
+    dt_database_release_reader(darktable.db, reader);
   }
-  else
-  {
-    img->id = -1;
-    fprintf(stderr, "[image_cache_allocate] failed to open image %" PRIu32 " from database: %s\n", entry->key,
-            sqlite3_errmsg(dt_database_get(darktable.db)));
-  }
-  sqlite3_finalize(stmt);
   img->cache_entry = entry; // init backref
   // could downgrade lock write->read on entry->lock if we were using concurrencykit..
   dt_image_refresh_makermodel(img);
@@ -180,12 +203,16 @@ void dt_image_cache_init(dt_image_cache_t *cache)
   dt_cache_init(&cache->cache, sizeof(dt_image_t), max_mem);
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate, cache);
   dt_cache_set_cleanup_callback(&cache->cache, &dt_image_cache_deallocate, cache);
+  dt_memory_governor_register_cache("image", &cache->cache, TRUE);
+  dt_cache_stats_register_cache("image", &cache->cache, TRUE);
 
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
 }
 
 void dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  dt_memory_governor_unregister(&cache->cache);
+  dt_cache_stats_unregister(&cache->cache);
   dt_cache_cleanup(&cache->cache);
 }
 
@@ -196,6 +223,57 @@ void dt_image_cache_print(dt_image_cache_t *cache)
          (float)cache->cache.cost / (float)cache->cache.cost_quota);
 }
 
+// step over the rows of an image struct query, putting them into the cache
+static void _image_cache_preload(dt_image_cache_t *cache, sqlite3_stmt *stmt)
+{
+  // stay below the fill ratio where dt_cache_get() starts to garbage collect,
+  // preloading shouldn't push out images which are in use.
+  const size_t limit = 0.8f * cache->cache.cost_quota;
+  int loaded = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(__atomic_load_n(&cache->cache.cost, __ATOMIC_RELAXED) + sizeof(dt_image_t) > limit) break;
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    if(dt_cache_contains(&cache->cache, imgid)) continue;
+    _preload_row = stmt;
+    dt_cache_entry_t *entry = dt_cache_get(&cache->cache, imgid, 'r');
+    _preload_row = NULL;
+    dt_cache_release(&cache->cache, entry);
+    loaded++;
+  }
+  sqlite3_finalize(stmt);
+
+  dt_print(DT_DEBUG_CACHE, "[image_cache] preloaded %d images\n", loaded);
+}
+
+void dt_image_cache_preload(dt_image_cache_t *cache, GList *imgs)
+{
+  if(!imgs) return;
+  sqlite3_stmt *stmt;
+  GString *query = g_string_new(DT_IMAGE_CACHE_COLUMNS "  WHERE id IN (");
+  for(GList *l = imgs; l; l = g_list_next(l))
+    g_string_append_printf(query, l->next ? "%d," : "%d)", GPOINTER_TO_INT(l->data));
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query->str, -1, &stmt, NULL);
+  g_string_free(query, TRUE);
+  _image_cache_preload(cache, stmt);
+}
+
+void dt_image_cache_preload_collection(dt_image_cache_t *cache, const int offset, const int count)
+{
+  if(count <= 0) return;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              DT_IMAGE_CACHE_COLUMNS
+                              "  JOIN memory.collected_images AS c ON c.imgid = id"
+                              "  WHERE c.rowid >= ?1"
+                              "  ORDER BY c.rowid"
+                              "  LIMIT ?2",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, count);
+  _image_cache_preload(cache, stmt);
+}
+
 dt_image_t *dt_image_cache_get(dt_image_cache_t *cache, const int32_t imgid, char mode)
 {
   if(imgid <= 0) return NULL;
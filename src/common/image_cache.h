@@ -51,6 +51,12 @@ void dt_image_cache_print(dt_image_cache_t *cache);
 // point where sql and xmp can be synched (unsafe setting).
 dt_image_t *dt_image_cache_get(dt_image_cache_t *cache, const int32_t imgid, char mode);
 
+// loads the image structs of all given imgids with a single query. images already in the cache
+// are skipped, and it stops early rather than evicting anything to make room.
+void dt_image_cache_preload(dt_image_cache_t *cache, GList *imgs);
+// same for count images of memory.collected_images, starting at the given (1-based) position
+void dt_image_cache_preload_collection(dt_image_cache_t *cache, const int offset, const int count);
+
 // same as read_get, but doesn't block and returns NULL if the image
 // is currently unavailable.
 dt_image_t *dt_image_cache_testget(dt_image_cache_t *cache, const int32_t imgid, char mode);
@@ -629,6 +629,34 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+size_t dt_imageio_export_memory_estimate(const int32_t imgid, const int max_width, const int max_height,
+                                         const gboolean high_quality, const gboolean upscale)
+{
+  const dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  if(!image) return 0;
+  const size_t width = image->width;
+  const size_t height = image->height;
+  // mosaiced raws come in a single channel
+  const size_t in_bpp = dt_image_is_raw(image) ? sizeof(float) : 4 * sizeof(float);
+  // the size after cropping and distortions, if it has been processed before
+  const double final_width = image->final_width > 0 ? image->final_width : width;
+  const double final_height = image->final_height > 0 ? image->final_height : height;
+  dt_image_cache_read_release(darktable.image_cache, image);
+
+  double scale = 1.0;
+  if(max_width > 0) scale = fmin(scale, max_width / final_width);
+  if(max_height > 0) scale = fmin(scale, max_height / final_height);
+  if(upscale && max_width > 0 && max_height > 0)
+    scale = fmin(max_width / final_width, max_height / final_height);
+
+  const size_t out = (size_t)(final_width * scale) * (size_t)(final_height * scale);
+  // high quality processes at full resolution and downsamples at the end
+  const size_t processed = high_quality ? MAX(out, width * height) : out;
+  // the default tiling callback sees a factor of 2 for a module (input and output),
+  // on top of the two cache lines of the export pipe.
+  return width * height * in_bpp + (2 + 2) * processed * 4 * sizeof(float);
+}
+
 int dt_imageio_export(const int32_t imgid, const char *filename, dt_imageio_module_format_t *format,
                       dt_imageio_module_data_t *format_params, const gboolean high_quality, const gboolean upscale,
                       const gboolean copy_metadata, const gboolean export_masks,
@@ -896,6 +924,9 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
 
   const int bpp = format->bpp(format_params);
 
+  // large exports can stream the whole pipe tile by tile to bound the memory of intermediate buffers
+  const int tile_size = thumbnail_export ? 0 : dt_conf_get_int("export_tile_size");
+
   dt_get_times(&start);
   if(high_quality_processing)
   {
@@ -903,7 +934,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
      * if high quality processing was requested, downsampling will be done
      * at the very end of the pipe (just before border and watermark)
      */
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    dt_dev_pixelpipe_process_tiled(&pipe, &dev, processed_width, processed_height, scale, tile_size, TRUE);
   }
   else
   {
@@ -930,10 +961,7 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
     if(finalscale) finalscale->enabled = 0;
 
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    dt_dev_pixelpipe_process_tiled(&pipe, &dev, processed_width, processed_height, scale, tile_size, bpp != 8);
 
     if(finalscale) finalscale->enabled = 1;
   }
@@ -88,6 +88,11 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
                                  dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *storage_params,
                                  int num, int total, dt_export_metadata_t *metadata);
 
+// rough estimate of the memory in bytes exporting the image with the given maximum output size needs:
+// the full input buffer, two cache lines of the export pipe and the working set of a module.
+size_t dt_imageio_export_memory_estimate(const int32_t imgid, const int max_width, const int max_height,
+                                         const gboolean high_quality, const gboolean upscale);
+
 size_t dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht,
                             dt_image_orientation_t orientation);
 
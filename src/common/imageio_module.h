@@ -39,7 +39,8 @@ typedef enum dt_imageio_format_flags_t
 {
   FORMAT_FLAGS_SUPPORT_XMP = 1,
   FORMAT_FLAGS_NO_TMPFILE = 2,
-  FORMAT_FLAGS_SUPPORT_LAYERS = 4
+  FORMAT_FLAGS_SUPPORT_LAYERS = 4,
+  FORMAT_FLAGS_NO_CONCURRENT = 8 // write_image() collects all images in one file, write them one after the other
 } dt_imageio_format_flags_t;
 
 /**
@@ -181,6 +182,8 @@ typedef struct dt_imageio_module_storage_t
                const int num, const int total, const gboolean high_quality, const gboolean upscale,
                const gboolean export_masks, dt_colorspaces_color_profile_type_t icc_type, const gchar *icc_filename,
                dt_iop_color_intent_t icc_intent, dt_export_metadata_t *metadata_flags);
+  /* store() may be called for several images at once from different threads, if implemented and non-zero. */
+  int (*concurrent_store)(struct dt_imageio_module_storage_t *self);
   /* called once at the end (after exporting all images), if implemented. */
   void (*finalize_store)(struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data);
 
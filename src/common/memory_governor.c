@@ -0,0 +1,441 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/memory_governor.h"
+#include "common/cache.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// we are under pressure above this share of the budget, and free down to the lower one
+#define DT_MEMORY_GOVERNOR_HIGH 0.9
+#define DT_MEMORY_GOVERNOR_LOW 0.8
+// percentage of the last 10 seconds some task stalled on memory, as reported by psi
+#define DT_MEMORY_GOVERNOR_PSI 10.0
+
+typedef struct dt_memory_client_t
+{
+  gchar *name;
+  dt_memory_governor_usage_t usage;
+  dt_memory_governor_shrink_t shrink;
+  void *data;
+  void *key;     // what the client is unregistered by
+  gboolean owned; // data was allocated by us
+  size_t current; // usage as of the last check, to sort by
+  int refs;         // checks which have it in their plan, the last one frees a removed client
+  int busy;         // checks asking it to shrink right now, unregister waits for them
+  gboolean removed; // unregistered
+} dt_memory_client_t;
+
+typedef struct dt_memory_cache_client_t
+{
+  dt_cache_t *cache;
+  gboolean cost_is_bytes;
+} dt_memory_cache_client_t;
+
+static gboolean _governor_initialized = FALSE;
+static dt_pthread_mutex_t _governor_mutex; // protects the client list, not the clients
+static pthread_cond_t _governor_cond;      // a client is done shrinking
+static GList *_governor_clients = NULL;
+static size_t _governor_budget = 0;
+static size_t _governor_cgroup_limit = 0;
+static gchar *_governor_cgroup_dir = NULL; // memory controller of our cgroup, NULL if none
+static gboolean _governor_cgroup_v2 = FALSE;
+static gboolean _governor_cgroup_limited = FALSE; // the cgroup limit is below physical memory
+static pthread_t _governor_thread;
+static volatile gint _governor_running = 0;
+
+static gboolean _read_size(const char *dir, const char *file, size_t *value)
+{
+  gchar *filename = g_build_filename(dir, file, NULL);
+  gchar *contents = NULL;
+  gboolean res = FALSE;
+  // "max" in cgroup v2 means no limit, leave that to the caller's default
+  if(g_file_get_contents(filename, &contents, NULL, NULL) && g_ascii_isdigit(contents[0]))
+  {
+    *value = g_ascii_strtoull(contents, NULL, 10);
+    res = TRUE;
+  }
+  g_free(contents);
+  g_free(filename);
+  return res;
+}
+
+// value of one key of a flat keyed file like memory.stat
+static size_t _read_key(const char *dir, const char *file, const char *key)
+{
+  gchar *filename = g_build_filename(dir, file, NULL);
+  gchar *contents = NULL;
+  size_t value = 0;
+  if(g_file_get_contents(filename, &contents, NULL, NULL))
+  {
+    const size_t len = strlen(key);
+    for(const char *line = contents; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL)
+    {
+      if(!strncmp(line, key, len) && line[len] == ' ')
+      {
+        value = g_ascii_strtoull(line + len + 1, NULL, 10);
+        break;
+      }
+    }
+  }
+  g_free(contents);
+  g_free(filename);
+  return value;
+}
+
+// find the memory controller of the cgroup we are in, from /proc/self/cgroup.
+// inside a container the namespace root is our cgroup, so fall back to the mount point itself.
+static void _cgroup_find(void)
+{
+#ifdef __linux__
+  gchar *contents = NULL;
+  if(!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) return;
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  for(int k = 0; lines[k] && !_governor_cgroup_dir; k++)
+  {
+    gchar **fields = g_strsplit(lines[k], ":", 3);
+    if(g_strv_length(fields) == 3)
+    {
+      gchar *dir = NULL;
+      if(!strcmp(fields[0], "0") && !fields[1][0])
+      {
+        dir = g_build_filename("/sys/fs/cgroup", fields[2], NULL);
+        gchar *max = g_build_filename(dir, "memory.max", NULL);
+        if(!g_file_test(max, G_FILE_TEST_EXISTS))
+        {
+          g_free(dir);
+          dir = g_strdup("/sys/fs/cgroup");
+        }
+        g_free(max);
+        _governor_cgroup_v2 = TRUE;
+      }
+      else
+      {
+        gchar **controllers = g_strsplit(fields[1], ",", -1);
+        if(g_strv_contains((const gchar *const *)controllers, "memory"))
+        {
+          dir = g_build_filename("/sys/fs/cgroup/memory", fields[2], NULL);
+          gchar *limit = g_build_filename(dir, "memory.limit_in_bytes", NULL);
+          if(!g_file_test(limit, G_FILE_TEST_EXISTS))
+          {
+            g_free(dir);
+            dir = g_strdup("/sys/fs/cgroup/memory");
+          }
+          g_free(limit);
+          _governor_cgroup_v2 = FALSE;
+        }
+        g_strfreev(controllers);
+      }
+
+      // "max" leaves the limit at 0, the cgroup still tells about its pressure
+      size_t limit = 0;
+      if(dir && _read_size(dir, _governor_cgroup_v2 ? "memory.max" : "memory.limit_in_bytes", &limit))
+        _governor_cgroup_limit = limit;
+      _governor_cgroup_dir = dir;
+    }
+    g_strfreev(fields);
+  }
+  g_strfreev(lines);
+  g_free(contents);
+#endif
+}
+
+// what we hold: the cgroup's usage without the page cache the kernel can drop by itself,
+// or our resident set size if we don't run in a limited cgroup.
+static size_t _current_usage(void)
+{
+#ifdef __linux__
+  size_t usage = 0;
+  if(_governor_cgroup_limited
+     && _read_size(_governor_cgroup_dir, _governor_cgroup_v2 ? "memory.current" : "memory.usage_in_bytes",
+                   &usage))
+  {
+    const size_t inactive = _read_key(_governor_cgroup_dir, "memory.stat",
+                                      _governor_cgroup_v2 ? "inactive_file" : "total_inactive_file");
+    return usage > inactive ? usage - inactive : 0;
+  }
+  unsigned long size = 0, resident = 0;
+  FILE *f = g_fopen("/proc/self/statm", "rb");
+  if(!f) return 0;
+  if(fscanf(f, "%lu %lu", &size, &resident) != 2) resident = 0;
+  fclose(f);
+  return (size_t)resident * sysconf(_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
+
+#ifdef __linux__
+// "some avg10" of a psi file, FALSE if there is none
+static gboolean _read_pressure(const char *filename, double *avg10)
+{
+  gchar *contents = NULL;
+  gboolean res = FALSE;
+  if(g_file_get_contents(filename, &contents, NULL, NULL))
+  {
+    const char *some = strstr(contents, "some avg10=");
+    if(some)
+    {
+      *avg10 = g_ascii_strtod(some + strlen("some avg10="), NULL);
+      res = TRUE;
+    }
+  }
+  g_free(contents);
+  return res;
+}
+#endif
+
+// share of the last 10 seconds in which some task stalled on memory. the cgroup's own file only
+// counts stalls of the tasks in it, the system wide one is the fallback.
+static double _current_pressure(void)
+{
+#ifdef __linux__
+  double avg10 = 0.0;
+  if(_governor_cgroup_dir && _governor_cgroup_v2)
+  {
+    gchar *filename = g_build_filename(_governor_cgroup_dir, "memory.pressure", NULL);
+    const gboolean found = _read_pressure(filename, &avg10);
+    g_free(filename);
+    if(found) return avg10;
+  }
+  _read_pressure("/proc/pressure/memory", &avg10);
+  return avg10;
+#else
+  return 0.0;
+#endif
+}
+
+static void _client_free(gpointer data)
+{
+  dt_memory_client_t *client = (dt_memory_client_t *)data;
+  if(client->owned) g_free(client->data);
+  g_free(client->name);
+  g_free(client);
+}
+
+static size_t _cache_usage(void *data)
+{
+  const dt_memory_cache_client_t *c = (dt_memory_cache_client_t *)data;
+  return c->cost_is_bytes ? __atomic_load_n(&c->cache->cost, __ATOMIC_RELAXED) : 0;
+}
+
+static size_t _cache_shrink(void *data, size_t bytes)
+{
+  dt_memory_cache_client_t *c = (dt_memory_cache_client_t *)data;
+  if(!c->cost_is_bytes)
+  {
+    // entries of unknown size, let go of all we can
+    dt_cache_gc(c->cache, 0.0f);
+    return 0;
+  }
+  const size_t before = __atomic_load_n(&c->cache->cost, __ATOMIC_RELAXED);
+  const size_t target = before > bytes ? before - bytes : 0;
+  dt_cache_gc(c->cache, (float)target / (float)MAX(c->cache->cost_quota, 1));
+  const size_t after = __atomic_load_n(&c->cache->cost, __ATOMIC_RELAXED);
+  return before > after ? before - after : 0;
+}
+
+static gint _sort_by_usage(gconstpointer a, gconstpointer b)
+{
+  const size_t ua = ((const dt_memory_client_t *)a)->current, ub = ((const dt_memory_client_t *)b)->current;
+  return ua > ub ? -1 : (ua < ub ? 1 : 0);
+}
+
+void dt_memory_governor_check(void)
+{
+  if(!_governor_initialized) return;
+
+  const size_t usage = _current_usage();
+  const double pressure = _current_pressure();
+  const gboolean over = usage > DT_MEMORY_GOVERNOR_HIGH * _governor_budget;
+  if(!over && pressure < DT_MEMORY_GOVERNOR_PSI) return;
+
+  // free down to the low mark, or a quarter of what the caches hold if it's only the kernel who's stalling
+  dt_pthread_mutex_lock(&_governor_mutex);
+  size_t held = 0;
+  for(GList *l = _governor_clients; l; l = g_list_next(l))
+  {
+    dt_memory_client_t *client = (dt_memory_client_t *)l->data;
+    client->current = client->usage ? client->usage(client->data) : 0;
+    held += client->current;
+  }
+  const size_t low = DT_MEMORY_GOVERNOR_LOW * _governor_budget;
+  const size_t needed = over ? usage - low : held / 4;
+
+  // the biggest first, clients of unknown size come last. they are asked without the lock held,
+  // shrinking may write out to disk, while pipes register and unregister.
+  _governor_clients = g_list_sort(_governor_clients, _sort_by_usage);
+  GList *plan = g_list_copy(_governor_clients);
+  for(GList *l = plan; l; l = g_list_next(l)) ((dt_memory_client_t *)l->data)->refs++;
+
+  size_t freed = 0;
+  for(GList *l = plan; l; l = g_list_next(l))
+  {
+    dt_memory_client_t *client = (dt_memory_client_t *)l->data;
+    if(freed < needed && !client->removed)
+    {
+      client->busy++;
+      dt_pthread_mutex_unlock(&_governor_mutex);
+      const size_t f = client->shrink(client->data, needed - freed);
+      dt_print(DT_DEBUG_MEMORY, "[memory_governor] %s freed %zu of %zu MB asked\n", client->name, f >> 20,
+               (needed - freed) >> 20);
+      freed += f;
+      dt_pthread_mutex_lock(&_governor_mutex);
+      client->busy--;
+      pthread_cond_broadcast(&_governor_cond);
+    }
+    if(--client->refs == 0 && client->removed) _client_free(client);
+  }
+  g_list_free(plan);
+  dt_pthread_mutex_unlock(&_governor_mutex);
+
+  dt_print(DT_DEBUG_MEMORY,
+           "[memory_governor] usage %zu MB of %zu MB budget, pressure %.2f%%, freed %zu of %zu MB\n",
+           usage >> 20, _governor_budget >> 20, pressure, freed >> 20, needed >> 20);
+}
+
+static void *_governor_watch(void *unused)
+{
+  dt_pthread_setname("memory");
+  int ticks = 0;
+  while(g_atomic_int_get(&_governor_running))
+  {
+    // short sleeps so cleanup doesn't have to wait for long
+    g_usleep(100000);
+    if(++ticks % 10 == 0) dt_memory_governor_check();
+  }
+  return NULL;
+}
+
+void dt_memory_governor_init(void)
+{
+  if(_governor_initialized) return;
+  dt_pthread_mutex_init(&_governor_mutex, NULL);
+  pthread_cond_init(&_governor_cond, NULL);
+
+  size_t budget = dt_get_total_memory() * 1024lu;
+  _cgroup_find();
+  // cgroup v1 reports a huge number for no limit
+  _governor_cgroup_limited = _governor_cgroup_dir && _governor_cgroup_limit && _governor_cgroup_limit < budget;
+  if(_governor_cgroup_limited) budget = _governor_cgroup_limit;
+  const int64_t limit = dt_conf_get_int64("memory_governor_limit");
+  if(limit > 0) budget = MIN(budget, (size_t)limit);
+  _governor_budget = budget;
+  _governor_initialized = TRUE;
+
+  dt_print(DT_DEBUG_MEMORY, "[memory_governor] budget %zu MB, cgroup %s (%zu MB)\n", budget >> 20,
+           _governor_cgroup_dir ? _governor_cgroup_dir : "none", _governor_cgroup_limit >> 20);
+
+#ifdef __linux__
+  g_atomic_int_set(&_governor_running, 1);
+  if(dt_pthread_create(&_governor_thread, _governor_watch, NULL))
+    g_atomic_int_set(&_governor_running, 0);
+#endif
+}
+
+void dt_memory_governor_cleanup(void)
+{
+  if(!_governor_initialized) return;
+  if(g_atomic_int_get(&_governor_running))
+  {
+    g_atomic_int_set(&_governor_running, 0);
+    pthread_join(_governor_thread, NULL);
+  }
+  _governor_initialized = FALSE;
+  g_list_free_full(_governor_clients, _client_free);
+  _governor_clients = NULL;
+  g_free(_governor_cgroup_dir);
+  _governor_cgroup_dir = NULL;
+  _governor_cgroup_limited = FALSE;
+  pthread_cond_destroy(&_governor_cond);
+  dt_pthread_mutex_destroy(&_governor_mutex);
+}
+
+size_t dt_memory_governor_budget(void)
+{
+  return _governor_budget;
+}
+
+size_t dt_memory_governor_clamp(const size_t limit, const float fraction)
+{
+  if(!_governor_budget) return limit;
+  return MIN(limit, (size_t)(fraction * _governor_budget));
+}
+
+static void _register(const char *name, dt_memory_governor_usage_t usage, dt_memory_governor_shrink_t shrink,
+                      void *data, void *key, const gboolean owned)
+{
+  dt_memory_client_t *client = (dt_memory_client_t *)g_malloc0(sizeof(dt_memory_client_t));
+  client->name = g_strdup(name);
+  client->usage = usage;
+  client->shrink = shrink;
+  client->data = data;
+  client->key = key;
+  client->owned = owned;
+  dt_pthread_mutex_lock(&_governor_mutex);
+  _governor_clients = g_list_prepend(_governor_clients, client);
+  dt_pthread_mutex_unlock(&_governor_mutex);
+}
+
+void dt_memory_governor_register(const char *name, dt_memory_governor_usage_t usage,
+                                 dt_memory_governor_shrink_t shrink, void *data)
+{
+  if(!_governor_initialized) return;
+  _register(name, usage, shrink, data, data, FALSE);
+}
+
+void dt_memory_governor_register_cache(const char *name, dt_cache_t *cache, const gboolean cost_is_bytes)
+{
+  if(!_governor_initialized) return;
+  dt_memory_cache_client_t *c = (dt_memory_cache_client_t *)g_malloc(sizeof(dt_memory_cache_client_t));
+  c->cache = cache;
+  c->cost_is_bytes = cost_is_bytes;
+  _register(name, _cache_usage, _cache_shrink, c, cache, TRUE);
+}
+
+void dt_memory_governor_unregister(void *data)
+{
+  if(!_governor_initialized) return;
+  dt_pthread_mutex_lock(&_governor_mutex);
+  for(GList *l = _governor_clients; l; l = g_list_next(l))
+  {
+    dt_memory_client_t *client = (dt_memory_client_t *)l->data;
+    if(client->key == data)
+    {
+      _governor_clients = g_list_delete_link(_governor_clients, l);
+      // a check might be shrinking it right now, the data has to stay valid until it's done.
+      // checks which only plan to ask it skip it, and the last of them frees it.
+      client->removed = TRUE;
+      while(client->busy) dt_pthread_cond_wait(&_governor_cond, &_governor_mutex);
+      if(!client->refs) _client_free(client);
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&_governor_mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,67 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+struct dt_cache_t;
+
+/**
+ * one memory budget for all caches. it is the smallest of physical memory, the memory limit
+ * of the cgroup we run in (v1 or v2) and the memory_governor_limit preference. caches size
+ * themselves within this budget, and register a shrink callback: a watcher thread compares
+ * our resident memory against the budget and reads the kernel's memory pressure (psi, the
+ * cgroup's own if it has one), and asks the caches to give memory back before the oom killer
+ * does it for us.
+ */
+
+/** returns an estimate of the bytes the client currently holds. */
+typedef size_t (*dt_memory_governor_usage_t)(void *data);
+/** asked to free about the given number of bytes. returns what it actually freed, as far as it
+  * knows. a client which can only free later, from its own thread, returns 0. */
+typedef size_t (*dt_memory_governor_shrink_t)(void *data, size_t bytes);
+
+void dt_memory_governor_init(void);
+void dt_memory_governor_cleanup(void);
+
+/** the global budget in bytes. */
+size_t dt_memory_governor_budget(void);
+/** clamps a cache's own size limit to the given fraction of the budget. */
+size_t dt_memory_governor_clamp(const size_t limit, const float fraction);
+
+/** register a client, data identifies it for unregistering. usage is called from the watcher
+  * thread with the registry locked, it must not block. shrink is called without the lock, it may
+  * take its time and (un)register other clients, but not unregister itself. unregistering waits
+  * for a shrink of the client which is running at that moment. */
+void dt_memory_governor_register(const char *name, dt_memory_governor_usage_t usage,
+                                 dt_memory_governor_shrink_t shrink, void *data);
+/** same for a dt_cache_t, shrinking through dt_cache_gc(). if cost_is_bytes is FALSE the cache
+  * counts entries, it is then emptied of everything unlocked on pressure. */
+void dt_memory_governor_register_cache(const char *name, struct dt_cache_t *cache,
+                                       const gboolean cost_is_bytes);
+void dt_memory_governor_unregister(void *data);
+
+/** check the memory situation now and shrink the clients if needed. the watcher thread calls
+  * this once a second. */
+void dt_memory_governor_check(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -17,6 +17,7 @@
 */
 
 #include "common/mipmap_cache.h"
+#include "common/cache_stats.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
@@ -26,6 +27,9 @@
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
+#include "common/memory_governor.h"
+#include "common/mipmap_codec.h"
+#include "common/mipmap_pack.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/imageop_math.h"
@@ -198,6 +202,13 @@ static inline dt_mipmap_size_t get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 28);
 }
 
+// whether thumbnails of this size are kept on disk at all
+static inline gboolean _disk_backend_enabled(const dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip)
+{
+  return cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
+                                || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8));
+}
+
 static int dt_mipmap_cache_get_filename(gchar *mipmapfilename, size_t size)
 {
   int r = -1;
@@ -242,6 +253,14 @@ static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width,
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
                     dt_colorspaces_color_profile_type_t *color_space, const uint32_t imgid,
                     const dt_mipmap_size_t size);
+static dt_mipmap_cache_one_t *_get_cache(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip);
+
+// bytes held by the buffers of one level, summed up per cache as well
+static inline void _stats_resident(dt_mipmap_cache_t *cache, const dt_mipmap_size_t mip, const int64_t delta)
+{
+  __atomic_fetch_add(&cache->stats[mip].resident, (uint64_t)delta, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&_get_cache(cache, mip)->cache.stats.resident, (uint64_t)delta, __ATOMIC_RELAXED);
+}
 
 // callback for the imageio core to allocate memory.
 // only needed for _F and _FULL buffers, as they change size
@@ -265,6 +284,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   {
     if((void *)dsc != (void *)dt_mipmap_cache_static_dead_image) dt_free_align(entry->data);
 
+    _stats_resident(darktable.mipmap_cache, buf->size, -(int64_t)entry->data_size);
     entry->data_size = 0;
 
     entry->data = dt_alloc_align(64, buffer_size);
@@ -279,6 +299,7 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
     }
 
     entry->data_size = buffer_size;
+    _stats_resident(darktable.mipmap_cache, buf->size, entry->data_size);
 
     // set buffer size only if we're making it larger.
     dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
@@ -307,6 +328,63 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return dsc + 1;
 }
 
+static int _read_from_pack(dt_mipmap_cache_t *cache, dt_mipmap_pack_t *pack, dt_cache_entry_t *entry,
+                           const dt_mipmap_size_t mip)
+{
+  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+  const uint32_t imgid = get_imgid(entry->key);
+  size_t len = 0;
+  uint32_t color_space = DT_COLORSPACE_NONE;
+  // decode straight from the mapped pack
+  const uint8_t *blob = dt_mipmap_pack_read_get(pack, imgid, &len, &color_space);
+  if(!blob) return 0;
+
+  uint32_t width = 0, height = 0;
+  dt_colorspaces_color_profile_type_t blob_color_space;
+  const int err = dt_mipmap_codec_decode(blob, len, entry->data + sizeof(*dsc), cache->max_width[mip],
+                                         cache->max_height[mip], &width, &height, &blob_color_space);
+  dt_mipmap_pack_read_release(pack);
+
+  if(err)
+  {
+    fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from the disk cache!\n",
+            imgid);
+    dt_mipmap_pack_remove(pack, imgid);
+    return 0;
+  }
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " from disk cache\n", mip, imgid);
+  dsc->width = width;
+  dsc->height = height;
+  dsc->iscale = 1.0f;
+  // the index knows the color space, also for codecs that can't store it
+  dsc->color_space = color_space;
+  return 1;
+}
+
+static void _write_to_pack(const dt_mipmap_cache_t *cache, dt_mipmap_pack_t *pack, const uint32_t imgid,
+                           const struct dt_mipmap_buffer_dsc *dsc)
+{
+  // Don't write existing thumbnails as both performance and quality (lossy jpg) suffer
+  if(dt_mipmap_pack_contains(pack, imgid)) return;
+
+  // first check the disk isn't full
+  struct statvfs vfsbuf;
+  if(statvfs(cache->cachedir, &vfsbuf) || ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20) < 100)
+  {
+    fprintf(stderr, "Aborting thumbnail write as there's not enough free space for the disk cache\n");
+    return;
+  }
+
+  const int cache_quality = dt_conf_get_int("database_cache_quality");
+  size_t length = 0;
+  uint8_t *blob = dt_mipmap_codec_encode(dt_mipmap_codec_get_default(), (const uint8_t *)(dsc + 1), dsc->width,
+                                         dsc->height, MIN(100, MAX(10, cache_quality)), dsc->color_space, &length);
+  // the color space goes into the index instead of exif data
+  if(blob) dt_mipmap_pack_write(pack, imgid, blob, length, dsc->color_space);
+  dt_free_align(blob);
+}
+
 // callback for the cache backend to initialize payload pointers
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 {
@@ -343,6 +421,7 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
       fprintf(stderr, "[mipmap cache] memory allocation failed!\n");
       exit(1);
     }
+    _stats_resident(cache, mip, entry->data_size);
 
     dsc = entry->data;
 
@@ -369,14 +448,17 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
   int loaded_from_disk = 0;
   if(mip < DT_MIPMAP_F)
   {
-    if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
-                              || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
+    if(_disk_backend_enabled(cache, mip))
     {
+      dt_mipmap_pack_t *pack = cache->pack[mip];
+      if(pack) loaded_from_disk = _read_from_pack(cache, pack, entry, mip);
+
       // try and load from disk, if successful set flag
       char filename[PATH_MAX] = {0};
       snprintf(filename, sizeof(filename), "%s.d/%d/%" PRIu32 ".jpg", cache->cachedir, (int)mip,
                get_imgid(entry->key));
-      FILE *f = g_fopen(filename, "rb");
+      // thumbnails written before the pack was switched on are still loose files
+      FILE *f = loaded_from_disk ? NULL : g_fopen(filename, "rb");
       if(f)
       {
         uint8_t *blob = 0;
@@ -389,11 +471,10 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         const int rd = fread(blob, sizeof(uint8_t), len, f);
         if(rd != len) goto read_error;
         dt_colorspaces_color_profile_type_t color_space;
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, len, &jpg)
-           || (jpg.width > cache->max_width[mip] || jpg.height > cache->max_height[mip])
-           || ((color_space = dt_imageio_jpeg_read_color_space(&jpg)) == DT_COLORSPACE_NONE) // pointless test to keep it in the if clause
-           || dt_imageio_jpeg_decompress(&jpg, entry->data + sizeof(*dsc)))
+        uint32_t width = 0, height = 0;
+        // the blob tells which codec wrote it
+        if(dt_mipmap_codec_decode(blob, len, entry->data + sizeof(*dsc), cache->max_width[mip],
+                                  cache->max_height[mip], &width, &height, &color_space))
         {
           fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %" PRIu32 " from `%s'!\n",
                   get_imgid(entry->key), filename);
@@ -401,11 +482,14 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
         }
         dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " from disk cache\n", mip,
                  get_imgid(entry->key));
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
+        dsc->width = width;
+        dsc->height = height;
         dsc->iscale = 1.0f;
         dsc->color_space = color_space;
         loaded_from_disk = 1;
+        // move it into the pack, as is
+        if(pack && !dt_mipmap_pack_write(pack, get_imgid(entry->key), blob, len, color_space))
+          g_unlink(filename);
         if(0)
         {
 read_error:
@@ -440,6 +524,7 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, uint32_t imgid,
   // if(dt_conf_get_bool("cache_disk_backend"))
   if(cache->cachedir[0])
   {
+    if(cache->pack[mip]) dt_mipmap_pack_remove(cache->pack[mip], imgid);
     char filename[PATH_MAX] = { 0 };
     snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
     g_unlink(filename);
@@ -460,8 +545,11 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       {
         dt_mipmap_cache_unlink_ondisk_thumbnail(data, get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0] && ((dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_8)
-                                     || (dt_conf_get_bool("cache_disk_backend_full") && mip == DT_MIPMAP_8)))
+      else if(cache->pack[mip] && _disk_backend_enabled(cache, mip))
+      {
+        _write_to_pack(cache, cache->pack[mip], get_imgid(entry->key), dsc);
+      }
+      else if(_disk_backend_enabled(cache, mip))
       {
         // serialize to disk
         char filename[PATH_MAX] = {0};
@@ -493,22 +581,36 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
             }
 
             const int cache_quality = dt_conf_get_int("database_cache_quality");
-            const uint8_t *exif = NULL;
-            int exif_len = 0;
-            if(dsc->color_space == DT_COLORSPACE_SRGB)
+            const dt_mipmap_codec_t codec = dt_mipmap_codec_get_default();
+            if(codec != DT_MIPMAP_CODEC_JPEG)
             {
-              exif = dt_mipmap_cache_exif_data_srgb;
-              exif_len = dt_mipmap_cache_exif_data_srgb_length;
+              // the file keeps its name, the codec is tagged in the blob itself
+              size_t length = 0;
+              uint8_t *blob = dt_mipmap_codec_encode(codec, entry->data + sizeof(*dsc), dsc->width, dsc->height,
+                                                     MIN(100, MAX(10, cache_quality)), dsc->color_space, &length);
+              const int err = !blob || fwrite(blob, 1, length, f) != length;
+              dt_free_align(blob);
+              if(err) goto write_error;
             }
-            else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
-            {
-              exif = dt_mipmap_cache_exif_data_adobergb;
-              exif_len = dt_mipmap_cache_exif_data_adobergb_length;
-            }
-            if(dt_imageio_jpeg_write(filename, entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
+            else
             {
+              const uint8_t *exif = NULL;
+              int exif_len = 0;
+              if(dsc->color_space == DT_COLORSPACE_SRGB)
+              {
+                exif = dt_mipmap_cache_exif_data_srgb;
+                exif_len = dt_mipmap_cache_exif_data_srgb_length;
+              }
+              else if(dsc->color_space == DT_COLORSPACE_ADOBERGB)
+              {
+                exif = dt_mipmap_cache_exif_data_adobergb;
+                exif_len = dt_mipmap_cache_exif_data_adobergb_length;
+              }
+              if(dt_imageio_jpeg_write(filename, entry->data + sizeof(*dsc), dsc->width, dsc->height, MIN(100, MAX(10, cache_quality)), exif, exif_len))
+              {
 write_error:
-              g_unlink(filename);
+                g_unlink(filename);
+              }
             }
           }
           if(f) fclose(f);
@@ -516,9 +618,15 @@ write_error:
       }
     }
   }
+  _stats_resident(cache, mip, -(int64_t)entry->data_size);
   dt_free_align(entry->data);
 }
 
+static void _stats_level_fill(void *data, dt_cache_report_t *report)
+{
+  dt_cache_stats_copy(&report->stats, (const dt_cache_stats_t *)data);
+}
+
 static uint32_t nearest_power_of_two(const uint32_t value)
 {
   uint32_t rc = 1;
@@ -529,15 +637,33 @@ static uint32_t nearest_power_of_two(const uint32_t value)
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
+
+  // a few large pack files per mip level instead of one file per thumbnail
+  memset(cache->pack, 0, sizeof(cache->pack));
+  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend_packed"))
+  {
+    char dirname[PATH_MAX] = { 0 };
+    snprintf(dirname, sizeof(dirname), "%s.d", cache->cachedir);
+    if(!g_mkdir_with_parents(dirname, 0750))
+      for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
+      {
+        char base[PATH_MAX] = { 0 };
+        snprintf(base, sizeof(base), "%s/%d", dirname, (int)k);
+        cache->pack[k] = dt_mipmap_pack_open(base);
+      }
+  }
+
   // make sure static memory is initialized
   struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_mipmap_cache_static_dead_image;
   dead_image_f((dt_mipmap_buffer_t *)(dsc + 1));
 
   // adjust numbers to be large enough to hold what mem limit suggests.
   // we want at least 100MB, and consider 8G just still reasonable.
+  // the thumbnails must not take more than a quarter of the global memory budget.
   const int64_t cache_memory = dt_conf_get_int64("cache_memory");
   const int worker_threads = dt_conf_get_int("worker_threads");
-  const size_t max_mem = CLAMPS(cache_memory, 100u << 20, ((size_t)8) << 30);
+  const size_t max_mem
+      = dt_memory_governor_clamp(CLAMPS(cache_memory, 100u << 20, ((size_t)8) << 30), 0.25f);
   const uint32_t parallel = CLAMP(worker_threads, 1, 8);
 
   // Fixed sizes for the thumbnail mip levels, selected for coverage of most screen sizes
@@ -582,6 +708,7 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_misses = 0;
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
+  memset(cache->stats, 0, sizeof(cache->stats));
 
   dt_cache_init(&cache->mip_thumbs.cache, 0, max_mem);
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
@@ -604,13 +731,44 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->buffer_size[DT_MIPMAP_F] = sizeof(struct dt_mipmap_buffer_dsc)
                                         + 4 * sizeof(float) * cache->max_width[DT_MIPMAP_F]
                                           * cache->max_height[DT_MIPMAP_F];
+
+  dt_memory_governor_register_cache("mipmap thumbs", &cache->mip_thumbs.cache, TRUE);
+  dt_memory_governor_register_cache("mipmap full", &cache->mip_full.cache, FALSE);
+  dt_memory_governor_register_cache("mipmap f", &cache->mip_f.cache, FALSE);
+
+  dt_cache_stats_register_cache("mipmap thumbs", &cache->mip_thumbs.cache, TRUE);
+  dt_cache_stats_register_cache("mipmap full", &cache->mip_full.cache, FALSE);
+  dt_cache_stats_register_cache("mipmap f", &cache->mip_f.cache, FALSE);
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++)
+  {
+    gchar *name = k == DT_MIPMAP_F ? g_strdup("mip f")
+                                   : (k == DT_MIPMAP_FULL ? g_strdup("mip full") : g_strdup_printf("mip %d", k));
+    dt_cache_stats_register(name, _stats_level_fill, &cache->stats[k]);
+    g_free(name);
+  }
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  dt_memory_governor_unregister(&cache->mip_thumbs.cache);
+  dt_memory_governor_unregister(&cache->mip_full.cache);
+  dt_memory_governor_unregister(&cache->mip_f.cache);
+  dt_cache_stats_unregister(&cache->mip_thumbs.cache);
+  dt_cache_stats_unregister(&cache->mip_full.cache);
+  dt_cache_stats_unregister(&cache->mip_f.cache);
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_NONE; k++) dt_cache_stats_unregister(&cache->stats[k]);
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+
+  // the evicted thumbnails are written by now, reclaim the space of removed ones if it's worth it
+  for(dt_mipmap_size_t k = DT_MIPMAP_0; k < DT_MIPMAP_F; k++)
+  {
+    if(!cache->pack[k]) continue;
+    if(dt_mipmap_pack_garbage(cache->pack[k]) > 0.5f) dt_mipmap_pack_compact(cache->pack[k]);
+    dt_mipmap_pack_close(cache->pack[k]);
+    cache->pack[k] = NULL;
+  }
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -697,6 +855,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->cache_entry = entry;
     if(entry)
     {
+      __atomic_fetch_add(&cache->stats[mip].hits, 1, __ATOMIC_RELAXED);
       ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
       struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
       buf->width = dsc->width;
@@ -735,10 +894,8 @@ void dt_mipmap_cache_get_with_caller(
     if(!cache->cachedir[0]) return;
     if(mip > DT_MIPMAP_FULL || (int)mip < DT_MIPMAP_0)
       return; // remove the (int) once we no longer have to support gcc < 4.8 :/
-    char filename[PATH_MAX] = {0};
-    snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
     // don't attempt to load if disk cache doesn't exist
-    if(!g_file_test(filename, G_FILE_TEST_EXISTS)) return;
+    if(!dt_mipmap_cache_ondisk_exists(cache, imgid, mip)) return;
     dt_control_add_job(darktable.control, DT_JOB_QUEUE_SYSTEM_FG, dt_image_load_job_create(imgid, mip));
   }
   else if(flags == DT_MIPMAP_BLOCKING)
@@ -752,6 +909,7 @@ void dt_mipmap_cache_get_with_caller(
     buf->cache_entry = entry;
 
     int mipmap_generated = 0;
+    const double generate_start = dt_get_wtime();
     if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
     {
       mipmap_generated = 1;
@@ -823,7 +981,11 @@ void dt_mipmap_cache_get_with_caller(
       }
       dsc->color_space = buf->color_space;
       dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      __atomic_fetch_add(&cache->stats[mip].misses, 1, __ATOMIC_RELAXED);
+      dt_cache_stats_latency(&cache->stats[mip], dt_get_wtime() - generate_start);
     }
+    else
+      __atomic_fetch_add(&cache->stats[mip].hits, 1, __ATOMIC_RELAXED);
 
     // image cache is leaving the write lock in place in case the image has been newly allocated.
     // this leads to a slight increase in thread contention, so we opt for dropping the write lock
@@ -918,13 +1080,8 @@ void dt_mipmap_cache_get_with_caller(
     __sync_fetch_and_add(&(_get_cache(cache, mip)->stats_misses), 1);
     // in case we don't even have a disk cache for our requested thumbnail,
     // prefetch at least mip0, in case we have that in the disk caches:
-    if(cache->cachedir[0])
-    {
-      char filename[PATH_MAX] = {0};
-      snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, key);
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
-        dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
-    }
+    if(dt_mipmap_cache_ondisk_exists(cache, imgid, mip))
+      dt_mipmap_cache_get(cache, 0, imgid, DT_MIPMAP_0, DT_MIPMAP_PREFETCH_DISK, 0);
     // nothing found :(
     buf->buf = NULL;
     buf->imgid = 0;
@@ -935,6 +1092,17 @@ void dt_mipmap_cache_get_with_caller(
   }
 }
 
+gboolean dt_mipmap_cache_ondisk_exists(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip)
+{
+  if(!cache->cachedir[0] || mip >= DT_MIPMAP_F) return FALSE;
+  // just an index lookup for the packed backend, unless it's still a loose file
+  if(cache->pack[mip] && dt_mipmap_pack_contains(cache->pack[mip], imgid)) return TRUE;
+  char filename[PATH_MAX] = {0};
+  snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
+  return g_file_test(filename, G_FILE_TEST_EXISTS);
+}
+
 void dt_mipmap_cache_write_get_with_caller(dt_mipmap_cache_t *cache, dt_mipmap_buffer_t *buf, const uint32_t imgid, const int mip, const char *file, int line)
 {
   dt_mipmap_cache_get_with_caller(cache, buf, imgid, mip, DT_MIPMAP_BLOCKING, 'w', file, line);
@@ -1012,6 +1180,52 @@ void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid)
   }
 }
 
+void dt_mipmap_cache_generate_pyramid(dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                      const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip)
+{
+  if(max_mip >= DT_MIPMAP_F || min_mip > max_mip) return;
+
+  // the largest one goes the usual way: disk cache, embedded thumbnail or pixelpipe
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_get(cache, &buf, imgid, max_mip, DT_MIPMAP_BLOCKING, 'r');
+  dt_cache_entry_t *src = buf.cache_entry;
+  struct dt_mipmap_buffer_dsc *src_dsc = (struct dt_mipmap_buffer_dsc *)src->data;
+  // no use in downsampling the dead image
+  const gboolean dead = !buf.buf || buf.width <= 8 || buf.height <= 8;
+
+  for(int k = (int)max_mip - 1; k >= (int)min_mip && !dead; k--)
+  {
+    // keep the larger one locked, we downsample from it. taking the write lock doesn't run _init_8(),
+    // the alloc callback only tries the disk.
+    dt_cache_entry_t *entry = dt_cache_get(&_get_cache(cache, k)->cache, get_key(imgid, k), 'w');
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, dt_mipmap_buffer_dsc_size);
+    struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)entry->data;
+    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    {
+      const double generate_start = dt_get_wtime();
+      ASAN_UNPOISON_MEMORY_REGION(dsc + 1, dsc->size - sizeof(struct dt_mipmap_buffer_dsc));
+      dt_print(DT_DEBUG_CACHE, "[mipmap_cache] generate mip %d for image %" PRIu32 " from level %d\n", k, imgid,
+               k + 1);
+      dt_iop_flip_and_zoom_8((uint8_t *)(src_dsc + 1), src_dsc->width, src_dsc->height, (uint8_t *)(dsc + 1),
+                             cache->max_width[k], cache->max_height[k], ORIENTATION_NONE, &dsc->width,
+                             &dsc->height);
+      dsc->iscale = 1.0f;
+      dsc->color_space = src_dsc->color_space;
+      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+      g_idle_add(_raise_signal_mipmap_updated, GINT_TO_POINTER(imgid));
+      __atomic_fetch_add(&cache->stats[k].misses, 1, __ATOMIC_RELAXED);
+      dt_cache_stats_latency(&cache->stats[k], dt_get_wtime() - generate_start);
+    }
+    else
+      __atomic_fetch_add(&cache->stats[k].hits, 1, __ATOMIC_RELAXED);
+    dt_cache_release(&_get_cache(cache, k + 1)->cache, src);
+    src = entry;
+    src_dsc = dsc;
+  }
+
+  dt_cache_release(&_get_cache(cache, dead ? max_mip : min_mip)->cache, src);
+}
+
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *out, uint32_t *width, uint32_t *height, float *iscale,
                     const uint32_t imgid)
 {
@@ -1298,6 +1512,21 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
+      dt_mipmap_pack_t *pack = cache->pack[mip];
+      if(pack)
+      {
+        size_t len = 0;
+        uint32_t color_space = DT_COLORSPACE_NONE;
+        const uint8_t *blob = dt_mipmap_pack_read_get(pack, src_imgid, &len, &color_space);
+        if(!blob) continue;
+        // the blob must not be appended to the pack it still points into
+        uint8_t *copy = g_memdup(blob, len);
+        dt_mipmap_pack_read_release(pack);
+        dt_mipmap_pack_write(pack, dst_imgid, copy, len, color_space);
+        g_free(copy);
+        continue;
+      }
+
       // try and load from disk, if successful set flag
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
@@ -99,6 +99,11 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // packed disk backend per thumbnail level, NULL when thumbnails are stored as single files
+  struct dt_mipmap_pack_t *pack[DT_MIPMAP_F];
+  // per level: hits are served from memory or the disk cache, misses had to be generated
+  // from the image, the latency histogram is the one of this generation.
+  dt_cache_stats_t stats[DT_MIPMAP_NONE];
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -146,6 +151,16 @@ void dt_mipmap_cache_remove(dt_mipmap_cache_t *cache, const uint32_t imgid);
 void dt_mimap_cache_evict(dt_mipmap_cache_t *cache, const uint32_t imgid);
 void dt_mipmap_cache_evict_at_size(dt_mipmap_cache_t *cache, const uint32_t imgid, dt_mipmap_size_t mip);
 
+// get the thumbnails of all sizes from min_mip to max_mip into the cache, processing the image only once
+// for max_mip. every smaller size is downsampled from the next larger one. sizes already in memory or on
+// disk are loaded instead, and still serve as source for the smaller ones.
+void dt_mipmap_cache_generate_pyramid(dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                      const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip);
+
+// check whether the disk backend has a thumbnail of this size, without loading it
+gboolean dt_mipmap_cache_ondisk_exists(const dt_mipmap_cache_t *cache, const uint32_t imgid,
+                                       const dt_mipmap_size_t mip);
+
 // return the closest mipmap size
 // for the given window you wish to draw.
 // a dt_mipmap_size_t has always a fixed resolution associated with it,
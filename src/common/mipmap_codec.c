@@ -0,0 +1,239 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_codec.h"
+#include "common/darktable.h"
+#include "common/imageio_jpeg.h"
+#include "control/conf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_WEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+#define DT_MIPMAP_CODEC_MAGIC 0x434d5444u // "DTMC"
+
+// in front of everything but jpeg
+typedef struct dt_mipmap_codec_header_t
+{
+  uint32_t magic;
+  uint8_t codec;
+  uint8_t color_space;
+  uint16_t reserved;
+  uint32_t width, height;
+} dt_mipmap_codec_header_t;
+
+static const char *_codec_names[DT_MIPMAP_CODEC_NONE]
+    = { "jpeg", "uncompressed", "lz4", "webp lossless", "webp" };
+
+const char *dt_mipmap_codec_name(const dt_mipmap_codec_t codec)
+{
+  return codec < DT_MIPMAP_CODEC_NONE ? _codec_names[codec] : "none";
+}
+
+gboolean dt_mipmap_codec_available(const dt_mipmap_codec_t codec)
+{
+  switch(codec)
+  {
+    case DT_MIPMAP_CODEC_JPEG:
+    case DT_MIPMAP_CODEC_UNCOMPRESSED:
+      return TRUE;
+    case DT_MIPMAP_CODEC_LZ4:
+#ifdef HAVE_LZ4
+      return TRUE;
+#else
+      return FALSE;
+#endif
+    case DT_MIPMAP_CODEC_WEBP_LOSSLESS:
+    case DT_MIPMAP_CODEC_WEBP:
+#ifdef HAVE_WEBP
+      return TRUE;
+#else
+      return FALSE;
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+dt_mipmap_codec_t dt_mipmap_codec_get_default(void)
+{
+  dt_mipmap_codec_t codec = DT_MIPMAP_CODEC_JPEG;
+  gchar *name = dt_conf_get_string("cache_disk_codec");
+  for(int k = 0; k < DT_MIPMAP_CODEC_NONE; k++)
+    if(!g_strcmp0(name, _codec_names[k])) codec = k;
+  g_free(name);
+  return dt_mipmap_codec_available(codec) ? codec : DT_MIPMAP_CODEC_JPEG;
+}
+
+#ifdef HAVE_WEBP
+// thumbnails don't carry alpha, and lossless webp would spend bits on it
+static uint8_t *_rgba_to_rgb(const uint8_t *in, const uint32_t width, const uint32_t height)
+{
+  uint8_t *rgb = (uint8_t *)dt_alloc_align(64, (size_t)3 * width * height);
+  if(!rgb) return NULL;
+  for(size_t k = 0; k < (size_t)width * height; k++)
+  {
+    rgb[3 * k + 0] = in[4 * k + 0];
+    rgb[3 * k + 1] = in[4 * k + 1];
+    rgb[3 * k + 2] = in[4 * k + 2];
+  }
+  return rgb;
+}
+#endif
+
+uint8_t *dt_mipmap_codec_encode(const dt_mipmap_codec_t codec, const uint8_t *in, const uint32_t width,
+                                const uint32_t height, const int quality,
+                                const dt_colorspaces_color_profile_type_t color_space, size_t *length)
+{
+  const size_t size = (size_t)4 * width * height;
+  const dt_mipmap_codec_header_t header = { DT_MIPMAP_CODEC_MAGIC, codec, color_space, 0, width, height };
+  uint8_t *blob = NULL;
+  *length = 0;
+
+  switch(codec)
+  {
+    case DT_MIPMAP_CODEC_JPEG:
+    {
+      blob = (uint8_t *)dt_alloc_align(64, size);
+      if(!blob) return NULL;
+      const int len = dt_imageio_jpeg_compress(in, blob, width, height, quality);
+      if(len <= 1) goto error;
+      *length = len;
+      return blob;
+    }
+    case DT_MIPMAP_CODEC_UNCOMPRESSED:
+    {
+      blob = (uint8_t *)dt_alloc_align(64, sizeof(header) + size);
+      if(!blob) return NULL;
+      memcpy(blob + sizeof(header), in, size);
+      *length = sizeof(header) + size;
+      break;
+    }
+#ifdef HAVE_LZ4
+    case DT_MIPMAP_CODEC_LZ4:
+    {
+      const int bound = LZ4_compressBound(size);
+      blob = (uint8_t *)dt_alloc_align(64, sizeof(header) + bound);
+      if(!blob) return NULL;
+      const int len = LZ4_compress_default((const char *)in, (char *)blob + sizeof(header), size, bound);
+      if(len <= 0) goto error;
+      *length = sizeof(header) + len;
+      break;
+    }
+#endif
+#ifdef HAVE_WEBP
+    case DT_MIPMAP_CODEC_WEBP_LOSSLESS:
+    case DT_MIPMAP_CODEC_WEBP:
+    {
+      uint8_t *rgb = _rgba_to_rgb(in, width, height);
+      if(!rgb) return NULL;
+      uint8_t *webp = NULL;
+      const size_t len = codec == DT_MIPMAP_CODEC_WEBP
+                             ? WebPEncodeRGB(rgb, width, height, 3 * width, quality, &webp)
+                             : WebPEncodeLosslessRGB(rgb, width, height, 3 * width, &webp);
+      dt_free_align(rgb);
+      if(len) blob = (uint8_t *)dt_alloc_align(64, sizeof(header) + len);
+      if(blob) memcpy(blob + sizeof(header), webp, len);
+      free(webp);
+      if(!blob) return NULL;
+      *length = sizeof(header) + len;
+      break;
+    }
+#endif
+    default:
+      return NULL;
+  }
+
+  memcpy(blob, &header, sizeof(header));
+  return blob;
+
+error:
+  dt_free_align(blob);
+  *length = 0;
+  return NULL;
+}
+
+int dt_mipmap_codec_decode(const uint8_t *blob, const size_t length, uint8_t *out, const uint32_t max_width,
+                           const uint32_t max_height, uint32_t *width, uint32_t *height,
+                           dt_colorspaces_color_profile_type_t *color_space)
+{
+  dt_mipmap_codec_header_t header;
+  if(length < sizeof(header)) return 1;
+  memcpy(&header, blob, sizeof(header));
+
+  if(header.magic != DT_MIPMAP_CODEC_MAGIC)
+  {
+    // no header, this is a plain jpeg
+    dt_imageio_jpeg_t jpg;
+    if(dt_imageio_jpeg_decompress_header(blob, length, &jpg) || jpg.width > max_width
+       || jpg.height > max_height)
+      return 1;
+    *color_space = dt_imageio_jpeg_read_color_space(&jpg);
+    if(dt_imageio_jpeg_decompress(&jpg, out)) return 1;
+    *width = jpg.width;
+    *height = jpg.height;
+    return 0;
+  }
+
+  if(header.width > max_width || header.height > max_height) return 1;
+  const uint8_t *payload = blob + sizeof(header);
+  const size_t payload_length = length - sizeof(header);
+  const size_t size = (size_t)4 * header.width * header.height;
+
+  switch(header.codec)
+  {
+    case DT_MIPMAP_CODEC_UNCOMPRESSED:
+      if(payload_length != size) return 1;
+      memcpy(out, payload, size);
+      break;
+#ifdef HAVE_LZ4
+    case DT_MIPMAP_CODEC_LZ4:
+      if(LZ4_decompress_safe((const char *)payload, (char *)out, payload_length, size) != (int)size) return 1;
+      break;
+#endif
+#ifdef HAVE_WEBP
+    case DT_MIPMAP_CODEC_WEBP_LOSSLESS:
+    case DT_MIPMAP_CODEC_WEBP:
+    {
+      int w = 0, h = 0;
+      if(!WebPGetInfo(payload, payload_length, &w, &h) || w != header.width || h != header.height) return 1;
+      if(!WebPDecodeRGBAInto(payload, payload_length, out, size, 4 * w)) return 1;
+      break;
+    }
+#endif
+    default:
+      // written by a build with more codecs
+      return 1;
+  }
+
+  *width = header.width;
+  *height = header.height;
+  *color_space = header.color_space;
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "common/colorspaces.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+// how the disk backend of the mipmap cache stores 8-bit thumbnails. jpeg is stored as plain jpeg, all
+// others get a small header, so every blob says how to decode it and caches with mixed codecs keep working.
+typedef enum dt_mipmap_codec_t
+{
+  DT_MIPMAP_CODEC_JPEG = 0,
+  DT_MIPMAP_CODEC_UNCOMPRESSED,  // raw rgba
+  DT_MIPMAP_CODEC_LZ4,           // raw rgba, lz4 compressed
+  DT_MIPMAP_CODEC_WEBP_LOSSLESS,
+  DT_MIPMAP_CODEC_WEBP,
+  DT_MIPMAP_CODEC_NONE
+} dt_mipmap_codec_t;
+
+/** name as used by the cache_disk_codec config option. */
+const char *dt_mipmap_codec_name(const dt_mipmap_codec_t codec);
+/** whether this build can encode and decode the codec. */
+gboolean dt_mipmap_codec_available(const dt_mipmap_codec_t codec);
+/** the codec picked in the config, jpeg if that one isn't available. */
+dt_mipmap_codec_t dt_mipmap_codec_get_default(void);
+
+/** compress an 8-bit rgba thumbnail. returns a blob to be freed with dt_free_align(), NULL on failure.
+ * quality is only used by the lossy codecs. */
+uint8_t *dt_mipmap_codec_encode(const dt_mipmap_codec_t codec, const uint8_t *in, const uint32_t width,
+                                const uint32_t height, const int quality,
+                                const dt_colorspaces_color_profile_type_t color_space, size_t *length);
+/** decode a blob written by any codec into out, which takes max_width x max_height rgba pixels.
+ * returns 0 on success. */
+int dt_mipmap_codec_decode(const uint8_t *blob, const size_t length, uint8_t *out, const uint32_t max_width,
+                           const uint32_t max_height, uint32_t *width, uint32_t *height,
+                           dt_colorspaces_color_profile_type_t *color_space);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
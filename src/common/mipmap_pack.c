@@ -0,0 +1,486 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(_WIN32)
+
+#include <sys/mman.h>
+
+#define DT_MIPMAP_PACK_MAGIC 0x4b505444u       // "DTPK"
+#define DT_MIPMAP_PACK_INDEX_MAGIC 0x49505444u // "DTPI"
+#define DT_MIPMAP_PACK_VERSION 1
+// the index grows in steps of this many image ids
+#define DT_MIPMAP_PACK_INDEX_STEP 65536
+
+typedef struct dt_mipmap_pack_header_t
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t generation; // bumped by every compaction, records pointing into older packs are stale
+  uint32_t reserved;
+} dt_mipmap_pack_header_t;
+
+typedef struct dt_mipmap_pack_record_t
+{
+  uint64_t offset;     // of the blob in the pack, 0 if there is none
+  uint32_t length;
+  uint32_t generation; // of the pack the blob got written to
+  uint32_t hash;       // of the blob, catches blobs torn by a crash
+  uint32_t tag;        // opaque to the pack
+} dt_mipmap_pack_record_t;
+
+struct dt_mipmap_pack_t
+{
+  char *base;
+  int data_fd, index_fd;
+
+  // readers hold this shared, remapping and changing records needs it exclusively
+  dt_pthread_rwlock_t lock;
+  // serializes writers, so the appends don't need the exclusive lock
+  dt_pthread_mutex_t append;
+
+  uint8_t *data;      // the mapped pack
+  size_t data_mapped;
+  uint64_t data_size; // where the next blob goes
+  uint32_t generation;
+
+  dt_mipmap_pack_header_t *index; // the mapped index, the records follow the header
+  uint32_t capacity;              // number of records in the index
+  uint64_t garbage;               // bytes in the pack no record points to
+};
+
+// FNV-1a, cheap compared to decoding the thumbnail
+static uint32_t _hash(const uint8_t *blob, const size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t k = 0; k < length; k++) hash = (hash ^ blob[k]) * 16777619u;
+  return hash;
+}
+
+static inline dt_mipmap_pack_record_t *_record(const dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  if(imgid >= pack->capacity) return NULL;
+  return (dt_mipmap_pack_record_t *)(pack->index + 1) + imgid;
+}
+
+static inline gboolean _record_valid(const dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *rec)
+{
+  return rec && rec->offset && rec->length && rec->generation == pack->generation
+         && rec->offset + rec->length <= pack->data_size;
+}
+
+static int _map_data(dt_mipmap_pack_t *pack)
+{
+  if(pack->data) munmap(pack->data, pack->data_mapped);
+  pack->data = NULL;
+  pack->data_mapped = 0;
+
+  void *data = mmap(NULL, pack->data_size, PROT_READ, MAP_SHARED, pack->data_fd, 0);
+  if(data == MAP_FAILED)
+  {
+    fprintf(stderr, "[mipmap_pack] failed to map `%s.pack': %s\n", pack->base, strerror(errno));
+    return 1;
+  }
+  pack->data = data;
+  pack->data_mapped = pack->data_size;
+  return 0;
+}
+
+static int _map_index(dt_mipmap_pack_t *pack, const uint32_t capacity)
+{
+  const size_t size = sizeof(dt_mipmap_pack_header_t) + (size_t)capacity * sizeof(dt_mipmap_pack_record_t);
+  // new records read as zero, which means empty
+  if(ftruncate(pack->index_fd, size))
+  {
+    fprintf(stderr, "[mipmap_pack] failed to grow `%s.idx': %s\n", pack->base, strerror(errno));
+    return 1;
+  }
+
+  void *index = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pack->index_fd, 0);
+  if(index == MAP_FAILED)
+  {
+    fprintf(stderr, "[mipmap_pack] failed to map `%s.idx': %s\n", pack->base, strerror(errno));
+    return 1;
+  }
+
+  if(pack->index)
+    munmap(pack->index,
+           sizeof(dt_mipmap_pack_header_t) + (size_t)pack->capacity * sizeof(dt_mipmap_pack_record_t));
+  pack->index = index;
+  pack->capacity = capacity;
+  return 0;
+}
+
+static int _read_header(const int fd, const uint32_t magic, dt_mipmap_pack_header_t *header)
+{
+  return pread(fd, header, sizeof(*header), 0) != sizeof(*header) || header->magic != magic
+         || header->version != DT_MIPMAP_PACK_VERSION;
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *base)
+{
+  dt_mipmap_pack_t *pack = (dt_mipmap_pack_t *)calloc(1, sizeof(dt_mipmap_pack_t));
+  pack->base = g_strdup(base);
+  pack->data_fd = pack->index_fd = -1;
+  dt_pthread_rwlock_init(&pack->lock, NULL);
+  dt_pthread_mutex_init(&pack->append, NULL);
+
+  gchar *datafile = g_strdup_printf("%s.pack", base);
+  gchar *indexfile = g_strdup_printf("%s.idx", base);
+  pack->data_fd = g_open(datafile, O_RDWR | O_CREAT, 0640);
+  pack->index_fd = g_open(indexfile, O_RDWR | O_CREAT, 0640);
+  g_free(datafile);
+  g_free(indexfile);
+  if(pack->data_fd < 0 || pack->index_fd < 0)
+  {
+    fprintf(stderr, "[mipmap_pack] failed to open `%s': %s\n", base, strerror(errno));
+    goto error;
+  }
+
+  struct stat st;
+  dt_mipmap_pack_header_t header;
+  gboolean reset = FALSE;
+  if(fstat(pack->data_fd, &st) || _read_header(pack->data_fd, DT_MIPMAP_PACK_MAGIC, &header))
+  {
+    // new or unusable pack, start over. the index has to go with it
+    header.magic = DT_MIPMAP_PACK_MAGIC;
+    header.version = DT_MIPMAP_PACK_VERSION;
+    header.generation = 1;
+    header.reserved = 0;
+    if(ftruncate(pack->data_fd, 0) || pwrite(pack->data_fd, &header, sizeof(header), 0) != sizeof(header))
+      goto error;
+    pack->data_size = sizeof(header);
+    reset = TRUE;
+  }
+  else
+    pack->data_size = st.st_size;
+  pack->generation = header.generation;
+
+  uint32_t capacity = 0;
+  if(reset || fstat(pack->index_fd, &st) || _read_header(pack->index_fd, DT_MIPMAP_PACK_INDEX_MAGIC, &header))
+  {
+    header.magic = DT_MIPMAP_PACK_INDEX_MAGIC;
+    header.version = DT_MIPMAP_PACK_VERSION;
+    header.generation = 0;
+    header.reserved = 0;
+    if(ftruncate(pack->index_fd, 0) || pwrite(pack->index_fd, &header, sizeof(header), 0) != sizeof(header))
+      goto error;
+  }
+  else
+    capacity = (st.st_size - sizeof(header)) / sizeof(dt_mipmap_pack_record_t);
+
+  if(_map_index(pack, MAX(capacity, DT_MIPMAP_PACK_INDEX_STEP)) || _map_data(pack)) goto error;
+
+  // everything the index doesn't point to is garbage, for example after a crash while writing
+  uint64_t live = 0;
+  for(uint32_t k = 0; k < pack->capacity; k++)
+  {
+    const dt_mipmap_pack_record_t *rec = _record(pack, k);
+    if(_record_valid(pack, rec)) live += rec->length;
+  }
+  pack->garbage = pack->data_size - sizeof(dt_mipmap_pack_header_t) - live;
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] opened `%s', %" PRIu64 " bytes, %" PRIu64 " of them garbage\n", base,
+           pack->data_size, pack->garbage);
+  return pack;
+
+error:
+  dt_mipmap_pack_close(pack);
+  return NULL;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  if(pack->index)
+  {
+    const size_t size
+        = sizeof(dt_mipmap_pack_header_t) + (size_t)pack->capacity * sizeof(dt_mipmap_pack_record_t);
+    msync(pack->index, size, MS_SYNC);
+    munmap(pack->index, size);
+  }
+  if(pack->data) munmap(pack->data, pack->data_mapped);
+  if(pack->data_fd >= 0) close(pack->data_fd);
+  if(pack->index_fd >= 0) close(pack->index_fd);
+  dt_pthread_mutex_destroy(&pack->append);
+  dt_pthread_rwlock_destroy(&pack->lock);
+  g_free(pack->base);
+  free(pack);
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_rwlock_rdlock(&pack->lock);
+  const gboolean valid = _record_valid(pack, _record(pack, imgid));
+  dt_pthread_rwlock_unlock(&pack->lock);
+  return valid;
+}
+
+const uint8_t *dt_mipmap_pack_read_get(dt_mipmap_pack_t *pack, const uint32_t imgid, size_t *length,
+                                       uint32_t *tag)
+{
+  dt_pthread_rwlock_rdlock(&pack->lock);
+  const dt_mipmap_pack_record_t *rec = _record(pack, imgid);
+  if(!_record_valid(pack, rec)) goto missing;
+
+  if(rec->offset + rec->length > pack->data_mapped)
+  {
+    // the pack grew since we mapped it
+    dt_pthread_rwlock_unlock(&pack->lock);
+    dt_pthread_rwlock_wrlock(&pack->lock);
+    if(pack->data_mapped < pack->data_size) _map_data(pack);
+    dt_pthread_rwlock_unlock(&pack->lock);
+    dt_pthread_rwlock_rdlock(&pack->lock);
+
+    rec = _record(pack, imgid);
+    if(!_record_valid(pack, rec) || rec->offset + rec->length > pack->data_mapped) goto missing;
+  }
+
+  const uint8_t *blob = pack->data + rec->offset;
+  if(_hash(blob, rec->length) != rec->hash)
+  {
+    dt_pthread_rwlock_unlock(&pack->lock);
+    fprintf(stderr, "[mipmap_pack] thumbnail for image %" PRIu32 " in `%s.pack' is broken\n", imgid, pack->base);
+    dt_mipmap_pack_remove(pack, imgid);
+    return NULL;
+  }
+
+  *length = rec->length;
+  if(tag) *tag = rec->tag;
+  return blob;
+
+missing:
+  dt_pthread_rwlock_unlock(&pack->lock);
+  return NULL;
+}
+
+void dt_mipmap_pack_read_release(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_rwlock_unlock(&pack->lock);
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *blob, const size_t length,
+                         const uint32_t tag)
+{
+  if(!length || length > UINT32_MAX) return 1;
+
+  dt_pthread_mutex_lock(&pack->append);
+
+  if(imgid >= pack->capacity)
+  {
+    const uint32_t capacity = (imgid / DT_MIPMAP_PACK_INDEX_STEP + 1) * DT_MIPMAP_PACK_INDEX_STEP;
+    dt_pthread_rwlock_wrlock(&pack->lock);
+    const int err = _map_index(pack, capacity);
+    dt_pthread_rwlock_unlock(&pack->lock);
+    if(err)
+    {
+      dt_pthread_mutex_unlock(&pack->append);
+      return 1;
+    }
+  }
+
+  // nobody looks past data_size, so the blob can be appended without blocking the readers
+  const uint64_t offset = pack->data_size;
+  if(pwrite(pack->data_fd, blob, length, offset) != (ssize_t)length)
+  {
+    fprintf(stderr, "[mipmap_pack] failed to write to `%s.pack': %s\n", pack->base, strerror(errno));
+    // don't leave a partial blob around
+    if(ftruncate(pack->data_fd, offset)) {}
+    dt_pthread_mutex_unlock(&pack->append);
+    return 1;
+  }
+
+  const uint32_t hash = _hash(blob, length);
+
+  dt_pthread_rwlock_wrlock(&pack->lock);
+  dt_mipmap_pack_record_t *rec = _record(pack, imgid);
+  if(_record_valid(pack, rec)) pack->garbage += rec->length;
+  rec->offset = offset;
+  rec->length = length;
+  rec->generation = pack->generation;
+  rec->hash = hash;
+  rec->tag = tag;
+  pack->data_size = offset + length;
+  dt_pthread_rwlock_unlock(&pack->lock);
+
+  dt_pthread_mutex_unlock(&pack->append);
+  return 0;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  dt_pthread_rwlock_wrlock(&pack->lock);
+  dt_mipmap_pack_record_t *rec = _record(pack, imgid);
+  if(rec)
+  {
+    if(_record_valid(pack, rec)) pack->garbage += rec->length;
+    memset(rec, 0, sizeof(*rec));
+  }
+  dt_pthread_rwlock_unlock(&pack->lock);
+}
+
+float dt_mipmap_pack_garbage(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_rwlock_rdlock(&pack->lock);
+  const uint64_t payload = pack->data_size - sizeof(dt_mipmap_pack_header_t);
+  const float garbage = payload ? (float)pack->garbage / payload : 0.0f;
+  dt_pthread_rwlock_unlock(&pack->lock);
+  return garbage;
+}
+
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack)
+{
+  dt_pthread_mutex_lock(&pack->append);
+  dt_pthread_rwlock_wrlock(&pack->lock);
+
+  const double start = dt_get_wtime();
+  const uint64_t old_size = pack->data_size;
+  gchar *datafile = g_strdup_printf("%s.pack", pack->base);
+  gchar *tmpfile = g_strdup_printf("%s.pack.tmp", pack->base);
+  uint64_t *offsets = (uint64_t *)calloc(pack->capacity, sizeof(uint64_t));
+
+  // write the live thumbnails to a new pack of the next generation. the index is only updated once that
+  // replaced the old pack, a crash in between just makes the records stale.
+  const int fd = g_open(tmpfile, O_RDWR | O_CREAT | O_TRUNC, 0640);
+  if(fd < 0 || (pack->data_mapped < pack->data_size && _map_data(pack))) goto error;
+
+  const dt_mipmap_pack_header_t header
+      = { DT_MIPMAP_PACK_MAGIC, DT_MIPMAP_PACK_VERSION, pack->generation + 1, 0 };
+  if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) goto error;
+
+  uint64_t pos = sizeof(header);
+  for(uint32_t k = 0; k < pack->capacity; k++)
+  {
+    const dt_mipmap_pack_record_t *rec = _record(pack, k);
+    if(!_record_valid(pack, rec)) continue;
+    if(pwrite(fd, pack->data + rec->offset, rec->length, pos) != (ssize_t)rec->length) goto error;
+    offsets[k] = pos;
+    pos += rec->length;
+  }
+
+  if(fsync(fd) || g_rename(tmpfile, datafile)) goto error;
+
+  close(pack->data_fd);
+  pack->data_fd = fd;
+  pack->generation = header.generation;
+  pack->data_size = pos;
+  pack->garbage = 0;
+  for(uint32_t k = 0; k < pack->capacity; k++)
+  {
+    dt_mipmap_pack_record_t *rec = _record(pack, k);
+    if(offsets[k])
+    {
+      rec->offset = offsets[k];
+      rec->generation = pack->generation;
+    }
+    else
+      memset(rec, 0, sizeof(*rec));
+  }
+  msync(pack->index, sizeof(dt_mipmap_pack_header_t) + (size_t)pack->capacity * sizeof(dt_mipmap_pack_record_t),
+        MS_SYNC);
+  _map_data(pack);
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_pack] compacted `%s' from %" PRIu64 " to %" PRIu64 " bytes in %.3f secs\n",
+           pack->base, old_size, pos, dt_get_wtime() - start);
+
+  free(offsets);
+  g_free(tmpfile);
+  g_free(datafile);
+  dt_pthread_rwlock_unlock(&pack->lock);
+  dt_pthread_mutex_unlock(&pack->append);
+  return 0;
+
+error:
+  fprintf(stderr, "[mipmap_pack] failed to compact `%s': %s\n", datafile, strerror(errno));
+  if(fd >= 0)
+  {
+    close(fd);
+    g_unlink(tmpfile);
+  }
+  free(offsets);
+  g_free(tmpfile);
+  g_free(datafile);
+  dt_pthread_rwlock_unlock(&pack->lock);
+  dt_pthread_mutex_unlock(&pack->append);
+  return 1;
+}
+
+#else // _WIN32
+
+// no mmap here, the mipmap cache keeps using one file per thumbnail
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *base)
+{
+  return NULL;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+  return FALSE;
+}
+
+const uint8_t *dt_mipmap_pack_read_get(dt_mipmap_pack_t *pack, const uint32_t imgid, size_t *length,
+                                       uint32_t *tag)
+{
+  return NULL;
+}
+
+void dt_mipmap_pack_read_release(dt_mipmap_pack_t *pack)
+{
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *blob, const size_t length,
+                         const uint32_t tag)
+{
+  return 1;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid)
+{
+}
+
+float dt_mipmap_pack_garbage(dt_mipmap_pack_t *pack)
+{
+  return 0.0f;
+}
+
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack)
+{
+  return 1;
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
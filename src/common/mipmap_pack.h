@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * packed disk backend for the thumbnails of one mip level. instead of one file per image, the
+ * compressed thumbnails get appended to <base>.pack, and <base>.idx holds one record per image id
+ * pointing into it. both files are memory mapped, so looking up and reading a thumbnail doesn't
+ * need any syscall. removed or replaced thumbnails leave holes in the pack, dt_mipmap_pack_compact()
+ * rewrites it without them.
+ */
+typedef struct dt_mipmap_pack_t dt_mipmap_pack_t;
+
+/** open or create the pack files <base>.pack and <base>.idx, NULL if that's not possible. */
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *base);
+/** unmap and close, the index is synced to disk. */
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+/** check for a thumbnail of imgid, this only looks at the mapped index. */
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const uint32_t imgid);
+/** get the stored blob of imgid and the tag it got written with. the blob points into the mapped pack
+ * and stays valid until dt_mipmap_pack_read_release(), which has to be called if this didn't return NULL. */
+const uint8_t *dt_mipmap_pack_read_get(dt_mipmap_pack_t *pack, const uint32_t imgid, size_t *length,
+                                       uint32_t *tag);
+void dt_mipmap_pack_read_release(dt_mipmap_pack_t *pack);
+/** append the blob for imgid, replacing any previous one. returns 0 on success. */
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const uint32_t imgid, const uint8_t *blob, const size_t length,
+                         const uint32_t tag);
+/** forget the thumbnail of imgid, the space is reclaimed by the next compaction. */
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const uint32_t imgid);
+
+/** fraction of the pack taken up by removed or replaced thumbnails. */
+float dt_mipmap_pack_garbage(dt_mipmap_pack_t *pack);
+/** rewrite the pack with only the live thumbnails. returns 0 on success. */
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
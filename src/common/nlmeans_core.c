@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/opencl.h"
+#include "common/scratch.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -122,7 +123,7 @@ define_patches(const dt_nlmeans_param_t *const params, const int stride, int *nu
     n_patches = (n_patches + 1) / 2;
   *num_patches = n_patches ;
   // allocate a cacheline-aligned buffer
-  struct patch_t* patches = dt_alloc_align(64,n_patches*sizeof(struct patch_t));
+  struct patch_t* patches = dt_scratch_alloc(n_patches*sizeof(struct patch_t));
   // set up the patch offsets
   int patch_num = 0;
   int shift = 0;
@@ -405,7 +406,7 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
 #endif /* CACHE_PIXDIFFS */
   const int padded_scratch_size = 16*((scratch_size+15)/16); // round up to a full cache line
   const int numthreads = dt_get_num_threads() ;
-  float *scratch_buf = dt_alloc_align(64,numthreads * padded_scratch_size * sizeof(float));
+  float *scratch_buf = dt_scratch_alloc_float(numthreads * padded_scratch_size);
   const int chk_height = compute_slice_height(roi_out->height);
   const int chk_width = compute_slice_width(roi_out->width);
 #ifdef _OPENMP
@@ -597,8 +598,8 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
   }
 
   // clean up: free the work space
-  dt_free_align(patches);
-  dt_free_align(scratch_buf);
+  dt_scratch_free(patches);
+  dt_scratch_free(scratch_buf);
   return;
 }
 
@@ -631,7 +632,7 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
 #endif /* CACHE_PIXDIFFS_SSE */
   const int padded_scratch_size = 16*((scratch_size+15)/16); // round up to a full cache line
   const int numthreads = dt_get_num_threads() ;
-  float *scratch_buf = dt_alloc_align(64,numthreads * padded_scratch_size * sizeof(float));
+  float *scratch_buf = dt_scratch_alloc_float(numthreads * padded_scratch_size);
   const int chk_height = compute_slice_height(roi_out->height);
   const int chk_width = compute_slice_width(roi_out->width);
 #ifdef _OPENMP
@@ -816,8 +817,8 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
   }
 
   // clean up: free the work space
-  dt_free_align(patches);
-  dt_free_align(scratch_buf);
+  dt_scratch_free(patches);
+  dt_scratch_free(scratch_buf);
   return;
 }
 #endif /* __SSE2__ */
@@ -997,7 +998,7 @@ int nlmeans_denoise_cl(const dt_nlmeans_param_t *const params, const int devid,
 
 error:
   // clean up and return status
-  dt_free_align(patches);
+  dt_scratch_free(patches);
   for(int k = 0; k < NUM_BUCKETS; k++)
   {
     dt_opencl_release_mem_object(buckets[k]);
@@ -1093,7 +1094,7 @@ int nlmeans_denoiseprofile_cl(const dt_nlmeans_param_t *const params, const int
 
 error:
   // clean up and return status
-  dt_free_align(patches);
+  dt_scratch_free(patches);
   for(int k = 0; k < NUM_BUCKETS; k++)
   {
     dt_opencl_release_mem_object(buckets[k]);
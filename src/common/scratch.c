@@ -0,0 +1,292 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/scratch.h"
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "common/memory_governor.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define DT_SCRATCH_MAGIC 0x73637274u
+// every block starts with its header, this keeps the memory after it aligned
+#define DT_SCRATCH_HEADER 64
+// idle bytes an arena keeps at most, the memory budget may make it less
+#define DT_SCRATCH_RETAIN ((size_t)1 << 30)
+
+typedef struct dt_scratch_block_t
+{
+  uint32_t magic;
+  int in_use;
+  dt_scratch_t *arena; // NULL if it came from the heap and goes back there
+  size_t capacity;     // usable bytes after the header
+  uint64_t last_used;
+} dt_scratch_block_t;
+
+G_STATIC_ASSERT(sizeof(dt_scratch_block_t) <= DT_SCRATCH_HEADER);
+
+struct dt_scratch_t
+{
+  dt_pthread_mutex_t lock; // protects everything below
+  GPtrArray *blocks;
+  size_t retained;         // sum of the capacities, also read by the memory governor
+  size_t limit;            // idle bytes kept after a reset
+  uint64_t clock;
+  int shrink_request;      // set by the memory governor, honoured at the next reset
+  dt_cache_stats_t stats;  // hits are reused blocks, misses new ones, evictions trimmed ones
+};
+
+static __thread dt_scratch_t *_scratch_current = NULL;
+
+static dt_scratch_block_t *_block_new(dt_scratch_t *arena, const size_t capacity)
+{
+  dt_scratch_block_t *block = (dt_scratch_block_t *)dt_alloc_align(64, DT_SCRATCH_HEADER + capacity);
+  if(!block) return NULL;
+  block->magic = DT_SCRATCH_MAGIC;
+  block->in_use = FALSE;
+  block->arena = arena;
+  block->capacity = capacity;
+  block->last_used = 0;
+  return block;
+}
+
+static void _block_free(dt_scratch_block_t *block)
+{
+  block->magic = 0;
+  dt_free_align(block);
+}
+
+// at least 64k, above that in eighths of the power of two below the size. the same module at a
+// slightly different roi then finds the block it used last time.
+static size_t _round_size(const size_t size)
+{
+  const int bits = 63 - __builtin_clzll((unsigned long long)size | 1);
+  const size_t step = MAX((size_t)1 << 16, ((size_t)1 << bits) >> 3);
+  return (size + step - 1) / step * step;
+}
+
+// frees idle blocks, least recently used first, until at most limit bytes are retained.
+// called with the arena locked.
+static size_t _trim(dt_scratch_t *arena, const size_t limit)
+{
+  size_t freed = 0;
+  while(arena->retained > limit)
+  {
+    guint oldest = G_MAXUINT;
+    for(guint k = 0; k < arena->blocks->len; k++)
+    {
+      const dt_scratch_block_t *block = (dt_scratch_block_t *)g_ptr_array_index(arena->blocks, k);
+      if(!block->in_use
+         && (oldest == G_MAXUINT
+             || block->last_used < ((dt_scratch_block_t *)g_ptr_array_index(arena->blocks, oldest))->last_used))
+        oldest = k;
+    }
+    if(oldest == G_MAXUINT) break;
+
+    dt_scratch_block_t *block = (dt_scratch_block_t *)g_ptr_array_remove_index_fast(arena->blocks, oldest);
+    __atomic_sub_fetch(&arena->retained, block->capacity, __ATOMIC_RELAXED);
+    freed += block->capacity;
+    arena->stats.evictions++;
+    _block_free(block);
+  }
+  return freed;
+}
+
+static size_t _governor_usage(void *data)
+{
+  dt_scratch_t *arena = (dt_scratch_t *)data;
+  return __atomic_load_n(&arena->retained, __ATOMIC_RELAXED);
+}
+
+static size_t _governor_shrink(void *data, size_t bytes)
+{
+  dt_scratch_t *arena = (dt_scratch_t *)data;
+  // idle blocks can go right away, unless the pipe is busy in here. then it's done at the next reset.
+  if(dt_pthread_mutex_trylock(&arena->lock))
+  {
+    __atomic_store_n(&arena->shrink_request, 1, __ATOMIC_RELEASE);
+    return 0;
+  }
+  const size_t freed = _trim(arena, arena->retained > bytes ? arena->retained - bytes : 0);
+  dt_pthread_mutex_unlock(&arena->lock);
+  return freed;
+}
+
+static void _stats_fill(void *data, dt_cache_report_t *report)
+{
+  dt_scratch_t *arena = (dt_scratch_t *)data;
+  dt_pthread_mutex_lock(&arena->lock);
+  report->stats = arena->stats;
+  report->stats.resident = arena->retained;
+  report->entries = arena->blocks->len;
+  report->quota = arena->limit;
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+dt_scratch_t *dt_scratch_new(void)
+{
+  dt_scratch_t *arena = (dt_scratch_t *)g_malloc0(sizeof(dt_scratch_t));
+  dt_pthread_mutex_init(&arena->lock, NULL);
+  arena->blocks = g_ptr_array_new();
+  arena->limit = dt_memory_governor_clamp(DT_SCRATCH_RETAIN, 1.0f / 16.0f);
+  dt_memory_governor_register("pixelpipe scratch", _governor_usage, _governor_shrink, arena);
+  return arena;
+}
+
+void dt_scratch_register_stats(dt_scratch_t *arena, const char *name)
+{
+  if(!arena) return;
+  dt_cache_stats_unregister(arena);
+  dt_cache_stats_register(name, _stats_fill, arena);
+}
+
+void dt_scratch_destroy(dt_scratch_t *arena)
+{
+  if(!arena) return;
+  dt_cache_stats_unregister(arena);
+  dt_memory_governor_unregister(arena);
+  for(guint k = 0; k < arena->blocks->len; k++)
+  {
+    dt_scratch_block_t *block = (dt_scratch_block_t *)g_ptr_array_index(arena->blocks, k);
+    // a leaked block goes to the heap once it's freed
+    if(block->in_use)
+      block->arena = NULL;
+    else
+      _block_free(block);
+  }
+  g_ptr_array_free(arena->blocks, TRUE);
+  dt_pthread_mutex_destroy(&arena->lock);
+  g_free(arena);
+}
+
+dt_scratch_t *dt_scratch_begin(dt_scratch_t *arena)
+{
+  dt_scratch_t *previous = _scratch_current;
+  _scratch_current = arena;
+  return previous;
+}
+
+void dt_scratch_end(dt_scratch_t *previous)
+{
+  dt_scratch_t *arena = _scratch_current;
+  _scratch_current = previous;
+  if(!arena) return;
+
+  dt_pthread_mutex_lock(&arena->lock);
+  // blocks still in use might be written to later on, they stay out of reuse until they are freed
+  int leaked = 0;
+  size_t leaked_bytes = 0;
+  for(guint k = 0; k < arena->blocks->len; k++)
+  {
+    const dt_scratch_block_t *block = (dt_scratch_block_t *)g_ptr_array_index(arena->blocks, k);
+    if(block->in_use)
+    {
+      leaked++;
+      leaked_bytes += block->capacity;
+    }
+  }
+  const size_t limit = __atomic_exchange_n(&arena->shrink_request, 0, __ATOMIC_ACQ_REL) ? 0 : arena->limit;
+  _trim(arena, limit + leaked_bytes);
+  dt_pthread_mutex_unlock(&arena->lock);
+
+  if(leaked)
+    dt_print(DT_DEBUG_MEMORY, "[scratch] %d buffers (%zu bytes) the module didn't free are still in use\n",
+             leaked, leaked_bytes);
+}
+
+void dt_scratch_release(dt_scratch_t *arena)
+{
+  if(!arena) return;
+  dt_pthread_mutex_lock(&arena->lock);
+  _trim(arena, 0);
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+void *dt_scratch_alloc(const size_t size)
+{
+  dt_scratch_t *arena = _scratch_current;
+  if(!arena)
+  {
+    dt_scratch_block_t *block = _block_new(NULL, size);
+    if(!block) return NULL;
+    block->in_use = TRUE;
+    return (char *)block + DT_SCRATCH_HEADER;
+  }
+
+  dt_pthread_mutex_lock(&arena->lock);
+  // the smallest idle block which fits, but not one more than twice as large
+  dt_scratch_block_t *best = NULL;
+  for(guint k = 0; k < arena->blocks->len; k++)
+  {
+    dt_scratch_block_t *block = (dt_scratch_block_t *)g_ptr_array_index(arena->blocks, k);
+    if(!block->in_use && block->capacity >= size && block->capacity / 2 <= size
+       && (!best || block->capacity < best->capacity))
+      best = block;
+  }
+
+  if(best)
+    arena->stats.hits++;
+  else
+  {
+    best = _block_new(arena, _round_size(size));
+    if(!best)
+    {
+      dt_pthread_mutex_unlock(&arena->lock);
+      return NULL;
+    }
+    g_ptr_array_add(arena->blocks, best);
+    __atomic_add_fetch(&arena->retained, best->capacity, __ATOMIC_RELAXED);
+    arena->stats.misses++;
+  }
+  best->in_use = TRUE;
+  best->last_used = ++arena->clock;
+  dt_pthread_mutex_unlock(&arena->lock);
+  return (char *)best + DT_SCRATCH_HEADER;
+}
+
+void dt_scratch_free(void *mem)
+{
+  if(!mem) return;
+  dt_scratch_block_t *block = (dt_scratch_block_t *)((char *)mem - DT_SCRATCH_HEADER);
+  if(block->magic != DT_SCRATCH_MAGIC || !block->in_use)
+  {
+    fprintf(stderr, "[scratch] freeing %p which isn't an allocated scratch buffer\n", mem);
+    return;
+  }
+
+  dt_scratch_t *arena = block->arena;
+  if(!arena)
+  {
+    _block_free(block);
+    return;
+  }
+  dt_pthread_mutex_lock(&arena->lock);
+  block->in_use = FALSE;
+  dt_pthread_mutex_unlock(&arena->lock);
+}
+
+size_t dt_scratch_retained(dt_scratch_t *arena)
+{
+  return arena ? __atomic_load_n(&arena->retained, __ATOMIC_RELAXED) : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
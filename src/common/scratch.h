@@ -0,0 +1,67 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stddef.h>
+
+/**
+ * scratch arenas for the temporary buffers of image operations. every pixelpipe owns one, and
+ * makes it the current arena of its thread while a module processes. dt_scratch_alloc() then
+ * hands out blocks the arena kept from earlier modules and earlier runs of the pipe, so slider
+ * drags in the darkroom don't pay for fresh pages (and their page faults) on every redraw.
+ * after each module the arena is reset: whatever is still allocated is logged as a leak and kept
+ * out of reuse until it's freed, and the idle blocks are trimmed to a limit within the memory
+ * governor's budget. pipes outside the darkroom give all idle blocks back after each run.
+ *
+ * without a current arena (other threads, openmp workers, code outside the pixelpipe) the
+ * functions fall back to the plain aligned heap, so kernels can use them unconditionally.
+ * memory from dt_scratch_alloc() must be freed with dt_scratch_free() before the module returns,
+ * it must never be kept in module or pipe data.
+ */
+
+typedef struct dt_scratch_t dt_scratch_t;
+
+dt_scratch_t *dt_scratch_new(void);
+void dt_scratch_destroy(dt_scratch_t *arena);
+/** report this arena in the cache statistics under the given name. */
+void dt_scratch_register_stats(dt_scratch_t *arena, const char *name);
+
+/** make arena the current one of the calling thread, returns the one to pass to dt_scratch_end(). */
+dt_scratch_t *dt_scratch_begin(dt_scratch_t *arena);
+/** reset the current arena and make previous current again. */
+void dt_scratch_end(dt_scratch_t *previous);
+/** free all idle blocks of the arena. */
+void dt_scratch_release(dt_scratch_t *arena);
+
+/** 64 byte aligned memory, from the current arena if there is one. */
+void *dt_scratch_alloc(const size_t size);
+void dt_scratch_free(void *mem);
+
+static inline float *dt_scratch_alloc_float(const size_t nfloats)
+{
+  return (float *)dt_scratch_alloc(nfloats * sizeof(float));
+}
+
+/** bytes held by the arena, in use or idle. */
+size_t dt_scratch_retained(dt_scratch_t *arena);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
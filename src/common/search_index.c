@@ -0,0 +1,212 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/search_index.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/dtpthread.h"
+
+typedef enum _index_state_t
+{
+  INDEX_UNKNOWN = 0,
+  INDEX_READY,
+  INDEX_UNAVAILABLE
+} _index_state_t;
+
+typedef struct _index_t
+{
+  const char *name;
+  // the table, the triggers and the initial fill, in this order. the connection is shared between the threads,
+  // a row the triggers put in while this runs is replaced by the fill.
+  const char *create[6];
+  const char *drop[4];
+  _index_state_t state;
+} _index_t;
+
+// the trigger bodies can't name a schema, the tables resolve by name as they are unique
+static _index_t _tags_index =
+{
+  .name = "tags",
+  .create =
+  {
+    "CREATE VIRTUAL TABLE memory.tags_text USING fts5(name, synonyms, tokenize='trigram')",
+    "CREATE TEMP TRIGGER tags_text_insert AFTER INSERT ON data.tags"
+    " BEGIN"
+    "  INSERT INTO tags_text (rowid, name, synonyms) VALUES (new.id, new.name, new.synonyms);"
+    " END",
+    "CREATE TEMP TRIGGER tags_text_update AFTER UPDATE OF id, name, synonyms ON data.tags"
+    " BEGIN"
+    "  DELETE FROM tags_text WHERE rowid = old.id;"
+    "  INSERT INTO tags_text (rowid, name, synonyms) VALUES (new.id, new.name, new.synonyms);"
+    " END",
+    "CREATE TEMP TRIGGER tags_text_delete AFTER DELETE ON data.tags"
+    " BEGIN"
+    "  DELETE FROM tags_text WHERE rowid = old.id;"
+    " END",
+    "INSERT OR REPLACE INTO memory.tags_text (rowid, name, synonyms) SELECT id, name, synonyms FROM data.tags",
+    NULL
+  },
+  .drop =
+  {
+    "DROP TRIGGER IF EXISTS temp.tags_text_insert",
+    "DROP TRIGGER IF EXISTS temp.tags_text_update",
+    "DROP TRIGGER IF EXISTS temp.tags_text_delete",
+    "DROP TABLE IF EXISTS memory.tags_text"
+  },
+  .state = INDEX_UNKNOWN
+};
+
+// rowid is the one of the metadata row, meta_data has no key of its own
+static _index_t _metadata_index =
+{
+  .name = "metadata",
+  .create =
+  {
+    "CREATE VIRTUAL TABLE memory.meta_data_text USING fts5(value, id UNINDEXED, key UNINDEXED, tokenize='trigram')",
+    "CREATE TEMP TRIGGER meta_data_text_insert AFTER INSERT ON main.meta_data"
+    " BEGIN"
+    "  INSERT INTO meta_data_text (rowid, value, id, key) VALUES (new.rowid, new.value, new.id, new.key);"
+    " END",
+    "CREATE TEMP TRIGGER meta_data_text_update AFTER UPDATE ON main.meta_data"
+    " BEGIN"
+    "  DELETE FROM meta_data_text WHERE rowid = old.rowid;"
+    "  INSERT INTO meta_data_text (rowid, value, id, key) VALUES (new.rowid, new.value, new.id, new.key);"
+    " END",
+    "CREATE TEMP TRIGGER meta_data_text_delete AFTER DELETE ON main.meta_data"
+    " BEGIN"
+    "  DELETE FROM meta_data_text WHERE rowid = old.rowid;"
+    " END",
+    "INSERT OR REPLACE INTO memory.meta_data_text (rowid, value, id, key)"
+    " SELECT rowid, value, id, key FROM main.meta_data",
+    NULL
+  },
+  .drop =
+  {
+    "DROP TRIGGER IF EXISTS temp.meta_data_text_insert",
+    "DROP TRIGGER IF EXISTS temp.meta_data_text_update",
+    "DROP TRIGGER IF EXISTS temp.meta_data_text_delete",
+    "DROP TABLE IF EXISTS memory.meta_data_text"
+  },
+  .state = INDEX_UNKNOWN
+};
+
+static dt_pthread_mutex_t _index_mutex;
+static gboolean _index_initialized = FALSE;
+
+static void _index_drop(sqlite3 *db, _index_t *index)
+{
+  for(int k = 0; k < G_N_ELEMENTS(index->drop); k++) sqlite3_exec(db, index->drop[k], NULL, NULL, NULL);
+}
+
+// creating may fail, e.g. on sqlite without fts5 or the trigram tokenizer, so no asserts here
+static void _index_build(_index_t *index)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  const double start = dt_get_wtime();
+
+  // a savepoint, as the caller may be in a transaction already
+  sqlite3_exec(db, "SAVEPOINT search_index", NULL, NULL, NULL);
+  for(int k = 0; index->create[k]; k++)
+  {
+    char *err = NULL;
+    if(sqlite3_exec(db, index->create[k], NULL, NULL, &err) != SQLITE_OK)
+    {
+      dt_print(DT_DEBUG_SQL, "[search index] %s index not available: %s\n", index->name, err);
+      sqlite3_free(err);
+      sqlite3_exec(db, "ROLLBACK TO search_index", NULL, NULL, NULL);
+      sqlite3_exec(db, "RELEASE search_index", NULL, NULL, NULL);
+      _index_drop(db, index);
+      index->state = INDEX_UNAVAILABLE;
+      return;
+    }
+  }
+  sqlite3_exec(db, "RELEASE search_index", NULL, NULL, NULL);
+
+  index->state = INDEX_READY;
+  dt_print(DT_DEBUG_SQL | DT_DEBUG_PERF, "[search index] %s index built in %.3f secs\n", index->name,
+           dt_get_wtime() - start);
+}
+
+static gboolean _index_get(_index_t *index)
+{
+  if(!_index_initialized) return FALSE;
+  dt_pthread_mutex_lock(&_index_mutex);
+  if(index->state == INDEX_UNKNOWN) _index_build(index);
+  const gboolean ready = index->state == INDEX_READY;
+  dt_pthread_mutex_unlock(&_index_mutex);
+  return ready;
+}
+
+void dt_search_index_init(void)
+{
+  if(_index_initialized) return;
+  dt_pthread_mutex_init(&_index_mutex, NULL);
+  _tags_index.state = _metadata_index.state = INDEX_UNKNOWN;
+  _index_initialized = TRUE;
+}
+
+void dt_search_index_cleanup(void)
+{
+  if(!_index_initialized) return;
+  sqlite3 *db = dt_database_get(darktable.db);
+  // the triggers would go with the connection, but nothing should write to the tables without them
+  if(_tags_index.state == INDEX_READY) _index_drop(db, &_tags_index);
+  if(_metadata_index.state == INDEX_READY) _index_drop(db, &_metadata_index);
+  _index_initialized = FALSE;
+  dt_pthread_mutex_destroy(&_index_mutex);
+}
+
+gboolean dt_search_index_tags(void)
+{
+  return _index_get(&_tags_index);
+}
+
+gboolean dt_search_index_metadata(void)
+{
+  return _index_get(&_metadata_index);
+}
+
+GHashTable *dt_search_index_find_tags(const char *text)
+{
+  // trigrams can't find anything shorter
+  if(!text || g_utf8_strlen(text, -1) < 3 || !dt_search_index_tags()) return NULL;
+
+  // one phrase, double quotes in it doubled
+  gchar **parts = g_strsplit(text, "\"", -1);
+  gchar *escaped = g_strjoinv("\"\"", parts);
+  gchar *phrase = g_strdup_printf("\"%s\"", escaped);
+  g_strfreev(parts);
+  g_free(escaped);
+
+  GHashTable *ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT rowid FROM memory.tags_text WHERE tags_text MATCH ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, phrase, -1, SQLITE_TRANSIENT);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    g_hash_table_add(ids, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  g_free(phrase);
+  return ids;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,48 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * trigram full text indexes over the tag names and synonyms (memory.tags_text, rowid is the tag id)
+ * and over the metadata values (memory.meta_data_text, with the image id and key). LIKE with three
+ * or more characters in a row and MATCH on them use the index instead of scanning data.tags and
+ * main.meta_data, which makes substring and prefix searches cheap on large libraries.
+ *
+ * the indexes live in the memory database and are built on first use, temporary triggers on the
+ * tables keep them in sync with every write. sqlite without fts5 or its trigram tokenizer (3.34)
+ * leaves them unavailable, callers then query the tables as before.
+ */
+
+void dt_search_index_init(void);
+void dt_search_index_cleanup(void);
+
+/** is memory.tags_text there? builds it on first use. */
+gboolean dt_search_index_tags(void);
+/** is memory.meta_data_text there? builds it on first use. */
+gboolean dt_search_index_metadata(void);
+
+/** the ids of the tags whose name or synonyms contain text, ignoring case, as a set. NULL if the index
+  * can't tell, e.g. for less than three characters. */
+GHashTable *dt_search_index_find_tags(const char *text);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,241 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/sidecar_queue.h"
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "common/image.h"
+#include "control/conf.h"
+
+// sidecars are written to different files, on network shares several writes in flight help
+#define DT_SIDECAR_THREADS 4
+
+typedef struct _sidecar_entry_t
+{
+  int32_t imgid;
+  double queued; // when it was first queued, the latency is measured from here
+  double due;    // when it is to be written, 0 for right away
+} _sidecar_entry_t;
+
+static gint _queue_running = 0;
+static dt_pthread_mutex_t _queue_mutex; // protects everything below
+static pthread_cond_t _queue_cond;      // entries queued, brought forward or written, or quitting
+static GHashTable *_queue_pending;      // imgid -> entry
+static GQueue *_queue_order;            // the pending entries, ordered by due time
+static GHashTable *_queue_writing;      // imgids of sidecars being written
+static gboolean _queue_quit = FALSE;
+static double _queue_delay = 0.0;
+static pthread_t _queue_threads[DT_SIDECAR_THREADS];
+static dt_cache_stats_t _queue_stats;   // hits are coalesced writes, misses written sidecars
+
+// the first due entry whose image isn't being written already, otherwise sets wake to the time the next
+// one is due (0 if none is). called locked.
+static GList *_next_due(const double now, double *wake)
+{
+  *wake = 0.0;
+  for(GList *l = _queue_order->head; l; l = g_list_next(l))
+  {
+    const _sidecar_entry_t *entry = (_sidecar_entry_t *)l->data;
+    if(entry->due > now && !_queue_quit)
+    {
+      *wake = entry->due;
+      break;
+    }
+    if(!g_hash_table_contains(_queue_writing, GINT_TO_POINTER(entry->imgid))) return l;
+  }
+  return NULL;
+}
+
+static void _wait_until(const double wake)
+{
+  const gint64 until = g_get_real_time() + (gint64)(1e6 * MAX(0.0, wake - dt_get_wtime()));
+  const struct timespec ts = { .tv_sec = until / G_USEC_PER_SEC, .tv_nsec = (until % G_USEC_PER_SEC) * 1000 };
+  dt_pthread_cond_timedwait(&_queue_cond, &_queue_mutex, &ts);
+}
+
+static void *_sidecar_worker(void *unused)
+{
+  dt_pthread_setname("sidecars");
+  dt_pthread_mutex_lock(&_queue_mutex);
+  while(TRUE)
+  {
+    double wake;
+    GList *link = _next_due(dt_get_wtime(), &wake);
+    if(!link)
+    {
+      if(_queue_quit && g_queue_is_empty(_queue_order)) break;
+      if(wake > 0.0)
+        _wait_until(wake);
+      else
+        dt_pthread_cond_wait(&_queue_cond, &_queue_mutex);
+      continue;
+    }
+
+    _sidecar_entry_t *entry = (_sidecar_entry_t *)link->data;
+    g_queue_delete_link(_queue_order, link);
+    g_hash_table_remove(_queue_pending, GINT_TO_POINTER(entry->imgid));
+    g_hash_table_add(_queue_writing, GINT_TO_POINTER(entry->imgid));
+    dt_pthread_mutex_unlock(&_queue_mutex);
+
+    // queued again meanwhile it gets a new entry, written once this one is done
+    dt_image_write_sidecar_file_now(entry->imgid);
+
+    dt_pthread_mutex_lock(&_queue_mutex);
+    g_hash_table_remove(_queue_writing, GINT_TO_POINTER(entry->imgid));
+    _queue_stats.misses++;
+    dt_cache_stats_latency(&_queue_stats, dt_get_wtime() - entry->queued);
+    pthread_cond_broadcast(&_queue_cond);
+    g_free(entry);
+  }
+  dt_pthread_mutex_unlock(&_queue_mutex);
+  return NULL;
+}
+
+static void _stats_fill(void *data, dt_cache_report_t *report)
+{
+  dt_pthread_mutex_lock(&_queue_mutex);
+  dt_cache_stats_copy(&report->stats, &_queue_stats);
+  report->entries = g_queue_get_length(_queue_order) + g_hash_table_size(_queue_writing);
+  dt_pthread_mutex_unlock(&_queue_mutex);
+}
+
+void dt_sidecar_queue_init(void)
+{
+  if(g_atomic_int_get(&_queue_running)) return;
+  dt_pthread_mutex_init(&_queue_mutex, NULL);
+  pthread_cond_init(&_queue_cond, NULL);
+  _queue_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+  _queue_order = g_queue_new();
+  _queue_writing = g_hash_table_new(g_direct_hash, g_direct_equal);
+  _queue_quit = FALSE;
+  _queue_delay = CLAMP(dt_conf_get_int("write_sidecar_files_delay"), 0, 10000) / 1000.0;
+  memset(&_queue_stats, 0, sizeof(_queue_stats));
+  for(int k = 0; k < DT_SIDECAR_THREADS; k++) dt_pthread_create(&_queue_threads[k], _sidecar_worker, NULL);
+  g_atomic_int_set(&_queue_running, 1);
+  dt_cache_stats_register("xmp sidecars", _stats_fill, &_queue_stats);
+}
+
+void dt_sidecar_queue_cleanup(void)
+{
+  if(!g_atomic_int_get(&_queue_running)) return;
+  dt_cache_stats_unregister(&_queue_stats);
+
+  // the threads write everything that is left before they go
+  dt_pthread_mutex_lock(&_queue_mutex);
+  _queue_quit = TRUE;
+  pthread_cond_broadcast(&_queue_cond);
+  dt_pthread_mutex_unlock(&_queue_mutex);
+  for(int k = 0; k < DT_SIDECAR_THREADS; k++) pthread_join(_queue_threads[k], NULL);
+  g_atomic_int_set(&_queue_running, 0);
+
+  g_hash_table_destroy(_queue_pending);
+  g_queue_free(_queue_order);
+  g_hash_table_destroy(_queue_writing);
+  pthread_cond_destroy(&_queue_cond);
+  dt_pthread_mutex_destroy(&_queue_mutex);
+}
+
+gboolean dt_sidecar_queue_running(void)
+{
+  return g_atomic_int_get(&_queue_running);
+}
+
+void dt_sidecar_queue_add(const int32_t imgid)
+{
+  dt_pthread_mutex_lock(&_queue_mutex);
+  if(g_hash_table_contains(_queue_pending, GINT_TO_POINTER(imgid)))
+  {
+    _queue_stats.hits++;
+    dt_pthread_mutex_unlock(&_queue_mutex);
+    return;
+  }
+
+  _sidecar_entry_t *entry = (_sidecar_entry_t *)g_malloc(sizeof(_sidecar_entry_t));
+  entry->imgid = imgid;
+  entry->queued = dt_get_wtime();
+  entry->due = entry->queued + _queue_delay;
+  // all entries are due the same time after queuing, so the order stays sorted
+  g_queue_push_tail(_queue_order, entry);
+  g_hash_table_insert(_queue_pending, GINT_TO_POINTER(imgid), entry);
+  // threads with something due already wake up by themselves
+  if(g_queue_get_length(_queue_order) == 1) pthread_cond_broadcast(&_queue_cond);
+  dt_pthread_mutex_unlock(&_queue_mutex);
+}
+
+void dt_sidecar_queue_remove(const int32_t imgid)
+{
+  if(!dt_sidecar_queue_running()) return;
+  dt_pthread_mutex_lock(&_queue_mutex);
+  _sidecar_entry_t *entry = (_sidecar_entry_t *)g_hash_table_lookup(_queue_pending, GINT_TO_POINTER(imgid));
+  if(entry)
+  {
+    g_hash_table_remove(_queue_pending, GINT_TO_POINTER(imgid));
+    g_queue_remove(_queue_order, entry);
+    g_free(entry);
+  }
+  while(g_hash_table_contains(_queue_writing, GINT_TO_POINTER(imgid)))
+    dt_pthread_cond_wait(&_queue_cond, &_queue_mutex);
+  dt_pthread_mutex_unlock(&_queue_mutex);
+}
+
+// is any of the images still waiting or being written? called locked.
+static gboolean _flush_pending(const GList *imgs)
+{
+  if(!imgs) return !g_queue_is_empty(_queue_order) || g_hash_table_size(_queue_writing);
+  for(const GList *l = imgs; l; l = g_list_next(l))
+    if(g_hash_table_contains(_queue_pending, l->data) || g_hash_table_contains(_queue_writing, l->data))
+      return TRUE;
+  return FALSE;
+}
+
+void dt_sidecar_queue_flush(const GList *imgs)
+{
+  if(!dt_sidecar_queue_running()) return;
+  dt_pthread_mutex_lock(&_queue_mutex);
+  if(!imgs)
+  {
+    for(GList *l = _queue_order->head; l; l = g_list_next(l)) ((_sidecar_entry_t *)l->data)->due = 0.0;
+  }
+  else
+  {
+    // to the front, which keeps the order sorted
+    for(const GList *l = imgs; l; l = g_list_next(l))
+    {
+      _sidecar_entry_t *entry = (_sidecar_entry_t *)g_hash_table_lookup(_queue_pending, l->data);
+      if(!entry || entry->due == 0.0) continue;
+      g_queue_remove(_queue_order, entry);
+      entry->due = 0.0;
+      g_queue_push_head(_queue_order, entry);
+    }
+  }
+  pthread_cond_broadcast(&_queue_cond);
+
+  while(_flush_pending(imgs)) dt_pthread_cond_wait(&_queue_cond, &_queue_mutex);
+  dt_pthread_mutex_unlock(&_queue_mutex);
+}
+
+void dt_sidecar_queue_flush_image(const int32_t imgid)
+{
+  GList imgs = { .data = GINT_TO_POINTER(imgid), .next = NULL, .prev = NULL };
+  dt_sidecar_queue_flush(&imgs);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,55 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+
+/**
+ * write-behind queue for the xmp sidecars. dt_image_write_sidecar_file() only queues the image,
+ * a few background threads write the sidecars a short while later. writes of the same image
+ * queued in the meantime are coalesced, so a bulk operation touching a sidecar several times
+ * (rating, tags, metadata, ...) writes it once, and the caller never waits for the disk.
+ *
+ * whatever reads sidecars back or depends on them being on disk has to flush first. the queue
+ * reports its pending images, coalesced and written sidecars and the time from queuing to
+ * writing as "xmp sidecars" in the cache statistics.
+ */
+
+void dt_sidecar_queue_init(void);
+/** writes everything still queued, then stops the threads. */
+void dt_sidecar_queue_cleanup(void);
+
+/** is the queue running? without it sidecars are written right away. */
+gboolean dt_sidecar_queue_running(void);
+
+/** queues the sidecar of the image for writing. */
+void dt_sidecar_queue_add(const int32_t imgid);
+/** the sidecar of the image won't be written, e.g. because the image is gone. waits for one in writing. */
+void dt_sidecar_queue_remove(const int32_t imgid);
+
+/** writes the queued sidecars of the given images (GList of imgids, NULL for all) without delay
+  * and waits until they and any in writing are on disk. the writing takes the image cache lock,
+  * so don't hold it when flushing. */
+void dt_sidecar_queue_flush(const GList *imgs);
+void dt_sidecar_queue_flush_image(const int32_t imgid);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
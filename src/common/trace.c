@@ -0,0 +1,115 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/trace.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static FILE *_trace_file = NULL;
+static dt_pthread_mutex_t _trace_mutex;
+static int _trace_events = 0;
+static int _trace_threads = 0;
+static double _trace_start = 0.0;
+
+// small per-thread ids read better in the viewers than pthread_t values
+static __thread int _trace_tid = -1;
+
+gboolean dt_trace_init(const char *filename)
+{
+  if(_trace_file) return TRUE;
+  FILE *f = g_fopen(filename, "wb");
+  if(!f)
+  {
+    fprintf(stderr, "[trace] can't open `%s' for writing\n", filename);
+    return FALSE;
+  }
+  dt_pthread_mutex_init(&_trace_mutex, NULL);
+  _trace_events = 0;
+  _trace_threads = 0;
+  _trace_start = dt_get_wtime();
+  fprintf(f, "[\n");
+  _trace_file = f;
+  return TRUE;
+}
+
+void dt_trace_cleanup(void)
+{
+  if(!_trace_file) return;
+  dt_pthread_mutex_lock(&_trace_mutex);
+  fprintf(_trace_file, "\n]\n");
+  fclose(_trace_file);
+  _trace_file = NULL;
+  dt_pthread_mutex_unlock(&_trace_mutex);
+  dt_pthread_mutex_destroy(&_trace_mutex);
+}
+
+gboolean dt_trace_enabled(void)
+{
+  return _trace_file != NULL;
+}
+
+void dt_trace_complete(const char *category, const char *name, double start, double duration,
+                       const char *args)
+{
+  if(!_trace_file) return;
+
+  dt_pthread_mutex_lock(&_trace_mutex);
+  if(!_trace_file)
+  {
+    dt_pthread_mutex_unlock(&_trace_mutex);
+    return;
+  }
+  if(_trace_tid < 0) _trace_tid = ++_trace_threads;
+
+  // time stamps are in microseconds
+  fprintf(_trace_file,
+          "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.0f,\"dur\":%.0f,\"pid\":%d,\"tid\":%d,"
+          "\"args\":{%s}}",
+          _trace_events ? ",\n" : "", name, category, 1e6 * (start - _trace_start), 1e6 * duration,
+          (int)getpid(), _trace_tid, args ? args : "");
+  _trace_events++;
+  dt_pthread_mutex_unlock(&_trace_mutex);
+}
+
+gchar *dt_trace_escape(const char *str)
+{
+  if(!str) return g_strdup("");
+  GString *out = g_string_sized_new(strlen(str) + 8);
+  for(const unsigned char *c = (const unsigned char *)str; *c; c++)
+  {
+    if(*c == '"' || *c == '\\')
+    {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, *c);
+    }
+    else if(*c < 0x20)
+      g_string_append_printf(out, "\\u%04x", *c);
+    else
+      g_string_append_c(out, *c);
+  }
+  return g_string_free(out, FALSE);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
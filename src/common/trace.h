@@ -0,0 +1,45 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * structured timing traces in the chrome trace event format, which can be loaded
+ * into chrome://tracing or https://ui.perfetto.dev. enabled with --trace <file>.
+ */
+
+/** start writing events to the given file. returns FALSE if it can't be opened. */
+gboolean dt_trace_init(const char *filename);
+/** terminate the json array and close the file. */
+void dt_trace_cleanup(void);
+/** whether events are being recorded at all. cheap, check it before assembling event arguments. */
+gboolean dt_trace_enabled(void);
+
+/** write a complete ("X") event. start is a dt_get_wtime() time stamp, duration is in seconds.
+  * category and name are written verbatim, args is the body of a json object (without the braces) or NULL. */
+void dt_trace_complete(const char *category, const char *name, double start, double duration,
+                       const char *args);
+
+/** escape a string to be used inside a json string literal. the result has to be freed. */
+gchar *dt_trace_escape(const char *str);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -204,15 +204,16 @@ typedef struct dt_control_t
 
   // job management
   int32_t running;
-  gboolean export_scheduled;
-  dt_pthread_mutex_t queue_mutex, cond_mutex, run_mutex;
+  gint export_scheduled; // atomic
+  dt_pthread_mutex_t cond_mutex, run_mutex;
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread, kick_on_workers_thread, update_gphoto_thread;
-  dt_job_t **job;
+  struct dt_control_worker_t *workers; // the job queues of every worker, see jobs.c
 
-  GList *queues[DT_JOB_QUEUE_MAX];
-  size_t queue_length[DT_JOB_QUEUE_MAX];
+  gint next_worker;      // round robin for jobs not added by a worker
+  gint queued_system_fg; // jobs in all DT_JOB_QUEUE_SYSTEM_FG queues together
+  gint job_sequence;
 
   dt_pthread_mutex_t res_mutex;
   dt_job_t *job_res[DT_CTL_WORKER_RESERVED];
@@ -32,6 +32,20 @@ typedef struct worker_thread_parameters_t
   int32_t threadid;
 } worker_thread_parameters_t;
 
+/* every worker owns its own set of queues. jobs added from a worker stay with it, all others get spread
+    round robin. the owner takes jobs from the head of its queues, a worker running out of work steals
+    from the others before going to sleep. for the thumbnail stack that is the oldest request.
+*/
+typedef struct dt_control_worker_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  GQueue queue[DT_JOB_QUEUE_MAX];
+  int queued;            // jobs in all queues, may be read without the lock to skip empty workers
+  struct _dt_job_t *job; // the job this worker is running, for deduping
+  gboolean sleeping;
+} dt_control_worker_t;
+
 typedef struct _dt_job_t
 {
   dt_job_execute_callback execute;
@@ -46,6 +60,7 @@ typedef struct _dt_job_t
   dt_job_state_t state;
   unsigned char priority;
   dt_job_queue_t queue;
+  guint sequence; // order in which the jobs got queued
 
   dt_job_state_change_callback state_changed_cb;
 
@@ -224,69 +239,150 @@ static int32_t dt_control_run_job_res(dt_control_t *control, int32_t res)
   return 0;
 }
 
-static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
+static __thread int worker_id = -1;
+
+static void _control_lock_workers(dt_control_t *control)
 {
-  /*
-   * job scheduling works like this:
-   * - when there is a single job in the queue head with a maximal priority -> pick it
-   * - otherwise pick among the ones with the maximal priority in the following order:
-   *   * user foreground
-   *   * system foreground
-   *   * user background
-   *   * system background
-   * - the jobs that didn't get picked this round get their priority incremented
-   */
+  for(int k = 0; k < control->num_threads; k++) dt_pthread_mutex_lock(&control->workers[k].mutex);
+}
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
+static void _control_unlock_workers(dt_control_t *control)
+{
+  for(int k = control->num_threads - 1; k >= 0; k--) dt_pthread_mutex_unlock(&control->workers[k].mutex);
+}
 
-  // find the job
+/* take the next job from the queues of worker w, its mutex has to be held.
+ * job scheduling works like this:
+ * - when there is a single job in the queue head with a maximal priority -> pick it
+ * - otherwise pick among the ones with the maximal priority in the following order:
+ *   * user foreground
+ *   * system foreground
+ *   * user background
+ *   * system background
+ * - the jobs that didn't get picked this round get their priority incremented
+ * a thief takes the oldest job of the thumbnail stack instead of the newest one the owner is about to run.
+ */
+static _dt_job_t *_control_take_job(dt_control_t *control, dt_control_worker_t *w, dt_control_worker_t *self)
+{
+  const gboolean steal = w != self;
+  gboolean skip_export = FALSE;
   _dt_job_t *job = NULL;
   int winner_queue = DT_JOB_QUEUE_MAX;
-  int max_priority = -1;
-  for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
+
+  while(!job)
   {
-    if(control->queues[i] == NULL) continue;
-    if(control->export_scheduled && i == DT_JOB_QUEUE_USER_EXPORT) continue;
-    _dt_job_t *_job = (_dt_job_t *)control->queues[i]->data;
-    if(_job->priority > max_priority)
+    int max_priority = -1;
+    winner_queue = DT_JOB_QUEUE_MAX;
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
     {
-      max_priority = _job->priority;
-      job = _job;
-      winner_queue = i;
+      if(g_queue_is_empty(&w->queue[i])) continue;
+      if(i == DT_JOB_QUEUE_USER_EXPORT && (skip_export || g_atomic_int_get(&control->export_scheduled))) continue;
+      _dt_job_t *_job = (_dt_job_t *)(steal && i == DT_JOB_QUEUE_SYSTEM_FG ? g_queue_peek_tail(&w->queue[i])
+                                                                           : g_queue_peek_head(&w->queue[i]));
+      if(_job->priority > max_priority)
+      {
+        max_priority = _job->priority;
+        job = _job;
+        winner_queue = i;
+      }
     }
-  }
 
-  if(!job)
-  {
-    dt_pthread_mutex_unlock(&control->queue_mutex);
-    return NULL;
+    if(!job) return NULL;
+
+    // only one export may ever be running, some other worker might just have started one
+    if(winner_queue == DT_JOB_QUEUE_USER_EXPORT
+       && !g_atomic_int_compare_and_exchange(&control->export_scheduled, FALSE, TRUE))
+    {
+      skip_export = TRUE;
+      job = NULL;
+    }
   }
 
-  // the order of the queues in control->queues matches our priority, and we only update job when the priority
-  // is strictly bigger
+  // the order of the queues matches our priority, and we only update job when the priority is strictly bigger
   // invariant -> job is the one we are looking for
 
   // remove the to be scheduled job from its queue
-  GList **queue = &control->queues[winner_queue];
-  *queue = g_list_delete_link(*queue, *queue);
-  control->queue_length[winner_queue]--;
-  if(winner_queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = TRUE;
+  if(steal && winner_queue == DT_JOB_QUEUE_SYSTEM_FG)
+    g_queue_pop_tail(&w->queue[winner_queue]);
+  else
+    g_queue_pop_head(&w->queue[winner_queue]);
+  g_atomic_int_add(&w->queued, -1);
+  if(winner_queue == DT_JOB_QUEUE_SYSTEM_FG) g_atomic_int_add(&control->queued_system_fg, -1);
 
-  // and place it in scheduled job array (for job deduping)
-  control->job[dt_control_get_threadid()] = job;
+  // and remember it as running (for job deduping). dedupers hold all worker mutexes, so w's is enough here
+  self->job = job;
 
   // increment the priorities of the others
   for(int i = 0; i < DT_JOB_QUEUE_MAX; i++)
   {
-    if(i == winner_queue || control->queues[i] == NULL) continue;
-    ((_dt_job_t *)control->queues[i]->data)->priority++;
+    if(i == winner_queue || g_queue_is_empty(&w->queue[i])) continue;
+    ((_dt_job_t *)g_queue_peek_head(&w->queue[i]))->priority++;
   }
 
-  dt_pthread_mutex_unlock(&control->queue_mutex);
-
   return job;
 }
 
+static _dt_job_t *dt_control_schedule_job(dt_control_t *control)
+{
+  const int n = control->num_threads;
+  dt_control_worker_t *self = &control->workers[worker_id];
+
+  // our own queues first, then try to steal from the others
+  for(int k = 0; k < n; k++)
+  {
+    const int victim = (worker_id + k) % n;
+    dt_control_worker_t *w = &control->workers[victim];
+    if(!g_atomic_int_get(&w->queued)) continue;
+
+    dt_pthread_mutex_lock(&w->mutex);
+    _dt_job_t *job = _control_take_job(control, w, self);
+    dt_pthread_mutex_unlock(&w->mutex);
+
+    if(job)
+    {
+      if(k) dt_print(DT_DEBUG_CONTROL, "[schedule_job] worker %d stole job from worker %d\n", worker_id, victim);
+      return job;
+    }
+  }
+
+  return NULL;
+}
+
+// wake up the worker a job got queued at. if that one is busy wake any sleeping one, it will steal the job.
+static void _control_wake_worker(dt_control_t *control, const int target)
+{
+  const int n = control->num_threads;
+  for(int k = 0; k < n; k++)
+  {
+    dt_control_worker_t *w = &control->workers[(target + k) % n];
+    dt_pthread_mutex_lock(&w->mutex);
+    const gboolean sleeping = w->sleeping;
+    if(sleeping)
+    {
+      w->sleeping = FALSE;
+      pthread_cond_signal(&w->cond);
+    }
+    dt_pthread_mutex_unlock(&w->mutex);
+    if(sleeping) return;
+  }
+}
+
+static void _control_kick_workers(dt_control_t *control)
+{
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_control_worker_t *w = &control->workers[k];
+    dt_pthread_mutex_lock(&w->mutex);
+    w->sleeping = FALSE;
+    pthread_cond_signal(&w->cond);
+    dt_pthread_mutex_unlock(&w->mutex);
+  }
+
+  dt_pthread_mutex_lock(&control->cond_mutex);
+  pthread_cond_broadcast(&control->cond);
+  dt_pthread_mutex_unlock(&control->cond_mutex);
+}
+
 static void dt_control_job_execute(_dt_job_t *job)
 {
   dt_print(DT_DEBUG_CONTROL, "[run_job+] %02d %f ", DT_CTL_WORKER_RESERVED + dt_control_get_threadid(),
@@ -307,12 +403,9 @@ static void dt_control_job_execute(_dt_job_t *job)
   dt_print(DT_DEBUG_CONTROL, "\n");
 }
 
-static int32_t dt_control_run_job(dt_control_t *control)
+// runs a job dt_control_schedule_job() gave us
+static void _control_execute_job(dt_control_t *control, _dt_job_t *job)
 {
-  _dt_job_t *job = dt_control_schedule_job(control);
-
-  if(!job) return -1;
-
   /* change state to running */
   dt_pthread_mutex_lock(&job->wait_mutex);
   if(dt_control_job_get_state(job) == DT_JOB_STATE_QUEUED)
@@ -321,15 +414,14 @@ static int32_t dt_control_run_job(dt_control_t *control)
   dt_pthread_mutex_unlock(&job->wait_mutex);
 
   // remove the job from scheduled job array (for job deduping)
-  dt_pthread_mutex_lock(&control->queue_mutex);
-  control->job[dt_control_get_threadid()] = NULL;
-  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) control->export_scheduled = FALSE;
-  dt_pthread_mutex_unlock(&control->queue_mutex);
+  dt_control_worker_t *self = &control->workers[worker_id];
+  dt_pthread_mutex_lock(&self->mutex);
+  self->job = NULL;
+  dt_pthread_mutex_unlock(&self->mutex);
+  if(job->queue == DT_JOB_QUEUE_USER_EXPORT) g_atomic_int_set(&control->export_scheduled, FALSE);
 
   // and free it
   dt_control_job_dispose(job);
-
-  return 0;
 }
 
 int32_t dt_control_add_job_res(dt_control_t *control, _dt_job_t *job, int32_t res)
@@ -387,34 +479,39 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
   }
 
   job->queue = queue_id;
+  job->sequence = (guint)g_atomic_int_add(&control->job_sequence, 1);
 
-  _dt_job_t *job_for_disposal = NULL;
+  // jobs added by a worker stay with it, everything else gets spread over all of them
+  const int target = worker_id >= 0
+                         ? worker_id
+                         : (int)((guint)g_atomic_int_add(&control->next_worker, 1) % control->num_threads);
+  dt_control_worker_t *w = &control->workers[target];
 
-  dt_pthread_mutex_lock(&control->queue_mutex);
-
-  GList **queue = &control->queues[queue_id];
-  size_t length = control->queue_length[queue_id];
-
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %zu | ", length);
-  dt_control_job_print(job);
-  dt_print(DT_DEBUG_CONTROL, "\n");
+  _dt_job_t *job_for_disposal = NULL;
 
   if(queue_id == DT_JOB_QUEUE_SYSTEM_FG)
   {
     // this is a stack with limited size and bubble up and all that stuff
     job->priority = DT_CONTROL_FG_PRIORITY;
 
+    // deduping has to see all queues at once
+    _control_lock_workers(control);
+
+    dt_print(DT_DEBUG_CONTROL, "[add_job] %d | ", g_atomic_int_get(&control->queued_system_fg));
+    dt_control_job_print(job);
+    dt_print(DT_DEBUG_CONTROL, "\n");
+
     // check if we have already scheduled the job
     for(int k = 0; k < control->num_threads; k++)
     {
-      _dt_job_t *other_job = (_dt_job_t *)control->job[k];
+      _dt_job_t *other_job = control->workers[k].job;
       if(dt_control_job_equal(job, other_job))
       {
         dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in scheduled: ");
         dt_control_job_print(other_job);
         dt_print(DT_DEBUG_CONTROL, "\n");
 
-        dt_pthread_mutex_unlock(&control->queue_mutex);
+        _control_unlock_workers(control);
 
         dt_control_job_set_state(job, DT_JOB_STATE_DISCARDED);
         dt_control_job_dispose(job);
@@ -423,41 +520,60 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
       }
     }
 
-    // if the job is already in the queue -> move it to the top
-    for(GList *iter = *queue; iter; iter = g_list_next(iter))
+    // if the job is already in a queue -> move it to the top of ours
+    for(int k = 0; k < control->num_threads && !job_for_disposal; k++)
     {
-      _dt_job_t *other_job = (_dt_job_t *)iter->data;
-      if(dt_control_job_equal(job, other_job))
+      GQueue *queue = &control->workers[k].queue[DT_JOB_QUEUE_SYSTEM_FG];
+      for(GList *iter = queue->head; iter; iter = g_list_next(iter))
       {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
-        dt_control_job_print(other_job);
-        dt_print(DT_DEBUG_CONTROL, "\n");
-
-        *queue = g_list_delete_link(*queue, iter);
-        length--;
-
-        job_for_disposal = job;
-
-        job = other_job;
-        break; // there can't be any further copy in the list
+        _dt_job_t *other_job = (_dt_job_t *)iter->data;
+        if(dt_control_job_equal(job, other_job))
+        {
+          dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue: ");
+          dt_control_job_print(other_job);
+          dt_print(DT_DEBUG_CONTROL, "\n");
+
+          g_queue_delete_link(queue, iter);
+          g_atomic_int_add(&control->workers[k].queued, -1);
+          g_atomic_int_add(&control->queued_system_fg, -1);
+
+          other_job->sequence = job->sequence;
+          job_for_disposal = job;
+
+          job = other_job;
+          break; // there can't be any further copy in the list
+        }
       }
     }
 
     // now we can add the new job to the list
-    *queue = g_list_prepend(*queue, job);
-    length++;
+    g_queue_push_head(&w->queue[DT_JOB_QUEUE_SYSTEM_FG], job);
+    g_atomic_int_inc(&w->queued);
+    g_atomic_int_inc(&control->queued_system_fg);
 
-    // and take care of the maximal queue size
-    if(length > DT_CONTROL_MAX_JOBS)
+    // and take care of the maximal queue size by dropping the oldest job. the tails are the oldest per worker
+    if(g_atomic_int_get(&control->queued_system_fg) > DT_CONTROL_MAX_JOBS)
     {
-      GList *last = g_list_last(*queue);
-      dt_control_job_set_state((_dt_job_t *)last->data, DT_JOB_STATE_DISCARDED);
-      dt_control_job_dispose((_dt_job_t *)last->data);
-      *queue = g_list_delete_link(*queue, last);
-      length--;
+      dt_control_worker_t *oldest = NULL;
+      for(int k = 0; k < control->num_threads; k++)
+      {
+        _dt_job_t *tail = (_dt_job_t *)g_queue_peek_tail(&control->workers[k].queue[DT_JOB_QUEUE_SYSTEM_FG]);
+        if(tail
+           && (!oldest
+               || (gint)(tail->sequence
+                         - ((_dt_job_t *)g_queue_peek_tail(&oldest->queue[DT_JOB_QUEUE_SYSTEM_FG]))->sequence)
+                      < 0))
+          oldest = &control->workers[k];
+      }
+      _dt_job_t *last = (_dt_job_t *)g_queue_pop_tail(&oldest->queue[DT_JOB_QUEUE_SYSTEM_FG]);
+      g_atomic_int_add(&oldest->queued, -1);
+      g_atomic_int_add(&control->queued_system_fg, -1);
+      dt_control_job_set_state(last, DT_JOB_STATE_DISCARDED);
+      dt_control_job_dispose(last);
     }
 
-    control->queue_length[queue_id] = length;
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    _control_unlock_workers(control);
   }
   else
   {
@@ -468,16 +584,21 @@ int dt_control_add_job(dt_control_t *control, dt_job_queue_t queue_id, _dt_job_t
       job->priority = 0;
     else
       job->priority = DT_CONTROL_FG_PRIORITY;
-    *queue = g_list_append(*queue, job);
-    control->queue_length[queue_id]++;
+
+    dt_pthread_mutex_lock(&w->mutex);
+
+    dt_print(DT_DEBUG_CONTROL, "[add_job] %u | ", g_queue_get_length(&w->queue[queue_id]));
+    dt_control_job_print(job);
+    dt_print(DT_DEBUG_CONTROL, "\n");
+
+    g_queue_push_tail(&w->queue[queue_id], job);
+    g_atomic_int_inc(&w->queued);
+    dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
+    dt_pthread_mutex_unlock(&w->mutex);
   }
-  dt_control_job_set_state(job, DT_JOB_STATE_QUEUED);
-  dt_pthread_mutex_unlock(&control->queue_mutex);
 
   // notify workers
-  dt_pthread_mutex_lock(&control->cond_mutex);
-  pthread_cond_broadcast(&control->cond);
-  dt_pthread_mutex_unlock(&control->cond_mutex);
+  _control_wake_worker(control, target);
 
   // dispose of dropped job, if any
   dt_control_job_set_state(job_for_disposal, DT_JOB_STATE_DISCARDED);
@@ -538,10 +659,10 @@ static void *dt_control_worker_kicker(void *ptr)
   while(dt_control_running())
   {
     sleep(2);
-    dt_pthread_mutex_lock(&control->cond_mutex);
-    pthread_cond_broadcast(&control->cond);
-    dt_pthread_mutex_unlock(&control->cond_mutex);
+    _control_kick_workers(control);
   }
+  // make sure no worker keeps sleeping through the shutdown
+  _control_kick_workers(control);
   return NULL;
 }
 
@@ -553,21 +674,38 @@ static void *dt_control_work(void *ptr)
   worker_thread_parameters_t *params = (worker_thread_parameters_t *)ptr;
   dt_control_t *control = params->self;
   threadid = params->threadid;
+  worker_id = threadid;
   char name[16] = {0};
   snprintf(name, sizeof(name), "worker %d", threadid);
   dt_pthread_setname(name);
   free(params);
-  // int32_t threadid = dt_control_get_threadid();
+  dt_control_worker_t *self = &control->workers[worker_id];
   while(dt_control_running())
   {
     // dt_print(DT_DEBUG_CONTROL, "[control_work] %d\n", threadid);
-    if(dt_control_run_job(control) < 0)
+    _dt_job_t *job = dt_control_schedule_job(control);
+    if(!job)
     {
-      // wait for a new job.
-      dt_pthread_mutex_lock(&control->cond_mutex);
-      dt_pthread_cond_wait(&control->cond, &control->cond_mutex);
-      dt_pthread_mutex_unlock(&control->cond_mutex);
+      // announce that we are about to sleep before looking around once more. whoever queues a job
+      // after that sees the flag and wakes us up, so nothing gets lost in between.
+      dt_pthread_mutex_lock(&self->mutex);
+      self->sleeping = TRUE;
+      dt_pthread_mutex_unlock(&self->mutex);
+
+      job = dt_control_schedule_job(control);
+
+      // busy again before running what we found, otherwise wait for a new job
+      dt_pthread_mutex_lock(&self->mutex);
+      const gboolean woken = !self->sleeping;
+      while(!job && self->sleeping && dt_control_running()) dt_pthread_cond_wait(&self->cond, &self->mutex);
+      self->sleeping = FALSE;
+      dt_pthread_mutex_unlock(&self->mutex);
+
+      if(!job) continue;
+      // a wakeup which came in meanwhile was meant for another job, pass it on
+      if(woken) _control_wake_worker(control, (worker_id + 1) % control->num_threads);
     }
+    _control_execute_job(control, job);
   }
   return NULL;
 }
@@ -607,7 +745,14 @@ void dt_control_jobs_init(dt_control_t *control)
   // start threads
   control->num_threads = CLAMP(dt_conf_get_int("worker_threads"), 1, 8);
   control->thread = (pthread_t *)calloc(control->num_threads, sizeof(pthread_t));
-  control->job = (dt_job_t **)calloc(control->num_threads, sizeof(dt_job_t *));
+  control->workers = (dt_control_worker_t *)calloc(control->num_threads, sizeof(dt_control_worker_t));
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_control_worker_t *w = &control->workers[k];
+    dt_pthread_mutex_init(&w->mutex, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++) g_queue_init(&w->queue[i]);
+  }
   dt_pthread_mutex_lock(&control->run_mutex);
   control->running = 1;
   dt_pthread_mutex_unlock(&control->run_mutex);
@@ -641,7 +786,14 @@ void dt_control_jobs_init(dt_control_t *control)
 
 void dt_control_jobs_cleanup(dt_control_t *control)
 {
-  free(control->job);
+  for(int k = 0; k < control->num_threads; k++)
+  {
+    dt_control_worker_t *w = &control->workers[k];
+    for(int i = 0; i < DT_JOB_QUEUE_MAX; i++) g_queue_clear(&w->queue[i]);
+    pthread_cond_destroy(&w->cond);
+    dt_pthread_mutex_destroy(&w->mutex);
+  }
+  free(control->workers);
   free(control->thread);
 }
 
@@ -45,7 +45,8 @@ typedef enum dt_job_queue_t
   DT_JOB_QUEUE_USER_FG = 0,     // gui actions, ...
   DT_JOB_QUEUE_SYSTEM_FG = 1,   // thumbnail creation, ..., may be pushed out of the queue
   DT_JOB_QUEUE_USER_BG = 2,     // imports, ...
-  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time
+  DT_JOB_QUEUE_USER_EXPORT = 3, // exports. only one of these jobs will ever be scheduled at a time,
+                                // it runs several export pipes concurrently on its own if possible
   DT_JOB_QUEUE_SYSTEM_BG = 4,   // some lua stuff that may not be pushed out of the queue, ...
   DT_JOB_QUEUE_MAX = 5
 } dt_job_queue_t;
@@ -28,11 +28,14 @@
 #include "common/imageio.h"
 #include "common/imageio_dng.h"
 #include "common/imageio_module.h"
+#include "common/memory_governor.h"
 #include "common/mipmap_cache.h"
+#include "common/sidecar_queue.h"
 #include "common/tags.h"
 #include "common/undo.h"
 #include "control/conf.h"
 #include "develop/imageop_math.h"
+#include "develop/tiling.h"
 
 #include "gui/gtk.h"
 
@@ -215,6 +218,8 @@ static dt_job_t *dt_control_generic_image_job_create(dt_job_execute_callback exe
 static int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = dt_control_job_get_params(job);
+  // don't race queued writes of the same sidecars
+  dt_sidecar_queue_flush(params->index);
   GList *t = params->index;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -1260,6 +1265,172 @@ static int32_t dt_control_refresh_exif_run(dt_job_t *job)
 }
 
 
+// concurrent export: the job thread does the bookkeeping for every image and hands it to one of
+// a few worker threads, each running its own export pipe, as long as the memory estimated for all
+// images in flight fits into host_memory_limit.
+typedef struct _export_task_t
+{
+  int imgid;
+  int num;
+  size_t memory;
+} _export_task_t;
+
+typedef struct _export_scheduler_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  GQueue *tasks;     // waiting for a worker
+  gboolean done;     // no more tasks will be queued
+  int workers;
+  pthread_t *threads;
+  size_t budget;     // bytes all images in flight may use together, 0 for no limit
+  size_t reserved;   // bytes estimated for the images in flight
+  int in_flight;     // queued or being stored
+  int finished;
+  // the export itself, shared by all workers
+  dt_job_t *job;
+  dt_control_export_t *settings;
+  dt_imageio_module_format_t *mformat;
+  dt_imageio_module_storage_t *mstorage;
+  dt_imageio_module_data_t *sdata;
+  dt_imageio_module_data_t *fdata; // template, every worker stores with its own copy
+  dt_export_metadata_t *metadata;
+  int total;
+} _export_scheduler_t;
+
+static int _export_concurrency(dt_imageio_module_format_t *mformat, dt_imageio_module_data_t *fdata,
+                               dt_imageio_module_storage_t *mstorage, const guint total)
+{
+  if(total < 2 || !mstorage->concurrent_store || !mstorage->concurrent_store(mstorage)) return 1;
+  if(mformat->flags(fdata) & FORMAT_FLAGS_NO_CONCURRENT) return 1;
+  const int max = dt_conf_get_int("max_concurrent_exports");
+  // by default a few pipes, each still keeping at least two cores busy
+  const int workers = max > 0 ? max : darktable.num_openmp_threads / 2;
+  return CLAMP(workers, 1, MIN(total, 16));
+}
+
+// mark an image as done, with its reservation if it was scheduled
+static void _export_finish_task(_export_scheduler_t *s, _export_task_t *task)
+{
+  dt_pthread_mutex_lock(&s->mutex);
+  if(task)
+  {
+    s->reserved -= task->memory;
+    s->in_flight--;
+  }
+  s->finished++;
+  dt_control_job_set_progress(s->job, MIN(1.0, (double)s->finished / s->total));
+  pthread_cond_broadcast(&s->cond);
+  dt_pthread_mutex_unlock(&s->mutex);
+  free(task);
+}
+
+static void *_export_worker(void *data)
+{
+  _export_scheduler_t *s = (_export_scheduler_t *)data;
+  dt_pthread_setname("export");
+#ifdef _OPENMP
+  // split the cores between the pipes instead of oversubscribing them
+  omp_set_num_threads(MAX(1, darktable.num_openmp_threads / s->workers));
+#endif
+  dt_tiling_set_host_memory_share(1.0f / s->workers);
+
+  dt_imageio_module_data_t *fdata = s->mformat->get_params(s->mformat);
+  memcpy(fdata, s->fdata, s->mformat->params_size(s->mformat));
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&s->mutex);
+    while(g_queue_is_empty(s->tasks) && !s->done) dt_pthread_cond_wait(&s->cond, &s->mutex);
+    _export_task_t *task = (_export_task_t *)g_queue_pop_head(s->tasks);
+    dt_pthread_mutex_unlock(&s->mutex);
+    if(!task) break;
+
+    dt_control_export_t *settings = s->settings;
+    if(dt_control_job_get_state(s->job) != DT_JOB_STATE_CANCELLED
+       && s->mstorage->store(s->mstorage, s->sdata, task->imgid, s->mformat, fdata, task->num, s->total,
+                             settings->high_quality, settings->upscale, settings->export_masks,
+                             settings->icc_type, settings->icc_filename, settings->icc_intent, s->metadata) != 0)
+      dt_control_job_cancel(s->job);
+
+    _export_finish_task(s, task);
+  }
+
+  s->mformat->free_params(s->mformat, fdata);
+  return NULL;
+}
+
+static _export_scheduler_t *_export_scheduler_start(dt_job_t *job, dt_control_export_t *settings,
+                                                    dt_imageio_module_format_t *mformat,
+                                                    dt_imageio_module_data_t *fdata,
+                                                    dt_imageio_module_storage_t *mstorage,
+                                                    dt_imageio_module_data_t *sdata,
+                                                    dt_export_metadata_t *metadata, const guint total)
+{
+  const int workers = _export_concurrency(mformat, fdata, mstorage, total);
+  if(workers < 2) return NULL;
+
+  _export_scheduler_t *s = (_export_scheduler_t *)calloc(1, sizeof(_export_scheduler_t));
+  dt_pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  s->tasks = g_queue_new();
+  s->workers = workers;
+  // never plan with more than half of the global memory budget, even without a host memory limit
+  const size_t host_limit = (size_t)MAX(dt_conf_get_int("host_memory_limit"), 0) * 1024 * 1024;
+  s->budget = dt_memory_governor_clamp(host_limit ? host_limit : SIZE_MAX, 0.5f);
+  if(s->budget == SIZE_MAX) s->budget = 0;
+  s->job = job;
+  s->settings = settings;
+  s->mformat = mformat;
+  s->mstorage = mstorage;
+  s->sdata = sdata;
+  s->fdata = fdata;
+  s->metadata = metadata;
+  s->total = total;
+  s->threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+  for(int k = 0; k < workers; k++) dt_pthread_create(&s->threads[k], _export_worker, s);
+
+  dt_print(DT_DEBUG_CONTROL, "[export_job] exporting with %d concurrent pipes, memory budget %zu MB\n", workers,
+           s->budget >> 20);
+  return s;
+}
+
+// wait until a worker is free and the image fits into the memory budget, then queue it
+static void _export_schedule(_export_scheduler_t *s, const int imgid, const int num)
+{
+  _export_task_t *task = (_export_task_t *)malloc(sizeof(_export_task_t));
+  task->imgid = imgid;
+  task->num = num;
+  task->memory = dt_imageio_export_memory_estimate(imgid, s->fdata->max_width, s->fdata->max_height,
+                                                   s->settings->high_quality, s->settings->upscale);
+  // an image larger than the whole budget just runs on its own
+  if(s->budget) task->memory = MIN(task->memory, s->budget);
+
+  dt_pthread_mutex_lock(&s->mutex);
+  while(s->in_flight >= s->workers || (s->budget && s->reserved + task->memory > s->budget))
+    dt_pthread_cond_wait(&s->cond, &s->mutex);
+  s->reserved += task->memory;
+  s->in_flight++;
+  g_queue_push_tail(s->tasks, task);
+  pthread_cond_broadcast(&s->cond);
+  dt_pthread_mutex_unlock(&s->mutex);
+}
+
+static void _export_scheduler_finish(_export_scheduler_t *s)
+{
+  dt_pthread_mutex_lock(&s->mutex);
+  s->done = TRUE;
+  pthread_cond_broadcast(&s->cond);
+  dt_pthread_mutex_unlock(&s->mutex);
+  for(int k = 0; k < s->workers; k++) pthread_join(s->threads[k], NULL);
+
+  free(s->threads);
+  g_queue_free(s->tasks);
+  pthread_cond_destroy(&s->cond);
+  dt_pthread_mutex_destroy(&s->mutex);
+  free(s);
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   dt_control_image_enumerator_t *params = (dt_control_image_enumerator_t *)dt_control_job_get_params(job);
@@ -1287,6 +1458,9 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     mstorage->set_params(mstorage, sdata, mstorage->params_size(mstorage));
   }
 
+  // get all image structs in one go, the storage might have changed the list
+  dt_image_cache_preload(darktable.image_cache, t);
+
   // Get max dimensions...
   uint32_t w, h, fw, fh, sw, sh;
   fw = fh = sw = sh = 0;
@@ -1328,6 +1502,9 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     metadata.list = g_list_remove(metadata.list, metadata.list->data);
   }
 
+  _export_scheduler_t *sched
+      = _export_scheduler_start(job, settings, mformat, fdata, mstorage, sdata, &metadata, total);
+
   while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
   {
     const int imgid = GPOINTER_TO_INT(t->data);
@@ -1365,6 +1542,12 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
       else
       {
         dt_image_cache_read_release(darktable.image_cache, image);
+        if(sched)
+        {
+          // the worker updates the progress once it's done
+          _export_schedule(sched, imgid, num);
+          continue;
+        }
         if(mstorage->store(mstorage, sdata, imgid, mformat, fdata, num, total, settings->high_quality, settings->upscale,
                            settings->export_masks, settings->icc_type, settings->icc_filename, settings->icc_intent,
                            &metadata) != 0)
@@ -1372,10 +1555,16 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
       }
     }
 
+    if(sched)
+    {
+      _export_finish_task(sched, NULL);
+      continue;
+    }
     fraction += 1.0 / total;
     if(fraction > 1.0) fraction = 1.0;
     dt_control_job_set_progress(job, fraction);
   }
+  if(sched) _export_scheduler_finish(sched);
   g_list_free_full(metadata.list, g_free);
 
   if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
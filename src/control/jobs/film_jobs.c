@@ -17,8 +17,15 @@
 */
 #include "control/jobs/film_jobs.h"
 #include "common/darktable.h"
+#include "common/debug.h"
 #include "common/film.h"
+#include "common/image.h"
+#include "control/conf.h"
 #include <stdlib.h>
+#include <string.h>
+
+// files recorded in one transaction. the lua events and signals for them follow the commit.
+#define DT_IMPORT_BATCH 256
 
 typedef struct dt_film_import1_t
 {
@@ -133,6 +140,170 @@ int _film_filename_cmp(gchar *a, gchar *b)
   return ret;
 }
 
+// pipelined import: the job thread records the files in the database, a few worker threads read
+// their exif data and sidecars (the bulk of the work, mostly waiting for the disk), then the job
+// thread finishes the batch in one transaction. the database connection is shared with every other
+// thread, so no transaction is held while the files are read: recording and reading write in
+// autocommit, which is cheap with wal or synchronous off, and only the finishing, done by the job
+// thread alone once the reads are through, is grouped.
+typedef struct _import_item_t
+{
+  dt_image_import_t import;
+  gboolean done; // read by a worker
+} _import_item_t;
+
+typedef struct _import_pool_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond; // a new item, or an item done
+  GQueue *tasks;       // waiting for a worker
+  gboolean quit;
+  int workers;
+  pthread_t *threads;
+} _import_pool_t;
+
+typedef struct _import_batch_t
+{
+  _import_pool_t *pool; // NULL reads in the job thread
+  _import_item_t items[DT_IMPORT_BATCH];
+  int count;
+  guint imported;       // files handled in earlier batches
+  guint total;
+  double start;
+} _import_batch_t;
+
+static void *_import_worker(void *data)
+{
+  _import_pool_t *pool = (_import_pool_t *)data;
+  dt_pthread_setname("import");
+
+  while(TRUE)
+  {
+    dt_pthread_mutex_lock(&pool->mutex);
+    while(g_queue_is_empty(pool->tasks) && !pool->quit) dt_pthread_cond_wait(&pool->cond, &pool->mutex);
+    _import_item_t *item = (_import_item_t *)g_queue_pop_head(pool->tasks);
+    dt_pthread_mutex_unlock(&pool->mutex);
+    if(!item) break;
+
+    dt_image_import_read(&item->import);
+
+    dt_pthread_mutex_lock(&pool->mutex);
+    item->done = TRUE;
+    pthread_cond_broadcast(&pool->cond);
+    dt_pthread_mutex_unlock(&pool->mutex);
+  }
+  return NULL;
+}
+
+static _import_pool_t *_import_pool_start(const guint total)
+{
+  const int max = dt_conf_get_int("import_threads");
+  // exiv2 mostly waits for the disk, a few threads are enough to keep it busy. before exiv2 0.27 readMetadata()
+  // is serialized by a global lock (see exif.cc), the threads then only overlap the sidecar and database work.
+  const int workers = CLAMP(max > 0 ? max : MIN(darktable.num_openmp_threads, 8), 1, MIN(total, 32));
+  if(workers < 2) return NULL;
+
+  _import_pool_t *pool = (_import_pool_t *)calloc(1, sizeof(_import_pool_t));
+  dt_pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  pool->tasks = g_queue_new();
+  pool->workers = workers;
+  pool->threads = (pthread_t *)calloc(workers, sizeof(pthread_t));
+  for(int k = 0; k < workers; k++) dt_pthread_create(&pool->threads[k], _import_worker, pool);
+
+  dt_print(DT_DEBUG_CONTROL, "[film_import] reading files with %d threads\n", workers);
+  return pool;
+}
+
+static void _import_pool_stop(_import_pool_t *pool)
+{
+  if(!pool) return;
+  dt_pthread_mutex_lock(&pool->mutex);
+  pool->quit = TRUE;
+  pthread_cond_broadcast(&pool->cond);
+  dt_pthread_mutex_unlock(&pool->mutex);
+  for(int k = 0; k < pool->workers; k++) pthread_join(pool->threads[k], NULL);
+  free(pool->threads);
+  g_queue_free(pool->tasks);
+  pthread_cond_destroy(&pool->cond);
+  dt_pthread_mutex_destroy(&pool->mutex);
+  free(pool);
+}
+
+static void _import_wait(_import_pool_t *pool, _import_item_t *item)
+{
+  if(!pool) return;
+  dt_pthread_mutex_lock(&pool->mutex);
+  while(!item->done) dt_pthread_cond_wait(&pool->cond, &pool->mutex);
+  dt_pthread_mutex_unlock(&pool->mutex);
+}
+
+// could recording filename regroup the image of the other one? see dt_image_import_record().
+static gboolean _import_related(const char *filename, const char *other)
+{
+  if(!other) return FALSE;
+  gchar *name = g_path_get_basename(filename);
+  gchar *dot = strrchr(name, '.');
+  if(dot) dot[1] = '\0';
+  gchar *other_name = g_path_get_basename(other);
+  const gboolean related = g_str_has_prefix(other_name, name);
+  g_free(name);
+  g_free(other_name);
+  return related;
+}
+
+static void _import_add(_import_batch_t *batch, const int32_t film_id, const char *filename)
+{
+  // a raw may take over the group of a jpeg with the same name, which then has to be read already
+  for(int k = 0; k < batch->count; k++)
+    if(_import_related(filename, batch->items[k].import.filename))
+      _import_wait(batch->pool, &batch->items[k]);
+
+  _import_item_t *item = &batch->items[batch->count++];
+  item->done = FALSE;
+  dt_image_import_record(&item->import, film_id, filename, FALSE);
+
+  if(batch->pool && item->import.id && !item->import.existing)
+  {
+    dt_pthread_mutex_lock(&batch->pool->mutex);
+    g_queue_push_tail(batch->pool->tasks, item);
+    pthread_cond_broadcast(&batch->pool->cond);
+    dt_pthread_mutex_unlock(&batch->pool->mutex);
+  }
+  else
+  {
+    dt_image_import_read(&item->import);
+    item->done = TRUE;
+  }
+}
+
+static void _import_flush(dt_job_t *job, _import_batch_t *batch)
+{
+  if(batch->count == 0) return;
+
+  for(int k = 0; k < batch->count; k++) _import_wait(batch->pool, &batch->items[k]);
+
+  // nests in a transaction another thread may have open, see dt_database_start_transaction()
+  dt_database_start_transaction(darktable.db);
+  for(int k = 0; k < batch->count; k++) dt_image_import_finish(&batch->items[k].import);
+  dt_database_release_transaction(darktable.db);
+
+  for(int k = 0; k < batch->count; k++)
+  {
+    dt_image_import_notify(&batch->items[k].import, TRUE);
+    dt_image_import_clear(&batch->items[k].import);
+  }
+  batch->imported += batch->count;
+  batch->count = 0;
+
+  gchar message[512] = { 0 };
+  const double elapsed = dt_get_wtime() - batch->start;
+  g_snprintf(message, sizeof(message) - 1, _("importing %u/%u images, %.0f files/s"), batch->imported,
+             batch->total, elapsed > 0.0 ? batch->imported / elapsed : 0.0);
+  dt_control_job_set_progress_message(job, message);
+  dt_control_job_set_progress(job, (double)batch->imported / batch->total);
+}
+
 static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 {
   gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
@@ -194,11 +365,14 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
 
   /* let's start import of images */
   gchar message[512] = { 0 };
-  double fraction = 0;
   guint total = g_list_length(images);
   g_snprintf(message, sizeof(message) - 1, ngettext("importing %d image", "importing %d images", total), total);
   dt_control_job_set_progress_message(job, message);
 
+  _import_batch_t *batch = (_import_batch_t *)calloc(1, sizeof(_import_batch_t));
+  batch->pool = _import_pool_start(total);
+  batch->total = total;
+  batch->start = dt_get_wtime();
 
   /* loop thru the images and import to current film roll */
   dt_film_t *cfr = film;
@@ -210,6 +384,9 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     /* check if we need to initialize a new filmroll */
     if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
     {
+      // the gpx is matched against the exif data of the film roll's images
+      _import_flush(job, batch);
+
       // FIXME: maybe refactor into function and call it?
       if(cfr && cfr->dir)
       {
@@ -253,14 +430,15 @@ static void dt_film_import1(dt_job_t *job, dt_film_t *film)
     g_free(cdn);
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
-
-    fraction += 1.0 / total;
-    dt_control_job_set_progress(job, fraction);
-
+    if(batch->count == DT_IMPORT_BATCH) _import_flush(job, batch);
+    _import_add(batch, cfr->id, (const gchar *)image->data);
 
   } while((image = g_list_next(image)) != NULL);
 
+  _import_flush(job, batch);
+  _import_pool_stop(batch->pool);
+  free(batch);
+
   g_list_free_full(images, g_free);
 
   // only redraw at the end, to not spam the cpu with exposure events
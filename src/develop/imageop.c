@@ -390,6 +390,11 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *op)
   if(!g_module_symbol(module->module, "process_sse2", (gpointer) & (module->process_sse2)))
     module->process_sse2 = NULL;
 
+  if(!g_module_symbol(module->module, "process_pixels", (gpointer) & (module->process_pixels)))
+    module->process_pixels = NULL;
+  if(!g_module_symbol(module->module, "process_pixels_setup", (gpointer) & (module->process_pixels_setup)))
+    module->process_pixels_setup = NULL;
+
   if(!g_module_symbol(module->module, "process", (gpointer) & (module->process_plain))) goto error;
 
   if(!darktable.opencl->inited
@@ -534,6 +539,8 @@ int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt
   module->process_tiling = so->process_tiling;
   module->process_plain = so->process_plain;
   module->process_sse2 = so->process_sse2;
+  module->process_pixels = so->process_pixels;
+  module->process_pixels_setup = so->process_pixels_setup;
   module->process_cl = so->process_cl;
   module->process_tiling_cl = so->process_tiling_cl;
   module->distort_transform = so->distort_transform;
@@ -1929,6 +1936,12 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
     // register if module allows tiling, commit_params can overwrite this.
     if(module->flags() & IOP_FLAGS_ALLOW_TILING) piece->process_tiling_ready = 1;
 
+    // assume the module changes pixels, commit_params can overwrite this.
+    piece->identity = 0;
+
+    // a module which may need the whole image does so, commit_params can overwrite this.
+    piece->tiling_barrier = (module->flags() & IOP_FLAGS_TILING_BARRIER) != 0;
+
     if(darktable.unmuted & DT_DEBUG_PARAMS && module->so->get_introspection())
       _iop_validate_params(module->so->get_introspection()->field, params, TRUE);
 
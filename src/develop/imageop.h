@@ -104,7 +104,9 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_NO_MASKS           = 1 << 10, // The module doesn't support masks (used with SUPPORT_BLENDING)
   IOP_FLAGS_FENCE              = 1 << 11, // No module can be moved pass this one
   IOP_FLAGS_ALLOW_FAST_PIPE    = 1 << 12, // Module can work with a fast pipe
-  IOP_FLAGS_UNSAFE_COPY        = 1 << 13  // Unsafe to copy as part of history
+  IOP_FLAGS_UNSAFE_COPY        = 1 << 13, // Unsafe to copy as part of history
+  IOP_FLAGS_TILING_BARRIER     = 1 << 14, // May need the full image (global statistics), fused pipe tiling has to materialize it, see piece->tiling_barrier
+  IOP_FLAGS_ROI_DEPENDENT      = 1 << 15  // Output depends on the processed region as a whole, can't be pieced together from parts
 } dt_iop_flags_t;
 
 /** status of a module*/
@@ -272,6 +274,9 @@ typedef struct dt_iop_module_so_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const i, float *const o, const size_t npixels);
+  void (*process_pixels_setup)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
                     const struct dt_iop_roi_t *const roi_out);
@@ -529,6 +534,11 @@ typedef struct dt_iop_module_t
   void (*process_sse2)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                        const void *const i, void *const o, const struct dt_iop_roi_t *const roi_in,
                        const struct dt_iop_roi_t *const roi_out);
+  /** per-pixel variant of process() for pointwise modules, the pipe may fuse several of these. */
+  void (*process_pixels)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                         const float *const i, float *const o, const size_t npixels);
+  /** what process() does besides touching pixels, called once before a fused pass. */
+  void (*process_pixels_setup)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
   /** the opencl equivalent of process(). */
   int (*process_cl)(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const void *const i,
                     void *const o, const struct dt_iop_roi_t *const roi_in,
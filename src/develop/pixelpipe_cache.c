@@ -17,11 +17,43 @@
 */
 
 #include "develop/pixelpipe_cache.h"
+#include "common/cache_stats.h"
+#include "common/memory_governor.h"
 #include "develop/format.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
 #include <stdlib.h>
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
 
+// the cache is only ever touched by its pipe's thread, so the governor just leaves a note
+static size_t _cache_governor_usage(void *data)
+{
+  const dt_dev_pixelpipe_cache_t *cache = (dt_dev_pixelpipe_cache_t *)data;
+  return __atomic_load_n(&cache->allmem, __ATOMIC_RELAXED);
+}
+
+static size_t _cache_governor_shrink(void *data, size_t bytes)
+{
+  dt_dev_pixelpipe_cache_t *cache = (dt_dev_pixelpipe_cache_t *)data;
+  __atomic_store_n(&cache->shrink_request, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// read from other threads, the counters might be a bit behind
+static void _cache_stats_fill(void *data, dt_cache_report_t *report)
+{
+  const dt_dev_pixelpipe_cache_t *cache = (dt_dev_pixelpipe_cache_t *)data;
+  const uint64_t queries = cache->queries, misses = cache->misses;
+  report->stats.hits = queries > misses ? queries - misses : 0;
+  report->stats.misses = misses;
+  report->stats.evictions = cache->evictions;
+  report->stats.resident = __atomic_load_n(&cache->allmem, __ATOMIC_RELAXED);
+  report->entries = cache->entries;
+  report->quota = cache->memlimit;
+}
 
 // TODO: make cache global (needs to be thread safe then)
 // plan:
@@ -32,18 +64,44 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size)
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memlimit)
 {
+  cache->min_entries = entries;
+  cache->max_entries = memlimit ? MAX(entries, DT_DEV_PIXELPIPE_CACHE_MAX_LINES) : entries;
   cache->entries = entries;
-  cache->data = (void **)calloc(entries, sizeof(void *));
-  cache->size = (size_t *)calloc(entries, sizeof(size_t));
-  cache->dsc = (dt_iop_buffer_dsc_t *)calloc(entries, sizeof(dt_iop_buffer_dsc_t));
+  cache->memlimit = memlimit;
+  cache->allmem = 0;
+  const int32_t lines = cache->max_entries;
+  cache->data = (void **)calloc(lines, sizeof(void *));
+  cache->size = (size_t *)calloc(lines, sizeof(size_t));
+  cache->dsc = (dt_iop_buffer_dsc_t *)calloc(lines, sizeof(dt_iop_buffer_dsc_t));
 #ifdef _DEBUG
-  memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * entries);
+  memset(cache->dsc, 0x2c, sizeof(dt_iop_buffer_dsc_t) * lines);
 #endif
-  cache->basichash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->hash = (uint64_t *)calloc(entries, sizeof(uint64_t));
-  cache->used = (int32_t *)calloc(entries, sizeof(int32_t));
+  cache->basichash = (uint64_t *)calloc(lines, sizeof(uint64_t));
+  cache->hash = (uint64_t *)calloc(lines, sizeof(uint64_t));
+  cache->used = (int64_t *)calloc(lines, sizeof(int64_t));
+  // keys point into cache->hash, which is never reallocated
+  cache->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+  for(int k = 0; k < lines; k++)
+  {
+    cache->basichash[k] = -1;
+    cache->hash[k] = -1;
+    cache->used[k] = 0;
+  }
+  cache->half_float = 0;
+  cache->packed = (uint8_t *)calloc(lines, sizeof(uint8_t));
+  for(int s = 0; s < 2; s++)
+  {
+    cache->scratch[s] = NULL;
+    cache->scratch_size[s] = cache->scratch_used[s] = 0;
+    cache->scratch_line[s] = -1;
+    cache->scratch_hash[s] = -1;
+    cache->scratch_dirty[s] = 0;
+  }
+  cache->scratch_last = 0;
+  cache->shrink_request = 0;
+  cache->queries = cache->misses = cache->evictions = 0;
   for(int k = 0; k < entries; k++)
   {
     cache->size[k] = size;
@@ -51,17 +109,16 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, si
     { // allow 0 initial buffer size (yet unknown dimensions)
       cache->data[k] = (void *)dt_alloc_align(64, size);
       if(!cache->data[k]) goto alloc_memory_fail;
+      cache->allmem += size;
 #ifdef _DEBUG
       memset(cache->data[k], 0x5d, size);
 #endif
       ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
     }
     else cache->data[k] = 0;
-    cache->basichash[k] = -1;
-    cache->hash[k] = -1;
-    cache->used[k] = 0;
   }
-  cache->queries = cache->misses = 0;
+  // only the growing caches are worth shrinking, the others are at their minimum anyway
+  if(memlimit) dt_memory_governor_register("pixelpipe", _cache_governor_usage, _cache_governor_shrink, cache);
   return 1;
 
 alloc_memory_fail:
@@ -76,12 +133,18 @@ alloc_memory_fail:
     cache->size[k] = 0;
     cache->data[k] = NULL;
   }
+  cache->allmem = 0;
   return 0;
 }
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
+  dt_cache_stats_unregister(cache);
+  if(cache->memlimit) dt_memory_governor_unregister(cache);
   for(int k = 0; k < cache->entries; k++) dt_free_align(cache->data[k]);
+  for(int s = 0; s < 2; s++) dt_free_align(cache->scratch[s]);
+  g_hash_table_destroy(cache->index);
+  free(cache->packed);
   free(cache->data);
   free(cache->dsc);
   free(cache->basichash);
@@ -90,39 +153,361 @@ void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
   free(cache->size);
 }
 
-uint64_t dt_dev_pixelpipe_cache_basichash(int imgid, struct dt_dev_pixelpipe_t *pipe, int module)
+void dt_dev_pixelpipe_cache_register_stats(dt_dev_pixelpipe_cache_t *cache, const char *name)
 {
-  // bernstein hash (djb2)
-  // the hash is made of imgid and the actual fast-pipe mode if activated
-  uint64_t hash = 5381 + imgid + (pipe->type & DT_DEV_PIXELPIPE_FAST);
-  // go through all modules up to module and compute a weird hash using the operation and params.
-  GList *pieces = pipe->nodes;
-  for(int k = 0; k < module && pieces; k++)
+  dt_cache_stats_unregister(cache);
+  dt_cache_stats_register(name, _cache_stats_fill, cache);
+}
+
+void dt_dev_pixelpipe_cache_set_half_float(dt_dev_pixelpipe_cache_t *cache, const int half_float)
+{
+  // only affects lines allocated from now on, packed lines stay valid
+  cache->half_float = half_float;
+}
+
+typedef union _cache_fp32_t
+{
+  uint32_t u;
+  float f;
+} _cache_fp32_t;
+
+// from https://gist.github.com/rygorous/2156668 (round to nearest even)
+static inline uint16_t _cache_float_to_half(const float f)
+{
+  static const _cache_fp32_t denorm_magic = { ((127 - 15) + (23 - 10) + 1) << 23 };
+  const uint32_t f16max = (127 + 16) << 23;
+  _cache_fp32_t in = { .f = f };
+  const uint32_t sign = in.u & 0x80000000u;
+  in.u ^= sign;
+
+  uint16_t o;
+  if(in.u >= f16max) // out of range, we clamp before, so this is NaN
+    o = 0x7e00;
+  else if(in.u < (113 << 23)) // subnormal or zero
   {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
-    dt_develop_t *dev = piece->module->dev;
-    if(!(dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags())))
+    in.f += denorm_magic.f;
+    o = in.u - denorm_magic.u;
+  }
+  else
+  {
+    const uint32_t mant_odd = (in.u >> 13) & 1;
+    in.u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    in.u += mant_odd;
+    o = in.u >> 13;
+  }
+  return o | (sign >> 16);
+}
+
+// from https://gist.github.com/rygorous/2156668
+static inline float _cache_half_to_float(const uint16_t h)
+{
+  static const _cache_fp32_t magic = { 113 << 23 };
+  const uint32_t shifted_exp = 0x7c00 << 13;
+  _cache_fp32_t o;
+
+  o.u = (h & 0x7fff) << 13;
+  const uint32_t exp = shifted_exp & o.u;
+  o.u += (127 - 15) << 23;
+  if(exp == shifted_exp) // Inf/NaN
+    o.u += (128 - 16) << 23;
+  else if(exp == 0) // zero/denormal
+  {
+    o.u += 1 << 23;
+    o.f -= magic.f;
+  }
+  o.u |= (h & 0x8000) << 16;
+  return o.f;
+}
+
+// largest finite half float, everything beyond would turn into inf
+#define DT_CACHE_HALF_MAX 65504.0f
+
+static void _cache_pack(uint16_t *const out, const float *const in, const size_t n)
+{
+  const size_t blocks = n / 4;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(in, out, blocks) schedule(static)
+#endif
+  for(size_t b = 0; b < blocks; b++)
+  {
+#if defined(__F16C__)
+    const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + 4 * b), _mm_set1_ps(-DT_CACHE_HALF_MAX)),
+                                _mm_set1_ps(DT_CACHE_HALF_MAX));
+    _mm_storel_epi64((__m128i *)(out + 4 * b), _mm_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+#else
+    for(int c = 0; c < 4; c++)
+      out[4 * b + c] = _cache_float_to_half(CLAMPS(in[4 * b + c], -DT_CACHE_HALF_MAX, DT_CACHE_HALF_MAX));
+#endif
+  }
+  for(size_t k = 4 * blocks; k < n; k++)
+    out[k] = _cache_float_to_half(CLAMPS(in[k], -DT_CACHE_HALF_MAX, DT_CACHE_HALF_MAX));
+}
+
+static void _cache_unpack(float *const out, const uint16_t *const in, const size_t n)
+{
+  const size_t blocks = n / 4;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(in, out, blocks) schedule(static)
+#endif
+  for(size_t b = 0; b < blocks; b++)
+  {
+#if defined(__F16C__)
+    _mm_storeu_ps(out + 4 * b, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + 4 * b))));
+#else
+    for(int c = 0; c < 4; c++) out[4 * b + c] = _cache_half_to_float(in[4 * b + c]);
+#endif
+  }
+  for(size_t k = 4 * blocks; k < n; k++) out[k] = _cache_half_to_float(in[k]);
+}
+
+// pack a scratch buffer into its line. claims on lines which got reused or invalidated
+// meanwhile are dropped by _cache_set_hash() already.
+static void _cache_scratch_flush(dt_dev_pixelpipe_cache_t *cache, const int s)
+{
+  const int k = cache->scratch_line[s];
+  if(cache->scratch_dirty[s] && k >= 0 && cache->packed[k] && cache->data[k]
+     && cache->hash[k] == cache->scratch_hash[s])
+  {
+    const size_t n = MIN(cache->scratch_used[s], 2 * cache->size[k]) / sizeof(float);
+    _cache_pack((uint16_t *)cache->data[k], (const float *)cache->scratch[s], n);
+  }
+  cache->scratch_dirty[s] = 0;
+}
+
+// hand out a float buffer for packed line k. the scratch buffer handed out last is left alone,
+// it's the input of the module asking for its output now.
+static void *_cache_scratch_get(dt_dev_pixelpipe_cache_t *cache, const int k, const size_t size)
+{
+  const int s = 1 - cache->scratch_last;
+  _cache_scratch_flush(cache, s);
+  if(cache->scratch_size[s] < size)
+  {
+    dt_free_align(cache->scratch[s]);
+    cache->scratch[s] = dt_alloc_align(64, size);
+    cache->scratch_size[s] = cache->scratch[s] ? size : 0;
+  }
+  // always dirty: modules convert their input colorspace in place, and update the line's dsc with it
+  cache->scratch_line[s] = cache->scratch[s] ? k : -1;
+  cache->scratch_hash[s] = cache->hash[k];
+  cache->scratch_used[s] = size;
+  cache->scratch_dirty[s] = 1;
+  cache->scratch_last = s;
+  return cache->scratch[s];
+}
+
+// the scratch buffer currently holding line k, -1 if there is none
+static inline int _cache_scratch_find(const dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  for(int s = 0; s < 2; s++)
+    if(cache->scratch_line[s] == k && cache->scratch_hash[s] == cache->hash[k]) return s;
+  return -1;
+}
+
+// map a buffer handed out by the cache back to its line, -1 if it isn't ours
+static int _cache_find_data(const dt_dev_pixelpipe_cache_t *cache, const void *data)
+{
+  if(!data) return -1;
+  for(int s = 0; s < 2; s++)
+    if(cache->scratch[s] == data) return cache->scratch_line[s];
+  for(int k = 0; k < cache->entries; k++)
+    if(cache->data[k] == data) return k;
+  return -1;
+}
+
+// look up the line holding the given hash, -1 if there is none
+static inline int _cache_lookup(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
+{
+  const int k = GPOINTER_TO_INT(g_hash_table_lookup(cache->index, &hash)) - 1;
+  return k;
+}
+
+// line k gets a new content, scratch buffers still holding the old one must not be packed into it
+static inline void _cache_scratch_release(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  for(int s = 0; s < 2; s++)
+    if(cache->scratch_line[s] == k)
     {
-      hash = ((hash << 5) + hash) ^ piece->hash;
-      if(piece->module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
-      {
-        if(darktable.lib->proxy.colorpicker.size)
-        {
-          const char *str = (const char *)piece->module->color_picker_box;
-          for(size_t i = 0; i < sizeof(float) * 4; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
-        else
-        {
-          const char *str = (const char *)piece->module->color_picker_point;
-          for(size_t i = 0; i < sizeof(float) * 2; i++) hash = ((hash << 5) + hash) ^ str[i];
-        }
-      }
+      cache->scratch_line[s] = -1;
+      cache->scratch_dirty[s] = 0;
+    }
+}
+
+// (re)assign the hashes of line k, keeping the index in sync
+static void _cache_set_hash(dt_dev_pixelpipe_cache_t *cache, const int k, const uint64_t basichash,
+                            const uint64_t hash)
+{
+  _cache_scratch_release(cache, k);
+  if(cache->hash[k] != (uint64_t)-1) g_hash_table_remove(cache->index, &cache->hash[k]);
+  cache->basichash[k] = basichash;
+  cache->hash[k] = hash;
+  if(hash != (uint64_t)-1)
+  {
+    // a stale line with the same hash would shadow this one, drop it from the index
+    const int old = _cache_lookup(cache, hash);
+    if(old >= 0 && old != k)
+    {
+      g_hash_table_remove(cache->index, &hash);
+      _cache_scratch_release(cache, old);
+      cache->basichash[old] = -1;
+      cache->hash[old] = -1;
     }
+    g_hash_table_insert(cache->index, &cache->hash[k], GINT_TO_POINTER(k + 1));
+  }
+}
+
+// release the memory of line k, it stays around as an empty line
+static void _cache_free_line(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  _cache_set_hash(cache, k, -1, -1);
+  cache->allmem -= cache->size[k];
+  dt_free_align(cache->data[k]);
+  cache->data[k] = NULL;
+  cache->size[k] = 0;
+}
+
+// find a line for a new buffer of the given size: a new one if the budget allows it,
+// otherwise the weighted least recently used, preferring invalidated lines.
+static int _cache_get_line(dt_dev_pixelpipe_cache_t *cache, const size_t size)
+{
+  if(cache->entries < cache->max_entries && cache->allmem + size <= cache->memlimit)
+    return cache->entries++;
+
+  int victim = 0;
+  int invalid = -1;
+  for(int k = 0; k < cache->entries; k++)
+  {
+    if(cache->hash[k] == (uint64_t)-1)
+    {
+      // prefer a free line which is large enough already, avoids a reallocation
+      if(invalid < 0 || (cache->size[invalid] < size && cache->size[k] >= size)) invalid = k;
+    }
+    if(cache->used[k] < cache->used[victim]) victim = k;
+  }
+  if(invalid >= 0) return invalid;
+  cache->evictions++;
+  return victim;
+}
+
+// free old lines while we exceed the given limit. only lines which a fixed cache of
+// min_entries lines would have recycled already are touched, so buffers still used by
+// the pipe (input of the current module, backbuf) stay valid.
+static void _cache_shrink(dt_dev_pixelpipe_cache_t *cache, const int keep, const size_t limit)
+{
+  const int64_t now = cache->queries;
+  while(cache->allmem > limit)
+  {
+    int victim = -1;
+    int allocated = 0;
+    for(int k = 0; k < cache->entries; k++)
+    {
+      if(cache->data[k]) allocated++;
+      if(k == keep || !cache->data[k] || now - cache->used[k] <= cache->min_entries) continue;
+      if(victim < 0 || cache->used[k] < cache->used[victim]) victim = k;
+    }
+    // never go below the lines a fixed size cache would hold
+    if(victim < 0 || allocated <= cache->min_entries) break;
+    if(cache->hash[victim] != (uint64_t)-1) cache->evictions++;
+    _cache_free_line(cache, victim);
+  }
+}
+
+// the hash is made of imgid and the actual fast-pipe mode if activated
+static inline uint64_t _cache_hash_seed(const int imgid, const dt_dev_pixelpipe_t *pipe)
+{
+  return dt_dev_pixelpipe_cache_hash_mix(dt_dev_pixelpipe_cache_hash_mix(5381, imgid),
+                                         pipe->type & DT_DEV_PIXELPIPE_FAST);
+}
+
+// modules filtered out by the focused module (e.g. distortions while cropping) don't contribute
+static inline int _cache_tags_filter(const dt_dev_pixelpipe_t *pipe)
+{
+  if(!pipe->nodes) return 0;
+  const dt_develop_t *dev = ((dt_dev_pixelpipe_iop_t *)pipe->nodes->data)->module->dev;
+  return dev->gui_module ? dev->gui_module->operation_tags_filter() : 0;
+}
+
+// what a piece adds to the hash of the stack: its params hash and the color picker state.
+// 0 means the piece is skipped.
+static uint64_t _cache_piece_hash(const dt_dev_pixelpipe_iop_t *piece, const int filter)
+{
+  if(filter & piece->module->operation_tags()) return 0;
+  uint64_t hash = dt_dev_pixelpipe_cache_hash_mix(0, piece->hash);
+  if(piece->module->request_color_pick != DT_REQUEST_COLORPICK_OFF)
+  {
+    const int box = darktable.lib->proxy.colorpicker.size;
+    const float *pick = box ? piece->module->color_picker_box : piece->module->color_picker_point;
+    for(int i = 0; i < (box ? 4 : 2); i++)
+    {
+      uint32_t bits;
+      memcpy(&bits, pick + i, sizeof(bits));
+      hash = dt_dev_pixelpipe_cache_hash_mix(hash, bits);
+    }
+    hash = dt_dev_pixelpipe_cache_hash_mix(hash, box);
+  }
+  return hash;
+}
+
+void dt_dev_pixelpipe_cache_update_hashes(struct dt_dev_pixelpipe_t *pipe)
+{
+  const int n = g_list_length(pipe->nodes);
+  if(n != pipe->hash_prefix_len || !pipe->hash_prefix)
+  {
+    pipe->hash_prefix = (uint64_t *)realloc(pipe->hash_prefix, sizeof(uint64_t) * (n + 1));
+    pipe->hash_pieces = (uint64_t *)realloc(pipe->hash_pieces, sizeof(uint64_t) * (n + 1));
+    pipe->hash_prefix_len = n;
+    pipe->hash_prefix_valid = 0;
+  }
+
+  const uint64_t seed = _cache_hash_seed(pipe->image.id, pipe);
+  if(pipe->hash_prefix_valid < 1 || pipe->hash_prefix[0] != seed)
+  {
+    pipe->hash_prefix[0] = seed;
+    pipe->hash_prefix_valid = 1;
+  }
+  const int filter = _cache_tags_filter(pipe);
+  if(filter != pipe->hash_prefix_filter)
+  {
+    pipe->hash_prefix_filter = filter;
+    pipe->hash_prefix_valid = 1;
+  }
+
+  // only rehash from the first piece whose contribution changed onward
+  int k = 0;
+  for(GList *pieces = pipe->nodes; pieces; pieces = g_list_next(pieces), k++)
+  {
+    const uint64_t piece_hash = _cache_piece_hash((dt_dev_pixelpipe_iop_t *)pieces->data, filter);
+    if(k + 1 < pipe->hash_prefix_valid && piece_hash == pipe->hash_pieces[k]) continue;
+    pipe->hash_pieces[k] = piece_hash;
+    pipe->hash_prefix[k + 1] = piece_hash ? dt_dev_pixelpipe_cache_hash_mix(pipe->hash_prefix[k], piece_hash)
+                                          : pipe->hash_prefix[k];
+    pipe->hash_prefix_valid = k + 2;
+  }
+}
+
+// walk the module stack without using the prefix array
+static uint64_t _cache_basichash_walk(const int imgid, dt_dev_pixelpipe_t *pipe, const int module)
+{
+  const int filter = _cache_tags_filter(pipe);
+  uint64_t hash = _cache_hash_seed(imgid, pipe);
+  GList *pieces = pipe->nodes;
+  for(int k = 0; k < module && pieces; k++)
+  {
+    const uint64_t piece_hash = _cache_piece_hash((dt_dev_pixelpipe_iop_t *)pieces->data, filter);
+    if(piece_hash) hash = dt_dev_pixelpipe_cache_hash_mix(hash, piece_hash);
     pieces = g_list_next(pieces);
   }
   return hash;
 }
 
+uint64_t dt_dev_pixelpipe_cache_basichash(int imgid, struct dt_dev_pixelpipe_t *pipe, int module)
+{
+  // the prefix array is refreshed at the start of every pipe run and after synching the history,
+  // so during processing this is a plain lookup.
+  if(module >= 0 && module < pipe->hash_prefix_valid && pipe->hash_prefix[0] == _cache_hash_seed(imgid, pipe))
+    return pipe->hash_prefix[module];
+  return _cache_basichash_walk(imgid, pipe, module);
+}
+
 uint64_t dt_dev_pixelpipe_cache_basichash_prior(int imgid, struct dt_dev_pixelpipe_t *pipe,
                                                 const dt_iop_module_t *const module)
 {
@@ -143,7 +528,8 @@ uint64_t dt_dev_pixelpipe_cache_basichash_prior(int imgid, struct dt_dev_pixelpi
     pieces = g_list_next(pieces);
     modules = g_list_next(modules);
   }
-  return last>=0 ? dt_dev_pixelpipe_cache_basichash(imgid, pipe, last) : -1;
+  // called from the gui thread while the pipe might be running, don't touch the prefix array
+  return last>=0 ? _cache_basichash_walk(imgid, pipe, last) : -1;
 }
 
 void dt_dev_pixelpipe_cache_fullhash(int imgid, const dt_iop_roi_t *roi, struct dt_dev_pixelpipe_t *pipe, int module,
@@ -151,9 +537,11 @@ void dt_dev_pixelpipe_cache_fullhash(int imgid, const dt_iop_roi_t *roi, struct
 {
   uint64_t hash = *basichash = dt_dev_pixelpipe_cache_basichash(imgid, pipe, module);
   // also add scale, x and y:
-  const char *str = (const char *)roi;
-  for(size_t i = 0; i < sizeof(dt_iop_roi_t); i++)
-    hash = ((hash << 5) + hash) ^ str[i];
+  hash = dt_dev_pixelpipe_cache_hash_mix(hash, ((uint64_t)(uint32_t)roi->x << 32) | (uint32_t)roi->y);
+  hash = dt_dev_pixelpipe_cache_hash_mix(hash, ((uint64_t)(uint32_t)roi->width << 32) | (uint32_t)roi->height);
+  uint32_t scale;
+  memcpy(&scale, &roi->scale, sizeof(scale));
+  hash = dt_dev_pixelpipe_cache_hash_mix(hash, scale);
   *fullhash = hash;
 }
 
@@ -167,9 +555,7 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
-  for(int32_t k = 0; k < cache->entries; k++)
-    if(cache->hash[k] == hash) return 1;
-  return 0;
+  return _cache_lookup(cache, hash) >= 0;
 }
 
 int dt_dev_pixelpipe_cache_get_important(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash,
@@ -185,71 +571,100 @@ int dt_dev_pixelpipe_cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t b
   return dt_dev_pixelpipe_cache_get_weighted(cache, basichash, hash, size, data, dsc, 0);
 }
 
-int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash, const uint64_t hash,
-                                        const size_t size, void **data, dt_iop_buffer_dsc_t **dsc, int weight)
+static int _cache_get(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash, const uint64_t hash,
+                      const size_t size, void **data, dt_iop_buffer_dsc_t **dsc, const int weight,
+                      const int full_precision)
 {
-  cache->queries++;
+  // every query ages all other lines by one, a positive weight makes this line look older,
+  // a negative one keeps it around for longer.
+  const int64_t now = ++cache->queries;
   *data = NULL;
-  int max_used = -1, max = 0;
-  size_t sz = 0;
-  for(int k = 0; k < cache->entries; k++)
+
+  int k = _cache_lookup(cache, hash);
+  if(k >= 0 && (cache->packed[k] ? 2 * cache->size[k] : cache->size[k]) >= size)
   {
-    // search for hash in cache
-    if(cache->used[k] > max_used)
+    *dsc = &cache->dsc[k];
+    cache->used[k] = now - weight; // this is the MRU entry
+
+    if(cache->packed[k])
     {
-      max_used = cache->used[k];
-      max = k;
+      // still around in float from a previous request, or unpack into a scratch buffer
+      const int s = _cache_scratch_find(cache, k);
+      if(s >= 0)
+      {
+        cache->scratch_last = s;
+        *data = cache->scratch[s];
+        return 0;
+      }
+      *data = _cache_scratch_get(cache, k, size);
+      if(*data) _cache_unpack((float *)*data, (const uint16_t *)cache->data[k], size / sizeof(float));
+      return 0;
     }
-    cache->used[k]++; // age all entries
-    if(cache->hash[k] == hash)
-    {
-      *data = cache->data[k];
-      *dsc = &cache->dsc[k];
-      sz = cache->size[k];
-      cache->used[k] = weight; // this is the MRU entry
 
-      ASAN_POISON_MEMORY_REGION(*data, sz);
-      ASAN_UNPOISON_MEMORY_REGION(*data, size);
-    }
+    *data = cache->data[k];
+    ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+    return 0;
   }
 
-  if(!*data || sz < size)
+  // not found (or too small): get a new line or kill the LRU entry.
+  // float lines are stored as fp16 if asked to, display data written by gamma never is.
+  const int pack = cache->half_float && full_precision == 0 && (*dsc)->datatype == TYPE_FLOAT
+                   && size % (2 * sizeof(float)) == 0;
+  const size_t line_size = pack ? size / 2 : size;
+  if(k < 0) k = _cache_get_line(cache, line_size);
+  if(cache->size[k] < line_size)
   {
-    // kill LRU entry
-    // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries,
-    // weight);
-    if(cache->size[max] < size)
-    {
-      dt_free_align(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(64, size);
-      cache->size[max] = size;
-    }
-    *data = cache->data[max];
-    sz = cache->size[max];
+    cache->allmem -= cache->size[k];
+    dt_free_align(cache->data[k]);
+    cache->data[k] = (void *)dt_alloc_align(64, line_size);
+    cache->size[k] = line_size;
+    cache->allmem += line_size;
+  }
+  cache->packed[k] = pack;
 
-    ASAN_POISON_MEMORY_REGION(*data, sz);
-    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+  // first, update our copy, then update the pointer to point at our copy
+  cache->dsc[k] = **dsc;
+  *dsc = &cache->dsc[k];
 
-    // first, update our copy, then update the pointer to point at our copy
-    cache->dsc[max] = **dsc;
-    *dsc = &cache->dsc[max];
+  _cache_set_hash(cache, k, basichash, hash);
+  cache->used[k] = now - weight;
+  cache->misses++;
 
-    cache->basichash[max] = basichash;
-    cache->hash[max] = hash;
-    cache->used[max] = weight;
-    cache->misses++;
-    return 1;
-  }
+  if(pack)
+    *data = _cache_scratch_get(cache, k, size);
   else
-    return 0;
+  {
+    *data = cache->data[k];
+    ASAN_POISON_MEMORY_REGION(*data, cache->size[k]);
+    ASAN_UNPOISON_MEMORY_REGION(*data, size);
+  }
+
+  // the memory governor asked us to give back everything beyond the minimum
+  const size_t limit
+      = __atomic_exchange_n(&cache->shrink_request, 0, __ATOMIC_ACQ_REL) ? 0 : cache->memlimit;
+  if(cache->memlimit && cache->allmem > limit) _cache_shrink(cache, k, limit);
+  return 1;
+}
+
+int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash, const uint64_t hash,
+                                        const size_t size, void **data, dt_iop_buffer_dsc_t **dsc, int weight)
+{
+  return _cache_get(cache, basichash, hash, size, data, dsc, weight, 0);
+}
+
+int dt_dev_pixelpipe_cache_get_full_precision(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash,
+                                              const uint64_t hash, const size_t size, void **data,
+                                              dt_iop_buffer_dsc_t **dsc, int weight)
+{
+  return _cache_get(cache, basichash, hash, size, data, dsc, weight, 1);
 }
 
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k = 0; k < cache->entries; k++)
   {
-    cache->basichash[k] = -1;
-    cache->hash[k] = -1;
+    _cache_set_hash(cache, k, -1, -1);
     cache->used[k] = 0;
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
@@ -261,8 +676,7 @@ void dt_dev_pixelpipe_cache_flush_all_but(dt_dev_pixelpipe_cache_t *cache, uint6
   {
     if (cache->basichash[k] == basichash)
       continue;
-    cache->basichash[k] = -1;
-    cache->hash[k] = -1;
+    _cache_set_hash(cache, k, -1, -1);
     cache->used[k] = 0;
     ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
   }
@@ -270,26 +684,16 @@ void dt_dev_pixelpipe_cache_flush_all_but(dt_dev_pixelpipe_cache_t *cache, uint6
 
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
-  for(int k = 0; k < cache->entries; k++)
-  {
-    if(cache->data[k] == data)
-    {
-      cache->used[k] = -cache->entries;
-    }
-  }
+  const int k = _cache_find_data(cache, data);
+  if(k >= 0) cache->used[k] = cache->queries + cache->entries;
 }
 
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data)
 {
-  for(int k = 0; k < cache->entries; k++)
-  {
-    if(cache->data[k] == data)
-    {
-      cache->basichash[k] = -1;
-      cache->hash[k] = -1;
-      ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
-    }
-  }
+  const int k = _cache_find_data(cache, data);
+  if(k < 0) return;
+  _cache_set_hash(cache, k, -1, -1);
+  ASAN_POISON_MEMORY_REGION(cache->data[k], cache->size[k]);
 }
 
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
@@ -297,9 +701,14 @@ void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
   for(int k = 0; k < cache->entries; k++)
   {
     printf("pixelpipe cacheline %d ", k);
-    printf("used %d by %" PRIu64 " (%" PRIu64 ")", cache->used[k], cache->hash[k], cache->basichash[k]);
+    printf("age %" PRId64 " size %zu%s by %" PRIu64 " (%" PRIu64 ")", (int64_t)cache->queries - cache->used[k],
+           cache->size[k], cache->packed[k] ? " (fp16)" : "", cache->hash[k], cache->basichash[k]);
     printf("\n");
   }
+  printf("cache lines %d/%d, %.1f/%.1f MB\n", cache->entries, cache->max_entries,
+         cache->allmem / (1024.0 * 1024.0), cache->memlimit / (1024.0 * 1024.0));
+  printf("cache queries %" PRIu64 ", hits %" PRIu64 ", misses %" PRIu64 ", evictions %" PRIu64 "\n",
+         cache->queries, cache->queries - cache->misses, cache->misses, cache->evictions);
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses) / (float)cache->queries);
 }
 
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <glib.h>
 #include <inttypes.h>
 
 struct dt_dev_pixelpipe_t;
@@ -25,34 +26,81 @@ struct dt_iop_buffer_dsc_t;
 struct dt_iop_roi_t;
 
 /**
- * implements a simple pixel cache suitable for caching float images
+ * implements a pixel cache suitable for caching float images
  * corresponding to history items and zoom/pan settings in the develop module.
- * it is optimized for very few entries (~5), so most operations are O(N).
+ * lines are found through a hash index on the full hash. the cache always keeps
+ * a minimum number of lines and grows further as long as the memory budget allows,
+ * evicting the least recently used lines (weighted by the important/weighted hints) otherwise.
  */
 
+/** upper bound of cache lines a single pipe cache may grow to. */
+#define DT_DEV_PIXELPIPE_CACHE_MAX_LINES 128
+
 typedef struct dt_dev_pixelpipe_cache_t
 {
-  int32_t entries;
+  int32_t entries;     // lines currently in use
+  int32_t min_entries; // lines we always keep, regardless of the memory budget
+  int32_t max_entries; // capacity of the arrays below
+  size_t memlimit;     // memory budget in bytes, lines beyond min_entries are only added while all fit
+  size_t allmem;       // bytes currently allocated by all lines
   void **data;
   size_t *size;
   struct dt_iop_buffer_dsc_t *dsc;
   uint64_t *basichash;
   uint64_t *hash;
-  int32_t *used;
+  int64_t *used;       // time stamp of last use, shifted by the weight. old lines have small values.
+  GHashTable *index;   // &hash[k] -> k + 1 for all valid lines
 #ifdef HAVE_OPENCL
   void **gpu_mem;
 #endif
+  // half float storage: float lines are kept as fp16 in the cache line and handed out
+  // to the pipe through one of two float scratch buffers, packed back lazily once the
+  // scratch buffer is needed again.
+  int half_float;          // store new float lines packed
+  uint8_t *packed;         // line holds fp16 data, half the size of the float buffer
+  void *scratch[2];
+  size_t scratch_size[2];
+  size_t scratch_used[2];  // bytes of float data the scratch buffer was handed out for
+  int scratch_line[2];     // line the scratch buffer belongs to, -1 for none
+  uint64_t scratch_hash[2];// hash of that line at the time the scratch buffer was handed out
+  int scratch_dirty[2];    // scratch buffer content still needs to be packed into its line
+  int scratch_last;        // scratch buffer handed out last, the next request uses the other one
+  int shrink_request;      // set by the memory governor, the pipe frees down to min_entries on its next miss
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  uint64_t evictions;
 } dt_dev_pixelpipe_cache_t;
 
-/** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+/** constructs a new cache with given minimum cache line count (entries), float buffer entry size in bytes
+  and memory budget in bytes. if the budget is non-zero the cache grows beyond entries as long as all lines
+  together stay within it.
   \param[out] returns 0 if fail to allocate mem cache.
 */
-int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size);
+int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, size_t size, size_t memlimit);
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache);
+/** make the counters of this cache available through the cache statistics, until cleanup. */
+void dt_dev_pixelpipe_cache_register_stats(dt_dev_pixelpipe_cache_t *cache, const char *name);
+
+/** store float buffers as half floats, doubling the number of lines that fit into the memory budget.
+  * modules still get float buffers, only data read back from the cache goes through fp16. */
+void dt_dev_pixelpipe_cache_set_half_float(dt_dev_pixelpipe_cache_t *cache, const int half_float);
 
+/** combine a 64-bit value into a hash (hash_combine followed by the splitmix64 finalizer). */
+static inline uint64_t dt_dev_pixelpipe_cache_hash_mix(uint64_t hash, const uint64_t value)
+{
+  hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ull;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebull;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+/** brings the per-pipe prefix hashes of the module stack up to date, rehashing only from the first
+  * piece whose params or color picker state changed. */
+void dt_dev_pixelpipe_cache_update_hashes(struct dt_dev_pixelpipe_t *pipe);
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
 uint64_t dt_dev_pixelpipe_cache_basichash(int imgid, struct dt_dev_pixelpipe_t *pipe, int module);
 /** creates a hopefully unique hash from the complete module stack up to the module-th, including current viewport. */
@@ -77,6 +125,12 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
                                         const uint64_t hash, const size_t size,
                                         void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
 
+/** same as dt_dev_pixelpipe_cache_get_weighted(), but a new line is never stored as half floats.
+  * used for buffers which don't hold floats despite their format, like the 8-bit output of gamma. */
+int dt_dev_pixelpipe_cache_get_full_precision(dt_dev_pixelpipe_cache_t *cache, const uint64_t basichash,
+                                              const uint64_t hash, const size_t size,
+                                              void **data, struct dt_iop_buffer_dsc_t **dsc, int weight);
+
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
@@ -92,7 +146,7 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
-/** print out cache lines/hashes (debug). */
+/** print out cache lines/hashes and hit/miss/eviction counters (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
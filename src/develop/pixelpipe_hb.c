@@ -21,12 +21,16 @@
 #include "common/imageio.h"
 #include "common/opencl.h"
 #include "common/iop_order.h"
+#include "common/memory_governor.h"
+#include "common/scratch.h"
+#include "common/trace.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/format.h"
 #include "develop/imageop_math.h"
 #include "develop/pixelpipe.h"
+#include "develop/stage_cache.h"
 #include "develop/tiling.h"
 #include "develop/masks.h"
 #include "gui/gtk.h"
@@ -42,6 +46,9 @@
 #include <strings.h>
 #include <unistd.h>
 
+// longest run of pointwise modules processed in one pass
+#define DT_DEV_PIXELPIPE_FUSE_MAX 32
+
 typedef enum dt_pixelpipe_flow_t
 {
   PIXELPIPE_FLOW_NONE = 0,
@@ -108,26 +115,66 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+// write a chrome trace event for a module run or cache hit in the pipe, see --trace
+static void _trace_module(dt_dev_pixelpipe_t *pipe, const dt_iop_module_t *module, const dt_iop_roi_t *roi_in,
+                          const dt_iop_roi_t *roi_out, const dt_times_t *start,
+                          const dt_pixelpipe_flow_t pixelpipe_flow, const gboolean cache_hit,
+                          const size_t bytes)
+{
+  dt_times_t end;
+  dt_get_times(&end);
+
+  gchar *instance = dt_trace_escape(module ? module->multi_name : "");
+  gchar *name = g_strdup_printf("%s%s%s", module ? module->op : "input", *instance ? " " : "", instance);
+  const char *path = cache_hit ? "cache"
+                     : pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_GPU ? "GPU"
+                     : pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_ON_CPU ? "CPU" : "copy";
+  gchar *args = g_strdup_printf(
+      "\"pipe\":\"%s\",\"module\":\"%s\",\"instance\":\"%s\",\"roi_in\":[%d,%d],\"roi_out\":[%d,%d],"
+      "\"path\":\"%s\",\"tiled\":%s,\"cache\":\"%s\",\"bytes\":%zu,\"wall\":%.6f,\"cpu\":%.6f",
+      _pipe_type_to_str(pipe->type), module ? module->op : "input", instance, roi_in->width, roi_in->height,
+      roi_out->width, roi_out->height, path,
+      pixelpipe_flow & PIXELPIPE_FLOW_PROCESSED_WITH_TILING ? "true" : "false", cache_hit ? "hit" : "miss",
+      bytes, end.clock - start->clock, end.user - start->user);
+
+  dt_trace_complete("pixelpipe", name, start->clock, end.clock - start->clock, args);
+
+  g_free(args);
+  g_free(name);
+  g_free(instance);
+}
+
+// memory budget for the darkroom pipe caches, export and thumbnail pipes only keep two lines.
+// there are three darkroom pipes, together they get at most a quarter of the global budget.
+// only these read lines back often enough for half float lines to pay off.
+static size_t _get_cache_memlimit(void)
+{
+  const int64_t limit = dt_conf_get_int64("pixelpipe_cache_memory");
+  return dt_memory_governor_clamp(MAX(limit, 0), 0.25f / 3.0f);
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels,
                                  gboolean store_masks)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_EXPORT;
   pipe->levels = levels;
   pipe->store_all_raster_masks = store_masks;
+  pipe->fuse_pointwise = dt_conf_get_bool("pixelpipe_fuse_pointwise");
   return res;
 }
 
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 2, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
+  pipe->fuse_pointwise = dt_conf_get_bool("pixelpipe_fuse_pointwise");
   return res;
 }
 
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 4 * sizeof(float) * width * height, 0, 0);
   pipe->type = DT_DEV_PIXELPIPE_THUMBNAIL;
   return res;
 }
@@ -135,28 +182,37 @@ int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t
 int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 8);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 8, _get_cache_memlimit());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW;
+  if(res) dt_dev_pixelpipe_cache_register_stats(&pipe->cache, "pixelpipe preview");
+  if(res) dt_dev_pixelpipe_cache_set_half_float(&pipe->cache, dt_conf_get_bool("pixelpipe_cache_half_float"));
+  if(res) dt_scratch_register_stats(pipe->scratch, "scratch preview");
   return res;
 }
 
 int dt_dev_pixelpipe_init_preview2(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 5);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 5, _get_cache_memlimit());
   pipe->type = DT_DEV_PIXELPIPE_PREVIEW2;
+  if(res) dt_dev_pixelpipe_cache_register_stats(&pipe->cache, "pixelpipe preview2");
+  if(res) dt_dev_pixelpipe_cache_set_half_float(&pipe->cache, dt_conf_get_bool("pixelpipe_cache_half_float"));
+  if(res) dt_scratch_register_stats(pipe->scratch, "scratch preview2");
   return res;
 }
 
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
   // don't know which buffer size we're going to need, set to 0 (will be alloced on demand)
-  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 8);
+  const int res = dt_dev_pixelpipe_init_cached(pipe, 0, 8, _get_cache_memlimit());
   pipe->type = DT_DEV_PIXELPIPE_FULL;
+  if(res) dt_dev_pixelpipe_cache_register_stats(&pipe->cache, "pixelpipe full");
+  if(res) dt_dev_pixelpipe_cache_set_half_float(&pipe->cache, dt_conf_get_bool("pixelpipe_cache_half_float"));
+  if(res) dt_scratch_register_stats(pipe->scratch, "scratch full");
   return res;
 }
 
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries)
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memlimit)
 {
   pipe->devid = -1;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
@@ -164,7 +220,13 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
-  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
+  pipe->hash_prefix = NULL;
+  pipe->hash_pieces = NULL;
+  pipe->hash_prefix_len = pipe->hash_prefix_valid = 0;
+  pipe->hash_prefix_filter = 0;
+  pipe->scratch = NULL;
+  if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size, memlimit)) return 0;
+  pipe->scratch = dt_scratch_new();
   pipe->cache_obsolete = 0;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.0f;
@@ -175,11 +237,19 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->output_backbuf_width = 0;
   pipe->output_backbuf_height = 0;
   pipe->output_imgid = 0;
+  pipe->output_backbuf_roi = (dt_iop_roi_t){ 0, 0, 0, 0, 0.0f };
+  pipe->output_backbuf_history = 0;
+  pipe->delta_strip = 0;
 
   pipe->processing = 0;
   dt_atomic_set_int(&pipe->shutdown,FALSE);
   pipe->opencl_error = 0;
   pipe->tiling = 0;
+  pipe->tiling_barrier = NULL;
+  pipe->tiling_barrier_buf = NULL;
+  pipe->tiled_output = NULL;
+  pipe->fuse_pointwise = 0;
+  pipe->share_stages = dt_conf_get_bool("pixelpipe_share_stages");
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->bypass_blendif = 0;
   pipe->input_timestamp = 0;
@@ -228,6 +298,15 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_scratch_destroy(pipe->scratch);
+  pipe->scratch = NULL;
+  free(pipe->hash_prefix);
+  pipe->hash_prefix = NULL;
+  free(pipe->hash_pieces);
+  pipe->hash_pieces = NULL;
+  pipe->hash_prefix_len = pipe->hash_prefix_valid = 0;
+  dt_free_align(pipe->tiled_output);
+  pipe->tiled_output = NULL;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -274,6 +353,7 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  pipe->hash_prefix_valid = 0;
   // also cleanup iop here
   if(pipe->iop)
   {
@@ -322,6 +402,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     piece->hash = 0;
     piece->process_cl_ready = 0;
     piece->process_tiling_ready = 0;
+    piece->identity = 0;
     piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
     memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
     memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
@@ -406,6 +487,7 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     dt_dev_pixelpipe_synch(pipe, dev, history);
     history = g_list_next(history);
   }
+  dt_dev_pixelpipe_cache_update_hashes(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -414,6 +496,7 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   GList *history = g_list_nth(dev->history, dev->history_end - 1);
   if(history) dt_dev_pixelpipe_synch(pipe, dev, history);
+  dt_dev_pixelpipe_cache_update_hashes(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -1093,6 +1176,8 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
   const size_t in_bpp = dt_iop_buffer_dsc_to_bpp(input_format);
   const size_t bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
   /* process module on cpu. use tiling if needed and possible. */
+  // temporary buffers come from the arena of the pipe, which is reset once the module is done.
+  dt_scratch_t *const previous_scratch = dt_scratch_begin(pipe->scratch);
   if(piece->process_tiling_ready
      && !dt_tiling_piece_fits_host_memory(MAX(roi_in->width, roi_out->width),
                                           MAX(roi_in->height, roi_out->height), MAX(in_bpp, bpp),
@@ -1108,6 +1193,7 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
     *pixelpipe_flow |= (PIXELPIPE_FLOW_PROCESSED_ON_CPU);
     *pixelpipe_flow &= ~(PIXELPIPE_FLOW_PROCESSED_ON_GPU | PIXELPIPE_FLOW_PROCESSED_WITH_TILING);
   }
+  dt_scratch_end(previous_scratch);
 
   // and save the output colorspace
   pipe->dsc.cst = module->output_colorspace(module, pipe, piece);
@@ -1170,7 +1256,235 @@ static int pixelpipe_process_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
   return 0; //no errors
 }
 
-// recursive helper for process:
+// serve a tile from the materialized output of the tiling barrier. the requested region can reach out of
+// the materialized one by the halo of the following modules, that part is left black.
+static int _process_tiling_barrier(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece, void **output,
+                                   dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                                   const uint64_t basichash, const uint64_t hash)
+{
+  const dt_iop_roi_t *const full = &pipe->tiling_barrier_roi;
+  const size_t bpp = dt_iop_buffer_dsc_to_bpp(&pipe->tiling_barrier_dsc);
+  const size_t bufsize = bpp * roi_out->width * roi_out->height;
+
+  dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format);
+  **out_format = pipe->dsc = piece->dsc_out = pipe->tiling_barrier_dsc;
+  memset(*output, 0, bufsize);
+
+  const int x0 = MAX(roi_out->x, full->x);
+  const int y0 = MAX(roi_out->y, full->y);
+  const int x1 = MIN(roi_out->x + roi_out->width, full->x + full->width);
+  const int y1 = MIN(roi_out->y + roi_out->height, full->y + full->height);
+  if(x1 <= x0 || y1 <= y0) return 0;
+
+  const char *const in = (const char *)pipe->tiling_barrier_buf;
+  char *const out = (char *)*output;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bpp, x0, x1, y0, y1, in, out, full, roi_out) \
+  schedule(static)
+#endif
+  for(int j = y0; j < y1; j++)
+    memcpy(out + bpp * ((size_t)(j - roi_out->y) * roi_out->width + (x0 - roi_out->x)),
+           in + bpp * ((size_t)(j - full->y) * full->width + (x0 - full->x)), bpp * (x1 - x0));
+  return 0;
+}
+
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// pieces the pipe would skip in dt_dev_pixelpipe_process_rec()
+static gboolean _skip_piece(dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  return !piece->enabled
+         || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags());
+}
+
+// pieces whose committed params make them an identity and which don't have to produce anything else
+// (blend masks, picker values, histograms). the pipe passes their input on instead of processing them.
+static gboolean _identity_piece(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!piece->identity) return FALSE;
+
+  const dt_develop_blend_params_t *const bp = (dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (module->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && bp->mask_mode != DEVELOP_MASK_DISABLED)
+    return FALSE;
+  if(module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return FALSE;
+  if(piece->request_histogram & DT_REQUEST_ON) return FALSE;
+  if(module->request_mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE) return FALSE;
+
+  return module->input_colorspace(module, pipe, piece) == module->output_colorspace(module, pipe, piece);
+}
+
+static gboolean _fuse_eligible(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                               const dt_iop_roi_t *roi_out)
+{
+  if(!module->process_pixels) return FALSE;
+
+  // blending, pickers and histograms need the full input and output buffers
+  const dt_develop_blend_params_t *const bp = (dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && (module->flags() & IOP_FLAGS_SUPPORTS_BLENDING) && bp->mask_mode != DEVELOP_MASK_DISABLED)
+    return FALSE;
+  if(module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return FALSE;
+  if(piece->request_histogram & DT_REQUEST_ON) return FALSE;
+
+  // raw buffers before demosaic have a single channel
+  if(dt_image_is_raw(&pipe->image)
+     && module->iop_order < dt_ioppr_get_iop_order(pipe->iop_order_list, "demosaic", 0))
+    return FALSE;
+
+  if(module->input_colorspace(module, pipe, piece) != module->output_colorspace(module, pipe, piece))
+    return FALSE;
+
+  dt_iop_roi_t roi_in = *roi_out;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  return !memcmp(&roi_in, roi_out, sizeof(dt_iop_roi_t));
+}
+
+// walk back from the current module over the pointwise ones working in the same colorspace. returns the
+// length of the run, which is stored first to last in run, and leaves modules, pieces and pos on what
+// comes before it.
+static int _fuse_collect(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi_out,
+                         GList **modules, GList **pieces, int *pos, dt_dev_pixelpipe_iop_t **run)
+{
+  int len = 0;
+  int cst = -1;
+  GList *m = *modules, *p = *pieces;
+  int k = *pos;
+  for(; m && p && len < DT_DEV_PIXELPIPE_FUSE_MAX; m = g_list_previous(m), p = g_list_previous(p), k--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(_skip_piece(dev, module, piece) || _identity_piece(pipe, module, piece)) continue;
+    if(!_fuse_eligible(pipe, module, piece, roi_out)) break;
+    const int module_cst = module->input_colorspace(module, pipe, piece);
+    if(len && module_cst != cst) break;
+    cst = module_cst;
+    run[len++] = piece;
+  }
+  if(len < 2) return len;
+
+  for(int i = 0; i < len / 2; i++)
+  {
+    dt_dev_pixelpipe_iop_t *tmp = run[i];
+    run[i] = run[len - 1 - i];
+    run[len - 1 - i] = tmp;
+  }
+  *modules = m;
+  *pieces = p;
+  *pos = k;
+  return len;
+}
+
+// process a run of pointwise modules with a single pass over the image: each row goes through all
+// kernels while it is still in cache, and none of the intermediate buffers are allocated.
+static int _process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+                          dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
+                          dt_dev_pixelpipe_iop_t **run, const int run_len, GList *modules, GList *pieces,
+                          const int pos, const uint64_t basichash, const uint64_t hash)
+{
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  // pointwise, so the input covers the same region
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, roi_out, modules, pieces,
+                                  pos))
+    return 1;
+
+  if(input_format->datatype != TYPE_FLOAT || input_format->channels != 4)
+  {
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_process_fused] unexpected input format for `%s' [%s]\n",
+             run[0]->module->op, _pipe_type_to_str(pipe->type));
+    return 1;
+  }
+
+  if(dt_atomic_get_int(&pipe->shutdown)) return 1;
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  const int cst = run[0]->module->input_colorspace(run[0]->module, pipe, run[0]);
+  dt_ioppr_transform_image_colorspace(run[0]->module, input, input, roi_out->width, roi_out->height,
+                                      input_format->cst, cst, &input_format->cst,
+                                      dt_ioppr_get_pipe_work_profile_info(pipe));
+
+  // pass the buffer format through the run like the single modules would do it
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  for(int k = 0; k < run_len; k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = run[k];
+    piece->processed_roi_in = piece->processed_roi_out = *roi_out;
+    piece->dsc_out = piece->dsc_in = dsc;
+    piece->module->output_format(piece->module, pipe, piece, &piece->dsc_out);
+    pipe->dsc = piece->dsc_out;
+    if(piece->module->process_pixels_setup) piece->module->process_pixels_setup(piece->module, piece);
+    pipe->dsc.cst = cst;
+    dsc = piece->dsc_out = pipe->dsc;
+  }
+
+  const size_t bufsize = (size_t)4 * sizeof(float) * roi_out->width * roi_out->height;
+  const int new_line = dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format);
+  **out_format = dsc;
+
+  const float *const in = (const float *)input;
+  float *const out = (float *)*output;
+  const size_t width = roi_out->width;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, width, run, run_len, roi_out) \
+  schedule(static)
+#endif
+  for(int j = 0; j < roi_out->height; j++)
+  {
+    const float *const row_in = in + (size_t)4 * j * width;
+    float *const row_out = out + (size_t)4 * j * width;
+    run[0]->module->process_pixels(run[0]->module, run[0], row_in, row_out, width);
+    for(int k = 1; k < run_len; k++) run[k]->module->process_pixels(run[k]->module, run[k], row_out, row_out, width);
+  }
+
+  if((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled())
+  {
+    GString *names = g_string_new(NULL);
+    for(int k = 0; k < run_len; k++)
+    {
+      gchar *module_label = dt_history_item_get_name(run[k]->module);
+      g_string_append_printf(names, k ? ", `%s'" : "`%s'", module_label);
+      g_free(module_label);
+    }
+    if(dt_trace_enabled())
+      _trace_module(pipe, run[run_len - 1]->module, roi_out, roi_out, &start, PIXELPIPE_FLOW_PROCESSED_ON_CPU,
+                    FALSE, new_line ? bufsize : 0);
+    dt_show_times_f(&start, "[dev_pixelpipe]", "processed %s fused on CPU [%s]", names->str,
+                    _pipe_type_to_str(pipe->type));
+    g_string_free(names, TRUE);
+  }
+
+  return dt_atomic_get_int(&pipe->shutdown) ? 1 : 0;
+}
+
+static gboolean _tiling_uses_raster_masks(dt_dev_pixelpipe_t *pipe);
+
+// the output of the last module before colorin goes through the stage cache, shared with the
+// other pipes of the same kind. 0 if this piece doesn't end the sensor-referred stage.
+static uint64_t _shared_stage(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *modules, GList *pieces,
+                              const uint64_t basichash)
+{
+  if(!pipe->share_stages || !modules || pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE) return 0;
+  GList *m = g_list_next(modules);
+  GList *p = g_list_next(pieces);
+  while(m && p && _skip_piece(dev, (dt_iop_module_t *)m->data, (dt_dev_pixelpipe_iop_t *)p->data))
+  {
+    m = g_list_next(m);
+    p = g_list_next(p);
+  }
+  if(!m || strcmp(((dt_iop_module_t *)m->data)->op, "colorin")) return 0;
+  // skipped modules wouldn't leave their raster masks for later ones
+  if(_tiling_uses_raster_masks(pipe)) return 0;
+  return dt_dev_stage_cache_stage(pipe, basichash);
+}
+
 static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
                                         void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                         const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
@@ -1233,6 +1547,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format);
 
+    if(dt_trace_enabled())
+    {
+      dt_times_t start;
+      dt_get_times(&start);
+      _trace_module(pipe, module, roi_out, roi_out, &start, PIXELPIPE_FLOW_NONE, TRUE, 0);
+    }
+
     if(!modules) return 0;
     // go to post-collect directly:
     goto post_process_collect_info;
@@ -1247,6 +1568,27 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   if(pipe == dev->preview2_pipe && dev->preview2_loading) return 1;
   if(dev->gui_leaving) return 1;
 
+  // another pipe might have computed everything up to here already
+  const uint64_t stage = _shared_stage(pipe, dev, modules, pieces, basichash);
+  if(stage && dt_dev_stage_cache_available(stage, roi_out, *out_format))
+  {
+    dt_times_t start;
+    dt_get_times(&start);
+    dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format);
+    if(!dt_dev_stage_cache_get(stage, roi_out, *output, bufsize, *out_format))
+    {
+      if(dt_trace_enabled()) _trace_module(pipe, module, roi_out, roi_out, &start, PIXELPIPE_FLOW_NONE, TRUE, 0);
+      goto post_process_collect_info;
+    }
+    // evicted meanwhile
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+  }
+  else if(stage)
+    dt_dev_stage_cache_want(stage, pipe);
+
+  // fused tiling: everything up to this module has been processed for the full image already
+  if(piece && piece == pipe->tiling_barrier)
+    return _process_tiling_barrier(pipe, piece, output, out_format, roi_out, basichash, hash);
 
   // 3) input -> output
   if(!modules)
@@ -1258,6 +1600,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
     dt_times_t start;
     dt_get_times(&start);
+    size_t allocated = 0;
     // we're looking for the full buffer
     {
       if(roi_out->scale == 1.0 && roi_out->x == 0 && roi_out->y == 0 && pipe->iwidth == roi_out->width
@@ -1267,6 +1610,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       }
       else if(dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format))
       {
+        allocated = bufsize;
         memset(*output, 0, bufsize);
         if(roi_in.scale == 1.0f)
         {
@@ -1307,11 +1651,28 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     }
 
     dt_show_times_f(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    if(dt_trace_enabled())
+    {
+      const dt_iop_roi_t roi_input = { 0, 0, pipe->iwidth, pipe->iheight, 1.0f };
+      _trace_module(pipe, NULL, &roi_input, roi_out, &start, PIXELPIPE_FLOW_NONE, FALSE, allocated);
+    }
   }
   else
   {
     // 3b) recurse and obtain output array in &input
 
+    // if this module ends a run of pointwise ones, do them all in one go
+    if(pipe->fuse_pointwise && pipe->devid < 0 && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE)
+    {
+      dt_dev_pixelpipe_iop_t *run[DT_DEV_PIXELPIPE_FUSE_MAX];
+      GList *run_modules = modules, *run_pieces = pieces;
+      int run_pos = pos;
+      const int run_len = _fuse_collect(pipe, dev, roi_out, &run_modules, &run_pieces, &run_pos, run);
+      if(run_len > 1)
+        return _process_fused(pipe, dev, output, out_format, roi_out, run, run_len, run_modules, run_pieces,
+                              run_pos, basichash, hash);
+    }
+
     // get region of interest which is needed in input
     if(dt_atomic_get_int(&pipe->shutdown))
     {
@@ -1343,6 +1704,28 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
     const size_t out_bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
 
+    // a module which leaves the pixels as they are gets neither a buffer nor a cache line, its output is
+    // its input. that stays valid as long as a buffer of its own would: it is the line the cache handed
+    // out last. the pipe input itself is never passed on, the following modules may convert in place.
+    if(_identity_piece(pipe, module, piece) && input != pipe->input
+       && pipe->mask_display == DT_DEV_PIXELPIPE_DISPLAY_NONE && in_bpp == out_bpp
+       && input_format->cst == module->input_colorspace(module, pipe, piece)
+       && !memcmp(&roi_in, roi_out, sizeof(struct dt_iop_roi_t)))
+    {
+      dt_times_t start;
+      dt_get_times(&start);
+      pipe->dsc = piece->dsc_out = piece->dsc_in;
+      *output = input;
+      *cl_mem_output = cl_mem_input;
+      // keep pointing at the description of the cache line, in place conversions update it
+      if(input_format == &_input_format)
+        **out_format = _input_format;
+      else
+        *out_format = input_format;
+      if(dt_trace_enabled()) _trace_module(pipe, module, &roi_in, roi_out, &start, PIXELPIPE_FLOW_NONE, TRUE, 0);
+      return 0;
+    }
+
     // reserve new cache line: output
     if(dt_atomic_get_int(&pipe->shutdown))
     {
@@ -1354,10 +1737,14 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
       important = (strcmp(module->op, "colorout") == 0);
     else
       important = (strcmp(module->op, "gamma") == 0);
-    if(important)
-      (void)dt_dev_pixelpipe_cache_get_important(&(pipe->cache), basichash, hash, bufsize, output, out_format);
-    else
-      (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), basichash, hash, bufsize, output, out_format);
+    const int weight = important ? -pipe->cache.entries : 0;
+    // gamma writes 8-bit display data into its buffer, that must never be packed into half floats
+    const int new_line
+        = (strcmp(module->op, "gamma") == 0)
+              ? dt_dev_pixelpipe_cache_get_full_precision(&(pipe->cache), basichash, hash, bufsize, output,
+                                                          out_format, weight)
+              : dt_dev_pixelpipe_cache_get_weighted(&(pipe->cache), basichash, hash, bufsize, output,
+                                                    out_format, weight);
 
 // if(module) printf("reserving new buf in cache for module %s %s: %ld buf %p\n", module->op, pipe ==
 // dev->preview_pipe ? "[preview]" : "", hash, *output);
@@ -2023,9 +2410,24 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     g_free(module_label);
     module_label = NULL;
 
+    if(dt_trace_enabled())
+      _trace_module(pipe, module, &roi_in, roi_out, &start, pixelpipe_flow, FALSE, new_line ? bufsize : 0);
+
     // in case we get this buffer from the cache in the future, cache some stuff:
     **out_format = piece->dsc_out = pipe->dsc;
 
+    // the darkroom pipes keep their own results, they only hand out what others are waiting for
+    if(stage
+       && ((pipe->type & (DT_DEV_PIXELPIPE_EXPORT | DT_DEV_PIXELPIPE_THUMBNAIL))
+           || dt_dev_stage_cache_wanted(stage, pipe)))
+    {
+#ifdef HAVE_OPENCL
+      if(*cl_mem_output != NULL)
+        dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height, bpp);
+#endif
+      dt_dev_stage_cache_put(stage, roi_out, *output, bufsize, *out_format);
+    }
+
     if(module == darktable.develop->gui_module)
     {
       // give the input buffer to the currently focused plugin more weight.
@@ -2192,10 +2594,8 @@ post_process_collect_info:
 }
 
 
-int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
-                                      int height, float scale)
+static dt_dev_pixelpipe_iop_t *_get_gamma_piece(dt_dev_pixelpipe_t *pipe)
 {
-  // temporarily disable gamma mapping.
   GList *gammap = g_list_last(pipe->nodes);
   dt_dev_pixelpipe_iop_t *gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
   while(strcmp(gamma->module->op, "gamma"))
@@ -2205,6 +2605,14 @@ int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *de
     if(!gammap) break;
     gamma = (dt_dev_pixelpipe_iop_t *)gammap->data;
   }
+  return gamma;
+}
+
+int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
+                                      int height, float scale)
+{
+  // temporarily disable gamma mapping.
+  dt_dev_pixelpipe_iop_t *gamma = _get_gamma_piece(pipe);
   if(gamma) gamma->enabled = 0;
   const int ret = dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
   if(gamma) gamma->enabled = 1;
@@ -2245,6 +2653,8 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
                                                      int pos)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
+  // pick up color picker and focus changes, params have been hashed when synching the history
+  dt_dev_pixelpipe_cache_update_hashes(pipe);
   int ret = dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, roi_out, modules, pieces, pos);
 #ifdef HAVE_OPENCL
   // copy back final opencl buffer (if any) to CPU
@@ -2281,6 +2691,12 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 }
 
 
+// hash of everything but the region the output of the pipe depends on
+static inline uint64_t _delta_history_hash(dt_dev_pixelpipe_t *pipe)
+{
+  return dt_dev_pixelpipe_cache_basichash(pipe->image.id, pipe, g_list_length(pipe->nodes));
+}
+
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
                              float scale)
 {
@@ -2385,6 +2801,9 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  // only the darkroom runs its pipes again soon enough to reuse the idle scratch blocks
+  if(!(pipe->type & (DT_DEV_PIXELPIPE_FULL | DT_DEV_PIXELPIPE_PREVIEW | DT_DEV_PIXELPIPE_PREVIEW2)))
+    dt_scratch_release(pipe->scratch);
   // ... and in case of other errors ...
   if(err)
   {
@@ -2399,9 +2818,10 @@ restart:
   pipe->backbuf_width = width;
   pipe->backbuf_height = height;
 
-  if((pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW
-     || (pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL
-     || (pipe->type & DT_DEV_PIXELPIPE_PREVIEW2) == DT_DEV_PIXELPIPE_PREVIEW2)
+  if(!pipe->delta_strip
+     && ((pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW
+         || (pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL
+         || (pipe->type & DT_DEV_PIXELPIPE_PREVIEW2) == DT_DEV_PIXELPIPE_PREVIEW2))
   {
     if(pipe->output_backbuf == NULL || pipe->output_backbuf_width != pipe->backbuf_width || pipe->output_backbuf_height != pipe->backbuf_height)
     {
@@ -2414,6 +2834,8 @@ restart:
     if(pipe->output_backbuf)
       memcpy(pipe->output_backbuf, pipe->backbuf, (size_t)pipe->output_backbuf_width * pipe->output_backbuf_height * 4 * sizeof(uint8_t));
     pipe->output_imgid = pipe->image.id;
+    pipe->output_backbuf_roi = roi;
+    pipe->output_backbuf_history = _delta_history_hash(pipe);
   }
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
@@ -2422,9 +2844,375 @@ restart:
   return 0;
 }
 
+// the last enabled module which needs to see the full image
+static dt_dev_pixelpipe_iop_t *_tiling_find_barrier(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_iop_t *barrier = NULL;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece->enabled && piece->tiling_barrier) barrier = piece;
+  }
+  return barrier;
+}
+
+// raster masks are stored per module with the roi they were processed with, they can't be passed
+// from a full size run to a tile (nor be exported from a tile).
+static gboolean _tiling_uses_raster_masks(dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->store_all_raster_masks) return TRUE;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    const dt_develop_blend_params_t *const bp = (dt_develop_blend_params_t *)piece->blendop_data;
+    if(piece->enabled && bp && (bp->mask_mode & DEVELOP_MASK_RASTER)) return TRUE;
+  }
+  return FALSE;
+}
+
+// overlap (in output pixels) a tile needs so that the modules after the barrier see enough of their
+// surrounding. modules which read outside their roi tell so in modify_roi_in(), the tileable ones report
+// the rest via their tiling callback.
+static int _tiling_halo(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_iop_t *barrier, const float scale)
+{
+  int halo = 0;
+  gboolean after = (barrier == NULL);
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(piece == barrier)
+    {
+      after = TRUE;
+      continue;
+    }
+    if(!after || !piece->enabled || !(piece->module->flags() & IOP_FLAGS_ALLOW_TILING)) continue;
+
+    const dt_iop_roi_t roi_in
+        = { 0, 0, (int)(piece->buf_in.width * scale), (int)(piece->buf_in.height * scale), scale };
+    const dt_iop_roi_t roi_out
+        = { 0, 0, (int)(piece->buf_out.width * scale), (int)(piece->buf_out.height * scale), scale };
+    dt_develop_tiling_t tiling = { 0 };
+    piece->module->tiling_callback(piece->module, piece, &roi_in, &roi_out, &tiling);
+    halo += tiling.overlap;
+  }
+  // and a few pixels for the interpolation of the distorting modules
+  return halo + 4;
+}
+
+// materialize the output of the barrier module for all that the full image needs of it.
+static int _tiling_process_barrier(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
+                                   dt_dev_pixelpipe_iop_t *barrier, const dt_iop_roi_t *roi)
+{
+  // walk the region of interest back to the barrier and switch off everything after it
+  dt_iop_roi_t roi_barrier = *roi;
+  GList *disabled = NULL;
+  for(GList *pieces = g_list_last(pipe->nodes); pieces; pieces = g_list_previous(pieces))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece == barrier) break;
+    if(!piece->enabled) continue;
+    dt_iop_roi_t roi_in = roi_barrier;
+    piece->module->modify_roi_in(piece->module, piece, &roi_barrier, &roi_in);
+    roi_barrier = roi_in;
+    piece->enabled = 0;
+    disabled = g_list_prepend(disabled, piece);
+  }
+
+  const int err = dt_dev_pixelpipe_process(pipe, dev, roi_barrier.x, roi_barrier.y, roi_barrier.width,
+                                           roi_barrier.height, roi_barrier.scale);
+
+  for(GList *l = disabled; l; l = g_list_next(l)) ((dt_dev_pixelpipe_iop_t *)l->data)->enabled = 1;
+  g_list_free(disabled);
+
+  if(err) return 1;
+
+  // the cache line will be recycled by the tiles, keep our own copy
+  pipe->tiling_barrier_roi = roi_barrier;
+  pipe->tiling_barrier_dsc = barrier->dsc_out;
+  const size_t size = dt_iop_buffer_dsc_to_bpp(&barrier->dsc_out) * roi_barrier.width * roi_barrier.height;
+  pipe->tiling_barrier_buf = dt_alloc_align(64, size);
+  if(!pipe->tiling_barrier_buf) return 1;
+  memcpy(pipe->tiling_barrier_buf, pipe->backbuf, size);
+  return 0;
+}
+
+static int _tiling_process_tiles(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, const dt_iop_roi_t *roi,
+                                 const int tile_size, const int halo)
+{
+  const int tiles_x = (roi->width + tile_size - 1) / tile_size;
+  const int tiles_y = (roi->height + tile_size - 1) / tile_size;
+  size_t bpp = 0;
+
+  for(int ty = 0; ty < tiles_y; ty++)
+    for(int tx = 0; tx < tiles_x; tx++)
+    {
+      // the tile itself, and what we process of it including the halo
+      const int x0 = tx * tile_size, y0 = ty * tile_size;
+      const int x1 = MIN(x0 + tile_size, roi->width), y1 = MIN(y0 + tile_size, roi->height);
+      const int px0 = MAX(x0 - halo, 0), py0 = MAX(y0 - halo, 0);
+      const int px1 = MIN(x1 + halo, roi->width), py1 = MIN(y1 + halo, roi->height);
+
+      dt_print(DT_DEBUG_DEV, "[pixelpipe_process_tiled] [%s] tile %d/%d: %dx%d at %d,%d with halo %d\n",
+               _pipe_type_to_str(pipe->type), ty * tiles_x + tx + 1, tiles_x * tiles_y, x1 - x0, y1 - y0, x0,
+               y0, halo);
+
+      if(dt_dev_pixelpipe_process(pipe, dev, roi->x + px0, roi->y + py0, px1 - px0, py1 - py0, roi->scale))
+        return 1;
+
+      // only now we know what the pipe outputs
+      if(!pipe->tiled_output)
+      {
+        // gamma writes packed 8 bit rgba into its float buffer, the rows are only that wide then
+        const dt_dev_pixelpipe_iop_t *gamma = _get_gamma_piece(pipe);
+        bpp = gamma && gamma->enabled ? 4 * sizeof(uint8_t) : dt_iop_buffer_dsc_to_bpp(&pipe->dsc);
+        pipe->tiled_output = dt_alloc_align(64, bpp * roi->width * roi->height);
+        if(!pipe->tiled_output) return 1;
+      }
+
+      const char *const in = (const char *)pipe->backbuf;
+      char *const out = (char *)pipe->tiled_output;
+      const int out_width = roi->width;
+      const int in_width = px1 - px0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+      dt_omp_firstprivate(bpp, in, out, in_width, out_width, x0, x1, y0, y1, px0, py0) \
+      schedule(static)
+#endif
+      for(int j = y0; j < y1; j++)
+        memcpy(out + bpp * ((size_t)j * out_width + x0), in + bpp * ((size_t)(j - py0) * in_width + (x0 - px0)),
+               bpp * (x1 - x0));
+    }
+  return 0;
+}
+
+int dt_dev_pixelpipe_process_tiled(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int width, int height,
+                                   float scale, int tile_size, gboolean no_gamma)
+{
+  const dt_iop_roi_t roi = (dt_iop_roi_t){ 0, 0, width, height, scale };
+
+  dt_dev_pixelpipe_iop_t *gamma = no_gamma ? _get_gamma_piece(pipe) : NULL;
+  if(gamma) gamma->enabled = 0;
+
+  dt_dev_pixelpipe_iop_t *barrier = _tiling_find_barrier(pipe);
+  const int halo = _tiling_halo(pipe, barrier, scale);
+
+  const char *fallback = NULL;
+  if(tile_size <= 0 || (width <= tile_size && height <= tile_size))
+    fallback = "image fits into a single tile";
+  else if(halo >= tile_size)
+    fallback = "halo larger than the tiles";
+  else if(_tiling_uses_raster_masks(pipe))
+    fallback = "raster masks in use";
+
+  int err = 0;
+  if(fallback)
+  {
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_process_tiled] [%s] processing in one go: %s\n",
+             _pipe_type_to_str(pipe->type), fallback);
+    err = dt_dev_pixelpipe_process(pipe, dev, 0, 0, width, height, scale);
+  }
+  else
+  {
+    dt_times_t start;
+    dt_get_times(&start);
+
+    if(barrier)
+    {
+      gchar *module_label = dt_history_item_get_name(barrier->module);
+      dt_print(DT_DEBUG_DEV, "[pixelpipe_process_tiled] [%s] materializing up to `%s'\n",
+               _pipe_type_to_str(pipe->type), module_label);
+      g_free(module_label);
+      err = _tiling_process_barrier(pipe, dev, barrier, &roi);
+      // from now on the tiles are served from its output
+      pipe->tiling_barrier = barrier;
+    }
+
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    dt_free_align(pipe->tiled_output);
+    pipe->tiled_output = NULL;
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+    if(!err) err = _tiling_process_tiles(pipe, dev, &roi, tile_size, halo);
+
+    pipe->tiling_barrier = NULL;
+    dt_free_align(pipe->tiling_barrier_buf);
+    pipe->tiling_barrier_buf = NULL;
+
+    if(!err)
+    {
+      dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+      pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
+      pipe->backbuf = pipe->tiled_output;
+      pipe->backbuf_width = width;
+      pipe->backbuf_height = height;
+      dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    }
+
+    dt_show_times_f(&start, "[dev_pixelpipe]", "processed %dx%d in tiles of %d [%s]", width, height, tile_size,
+                    _pipe_type_to_str(pipe->type));
+  }
+
+  if(gamma) gamma->enabled = 1;
+  return err;
+}
+
+// how far (in output pixels) the modules look around a pixel. a strip is processed that much larger, so
+// that at its edges they see what they'd see in a run over the whole region.
+static int _delta_halo(dt_dev_pixelpipe_t *pipe, const float scale)
+{
+  int halo = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    const dt_iop_roi_t roi_in
+        = { 0, 0, (int)(piece->buf_in.width * scale), (int)(piece->buf_in.height * scale), scale };
+    const dt_iop_roi_t roi_out
+        = { 0, 0, (int)(piece->buf_out.width * scale), (int)(piece->buf_out.height * scale), scale };
+    dt_develop_tiling_t tiling = { 0 };
+    piece->module->tiling_callback(piece->module, piece, &roi_in, &roi_out, &tiling);
+    halo += tiling.overlap;
+  }
+  // and a few pixels for the interpolation of the distorting modules
+  return halo + 4;
+}
+
+// why the previous output can't be reused for the given region, NULL if it can
+static const char *_delta_unusable(dt_dev_pixelpipe_t *pipe, const dt_iop_roi_t *roi, int *halo)
+{
+  const dt_iop_roi_t *prev = &pipe->output_backbuf_roi;
+  if(!dt_conf_get_bool("darkroom_pan_reuse")) return "disabled";
+  if(!pipe->output_backbuf || pipe->output_imgid != pipe->image.id) return "no previous output";
+  if(pipe->cache_obsolete) return "caches obsolete";
+  if(prev->scale != roi->scale || prev->width != roi->width || prev->height != roi->height
+     || pipe->output_backbuf_width != roi->width || pipe->output_backbuf_height != roi->height)
+    return "zoomed or resized";
+  if(prev->x == roi->x && prev->y == roi->y) return "same region";
+  // only worth it if most of the view is still there
+  const int64_t overlap = (int64_t)MAX(0, roi->width - abs(roi->x - prev->x))
+                          * MAX(0, roi->height - abs(roi->y - prev->y));
+  if(2 * overlap < (int64_t)roi->width * roi->height) return "panned too far";
+  if(pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE || pipe->bypass_blendif) return "mask displayed";
+
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    const dt_iop_module_t *module = piece->module;
+    if(module->flags() & IOP_FLAGS_ROI_DEPENDENT) return "module depends on the full region";
+    // statistics over a strip aren't those over the region, and these don't tell their halo
+    if(piece->tiling_barrier) return "module needs the whole image";
+    // pickers and histograms have to see the whole view
+    if(module->request_color_pick != DT_REQUEST_COLORPICK_OFF || (piece->request_histogram & DT_REQUEST_ON)
+       || module->request_mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE)
+      return "module needs the full region";
+  }
+
+  // params, focus and picker state are part of the hash of the stack
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  dt_dev_pixelpipe_cache_update_hashes(pipe);
+  const uint64_t history = _delta_history_hash(pipe);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  if(pipe->output_backbuf_history != history) return "history changed";
+
+  // the strips with their halo shouldn't amount to more than the region
+  *halo = _delta_halo(pipe, roi->scale);
+  const int64_t strips = (int64_t)(abs(roi->x - prev->x) + 2 * *halo) * (roi->height + 2 * *halo)
+                         + (int64_t)(abs(roi->y - prev->y) + 2 * *halo) * (roi->width + 2 * *halo);
+  if(strips >= (int64_t)roi->width * roi->height) return "halo too large";
+  return NULL;
+}
+
+int dt_dev_pixelpipe_process_delta(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
+                                   int height, float scale)
+{
+  const dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, width, height, scale };
+  int halo = 0;
+  const char *full = _delta_unusable(pipe, &roi, &halo);
+  if(full)
+  {
+    dt_print(DT_DEBUG_DEV, "[pixelpipe_process_delta] [%s] processing the whole region: %s\n",
+             _pipe_type_to_str(pipe->type), full);
+    return dt_dev_pixelpipe_process(pipe, dev, x, y, width, height, scale);
+  }
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  // output pixel (i, j) was pixel (i + dx, j + dy) of the previous one
+  const int dx = x - pipe->output_backbuf_roi.x;
+  const int dy = y - pipe->output_backbuf_roi.y;
+  const int ox0 = MAX(0, -dx), ox1 = MIN(width, width - dx);
+  const int oy0 = MAX(0, -dy), oy1 = MIN(height, height - dy);
+
+  const size_t stride = (size_t)4 * width;
+  uint8_t *out = (uint8_t *)g_malloc((size_t)height * stride);
+
+  // the part which is still visible. the gui thread might draw output_backbuf meanwhile, reading is fine.
+  const uint8_t *const prev = pipe->output_backbuf;
+  for(int j = oy0; j < oy1; j++)
+    memcpy(out + j * stride + (size_t)4 * ox0, prev + (size_t)(j + dy) * stride + (size_t)4 * (ox0 + dx),
+           (size_t)4 * (ox1 - ox0));
+
+  // the newly exposed strips: full rows above and below, then the columns left and right of the overlap
+  const int strips[4][4] = { { 0, 0, width, oy0 },
+                             { 0, oy1, width, height - oy1 },
+                             { 0, oy0, ox0, oy1 - oy0 },
+                             { ox1, oy0, width - ox1, oy1 - oy0 } };
+  // strips are processed with the halo around them, as far as the image goes, and cropped
+  const int image_width = (int)(pipe->processed_width * scale);
+  const int image_height = (int)(pipe->processed_height * scale);
+  int err = 0;
+  pipe->delta_strip = 1;
+  for(int s = 0; s < 4 && !err; s++)
+  {
+    const int sx = strips[s][0], sy = strips[s][1], sw = strips[s][2], sh = strips[s][3];
+    if(sw <= 0 || sh <= 0) continue;
+    const int px0 = MAX(x + sx - halo, MIN(x + sx, 0));
+    const int py0 = MAX(y + sy - halo, MIN(y + sy, 0));
+    const int px1 = MIN(x + sx + sw + halo, MAX(x + sx + sw, image_width));
+    const int py1 = MIN(y + sy + sh + halo, MAX(y + sy + sh, image_height));
+    err = dt_dev_pixelpipe_process(pipe, dev, px0, py0, px1 - px0, py1 - py0, scale);
+    if(err) break;
+    const size_t in_stride = (size_t)4 * (px1 - px0);
+    const size_t in_offset = (size_t)(y + sy - py0) * in_stride + (size_t)4 * (x + sx - px0);
+    dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+    for(int j = 0; j < sh; j++)
+      memcpy(out + (size_t)(sy + j) * stride + (size_t)4 * sx, pipe->backbuf + in_offset + j * in_stride,
+             (size_t)4 * sw);
+    dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+  }
+  pipe->delta_strip = 0;
+
+  if(err)
+  {
+    g_free(out);
+    return err;
+  }
+
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  g_free(pipe->output_backbuf);
+  pipe->output_backbuf = out;
+  pipe->output_backbuf_width = width;
+  pipe->output_backbuf_height = height;
+  pipe->output_backbuf_roi = roi;
+  pipe->output_imgid = pipe->image.id;
+  pipe->backbuf = out;
+  pipe->backbuf_width = width;
+  pipe->backbuf_height = height;
+  pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, 0);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
+  dt_show_times_f(&start, "[dev_pixelpipe]", "panned by %d,%d, processed %d of %d pixels [%s]", dx, dy,
+                  width * height - (ox1 - ox0) * (oy1 - oy0), width * height, _pipe_type_to_str(pipe->type));
+  return 0;
+}
+
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  // the output can't be trusted to match a new run anymore either
+  pipe->output_backbuf_history = 0;
 }
 
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in,
@@ -66,6 +66,8 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t processed_roi_in, processed_roi_out; // the actual roi that was used for processing the piece
   int process_cl_ready;       // set this to 0 in commit_params to temporarily disable the use of process_cl
   int process_tiling_ready;   // set this to 0 in commit_params to temporarily disable tiling
+  int identity;               // set this to 1 in commit_params if the params leave every pixel as it is
+  int tiling_barrier;         // set this to 0 in commit_params if the params don't need the whole image
 
   // the following are used internally for caching:
   dt_iop_buffer_dsc_t dsc_in, dsc_out;
@@ -93,6 +95,17 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // temporary buffers of the modules, see common/scratch.h
+  struct dt_scratch_t *scratch;
+  // prefix hashes of the module stack, hash_prefix[k] covers the first k pieces.
+  // see dt_dev_pixelpipe_cache_update_hashes().
+  uint64_t *hash_prefix;
+  // contribution of each piece the prefix was built from
+  uint64_t *hash_pieces;
+  // number of pieces the arrays are allocated for, and number of up to date prefix entries
+  int hash_prefix_len, hash_prefix_valid;
+  // operation tags filter of the focused module the prefix was built with
+  int hash_prefix_filter;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -131,6 +144,11 @@ typedef struct dt_dev_pixelpipe_t
   uint8_t *output_backbuf;
   int output_backbuf_width, output_backbuf_height;
   int output_imgid;
+  // region, scale and history output_backbuf has been rendered for, see dt_dev_pixelpipe_process_delta()
+  dt_iop_roi_t output_backbuf_roi;
+  uint64_t output_backbuf_history;
+  // processing a strip for dt_dev_pixelpipe_process_delta(), output_backbuf is left alone
+  int delta_strip;
   // working?
   int processing;
   // shutting down?
@@ -141,6 +159,18 @@ typedef struct dt_dev_pixelpipe_t
   int opencl_error;
   // running in a tiling context?
   int tiling;
+  // fused tile-streaming, see dt_dev_pixelpipe_process_tiled(): the last module which needs the full
+  // image, its materialized output and the region this covers.
+  dt_dev_pixelpipe_iop_t *tiling_barrier;
+  void *tiling_barrier_buf;
+  dt_iop_roi_t tiling_barrier_roi;
+  dt_iop_buffer_dsc_t tiling_barrier_dsc;
+  // the tiles assembled into the full output, backbuf points here after a tiled run
+  void *tiled_output;
+  // run adjacent pointwise modules in a single pass, skipping their intermediate buffers?
+  int fuse_pointwise;
+  // take the output of the modules before colorin from, and give it to, the stage cache?
+  int share_stages;
   // should this pixelpipe display a mask in the end?
   int mask_display;
   // should this pixelpipe completely suppressed the blendif module?
@@ -184,8 +214,8 @@ int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int
 // inits all but the pixel caches, so you can't actually process an image (just get dimensions and
 // distortions)
 int dt_dev_pixelpipe_init_dummy(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
-// inits the pixelpipe with given cacheline size and number of entries.
-int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries);
+// inits the pixelpipe with given cacheline size, minimum number of entries and memory budget in bytes.
+int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t entries, size_t memlimit);
 // constructs a new input buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width,
                                 int height, float iscale);
@@ -221,6 +251,20 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev,
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
+// process the full image by running the whole pipe once per output tile of at most tile_size pixels
+// (plus halo), so intermediate buffers scale with the tile and not with the image. modules flagged
+// IOP_FLAGS_TILING_BARRIER whose params need the whole image (piece->tiling_barrier) are processed once
+// for the full image. falls back to a single run if
+// tile_size is 0 or the image fits. returns 1 if pipe was altered during processing.
+int dt_dev_pixelpipe_process_tiled(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width, int height,
+                                   float scale, int tile_size, gboolean no_gamma);
+// process region of interest of pixels like dt_dev_pixelpipe_process(), but if the previous output of this
+// pipe was rendered with the same scale, size and history (i.e. the view was panned) only the newly exposed
+// strips are processed, with the halo the modules look around, and stitched to the part of the previous
+// output which is still visible. with modules needing the whole image the region is processed in full.
+// returns 1 if pipe was altered during processing.
+int dt_dev_pixelpipe_process_delta(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width,
+                                   int height, float scale);
 
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
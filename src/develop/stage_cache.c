@@ -0,0 +1,288 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/stage_cache.h"
+#include "common/cache_stats.h"
+#include "common/darktable.h"
+#include "common/dtpthread.h"
+#include "common/memory_governor.h"
+#include "control/conf.h"
+#include "develop/format.h"
+#include "develop/imageop_math.h"
+#include "develop/pixelpipe.h"
+
+#include <string.h>
+
+// upper bound of the memory held by all entries, the budget may make it less
+#define DT_STAGE_CACHE_MAX ((size_t)2 << 30)
+// how many stages asked for and not found are remembered
+#define DT_STAGE_CACHE_WANTED 16
+
+// preferences the modules of the stage read while processing, their results depend on them
+static const char *_stage_conf[]
+    = { "plugins/darkroom/demosaic/quality", "plugins/darkroom/demosaic/fdc_xover_iso",
+        "plugins/lighttable/thumbnail_hq_min_level", NULL };
+
+typedef struct dt_stage_entry_t
+{
+  uint64_t stage;
+  dt_iop_roi_t roi;
+  dt_iop_buffer_dsc_t dsc;
+  void *data;
+  size_t size;
+} dt_stage_entry_t;
+
+typedef struct dt_stage_wanted_t
+{
+  uint64_t stage;
+  const void *pipe;
+} dt_stage_wanted_t;
+
+static gboolean _stage_initialized = FALSE;
+static dt_pthread_mutex_t _stage_mutex; // protects everything below
+static GList *_stage_lru = NULL;        // last element is the most recently used
+static size_t _stage_allmem = 0;        // also read by the memory governor
+static size_t _stage_limit = 0;
+static dt_stage_wanted_t _stage_wanted[DT_STAGE_CACHE_WANTED]; // ring buffer of misses
+static int _stage_wanted_next = 0;
+static dt_cache_stats_t _stage_stats;
+
+static void _entry_free(dt_stage_entry_t *entry)
+{
+  __atomic_sub_fetch(&_stage_allmem, entry->size, __ATOMIC_RELAXED);
+  dt_free_align(entry->data);
+  g_free(entry);
+}
+
+// drop the least recently used entries until the given number of bytes are gone. called locked.
+static size_t _evict(const size_t bytes)
+{
+  size_t freed = 0;
+  while(_stage_lru && freed < bytes)
+  {
+    dt_stage_entry_t *entry = (dt_stage_entry_t *)_stage_lru->data;
+    _stage_lru = g_list_delete_link(_stage_lru, _stage_lru);
+    freed += entry->size;
+    _stage_stats.evictions++;
+    _entry_free(entry);
+  }
+  return freed;
+}
+
+static size_t _governor_usage(void *data)
+{
+  return __atomic_load_n(&_stage_allmem, __ATOMIC_RELAXED);
+}
+
+static size_t _governor_shrink(void *data, size_t bytes)
+{
+  // a pipe copying out of the cache holds the lock, we'll be asked again
+  if(dt_pthread_mutex_trylock(&_stage_mutex)) return 0;
+  const size_t freed = _evict(bytes);
+  dt_pthread_mutex_unlock(&_stage_mutex);
+  return freed;
+}
+
+static void _stats_fill(void *data, dt_cache_report_t *report)
+{
+  dt_pthread_mutex_lock(&_stage_mutex);
+  report->stats = _stage_stats;
+  report->stats.resident = _stage_allmem;
+  report->entries = g_list_length(_stage_lru);
+  report->quota = _stage_limit;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+}
+
+void dt_dev_stage_cache_init(void)
+{
+  if(_stage_initialized) return;
+  dt_pthread_mutex_init(&_stage_mutex, NULL);
+  memset(&_stage_stats, 0, sizeof(_stage_stats));
+  memset(_stage_wanted, 0, sizeof(_stage_wanted));
+  _stage_wanted_next = 0;
+  _stage_limit = dt_memory_governor_clamp(DT_STAGE_CACHE_MAX, 0.125f);
+  _stage_initialized = TRUE;
+  dt_memory_governor_register("stage cache", _governor_usage, _governor_shrink, &_stage_lru);
+  dt_cache_stats_register("stage cache", _stats_fill, &_stage_lru);
+}
+
+void dt_dev_stage_cache_cleanup(void)
+{
+  if(!_stage_initialized) return;
+  dt_cache_stats_unregister(&_stage_lru);
+  dt_memory_governor_unregister(&_stage_lru);
+  dt_dev_stage_cache_flush();
+  _stage_initialized = FALSE;
+  dt_pthread_mutex_destroy(&_stage_mutex);
+}
+
+uint64_t dt_dev_stage_cache_stage(const dt_dev_pixelpipe_t *pipe, const uint64_t basichash)
+{
+  uint64_t hash = dt_dev_pixelpipe_cache_hash_mix(basichash, pipe->type & DT_DEV_PIXELPIPE_ANY);
+  // preview and thumbnail pipes start from a downscaled input
+  hash = dt_dev_pixelpipe_cache_hash_mix(hash, ((uint64_t)(uint32_t)pipe->iwidth << 32) | (uint32_t)pipe->iheight);
+  uint32_t scale;
+  memcpy(&scale, &pipe->iscale, sizeof(scale));
+  hash = dt_dev_pixelpipe_cache_hash_mix(hash, scale);
+  for(const char **key = _stage_conf; *key; key++)
+  {
+    gchar *value = dt_conf_get_string(*key);
+    hash = dt_dev_pixelpipe_cache_hash_mix(hash, value ? g_str_hash(value) : 0);
+    g_free(value);
+  }
+  // 0 means not shared
+  return hash ? hash : 1;
+}
+
+static inline gboolean _same_roi(const dt_iop_roi_t *a, const dt_iop_roi_t *b)
+{
+  return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height && a->scale == b->scale;
+}
+
+// the entry with the same roi, otherwise the smallest rgb one anchored at the origin which covers
+// the roi at a larger scale. called locked.
+static dt_stage_entry_t *_find(const uint64_t stage, const dt_iop_roi_t *roi, const size_t size)
+{
+  const gboolean rgb = size == (size_t)roi->width * roi->height * 4 * sizeof(float);
+  dt_stage_entry_t *best = NULL;
+  for(GList *l = _stage_lru; l; l = g_list_next(l))
+  {
+    dt_stage_entry_t *entry = (dt_stage_entry_t *)l->data;
+    if(entry->stage != stage) continue;
+    if(entry->size == size && _same_roi(&entry->roi, roi)) return entry;
+    if(!rgb || entry->dsc.datatype != TYPE_FLOAT || entry->dsc.channels != 4) continue;
+    if(entry->roi.x || entry->roi.y || entry->roi.scale < roi->scale || roi->x < 0 || roi->y < 0) continue;
+    const float ratio = roi->scale / entry->roi.scale;
+    if((roi->x + roi->width) / ratio > entry->roi.width + 0.5f
+       || (roi->y + roi->height) / ratio > entry->roi.height + 0.5f)
+      continue;
+    if(!best || entry->size < best->size) best = entry;
+  }
+  return best;
+}
+
+gboolean dt_dev_stage_cache_available(const uint64_t stage, const dt_iop_roi_t *roi, const dt_iop_buffer_dsc_t *dsc)
+{
+  if(!_stage_initialized || !stage) return FALSE;
+  const size_t size = (size_t)roi->width * roi->height * dt_iop_buffer_dsc_to_bpp(dsc);
+  dt_pthread_mutex_lock(&_stage_mutex);
+  const gboolean found = _find(stage, roi, size) != NULL;
+  if(!found) _stage_stats.misses++;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+  return found;
+}
+
+int dt_dev_stage_cache_get(const uint64_t stage, const dt_iop_roi_t *roi, void *data, const size_t size,
+                           dt_iop_buffer_dsc_t *dsc)
+{
+  if(!_stage_initialized || !stage || !data) return 1;
+  dt_pthread_mutex_lock(&_stage_mutex);
+  dt_stage_entry_t *entry = _find(stage, roi, size);
+  if(!entry)
+  {
+    dt_pthread_mutex_unlock(&_stage_mutex);
+    return 1;
+  }
+
+  if(entry->size == size && _same_roi(&entry->roi, roi))
+    memcpy(data, entry->data, size);
+  else
+  {
+    // resample as if the entry was the full input, see dt_dev_pixelpipe_process_rec()
+    dt_iop_roi_t roi_out = *roi;
+    roi_out.scale = roi->scale / entry->roi.scale;
+    dt_iop_roi_t roi_in = entry->roi;
+    roi_in.scale = 1.0f;
+    dt_iop_clip_and_zoom((float *)data, (const float *)entry->data, &roi_out, &roi_in, roi->width,
+                         entry->roi.width);
+  }
+  *dsc = entry->dsc;
+  _stage_lru = g_list_remove(_stage_lru, entry);
+  _stage_lru = g_list_append(_stage_lru, entry);
+  _stage_stats.hits++;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+  return 0;
+}
+
+void dt_dev_stage_cache_want(const uint64_t stage, const void *pipe)
+{
+  if(!_stage_initialized || !stage) return;
+  dt_pthread_mutex_lock(&_stage_mutex);
+  _stage_wanted[_stage_wanted_next] = (dt_stage_wanted_t){ stage, pipe };
+  _stage_wanted_next = (_stage_wanted_next + 1) % DT_STAGE_CACHE_WANTED;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+}
+
+gboolean dt_dev_stage_cache_wanted(const uint64_t stage, const void *pipe)
+{
+  if(!_stage_initialized || !stage) return FALSE;
+  gboolean wanted = FALSE;
+  dt_pthread_mutex_lock(&_stage_mutex);
+  for(int k = 0; k < DT_STAGE_CACHE_WANTED && !wanted; k++)
+    wanted = _stage_wanted[k].stage == stage && _stage_wanted[k].pipe != pipe;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+  return wanted;
+}
+
+void dt_dev_stage_cache_put(const uint64_t stage, const dt_iop_roi_t *roi, const void *data, const size_t size,
+                            const dt_iop_buffer_dsc_t *dsc)
+{
+  if(!_stage_initialized || !stage || !data || size > _stage_limit) return;
+  void *copy = dt_alloc_align(64, size);
+  if(!copy) return;
+  memcpy(copy, data, size);
+
+  dt_stage_entry_t *entry = (dt_stage_entry_t *)g_malloc(sizeof(dt_stage_entry_t));
+  entry->stage = stage;
+  entry->roi = *roi;
+  entry->dsc = *dsc;
+  entry->data = copy;
+  entry->size = size;
+
+  dt_pthread_mutex_lock(&_stage_mutex);
+  for(GList *l = _stage_lru; l; l = g_list_next(l))
+  {
+    dt_stage_entry_t *old = (dt_stage_entry_t *)l->data;
+    if(old->stage == stage && _same_roi(&old->roi, roi))
+    {
+      _stage_lru = g_list_delete_link(_stage_lru, l);
+      _entry_free(old);
+      break;
+    }
+  }
+  for(int k = 0; k < DT_STAGE_CACHE_WANTED; k++)
+    if(_stage_wanted[k].stage == stage) _stage_wanted[k].stage = 0;
+  const size_t allmem = __atomic_load_n(&_stage_allmem, __ATOMIC_RELAXED);
+  if(allmem + size > _stage_limit) _evict(allmem + size - _stage_limit);
+  _stage_lru = g_list_append(_stage_lru, entry);
+  __atomic_add_fetch(&_stage_allmem, size, __ATOMIC_RELAXED);
+  dt_pthread_mutex_unlock(&_stage_mutex);
+}
+
+void dt_dev_stage_cache_flush(void)
+{
+  if(!_stage_initialized) return;
+  dt_pthread_mutex_lock(&_stage_mutex);
+  g_list_free_full(_stage_lru, (GDestroyNotify)_entry_free);
+  _stage_lru = NULL;
+  dt_pthread_mutex_unlock(&_stage_mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,69 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_buffer_dsc_t;
+struct dt_iop_roi_t;
+
+/**
+ * a process wide cache for the output of the sensor-referred part of the pipe (rawprepare,
+ * demosaic, denoise, ... up to colorin), which is the most expensive one and changes least.
+ * the per-pipe caches only help the pipe they belong to, so each new export or thumbnail pipe
+ * and each darkroom pipe coming back to an image would compute it again.
+ *
+ * entries are addressed by content: the hash of the module stack up to the stage, the kind of
+ * pipe (modules choose their quality by it, so e.g. export and darkroom results differ), the
+ * size of the pipe input, the preferences the modules read and the roi. a pipe takes an entry
+ * with the same roi, or scales down from one holding the whole image at a larger scale.
+ *
+ * export and thumbnail pipes store what they compute, the darkroom pipes only what another
+ * pipe asked for and didn't find, they have their own caches.
+ */
+
+void dt_dev_stage_cache_init(void);
+void dt_dev_stage_cache_cleanup(void);
+
+/** the address of the stage output the pipe computes for the given basichash. */
+uint64_t dt_dev_stage_cache_stage(const struct dt_dev_pixelpipe_t *pipe, const uint64_t basichash);
+
+/** is there an entry the given roi can be filled from? */
+gboolean dt_dev_stage_cache_available(const uint64_t stage, const struct dt_iop_roi_t *roi,
+                                      const struct dt_iop_buffer_dsc_t *dsc);
+/** fills data (size bytes, the roi in the format of dsc) from the cache and updates dsc.
+  * returns 0 on success, non-zero if there is no suitable entry (anymore). */
+int dt_dev_stage_cache_get(const uint64_t stage, const struct dt_iop_roi_t *roi, void *data, const size_t size,
+                           struct dt_iop_buffer_dsc_t *dsc);
+/** remember that the given pipe looked for the stage and didn't find it. */
+void dt_dev_stage_cache_want(const uint64_t stage, const void *pipe);
+/** has a pipe other than the given one looked for the stage recently? */
+gboolean dt_dev_stage_cache_wanted(const uint64_t stage, const void *pipe);
+/** stores a copy of a stage output, replacing an older one for the same roi. */
+void dt_dev_stage_cache_put(const uint64_t stage, const struct dt_iop_roi_t *roi, const void *data,
+                            const size_t size, const struct dt_iop_buffer_dsc_t *dsc);
+
+/** drops all entries. */
+void dt_dev_stage_cache_flush(void);
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -18,6 +18,7 @@
 
 
 #include "develop/tiling.h"
+#include "common/memory_governor.h"
 #include "common/opencl.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -43,6 +44,16 @@
    Needs to be increased if tiling fails due to insufficient buffer sizes. */
 #define RESERVE 5
 
+/* share of host_memory_limit the pipes on this thread may use. concurrent export
+   pipes split it between them. */
+static __thread float _host_memory_share = 1.0f;
+
+/* host_memory_limit in bytes, but never more than half of the global memory budget, times our share. */
+static float _host_memory_available(void)
+{
+  const size_t limit = (size_t)MAX(dt_conf_get_int("host_memory_limit"), 0) * 1024 * 1024;
+  return dt_memory_governor_clamp(limit, 0.5f) * _host_memory_share;
+}
 
 /* greatest common divisor */
 static unsigned _gcd(unsigned a, unsigned b)
@@ -610,8 +621,8 @@ static void _default_process_tiling_ptp(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
-  assert(available >= 500.0f * 1024.0f * 1024.0f);
+  assert(dt_conf_get_float("host_memory_limit") >= 500.0f);
+  float available = _host_memory_available();
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
                    - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
@@ -877,8 +888,8 @@ static void _default_process_tiling_roi(struct dt_iop_module_t *self, struct dt_
   }
 
   /* calculate optimal size of tiles */
-  float available = dt_conf_get_float("host_memory_limit") * 1024.0f * 1024.0f;
-  assert(available >= 500.0f * 1024.0f * 1024.0f);
+  assert(dt_conf_get_float("host_memory_limit") >= 500.0f);
+  float available = _host_memory_available();
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
   available = fmax(available - ((float)roi_out->width * roi_out->height * out_bpp)
                    - ((float)roi_in->width * roi_in->height * in_bpp) - tiling.overhead,
@@ -2053,6 +2064,11 @@ void default_tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpi
   return;
 }
 
+void dt_tiling_set_host_memory_share(const float share)
+{
+  _host_memory_share = CLAMPS(share, 0.01f, 1.0f);
+}
+
 int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
                                      const float factor, const size_t overhead)
 {
@@ -2070,7 +2086,8 @@ int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, co
 
   float requirement = factor * width * height * bpp + overhead;
 
-  if(host_memory_limit == 0 || requirement <= host_memory_limit * 1024.0f * 1024.0f) return TRUE;
+  if(host_memory_limit == 0 || requirement <= _host_memory_available())
+    return TRUE;
 
   return FALSE;
 }
@@ -67,6 +67,10 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
                      const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                      struct dt_develop_tiling_t *tiling);
 
+/** share of host_memory_limit the pipes processed on the calling thread may use (1.0 unless several
+    pipes run concurrently, like the export job does). */
+void dt_tiling_set_host_memory_share(const float share);
+
 int dt_tiling_piece_fits_host_memory(const size_t width, const size_t height, const unsigned bpp,
                                      const float factor, const size_t overhead);
 
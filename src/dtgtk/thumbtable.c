@@ -21,6 +21,7 @@
 #include "common/colorlabels.h"
 #include "common/debug.h"
 #include "common/history.h"
+#include "common/image_cache.h"
 #include "common/ratings.h"
 #include "common/selection.h"
 #include "control/control.h"
@@ -1257,7 +1258,12 @@ static void _dt_collection_changed_callback(gpointer instance, dt_collection_cha
 {
   if(!user_data) return;
   dt_thumbtable_t *table = (dt_thumbtable_t *)user_data;
-  if(query_change == DT_COLLECTION_CHANGE_RELOAD)
+  if(query_change == DT_COLLECTION_CHANGE_DELTA)
+  {
+    // no image moved, the thumbnails of the changed ones update their infos themselves
+    dt_control_queue_redraw_center();
+  }
+  else if(query_change == DT_COLLECTION_CHANGE_RELOAD)
   {
     int old_hover = dt_control_get_mouse_over_id();
     /** Here's how it works
@@ -1399,6 +1405,11 @@ static void _dt_collection_changed_callback(gpointer instance, dt_collection_cha
     // otherwise we reset the offset to the beginning
     table->offset = 1;
     table->offset_imgid = _thumb_get_imgid(table->offset);
+
+    // the collection is a new one, fetch the image structs of the visible thumbnails at once
+    // instead of one query per thumbnail
+    dt_image_cache_preload_collection(darktable.image_cache, table->offset,
+                                      table->thumbs_per_row * (table->rows + 1));
     dt_conf_set_int("plugins/lighttable/recentcollect/pos0", 1);
     dt_conf_set_int("lighttable/zoomable/last_offset", 1);
     dt_conf_set_int("lighttable/zoomable/last_pos_x", 0);
@@ -45,7 +45,57 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+typedef struct dt_generate_cache_t
+{
+  dt_mipmap_size_t min_mip, max_mip;
+  int32_t *imgids;     // images to work on
+  gboolean *stale;     // history changed since their thumbnails were written
+  size_t image_count;
+  gboolean incremental;
+  volatile gint next;  // next index into imgids to be picked up by a worker
+  volatile gint done;  // progress counter
+} dt_generate_cache_t;
+
+static void _generate_image(dt_generate_cache_t *g, const int32_t imgid, const gboolean stale)
+{
+  if(g->incremental)
+  {
+    gboolean ondisk = TRUE;
+    for(int k = g->max_mip; k >= g->min_mip && ondisk; k--)
+      ondisk = dt_mipmap_cache_ondisk_exists(darktable.mipmap_cache, imgid, k);
+    // nothing moved since the last run, don't even touch the cache
+    if(ondisk && !stale) return;
+    // thumbnails on disk show an outdated history, drop them
+    if(stale) dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  }
+
+  // develop once at max_mip, downsample all the smaller ones from there
+  dt_mipmap_cache_generate_pyramid(darktable.mipmap_cache, imgid, g->min_mip, g->max_mip);
+
+  // and immediately write thumbs to disc and remove from mipmap cache.
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+  // thumbnail in sync with image
+  dt_history_hash_set_mipmap(imgid);
+}
+
+static gpointer _generate_worker(gpointer data)
+{
+  dt_generate_cache_t *g = (dt_generate_cache_t *)data;
+  for(size_t i = g_atomic_int_add(&g->next, 1); i < g->image_count; i = g_atomic_int_add(&g->next, 1))
+  {
+    const int32_t imgid = g->imgids[i];
+    _generate_image(g, imgid, g->stale[i]);
+
+    const size_t counter = g_atomic_int_add(&g->done, 1) + 1;
+    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, g->image_count,
+            100.0 * counter / (float)g->image_count, imgid);
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    const int32_t min_imgid, const int32_t max_imgid, const int jobs,
+                                    const gboolean incremental)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
@@ -63,7 +113,7 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
 
   // some progress counter
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
+  size_t image_count = 0;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
@@ -87,39 +137,44 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // go through all images:
+  dt_generate_cache_t g = { .min_mip = min_mip, .max_mip = max_mip, .incremental = incremental };
+  g.imgids = g_malloc_n(MAX(image_count, 1), sizeof(int32_t));
+  g.stale = g_malloc_n(MAX(image_count, 1), sizeof(gboolean));
+
+  // collect all images up front, the workers don't need to share a statement then.
+  // an image is stale when its history has a hash which the thumbnails haven't been written for.
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT i.id, h.imgid IS NOT NULL AND h.mipmap_hash IS NOT h.current_hash"
+                              " FROM main.images AS i"
+                              " LEFT JOIN main.history_hash AS h ON h.imgid = i.id"
+                              " WHERE i.id >= ?1 AND i.id <= ?2",
+                              -1, &stmt, 0);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  while(sqlite3_step(stmt) == SQLITE_ROW && g.image_count < image_count)
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid);
-
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
-    {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
-
-      // if the thumbnail is already on disc - do nothing
-      if(!access(filename, R_OK)) continue;
-
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    }
+    g.imgids[g.image_count] = sqlite3_column_int(stmt, 0);
+    g.stale[g.image_count] = sqlite3_column_int(stmt, 1);
+    g.image_count++;
+  }
+  sqlite3_finalize(stmt);
 
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
-    // thumbnail in sync with image
-    dt_history_hash_set_mipmap(imgid);
+  // go through all images:
+  const int nthreads = MAX(1, MIN(jobs, (int)g.image_count));
+  if(nthreads == 1)
+  {
+    _generate_worker(&g);
+  }
+  else
+  {
+    GThread **threads = g_malloc_n(nthreads, sizeof(GThread *));
+    for(int k = 0; k < nthreads; k++) threads[k] = g_thread_new("generate-cache", _generate_worker, &g);
+    for(int k = 0; k < nthreads; k++) g_thread_join(threads[k]);
+    g_free(threads);
   }
 
-  sqlite3_finalize(stmt);
+  g_free(g.imgids);
+  g_free(g.stale);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -131,13 +186,19 @@ static void usage(const char *progname)
           "usage: %s [-h, --help; --version]\n"
           "  [--min-mip <0-8> (default = 0)] [-m, --max-mip <0-8> (default = 2)]\n"
           "  [--min-imgid <N>] [--max-imgid <N>]\n"
+          "  [-j, --jobs <N> (default = 1)] [--incremental]\n"
           "  [--core <darktable options>]\n"
           "\n"
           "When multiple mipmap sizes are requested, the biggest one is computed\n"
-          "while the rest are quickly downsampled.\n"
+          "while the rest are quickly downsampled from it.\n"
           "\n"
           "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-          "numbers to work on.\n",
+          "numbers to work on.\n"
+          "\n"
+          "--jobs processes that many images in parallel.\n"
+          "\n"
+          "--incremental skips images whose thumbnails are on disk and whose history\n"
+          "didn't change since they were written, and regenerates the outdated ones.\n",
           progname);
 }
 
@@ -163,6 +224,8 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = 0;
   int32_t max_imgid = INT32_MAX;
+  int jobs = 1;
+  gboolean incremental = FALSE;
 
   int k;
   for(k = 1; k < argc; k++)
@@ -198,6 +261,15 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--jobs")) && argc > k + 1)
+    {
+      k++;
+      jobs = MIN(MAX(atoi(arg[k]), 1), 64);
+    }
+    else if(!strcmp(arg[k], "--incremental"))
+    {
+      incremental = TRUE;
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -251,7 +323,7 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, jobs, incremental))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
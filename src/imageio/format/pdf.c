@@ -415,7 +415,7 @@ const char *name()
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_NO_TMPFILE;
+  return FORMAT_FLAGS_NO_TMPFILE | FORMAT_FLAGS_NO_CONCURRENT;
 }
 
 int dimension(struct dt_imageio_module_format_t *self, dt_imageio_module_data_t *data, uint32_t *width, uint32_t *height)
@@ -35,10 +35,13 @@
 #ifdef GDK_WINDOWING_QUARTZ
 #include "osx/osx.h"
 #endif
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 DT_MODULE(3)
 
@@ -243,7 +246,8 @@ int store(dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, co
   // set max_width and max_height values to expand them afterwards in darktable variables
   dt_variables_set_max_width_height(d->vp, fdata->max_width, fdata->max_height);
   int fail = 0;
-  // we're potentially called in parallel. have sequence number synchronized:
+  gboolean reserved = FALSE;
+  // we're potentially called in parallel. have sequence number and file name synchronized:
   dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   {
 try_again:
@@ -303,19 +307,20 @@ try_again:
   failed:
     g_free(output_dir);
 
-    if(!fail && d->onsave_action == DT_EXPORT_ONCONFLICT_UNIQUEFILENAME)
+    // reserve the file name before we leave the critical block, so that the exports running
+    // in parallel can't pick the same one. the format writers truncate the empty file.
+    if(!fail && d->onsave_action != DT_EXPORT_ONCONFLICT_OVERWRITE)
     {
       int seq = 1;
-      while(g_file_test(filename, G_FILE_TEST_EXISTS))
+      int fd;
+      while((fd = g_open(filename, O_CREAT | O_EXCL | O_WRONLY, 0644)) == -1 && errno == EEXIST
+            && d->onsave_action == DT_EXPORT_ONCONFLICT_UNIQUEFILENAME)
       {
         snprintf(c, filename_free_space, "_%.2d.%s", seq, ext);
         seq++;
       }
-    }
 
-    if(!fail && d->onsave_action == DT_EXPORT_ONCONFLICT_SKIP)
-    {
-      if(g_file_test(filename, G_FILE_TEST_EXISTS))
+      if(fd == -1 && errno == EEXIST)
       {
         dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
         fprintf(stderr, "[export_job] skipping `%s'\n", filename);
@@ -323,6 +328,17 @@ try_again:
                        num, total, filename);
         return 0;
       }
+      if(fd == -1)
+      {
+        fprintf(stderr, "[imageio_storage_disk] could not create file: `%s'!\n", filename);
+        dt_control_log(_("could not export to file `%s'!"), filename);
+        fail = 1;
+      }
+      else
+      {
+        close(fd);
+        reserved = TRUE;
+      }
     }
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
@@ -334,6 +350,8 @@ try_again:
   {
     fprintf(stderr, "[imageio_storage_disk] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    // don't leave the empty file behind
+    if(reserved) g_unlink(filename);
     return 1;
   }
 
@@ -393,6 +411,13 @@ int set_params(dt_imageio_module_storage_t *self, const void *params, const int
   return 0;
 }
 
+int concurrent_store(dt_imageio_module_storage_t *self)
+{
+  // file names are generated and the files created under darktable.plugin_threadsafe,
+  // so each image gets its own even when several are stored at the same time
+  return 1;
+}
+
 char *ask_user_confirmation(dt_imageio_module_storage_t *self)
 {
   disk_t *g = (disk_t *)self->gui_data;
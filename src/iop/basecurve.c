@@ -349,7 +349,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_TILING_BARRIER;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -1370,6 +1370,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->exposure_bias = p->exposure_bias;
   d->preserve_colors = p->preserve_colors;
 
+  // only the fusion pyramid needs the whole image, the curve alone is per pixel
+  if(!d->exposure_fusion) piece->tiling_barrier = 0;
+
   const int ch = 0;
   // take care of possible change of curve type or number of nodes (not yet implemented in UI)
   if(d->basecurve_type != p->basecurve_type[ch] || d->basecurve_nodes != p->basecurve_nodes[ch])
@@ -187,6 +187,22 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_colorcontrast_params_t *const d = (dt_iop_colorcontrast_params_t *)piece->data;
+
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float a = (in[k + 1] * d->a_steepness) + d->a_offset;
+    const float b = (in[k + 2] * d->b_steepness) + d->b_offset;
+    out[k] = in[k];
+    out[k + 1] = d->unbound ? a : CLAMP(a, -128.0f, 128.0f);
+    out[k + 2] = d->unbound ? b : CLAMP(b, -128.0f, 128.0f);
+    out[k + 3] = in[k + 3];
+  }
+}
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const restrict ivoid,
                   void *const restrict ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -145,6 +145,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_colorcorrection_data_t *const d = (dt_iop_colorcorrection_data_t *)piece->data;
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float L = in[k];
+    out[k] = L;
+    out[k+1] = d->saturation * (in[k+1] + L * d->a_scale + d->a_base);
+    out[k+2] = d->saturation * (in[k+2] + L * d->b_scale + d->b_base);
+    out[k+3] = in[k+3];
+  }
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
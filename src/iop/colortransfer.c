@@ -109,7 +109,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PREVIEW_NON_OPENCL;
+  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_PREVIEW_NON_OPENCL | IOP_FLAGS_TILING_BARRIER;
 }
 
 const char *deprecated_msg()
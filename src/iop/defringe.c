@@ -91,7 +91,7 @@ int default_group()
 int flags()
 {
   // a second instance might help to reduce artifacts when thick fringe needs to be removed
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_TILING_BARRIER | IOP_FLAGS_ROI_DEPENDENT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
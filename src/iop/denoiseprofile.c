@@ -23,6 +23,7 @@
 #include "common/nlmeans_core.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
+#include "common/scratch.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
@@ -1131,7 +1132,7 @@ static void eaw_decompose(float *const out, const float *const in, float *const
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
   const int boundary = 2 * mult;
   const int nthreads = dt_get_num_threads();
-  float *squared_sums = dt_alloc_align(64,3*sizeof(float)*nthreads);
+  float *squared_sums = dt_scratch_alloc(3*sizeof(float)*nthreads);
   for(int i = 0; i < 3*nthreads; i++)
     squared_sums[i] = 0.0f;
 
@@ -1219,7 +1220,7 @@ static void eaw_decompose(float *const out, const float *const in, float *const
     for(int i = 0; i < nthreads; i++)
       sum_squared[c] += squared_sums[3*i+c];
   }
-  dt_free_align(squared_sums);
+  dt_scratch_free(squared_sums);
 }
 
 #undef SUM_PIXEL_CONTRIBUTION
@@ -1234,7 +1235,7 @@ static void eaw_decompose_sse(float *const out, const float *const in, float *co
   static const float filter[5] = { 1.0f / 16.0f, 4.0f / 16.0f, 6.0f / 16.0f, 4.0f / 16.0f, 1.0f / 16.0f };
   const int boundary = 2 * mult;
   const int nthreads = dt_get_num_threads();
-  __m128 *squared_sums = dt_alloc_align(64,sizeof(__m128)*nthreads);
+  __m128 *squared_sums = dt_scratch_alloc(sizeof(__m128)*nthreads);
   for(int i = 0; i < nthreads; i++)
     squared_sums[i] = _mm_setzero_ps();
 
@@ -1318,7 +1319,7 @@ static void eaw_decompose_sse(float *const out, const float *const in, float *co
   __m128 sum = _mm_setzero_ps();
   for(int i = 0; i < nthreads; i++)
     sum += squared_sums[i];
-  dt_free_align(squared_sums);
+  dt_scratch_free(squared_sums);
   _mm_store_ps(sum_squared, sum);
   _mm_sfence();
 }
@@ -1512,8 +1513,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   float *tmp = NULL;
   float *buf1 = NULL, *buf2 = NULL;
   for(int k = 0; k < max_scale; k++)
-    buf[k] = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
-  tmp = dt_alloc_align(64, (size_t)4 * sizeof(float) * npixels);
+    buf[k] = dt_scratch_alloc((size_t)4 * sizeof(float) * npixels);
+  tmp = dt_scratch_alloc((size_t)4 * sizeof(float) * npixels);
 
   float wb[3];
   const float wb_weights[3] = { 2.0f, 1.0f, 2.0f };
@@ -1717,8 +1718,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     backtransform_Y0U0V0((float *)ovoid, width, height, d->a[1] * compensate_p, p, d->b[1], d->bias - 0.5 * logf(in_scale), wb, toRGB);
   }
 
-  for(int k = 0; k < max_scale; k++) dt_free_align(buf[k]);
-  dt_free_align(tmp);
+  for(int k = 0; k < max_scale; k++) dt_scratch_free(buf[k]);
+  dt_scratch_free(tmp);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, width, height);
 
@@ -1890,7 +1891,7 @@ static void process_nlmeans_cpu(dt_dev_pixelpipe_iop_t *piece,
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_scratch_alloc((size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   float wb[3];
   float p[3];
@@ -1911,7 +1912,7 @@ static void process_nlmeans_cpu(dt_dev_pixelpipe_iop_t *piece,
                                       .norm = norm2 };
   denoiser(in,ovoid,roi_in,roi_out,&params);
 
-  dt_free_align(in);
+  dt_scratch_free(in);
   nlmeans_backtransform(d,ovoid,roi_in,scale,compensate_p,wb,aa,bb,p);
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
@@ -2010,7 +2011,7 @@ static void process_variance(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     return;
   }
 
-  float *in = dt_alloc_align(64, (size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
+  float *in = dt_scratch_alloc((size_t)4 * sizeof(float) * roi_in->width * roi_in->height);
 
   float wb[3];
   const float wb_weights[3] = { 1.0f, 1.0f, 1.0f };
@@ -2025,7 +2026,7 @@ static void process_variance(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   for(int i = 0; i < 3; i++) wb[i] *= d->strength;
 
   const float compensate_p = DT_IOP_DENOISE_PROFILE_P_FULCRUM / powf(DT_IOP_DENOISE_PROFILE_P_FULCRUM, d->shadows);
-  precondition_v2((float *)ivoid, (float *)ovoid, roi_in->width, roi_in->height, d->a[1] * compensate_p, p, d->b[1], wb);
+  precondition_v2((float *)ivoid, in, roi_in->width, roi_in->height, d->a[1] * compensate_p, p, d->b[1], wb);
 
   float *out = (float *)ovoid;
   // we use out as a temporary buffer here
@@ -2046,6 +2047,7 @@ static void process_variance(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
   g->variance_G = var[1];
   g->variance_B = var[2];
 
+  dt_scratch_free(in);
   memcpy(ovoid, ivoid, npixels * 4 * sizeof(float));
 }
 
@@ -2500,7 +2502,7 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   dev_r = dt_opencl_alloc_device_buffer(devid, (size_t)reducesize * 4 * sizeof(float));
   if(dev_r == NULL) goto error;
 
-  sumsum = dt_alloc_align(64, (size_t)reducesize * 4 * sizeof(float));
+  sumsum = dt_scratch_alloc((size_t)reducesize * 4 * sizeof(float));
   if(sumsum == NULL) goto error;
 
   dev_tmp = dt_opencl_alloc_device(devid, width, height, 4 * sizeof(float));
@@ -2867,7 +2869,7 @@ static int process_wavelets_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_io
   for(int k = 0; k < max_scale; k++)
     dt_opencl_release_mem_object(dev_detail[k]);
   free(dev_detail);
-  dt_free_align(sumsum);
+  dt_scratch_free(sumsum);
   return TRUE;
 
 error:
@@ -2878,7 +2880,7 @@ error:
   for(int k = 0; k < max_scale; k++)
     dt_opencl_release_mem_object(dev_detail[k]);
   free(dev_detail);
-  dt_free_align(sumsum);
+  dt_scratch_free(sumsum);
   dt_print(DT_DEBUG_OPENCL, "[opencl_denoiseprofile] couldn't enqueue kernel! %d, devid %d\n", err, devid);
   return FALSE;
 }
@@ -96,7 +96,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_TILING_BARRIER | IOP_FLAGS_ROI_DEPENDENT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
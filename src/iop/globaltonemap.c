@@ -110,7 +110,8 @@ const char *deprecated_msg()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_DEPRECATED
+         | IOP_FLAGS_TILING_BARRIER;
 }
 
 int default_group()
@@ -561,7 +562,10 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->detail = p->detail;
 
   // drago needs the maximum L-value of the whole image so it must not use tiling
-  if(d->operator == OPERATOR_DRAGO) piece->process_tiling_ready = 0;
+  if(d->operator == OPERATOR_DRAGO)
+    piece->process_tiling_ready = 0;
+  else
+    piece->tiling_barrier = 0;
 
 #ifdef HAVE_OPENCL
   if(d->detail != 0.0f)
@@ -198,6 +198,17 @@ void process_sse2(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
                   const struct dt_iop_roi_t *const roi_out);
 #endif
 
+/** a per-pixel variant of process() for pure pointwise modules on 4 channel float buffers with
+  * roi_in == roi_out. the pipe may run the kernels of adjacent modules one after the other on each row
+  * instead of calling process() for every module, so this is called for a single row from several threads,
+  * possibly in place (i == o), and must not use OpenMP itself. */
+/** can be provided by each IOP. */
+void process_pixels(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const i,
+                    float *const o, const size_t npixels);
+/** called once before the rows of a fused pass, for what process() does besides touching the pixels
+  * (like updating piece->pipe->dsc.processed_maximum). */
+void process_pixels_setup(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece);
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 int process_cl(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
@@ -118,7 +118,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_TILING_BARRIER;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -512,6 +512,8 @@ void commit_params(dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_
   else
   {
     d->mode = LEVELS_MODE_MANUAL;
+    // no percentiles of the whole image to find
+    piece->tiling_barrier = 0;
 
     self->request_histogram |= (DT_REQUEST_ON);
 
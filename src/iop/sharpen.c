@@ -677,6 +677,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   d->radius = 2.5f * p->radius;
   d->amount = p->amount;
   d->threshold = p->threshold;
+
+  // nothing is added to the input without an amount or a radius
+  piece->identity = d->amount == 0.0f || d->radius == 0.0f;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
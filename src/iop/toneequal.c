@@ -330,7 +330,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_TILING_BARRIER;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -1514,6 +1514,9 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
   // UI blending param is set in % of the largest image dimension
   d->blending = p->blending / 100.0f;
 
+  // without the guided filter the mask is just the luminance of each pixel
+  if(d->details == DT_TONEEQ_NONE) piece->tiling_barrier = 0;
+
   // UI guided filter feathering param increases the edges taping
   // but the actual regularization params applied in guided filter behaves the other way
   d->feathering = 1.f / (p->feathering);
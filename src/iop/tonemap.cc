@@ -82,7 +82,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_DEPRECATED | IOP_FLAGS_TILING_BARRIER;
 }
 
 const char *deprecated_msg()
@@ -173,6 +173,41 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+void process_pixels(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                    float *const out, const size_t npixels)
+{
+  const dt_iop_velvia_data_t *const data = (dt_iop_velvia_data_t *)piece->data;
+  const float strength = data->strength / 100.0f;
+
+  if(strength <= 0.0)
+  {
+    if(in != out) memcpy(out, in, sizeof(float) * 4 * npixels);
+    return;
+  }
+
+  for(size_t k = 0; k < 4 * npixels; k += 4)
+  {
+    const float r = in[k + 0], g = in[k + 1], b = in[k + 2];
+
+    // same as process()
+    const float pmax = MAX(r, MAX(g, b));
+    const float pmin = MIN(r, MIN(g, b));
+    const float plum = (pmax + pmin) / 2.0f;
+    const float psat = (plum <= 0.5f) ? (pmax - pmin) / (1e-5f + pmax + pmin)
+                                      : (pmax - pmin) / (1e-5f + MAX(0.0f, 2.0f - pmax - pmin));
+    const float pweight
+        = CLAMPS(((1.0f - (1.5f * psat)) + ((1.0f + (fabsf(plum - 0.5f) * 2.0f)) * (1.0f - data->bias)))
+                     / (1.0f + (1.0f - data->bias)),
+                 0.0f, 1.0f);
+    const float saturation = strength * pweight;
+
+    out[k + 0] = CLAMPS(r + saturation * (r - 0.5f * (g + b)), 0.0f, 1.0f);
+    out[k + 1] = CLAMPS(g + saturation * (g - 0.5f * (b + r)), 0.0f, 1.0f);
+    out[k + 2] = CLAMPS(b + saturation * (b - 0.5f * (r + g)), 0.0f, 1.0f);
+    out[k + 3] = in[k + 3];
+  }
+}
+
 #if defined(__SSE__)
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
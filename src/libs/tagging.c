@@ -18,6 +18,7 @@
 #include "common/collection.h"
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/search_index.h"
 #include "common/tags.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -45,6 +46,7 @@ static gboolean _lib_tagging_tag_show(GtkAccelGroup *accel_group, GObject *accel
 typedef struct dt_lib_tagging_t
 {
   char keyword[1024];
+  GHashTable *matching; // ids of the tags matching the keyword, NULL to compare the names
   GtkEntry *entry;
   GtkTreeView *attached_view, *dictionary_view;
   GtkWidget *attach_button, *detach_button, *new_button, *import_button, *export_button, *attached_window, *dictionary_window;
@@ -184,9 +186,13 @@ static gboolean _set_matching_tag_visibility(GtkTreeModel *model, GtkTreePath *p
   gboolean visible;
   gchar *tagname = NULL;
   gchar *synonyms = NULL;
-  gtk_tree_model_get(model, iter, DT_LIB_TAGGING_COL_PATH, &tagname, DT_LIB_TAGGING_COL_SYNONYM, &synonyms, -1);
+  guint tagid = 0;
+  gtk_tree_model_get(model, iter, DT_LIB_TAGGING_COL_PATH, &tagname, DT_LIB_TAGGING_COL_SYNONYM, &synonyms,
+                     DT_LIB_TAGGING_COL_ID, &tagid, -1);
   if (!d->keyword[0])
     visible = TRUE;
+  else if (d->matching && tagid)
+    visible = g_hash_table_contains(d->matching, GUINT_TO_POINTER(tagid));
   else
   {
     if (synonyms && synonyms[0]) tagname = dt_util_dstrcat(tagname, ", %s", synonyms);
@@ -205,6 +211,15 @@ static gboolean _set_matching_tag_visibility(GtkTreeModel *model, GtkTreePath *p
   return FALSE;
 }
 
+// the search index finds the matching tags in one go, asked anew each time as the tags may have changed
+static void _show_matching_tags(GtkTreeModel *store, dt_lib_module_t *self)
+{
+  dt_lib_tagging_t *d = (dt_lib_tagging_t *)self->data;
+  if(d->matching) g_hash_table_destroy(d->matching);
+  d->matching = d->keyword[0] ? dt_search_index_find_tags(d->keyword) : NULL;
+  gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_set_matching_tag_visibility, self);
+}
+
 static gboolean _tree_reveal_func(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter, gpointer data)
 {
   gboolean state;
@@ -418,7 +433,7 @@ static void _init_treeview(dt_lib_module_t *self, const int which)
     }
     if (d->keyword[0])
     {
-      gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_set_matching_tag_visibility, self);
+      _show_matching_tags(store, self);
       gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_tree_reveal_func, NULL);
       gtk_tree_view_set_model(GTK_TREE_VIEW(view), model);
       gtk_tree_view_expand_all(d->dictionary_view);
@@ -450,7 +465,7 @@ static void _init_treeview(dt_lib_module_t *self, const int which)
     }
     if (which && d->keyword[0])
     {
-      gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_set_matching_tag_visibility, self);
+      _show_matching_tags(store, self);
     }
     gtk_tree_view_set_model(GTK_TREE_VIEW(view), model);
     g_object_unref(model);
@@ -1293,7 +1308,7 @@ static void _tag_name_changed(GtkEntry *entry, dt_lib_module_t *self)
   _set_keyword(self);
   GtkTreeModel *model = gtk_tree_view_get_model(d->dictionary_view);
   GtkTreeModel *store = gtk_tree_model_filter_get_model(GTK_TREE_MODEL_FILTER(model));
-  gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_set_matching_tag_visibility, self);
+  _show_matching_tags(store, self);
   if (d->tree_flag && d->keyword[0])
   {
     gtk_tree_model_foreach(store, (GtkTreeModelForeachFunc)_tree_reveal_func, NULL);
@@ -2608,6 +2623,7 @@ void gui_init(dt_lib_module_t *self)
   dt_lib_tagging_t *d = (dt_lib_tagging_t *)malloc(sizeof(dt_lib_tagging_t));
   self->data = (void *)d;
   d->last_tag = NULL;
+  d->matching = NULL;
   self->timeout_handle = 0;
 
   self->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
@@ -2873,6 +2889,7 @@ void gui_cleanup(dt_lib_module_t *self)
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_lib_selection_changed_callback), self);
   DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_collection_updated_callback), self);
   g_free(d->collection);
+  if(d->matching) g_hash_table_destroy(d->matching);
   free(self->data);
   self->data = NULL;
 }
@@ -0,0 +1,69 @@
+/*
+   This file is part of darktable,
+   Copyright (C) 2020 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/cache.h"
+#include "common/cache_stats.h"
+#include "lua/lua.h"
+
+static void _push_field(lua_State *L, const char *name, const uint64_t value)
+{
+  lua_pushinteger(L, (lua_Integer)value);
+  lua_setfield(L, -2, name);
+}
+
+// returns a table of all caches by name, each a table of its counters
+static int cache_stats(lua_State *L)
+{
+  GList *reports = dt_cache_stats_collect();
+  lua_newtable(L);
+  for(GList *l = reports; l; l = g_list_next(l))
+  {
+    const dt_cache_report_t *r = (dt_cache_report_t *)l->data;
+    lua_newtable(L);
+    _push_field(L, "entries", r->entries);
+    _push_field(L, "quota", r->quota);
+    _push_field(L, "hits", r->stats.hits);
+    _push_field(L, "misses", r->stats.misses);
+    _push_field(L, "evictions", r->stats.evictions);
+    _push_field(L, "lock_wait", r->stats.lock_wait);
+    _push_field(L, "resident", r->stats.resident);
+    lua_newtable(L);
+    for(int k = 0; k < DT_CACHE_LATENCY_BUCKETS; k++)
+    {
+      lua_pushinteger(L, (lua_Integer)r->stats.latency[k]);
+      lua_seti(L, -2, k + 1);
+    }
+    lua_setfield(L, -2, "latency");
+    lua_setfield(L, -2, r->name);
+  }
+  dt_cache_stats_free(reports);
+  return 1;
+}
+
+int dt_lua_init_cache(lua_State *L)
+{
+  dt_lua_push_darktable_lib(L);
+  lua_pushstring(L, "cache_stats");
+  lua_pushcfunction(L, &cache_stats);
+  lua_settable(L, -3);
+  lua_pop(L, 1);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -19,6 +19,7 @@
 #include "common/darktable.h"
 #include "common/file_location.h"
 #include "control/jobs.h"
+#include "lua/cache.h"
 #include "lua/cairo.h"
 #include "lua/call.h"
 #include "lua/configuration.h"
@@ -136,7 +137,7 @@ static lua_CFunction init_funcs[]
         dt_lua_init_luastorages,   dt_lua_init_tags,        dt_lua_init_film,     dt_lua_init_call,
         dt_lua_init_view,          dt_lua_init_events,      dt_lua_init_init,     dt_lua_init_widget,
         dt_lua_init_lualib,        dt_lua_init_gettext,     dt_lua_init_guides,   dt_lua_init_cairo,
-        NULL };
+        dt_lua_init_cache,         NULL };
 
 
 void dt_lua_init(lua_State *L, const char *lua_command)
@@ -0,0 +1,140 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// contention benchmark for dt_cache_t: many threads hammering get/release on
+// a shared cache, once with a single shard (the old "big fat lock" behaviour)
+// and once with the requested number of shards.
+//
+// usage: darktable-bench-cache [threads] [iterations per thread] [keys] [shards]
+
+#include "common/cache.h"
+#include "common/darktable.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct bench_thread_t
+{
+  dt_cache_t *cache;
+  uint32_t seed;
+  int iterations;
+  uint32_t keys;
+  int errors;
+}
+bench_thread_t;
+
+static void _allocate(void *data, dt_cache_entry_t *entry)
+{
+  uint32_t *buf = (uint32_t *)dt_alloc_align(64, sizeof(uint32_t));
+  *buf = entry->key;
+  entry->data = buf;
+  entry->data_size = sizeof(uint32_t);
+  entry->cost = 1;
+}
+
+static void _cleanup(void *data, dt_cache_entry_t *entry)
+{
+  dt_free_align(entry->data);
+}
+
+static void *_hammer(void *data)
+{
+  bench_thread_t *t = (bench_thread_t *)data;
+  uint32_t state = t->seed;
+  for(int k = 0; k < t->iterations; k++)
+  {
+    // xorshift, we only want a cheap spread of keys
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    const uint32_t key = 1 + state % t->keys;
+    // mostly readers, like the mipmap and image caches see in practice
+    const char mode = (k & 15) ? 'r' : 'w';
+    dt_cache_entry_t *entry = dt_cache_get(t->cache, key, mode);
+    if(*(uint32_t *)entry->data != key) t->errors++;
+    dt_cache_release(t->cache, entry);
+  }
+  return NULL;
+}
+
+static int _run(const int threads, const int iterations, const uint32_t keys, const uint32_t shards)
+{
+  dt_cache_t cache;
+  // quota below the key count, so eviction runs concurrently with lookups
+  dt_cache_init_sharded(&cache, 0, keys * 3 / 4, shards);
+  dt_cache_set_allocate_callback(&cache, _allocate, NULL);
+  dt_cache_set_cleanup_callback(&cache, _cleanup, NULL);
+
+  pthread_t *tid = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  bench_thread_t *t = (bench_thread_t *)calloc(threads, sizeof(bench_thread_t));
+
+  const double start = dt_get_wtime();
+  for(int k = 0; k < threads; k++)
+  {
+    t[k].cache = &cache;
+    t[k].seed = 0x12345678u + 7919u * k;
+    t[k].iterations = iterations;
+    t[k].keys = keys;
+    t[k].errors = 0;
+    pthread_create(tid + k, NULL, _hammer, t + k);
+  }
+  int errors = 0;
+  for(int k = 0; k < threads; k++)
+  {
+    pthread_join(tid[k], NULL);
+    errors += t[k].errors;
+  }
+  const double end = dt_get_wtime();
+
+  const double ops = (double)threads * iterations;
+  printf("[cache] %2u shard(s), %3d threads: %10.0f get/release per second, fill %zu/%zu, %d errors\n",
+         cache.num_shards, threads, ops / (end - start), cache.cost, cache.cost_quota, errors);
+
+  free(tid);
+  free(t);
+  dt_cache_cleanup(&cache);
+  return errors;
+}
+
+int main(int argc, char *argv[])
+{
+  const int threads = argc > 1 ? atoi(argv[1]) : 64;
+  const int iterations = argc > 2 ? atoi(argv[2]) : 200000;
+  const uint32_t keys = argc > 3 ? atoi(argv[3]) : 4096;
+  const uint32_t shards = argc > 4 ? atoi(argv[4]) : DT_CACHE_DEFAULT_SHARDS;
+
+  if(threads < 1 || iterations < 1 || keys < 4 || shards < 1)
+  {
+    fprintf(stderr, "usage: %s [threads] [iterations per thread] [keys] [shards]\n", argv[0]);
+    return 1;
+  }
+
+  int errors = 0;
+  for(int nt = 1; nt <= threads; nt *= 2)
+  {
+    errors += _run(nt, iterations, keys, 1);
+    errors += _run(nt, iterations, keys, shards);
+  }
+
+  return errors ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
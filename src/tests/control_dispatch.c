@@ -0,0 +1,194 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// dispatch benchmark for the dt_control job system: thousands of tiny jobs, the way thumbnail loads and
+// imports hit it. measures how long a job waits between dt_control_add_job() and starting to run, and how
+// many jobs per second get through.
+//
+// - flat:   all jobs queued at once from the main thread into DT_JOB_QUEUE_USER_BG
+// - bursts: small bursts of DT_JOB_QUEUE_SYSTEM_FG jobs, like scrolling the lighttable
+// - nested: one job queuing all the others from a worker, idle workers have to steal them
+//
+// usage: darktable-bench-jobs [worker threads] [jobs] [work per job in us]
+
+#include "common/darktable.h"
+#include "control/control.h"
+#include "control/jobs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct bench_t
+{
+  double *latency;  // per job, wait between being added and starting
+  gint executed;
+  gint disposed;
+  int jobs;
+  int work_us;
+} bench_t;
+
+typedef struct bench_job_t
+{
+  bench_t *bench;
+  int index;
+  double queued;
+} bench_job_t;
+
+static bench_t bench;
+
+static void _spin(const int us)
+{
+  const double end = dt_get_wtime() + us * 1e-6;
+  while(dt_get_wtime() < end)
+    ;
+}
+
+static void _job_destroy(void *data)
+{
+  bench_job_t *params = (bench_job_t *)data;
+  g_atomic_int_inc(&params->bench->disposed);
+  free(params);
+}
+
+static int32_t _job_run(dt_job_t *job)
+{
+  bench_job_t *params = (bench_job_t *)dt_control_job_get_params(job);
+  params->bench->latency[params->index] = dt_get_wtime() - params->queued;
+  _spin(params->bench->work_us);
+  g_atomic_int_inc(&params->bench->executed);
+  return 0;
+}
+
+static void _add_job(const dt_job_queue_t queue, const int index)
+{
+  dt_job_t *job = dt_control_job_create(&_job_run, "bench job %d", index);
+  bench_job_t *params = (bench_job_t *)calloc(1, sizeof(bench_job_t));
+  params->bench = &bench;
+  params->index = index;
+  params->queued = dt_get_wtime();
+  // with the size set no two jobs compare equal, so the thumbnail queue won't dedupe them
+  dt_control_job_set_params_with_size(job, params, sizeof(bench_job_t), _job_destroy);
+  dt_control_add_job(darktable.control, queue, job);
+}
+
+static int32_t _spawn_run(dt_job_t *job)
+{
+  for(int k = 0; k < bench.jobs; k++) _add_job(DT_JOB_QUEUE_USER_BG, k);
+  return 0;
+}
+
+static void _wait(const int jobs)
+{
+  while(g_atomic_int_get(&bench.disposed) < jobs) g_usleep(100);
+}
+
+static int _compare(const void *a, const void *b)
+{
+  const double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static void _report(const char *name, const double start, const double end)
+{
+  const int executed = g_atomic_int_get(&bench.executed);
+  qsort(bench.latency, executed, sizeof(double), _compare);
+  double sum = 0.0;
+  for(int k = 0; k < executed; k++) sum += bench.latency[k];
+  printf("[jobs] %-6s %6d jobs, %3d dropped: %10.0f jobs per second, latency mean %8.1f us, p50 %8.1f us, "
+         "p99 %8.1f us\n",
+         name, bench.jobs, bench.jobs - executed, executed / (end - start),
+         executed ? 1e6 * sum / executed : 0.0, executed ? 1e6 * bench.latency[executed / 2] : 0.0,
+         executed ? 1e6 * bench.latency[(int)(executed * 0.99)] : 0.0);
+}
+
+static void _reset()
+{
+  memset(bench.latency, 0, sizeof(double) * bench.jobs);
+  g_atomic_int_set(&bench.executed, 0);
+  g_atomic_int_set(&bench.disposed, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  const int threads = argc > 1 ? atoi(argv[1]) : 4;
+  bench.jobs = argc > 2 ? atoi(argv[2]) : 20000;
+  bench.work_us = argc > 3 ? atoi(argv[3]) : 10;
+
+  if(threads < 1 || bench.jobs < 1 || bench.work_us < 0)
+  {
+    fprintf(stderr, "usage: %s [worker threads] [jobs] [work per job in us]\n", argv[0]);
+    return 1;
+  }
+
+  char workers[64];
+  snprintf(workers, sizeof(workers), "worker_threads=%d", threads);
+  char *dt_argv[] = { "darktable-bench-jobs", "--library", ":memory:", "--conf", workers, NULL };
+  int dt_argc = sizeof(dt_argv) / sizeof(*dt_argv) - 1;
+
+  // init dt without gui and without data.db, then start the job system on its own
+  if(dt_init(dt_argc, dt_argv, FALSE, FALSE, NULL)) exit(1);
+  dt_control_t *control = darktable.control;
+  pthread_cond_init(&control->cond, NULL);
+  dt_pthread_mutex_init(&control->cond_mutex, NULL);
+  dt_pthread_mutex_init(&control->res_mutex, NULL);
+  dt_control_jobs_init(control);
+
+  bench.latency = (double *)calloc(bench.jobs, sizeof(double));
+
+  // flat
+  _reset();
+  double start = dt_get_wtime();
+  for(int k = 0; k < bench.jobs; k++) _add_job(DT_JOB_QUEUE_USER_BG, k);
+  _wait(bench.jobs);
+  _report("flat", start, dt_get_wtime());
+
+  // bursts, staying below the size of the thumbnail stack so nothing gets pushed out
+  _reset();
+  const int burst = 16;
+  start = dt_get_wtime();
+  for(int k = 0; k < bench.jobs; k += burst)
+  {
+    const int n = MIN(burst, bench.jobs - k);
+    for(int i = 0; i < n; i++) _add_job(DT_JOB_QUEUE_SYSTEM_FG, k + i);
+    _wait(k + n);
+  }
+  _report("bursts", start, dt_get_wtime());
+
+  // nested
+  _reset();
+  start = dt_get_wtime();
+  dt_control_add_job(control, DT_JOB_QUEUE_USER_FG, dt_control_job_create(&_spawn_run, "bench spawn"));
+  _wait(bench.jobs);
+  _report("nested", start, dt_get_wtime());
+
+  dt_control_shutdown(control);
+  dt_control_jobs_cleanup(control);
+  dt_pthread_mutex_destroy(&control->res_mutex);
+  dt_pthread_mutex_destroy(&control->cond_mutex);
+  pthread_cond_destroy(&control->cond);
+  free(bench.latency);
+
+  dt_cleanup();
+
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,297 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// import benchmark: a synthetic card dump of small dng and jpeg files, half of them raw+jpeg pairs, is
+// imported with one reading thread and with several (see dt_film_import1()). the files only carry exif
+// data and a tiny strip, so the numbers are about the per file overhead rather than reading bytes.
+//
+// usage: darktable-bench-import [files] [threads]
+
+#include "common/darktable.h"
+#include "common/debug.h"
+#include "common/film.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/progress.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _entry_t
+{
+  uint16_t tag;
+  uint16_t type;   // 1 byte, 2 ascii, 3 short, 4 long
+  uint32_t count;
+  uint32_t number; // short and long values
+  const char *bytes; // byte and ascii values
+} _entry_t;
+
+#define TAG_STRIP_OFFSETS 273
+
+static void _put16(GByteArray *b, const uint16_t v)
+{
+  const guint8 x[2] = { v & 0xff, v >> 8 };
+  g_byte_array_append(b, x, 2);
+}
+
+static void _put32(GByteArray *b, const uint32_t v)
+{
+  const guint8 x[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+  g_byte_array_append(b, x, 4);
+}
+
+static uint32_t _entry_size(const _entry_t *e)
+{
+  return e->count * (e->type == 3 ? 2 : e->type == 4 ? 4 : 1);
+}
+
+// a little endian tiff with one ifd, the strip (if any) at the end
+static GByteArray *_tiff(const _entry_t *entries, const int n, const guint8 *strip, const uint32_t strip_size)
+{
+  uint32_t extra = 8 + 2 + 12 * n + 4;
+  uint32_t extra_size = 0;
+  for(int k = 0; k < n; k++)
+    if(_entry_size(&entries[k]) > 4) extra_size += (_entry_size(&entries[k]) + 1) & ~1u;
+  const uint32_t strip_offset = extra + extra_size;
+
+  GByteArray *b = g_byte_array_new();
+  g_byte_array_append(b, (const guint8 *)"II", 2);
+  _put16(b, 42);
+  _put32(b, 8);
+  _put16(b, n);
+  for(int k = 0; k < n; k++)
+  {
+    const _entry_t *e = &entries[k];
+    const uint32_t size = _entry_size(e);
+    _put16(b, e->tag);
+    _put16(b, e->type);
+    _put32(b, e->count);
+    if(size > 4)
+    {
+      _put32(b, extra);
+      extra += (size + 1) & ~1u;
+    }
+    else if(e->bytes)
+    {
+      guint8 x[4] = { 0 };
+      memcpy(x, e->bytes, size);
+      g_byte_array_append(b, x, 4);
+    }
+    else if(e->type == 3)
+    {
+      _put16(b, e->number);
+      _put16(b, 0);
+    }
+    else
+      _put32(b, e->tag == TAG_STRIP_OFFSETS ? strip_offset : e->number);
+  }
+  _put32(b, 0);
+  for(int k = 0; k < n; k++)
+  {
+    const uint32_t size = _entry_size(&entries[k]);
+    if(size <= 4) continue;
+    g_byte_array_append(b, (const guint8 *)entries[k].bytes, size);
+    if(size & 1) g_byte_array_append(b, (const guint8 *)"", 1);
+  }
+  if(strip) g_byte_array_append(b, strip, strip_size);
+  return b;
+}
+
+static gboolean _write(const char *filename, const GByteArray *b)
+{
+  GError *error = NULL;
+  if(!g_file_set_contents(filename, (const gchar *)b->data, b->len, &error))
+  {
+    fprintf(stderr, "can't write `%s': %s\n", filename, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean _write_dng(const char *filename, const char *datetime)
+{
+  static const guint8 strip[16 * 16] = { 0 };
+  const char version[4] = { 1, 4, 0, 0 };
+  const _entry_t entries[] = {
+    { 256, 4, 1, 16, NULL },                        // width
+    { 257, 4, 1, 16, NULL },                        // height
+    { 258, 3, 1, 8, NULL },                         // bits per sample
+    { 259, 3, 1, 1, NULL },                         // no compression
+    { 262, 3, 1, 1, NULL },                         // black is zero
+    { 271, 2, 6, 0, "bench" },                      // make
+    { 272, 2, 10, 0, "synthetic" },                 // model
+    { TAG_STRIP_OFFSETS, 4, 1, 0, NULL },
+    { 277, 3, 1, 1, NULL },                         // samples per pixel
+    { 278, 4, 1, 16, NULL },                        // rows per strip
+    { 279, 4, 1, sizeof(strip), NULL },             // strip byte count
+    { 306, 2, 20, 0, datetime },
+    { 50706, 1, 4, 0, version },                    // dng version
+  };
+  GByteArray *b = _tiff(entries, sizeof(entries) / sizeof(*entries), strip, sizeof(strip));
+  const gboolean ok = _write(filename, b);
+  g_byte_array_free(b, TRUE);
+  return ok;
+}
+
+static gboolean _write_jpeg(const char *filename, const char *datetime)
+{
+  const _entry_t entries[] = {
+    { 271, 2, 6, 0, "bench" },
+    { 272, 2, 10, 0, "synthetic" },
+    { 306, 2, 20, 0, datetime },
+  };
+  GByteArray *exif = _tiff(entries, sizeof(entries) / sizeof(*entries), NULL, 0);
+
+  // soi, app1 with the exif data, an 8x8 grey frame header and an empty scan
+  GByteArray *b = g_byte_array_new();
+  const guint8 soi[] = { 0xff, 0xd8, 0xff, 0xe1 };
+  g_byte_array_append(b, soi, sizeof(soi));
+  const uint16_t app1 = 2 + 6 + exif->len;
+  const guint8 len[2] = { app1 >> 8, app1 & 0xff };
+  g_byte_array_append(b, len, 2);
+  g_byte_array_append(b, (const guint8 *)"Exif\0\0", 6);
+  g_byte_array_append(b, exif->data, exif->len);
+  const guint8 frame[] = { 0xff, 0xc0, 0x00, 0x0b, 0x08, 0x00, 0x08, 0x00, 0x08, 0x01, 0x01, 0x11, 0x00,
+                           0xff, 0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00, 0x00, 0xff, 0xd9 };
+  g_byte_array_append(b, frame, sizeof(frame));
+
+  const gboolean ok = _write(filename, b);
+  g_byte_array_free(exif, TRUE);
+  g_byte_array_free(b, TRUE);
+  return ok;
+}
+
+// the first half are raw+jpeg pairs, the rest alternates between the two
+static gboolean _make_card(const char *dir, const int files)
+{
+  if(g_mkdir_with_parents(dir, 0755)) return FALSE;
+  for(int k = 0; k < files; k++)
+  {
+    const int pair = k < files / 2;
+    const int stem = pair ? k / 2 : k;
+    const gboolean dng = pair ? !(k & 1) : (k & 1);
+    char datetime[20];
+    snprintf(datetime, sizeof(datetime), "2020:01:%02d %02d:%02d:%02d", 1 + stem / 86400 % 28, stem / 3600 % 24,
+             stem / 60 % 60, stem % 60);
+    gchar *name = g_strdup_printf("IMG_%06d.%s", stem, dng ? "dng" : "jpg");
+    gchar *filename = g_build_filename(dir, name, NULL);
+    const gboolean ok = dng ? _write_dng(filename, datetime) : _write_jpeg(filename, datetime);
+    g_free(filename);
+    g_free(name);
+    if(!ok) return FALSE;
+  }
+  return TRUE;
+}
+
+static void _remove_dir(const char *dir)
+{
+  GDir *d = g_dir_open(dir, 0, NULL);
+  if(d)
+  {
+    const gchar *name;
+    while((name = g_dir_read_name(d)) != NULL)
+    {
+      gchar *filename = g_build_filename(dir, name, NULL);
+      if(g_file_test(filename, G_FILE_TEST_IS_DIR))
+        _remove_dir(filename);
+      else
+        g_unlink(filename);
+      g_free(filename);
+    }
+    g_dir_close(d);
+  }
+  g_rmdir(dir);
+}
+
+static int _count_images(const int filmid)
+{
+  sqlite3_stmt *stmt;
+  int count = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT COUNT(*) FROM main.images WHERE film_id = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, filmid);
+  if(sqlite3_step(stmt) == SQLITE_ROW) count = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+static int _run(const char *root, const int files, const int threads)
+{
+  gchar *dir = g_strdup_printf("%s/card-%d", root, threads);
+  if(!_make_card(dir, files))
+  {
+    g_free(dir);
+    return 1;
+  }
+
+  dt_conf_set_int("import_threads", threads);
+  // without the job system running the import happens right here
+  const double start = dt_get_wtime();
+  const int filmid = dt_film_import(dir);
+  const double end = dt_get_wtime();
+
+  const int imported = _count_images(filmid);
+  printf("[import] %2d threads: %6d files, %6d imported in %7.3f s: %8.1f files per second\n", threads, files,
+         imported, end - start, imported / (end - start));
+  g_free(dir);
+  return imported != files;
+}
+
+int main(int argc, char *argv[])
+{
+  const int files = argc > 1 ? atoi(argv[1]) : 2000;
+  const int threads = argc > 2 ? atoi(argv[2]) : 8;
+
+  if(files < 1 || threads < 1)
+  {
+    fprintf(stderr, "usage: %s [files] [threads]\n", argv[0]);
+    return 1;
+  }
+
+  char *dt_argv[] = { "darktable-bench-import", "--library", ":memory:", "--conf", "ui_last/import_ignore_jpegs=FALSE",
+                      NULL };
+  int dt_argc = sizeof(dt_argv) / sizeof(*dt_argv) - 1;
+
+  // init dt without gui and without data.db, the import job reports its progress though
+  if(dt_init(dt_argc, dt_argv, FALSE, FALSE, NULL)) exit(1);
+  dt_control_progress_init(darktable.control);
+
+  gchar *root = g_dir_make_tmp("darktable-bench-import-XXXXXX", NULL);
+  if(!root)
+  {
+    fprintf(stderr, "can't create a temporary directory\n");
+    dt_cleanup();
+    return 1;
+  }
+
+  int failed = _run(root, files, 1);
+  if(threads > 1) failed |= _run(root, files, threads);
+
+  _remove_dir(root);
+  g_free(root);
+  dt_cleanup();
+
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
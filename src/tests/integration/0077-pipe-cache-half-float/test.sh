@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Half float lines (pixelpipe_cache_half_float) are only used by the
+# darkroom pipes, where lines are read back. Export with and without the
+# option and check that the export pipe ignores it: both results have to
+# be identical. Reading packed lines back is covered by the unit test
+# test_pipe_cache_half_float.
+#
+
+cd $(dirname $0)
+
+CLI=${DARKTABLE_CLI:-darktable-cli}
+TEST_IMAGES=$PWD/../images
+
+REF=../0035-multiple-modules
+XMP=$REF/multiple-modules.xmp
+IMAGE=$(grep DerivedFrom $XMP | cut -d'"' -f2)
+
+echo "      Image $IMAGE"
+
+rm -f output*.png
+
+CORE_OPTIONS="--conf host_memory_limit=8192 \
+     --conf worker_threads=4 -t 4 \
+     --conf plugins/lighttable/export/force_lcms2=FALSE \
+     --conf plugins/lighttable/export/iccintent=0"
+
+export OMP_THREAD_LIMIT=4
+
+for HALF in FALSE TRUE; do
+    $CLI --width 2048 --height 2048 \
+         --hq true --apply-custom-presets false \
+         "$TEST_IMAGES/$IMAGE" "$XMP" output-$HALF.png \
+         --core --disable-opencl $CORE_OPTIONS \
+         --conf pixelpipe_cache_half_float=$HALF 1> /dev/null 2> /dev/null
+
+    [ $? -ne 0 ] && echo "      darktable-cli errored" && exit 1
+done
+
+../deltae output-FALSE.png output-TRUE.png
+
+# deltae returns 0 for identical, 1 for minor and 2 for visible differences
+[ $? -eq 0 ]
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Export at 2048x2048 with a small artificial memory budget
+# (memory_governor_limit) so that the caches are clamped, tiling kicks in
+# and the governor has to shrink. Check that it did, from its -d memory
+# output, and that the result is still visually the same as the
+# reference of 0035-multiple-modules.
+#
+
+cd $(dirname $0)
+
+CLI=${DARKTABLE_CLI:-darktable-cli}
+TEST_IMAGES=$PWD/../images
+
+REF=../0035-multiple-modules
+XMP=$REF/multiple-modules.xmp
+IMAGE=$(grep DerivedFrom $XMP | cut -d'"' -f2)
+
+echo "      Image $IMAGE"
+
+rm -f output*.png output.log
+
+# 256 MB in total, below what the export needs, half of it for the pipes
+CORE_OPTIONS="--conf host_memory_limit=8192 \
+     --conf memory_governor_limit=268435456 \
+     --conf worker_threads=4 -t 4 \
+     --conf plugins/lighttable/export/force_lcms2=FALSE \
+     --conf plugins/lighttable/export/iccintent=0"
+
+export OMP_THREAD_LIMIT=4
+
+$CLI --width 2048 --height 2048 \
+     --hq true --apply-custom-presets false \
+     "$TEST_IMAGES/$IMAGE" "$XMP" output.png \
+     --core --disable-opencl -d memory $CORE_OPTIONS 1> output.log 2> /dev/null
+
+[ $? -ne 0 ] && echo "      darktable-cli errored" && exit 1
+
+# the watcher checks once a second, the export takes longer than that
+if ! grep -q '\[memory_governor\] usage .* freed' output.log; then
+    echo "      memory governor never shrank the caches"
+    exit 1
+fi
+
+../deltae $REF/expected.png output.png
+
+# deltae returns 0 for identical, 1 for minor and 2 for visible differences
+[ $? -lt 2 ]
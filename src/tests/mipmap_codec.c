@@ -0,0 +1,179 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// codec benchmark for the disk backend of the mipmap cache: takes the thumbnails of an existing
+// disk cache level as sample, for example ~/.cache/darktable/mipmaps-<hash>.d/2, re-encodes them with
+// every codec available in this build and reports disk footprint and decode throughput.
+//
+// usage: darktable-bench-mipmap-codec <thumbnail directory> [quality] [max images]
+
+#include "common/darktable.h"
+#include "common/imageio_jpeg.h"
+#include "common/mipmap_codec.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct sample_t
+{
+  uint8_t *rgba;
+  uint32_t width, height;
+} sample_t;
+
+static GList *_load_samples(const char *dirname, const int max_images, uint32_t *max_width,
+                            uint32_t *max_height)
+{
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  if(!dir) return NULL;
+
+  GList *samples = NULL;
+  int count = 0;
+  const gchar *name;
+  while((name = g_dir_read_name(dir)) && count < max_images)
+  {
+    gchar *filename = g_build_filename(dirname, name, NULL);
+    gchar *blob = NULL;
+    gsize length = 0;
+    if(g_file_get_contents(filename, &blob, &length, NULL))
+    {
+      dt_imageio_jpeg_t jpg;
+      // only plain jpeg thumbnails make a fair sample
+      if(!dt_imageio_jpeg_decompress_header(blob, length, &jpg))
+      {
+        sample_t *s = (sample_t *)calloc(1, sizeof(sample_t));
+        s->width = jpg.width;
+        s->height = jpg.height;
+        s->rgba = (uint8_t *)dt_alloc_align(64, (size_t)4 * jpg.width * jpg.height);
+        if(!dt_imageio_jpeg_decompress(&jpg, s->rgba))
+        {
+          *max_width = MAX(*max_width, s->width);
+          *max_height = MAX(*max_height, s->height);
+          samples = g_list_prepend(samples, s);
+          count++;
+        }
+        else
+        {
+          dt_free_align(s->rgba);
+          free(s);
+        }
+      }
+      g_free(blob);
+    }
+    g_free(filename);
+  }
+  g_dir_close(dir);
+  return samples;
+}
+
+static void _free_sample(gpointer data)
+{
+  sample_t *s = (sample_t *)data;
+  dt_free_align(s->rgba);
+  free(s);
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc < 2)
+  {
+    fprintf(stderr, "usage: %s <thumbnail directory> [quality] [max images]\n", argv[0]);
+    return 1;
+  }
+  const int quality = argc > 2 ? atoi(argv[2]) : 89;
+  const int max_images = argc > 3 ? atoi(argv[3]) : 1000;
+
+  uint32_t max_width = 0, max_height = 0;
+  GList *samples = _load_samples(argv[1], max_images, &max_width, &max_height);
+  if(!samples)
+  {
+    fprintf(stderr, "no jpeg thumbnails found in `%s'\n", argv[1]);
+    return 1;
+  }
+
+  size_t pixels = 0;
+  for(GList *l = samples; l; l = g_list_next(l))
+  {
+    const sample_t *s = (sample_t *)l->data;
+    pixels += (size_t)s->width * s->height;
+  }
+  printf("[codec] %u thumbnails, %.1f megapixels, quality %d\n", g_list_length(samples), pixels * 1e-6, quality);
+
+  uint8_t *out = (uint8_t *)dt_alloc_align(64, (size_t)4 * max_width * max_height);
+  int errors = 0;
+
+  for(dt_mipmap_codec_t codec = DT_MIPMAP_CODEC_JPEG; codec < DT_MIPMAP_CODEC_NONE; codec++)
+  {
+    if(!dt_mipmap_codec_available(codec))
+    {
+      printf("[codec] %-14s not available in this build\n", dt_mipmap_codec_name(codec));
+      continue;
+    }
+
+    // encode everything first, so the decode timing only sees the blobs
+    GList *blobs = NULL;
+    GList *lengths = NULL;
+    size_t footprint = 0;
+    const double enc_start = dt_get_wtime();
+    for(GList *l = samples; l; l = g_list_next(l))
+    {
+      const sample_t *s = (sample_t *)l->data;
+      size_t length = 0;
+      uint8_t *blob = dt_mipmap_codec_encode(codec, s->rgba, s->width, s->height, quality, DT_COLORSPACE_SRGB,
+                                             &length);
+      if(!blob) errors++;
+      blobs = g_list_prepend(blobs, blob);
+      lengths = g_list_prepend(lengths, GSIZE_TO_POINTER(length));
+      footprint += length;
+    }
+    const double enc_end = dt_get_wtime();
+    blobs = g_list_reverse(blobs);
+    lengths = g_list_reverse(lengths);
+
+    const double dec_start = dt_get_wtime();
+    GList *b = blobs, *n = lengths;
+    for(GList *l = samples; l; l = g_list_next(l), b = g_list_next(b), n = g_list_next(n))
+    {
+      const sample_t *s = (sample_t *)l->data;
+      uint32_t width = 0, height = 0;
+      dt_colorspaces_color_profile_type_t color_space;
+      if(!b->data
+         || dt_mipmap_codec_decode(b->data, GPOINTER_TO_SIZE(n->data), out, max_width, max_height, &width,
+                                   &height, &color_space)
+         || width != s->width || height != s->height)
+        errors++;
+    }
+    const double dec_end = dt_get_wtime();
+
+    printf("[codec] %-14s %9.1f MB on disk (%5.1f%% of rgba), encode %8.1f MP/s, decode %8.1f MP/s\n",
+           dt_mipmap_codec_name(codec), footprint / (1024.0 * 1024.0), 100.0 * footprint / (4.0 * pixels),
+           pixels * 1e-6 / (enc_end - enc_start), pixels * 1e-6 / (dec_end - dec_start));
+
+    g_list_free_full(blobs, dt_free_align_ptr);
+    g_list_free(lengths);
+  }
+
+  dt_free_align(out);
+  g_list_free_full(samples, _free_sample);
+  if(errors) fprintf(stderr, "[codec] %d thumbnails failed to round trip\n", errors);
+  return errors ? 1 : 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
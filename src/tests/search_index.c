@@ -0,0 +1,262 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// search benchmark: a synthetic library with a deep tag hierarchy, synonyms, tagged images and metadata
+// is searched the way the collect and tagging modules do, scanning the tables with LIKE and through the
+// trigram index (see common/search_index.h). both have to find the same images.
+//
+// usage: darktable-bench-search [images] [tags]
+
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/search_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUNDS 10
+#define TAGS_PER_IMAGE 6
+
+static const char *_words[] = { "alpine", "harbour", "sunset", "portrait", "meadow", "granite", "festival",
+                                "lighthouse", "glacier", "market", "cathedral", "orchard", "canyon", "violin",
+                                "kestrel", "bridge", "lantern", "vineyard", "monsoon", "tundra", "bazaar",
+                                "fjord", "quarry", "carousel", "pagoda", "estuary", "savanna", "citadel" };
+
+static const char *_word(GRand *rand)
+{
+  return _words[g_rand_int_range(rand, 0, G_N_ELEMENTS(_words))];
+}
+
+static void _populate(const int images, const int tags)
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  GRand *rand = g_rand_new_with_seed(42);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "BEGIN", NULL, NULL, NULL);
+
+  // places|<word>|<word> <n>|..., four levels with a synonym on every other tag
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO data.tags (id, name, synonyms, flags) VALUES (?1, ?2, ?3, 0)",
+                              -1, &stmt, NULL);
+  for(int k = 1; k <= tags; k++)
+  {
+    gchar *name = g_strdup_printf("%s|%s|%s %d|%s", k % 3 ? "places" : "subjects", _word(rand), _word(rand),
+                                  k % 97, _word(rand));
+    gchar *synonyms = k % 2 ? g_strdup_printf("%s, %s", _word(rand), _word(rand)) : NULL;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, k);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, synonyms, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    g_free(name);
+    g_free(synonyms);
+  }
+  sqlite3_finalize(stmt);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO main.images (id, group_id, film_id, filename) VALUES (?1, ?1, 1, ?2)",
+                              -1, &stmt, NULL);
+  for(int k = 1; k <= images; k++)
+  {
+    gchar *filename = g_strdup_printf("IMG_%06d.dng", k);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, k);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, filename, -1, SQLITE_TRANSIENT);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    g_free(filename);
+  }
+  sqlite3_finalize(stmt);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR IGNORE INTO main.tagged_images (imgid, tagid, position)"
+                                  " VALUES (?1, ?2, 0)",
+                              -1, &stmt, NULL);
+  for(int k = 1; k <= images; k++)
+    for(int t = 0; t < TAGS_PER_IMAGE; t++)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, k);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, g_rand_int_range(rand, 1, tags + 1));
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
+  sqlite3_finalize(stmt);
+
+  // a title and a description for each image
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT INTO main.meta_data (id, key, value) VALUES (?1, ?2, ?3)", -1, &stmt,
+                              NULL);
+  for(int k = 1; k <= images; k++)
+    for(int key = 1; key <= 2; key++)
+    {
+      gchar *value = key == 1 ? g_strdup_printf("%s at the %s", _word(rand), _word(rand))
+                              : g_strdup_printf("a %s near the %s, shot %d", _word(rand), _word(rand), k);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, k);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, key);
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, value, -1, SQLITE_TRANSIENT);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      g_free(value);
+    }
+  sqlite3_finalize(stmt);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "COMMIT", NULL, NULL, NULL);
+  g_rand_free(rand);
+}
+
+// runs the query ROUNDS times, returns the time per run in ms and the count of the last one
+static double _time_count(const char *query, int *count)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  const double start = dt_get_wtime();
+  for(int k = 0; k < ROUNDS; k++)
+  {
+    *count = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : -1;
+    sqlite3_reset(stmt);
+  }
+  const double end = dt_get_wtime();
+  sqlite3_finalize(stmt);
+  return 1000.0 * (end - start) / ROUNDS;
+}
+
+static int _compare(const char *what, const char *needle, const char *scan, const char *indexed)
+{
+  gchar *scan_query = g_strdup_printf("SELECT COUNT(*) FROM main.images WHERE %s", scan);
+  gchar *indexed_query = g_strdup_printf("SELECT COUNT(*) FROM main.images WHERE %s", indexed);
+  int scan_count, indexed_count;
+  const double scan_ms = _time_count(scan_query, &scan_count);
+  const double indexed_ms = _time_count(indexed_query, &indexed_count);
+  printf("[search] %-9s %-18s %7d images: scan %9.3f ms, index %9.3f ms, %6.1fx\n", what, needle, scan_count,
+         scan_ms, indexed_ms, scan_ms / MAX(indexed_ms, 1e-6));
+  g_free(scan_query);
+  g_free(indexed_query);
+  if(scan_count == indexed_count) return 0;
+  fprintf(stderr, "[search] %s `%s': the index found %d images instead of %d\n", what, needle, indexed_count,
+          scan_count);
+  return 1;
+}
+
+// what the tagging module filters its dictionary by
+static int _compare_tags(const char *needle)
+{
+  gchar *query = g_strdup_printf("SELECT COUNT(*) FROM data.tags WHERE name LIKE '%%%s%%' OR synonyms LIKE '%%%s%%'",
+                                 needle, needle);
+  int scan_count;
+  const double scan_ms = _time_count(query, &scan_count);
+  g_free(query);
+
+  const double start = dt_get_wtime();
+  int indexed_count = 0;
+  for(int k = 0; k < ROUNDS; k++)
+  {
+    GHashTable *ids = dt_search_index_find_tags(needle);
+    indexed_count = ids ? g_hash_table_size(ids) : -1;
+    if(ids) g_hash_table_destroy(ids);
+  }
+  const double indexed_ms = 1000.0 * (dt_get_wtime() - start) / ROUNDS;
+  printf("[search] %-9s %-18s %7d tags:   scan %9.3f ms, index %9.3f ms, %6.1fx\n", "palette", needle, scan_count,
+         scan_ms, indexed_ms, scan_ms / MAX(indexed_ms, 1e-6));
+  if(scan_count == indexed_count) return 0;
+  fprintf(stderr, "[search] palette `%s': the index found %d tags instead of %d\n", needle, indexed_count,
+          scan_count);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  const int images = argc > 1 ? atoi(argv[1]) : 100000;
+  const int tags = argc > 2 ? atoi(argv[2]) : 20000;
+
+  if(images < 1 || tags < 1)
+  {
+    fprintf(stderr, "usage: %s [images] [tags]\n", argv[0]);
+    return 1;
+  }
+
+  char *dt_argv[] = { "darktable-bench-search", "--library", ":memory:", NULL };
+  int dt_argc = sizeof(dt_argv) / sizeof(*dt_argv) - 1;
+
+  // init dt without gui and without data.db
+  if(dt_init(dt_argc, dt_argv, FALSE, FALSE, NULL)) exit(1);
+
+  double start = dt_get_wtime();
+  _populate(images, tags);
+  printf("[search] %d images with %d tags populated in %.3f s\n", images, tags, dt_get_wtime() - start);
+
+  start = dt_get_wtime();
+  const gboolean have_tags = dt_search_index_tags();
+  const gboolean have_metadata = dt_search_index_metadata();
+  if(!have_tags || !have_metadata)
+  {
+    fprintf(stderr, "[search] sqlite has no fts5 trigram tokenizer, nothing to compare\n");
+    dt_cleanup();
+    return 0;
+  }
+  printf("[search] indexes built in %.3f s\n", dt_get_wtime() - start);
+
+  int failed = 0;
+  // substrings as typed into the collect module, with the rule's own wildcards
+  const char *substrings[] = { "%harb%", "%glacier 4%", "%|fjord|%", "%ant%" };
+  for(int k = 0; k < G_N_ELEMENTS(substrings); k++)
+  {
+    gchar *scan = g_strdup_printf("(id IN (SELECT imgid FROM main.tagged_images AS a JOIN data.tags AS b"
+                                  " ON a.tagid = b.id WHERE name LIKE '%s'))", substrings[k]);
+    gchar *indexed = g_strdup_printf("(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN"
+                                     " (SELECT rowid FROM memory.tags_text WHERE name LIKE '%s')))", substrings[k]);
+    failed |= _compare("tag", substrings[k], scan, indexed);
+    g_free(scan);
+    g_free(indexed);
+  }
+
+  // a shift-click in the collect module: the tag and everything below it
+  const char *hierarchies[] = { "places|harbour", "subjects|violin|kestrel 12" };
+  for(int k = 0; k < G_N_ELEMENTS(hierarchies); k++)
+  {
+    const char *h = hierarchies[k];
+    gchar *scan = g_strdup_printf("(id IN (SELECT imgid FROM main.tagged_images AS a JOIN data.tags AS b"
+                                  " ON a.tagid = b.id WHERE name LIKE '%s' OR name LIKE '%s|%%'))", h, h);
+    gchar *indexed = g_strdup_printf("(id IN (SELECT imgid FROM main.tagged_images WHERE tagid IN"
+                                     " (SELECT rowid FROM memory.tags_text WHERE name LIKE '%s%%'"
+                                     " AND (name LIKE '%s' OR name LIKE '%s|%%'))))", h, h, h);
+    failed |= _compare("hierarchy", h, scan, indexed);
+    g_free(scan);
+    g_free(indexed);
+  }
+
+  const char *values[] = { "lighthouse", "near the can", "shot 4711" };
+  for(int k = 0; k < G_N_ELEMENTS(values); k++)
+  {
+    gchar *scan = g_strdup_printf("(id IN (SELECT id FROM main.meta_data WHERE key = 2 AND value LIKE '%%%s%%'))",
+                                  values[k]);
+    gchar *indexed = g_strdup_printf("(id IN (SELECT id FROM memory.meta_data_text WHERE value LIKE '%%%s%%'"
+                                     " AND key = 2))", values[k]);
+    failed |= _compare("metadata", values[k], scan, indexed);
+    g_free(scan);
+    g_free(indexed);
+  }
+
+  const char *needles[] = { "fjo", "harbour", "ALPINE", "quarry 3" };
+  for(int k = 0; k < G_N_ELEMENTS(needles); k++) failed |= _compare_tags(needles[k]);
+
+  dt_cleanup();
+
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
@@ -0,0 +1,131 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/cache_stats.c and the counters of common/cache.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/cache_stats.c"
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_latency_buckets(void **state)
+{
+  dt_cache_stats_t stats = { 0 };
+
+  TR_STEP("verify that bucket k counts events of less than 2^k microseconds");
+  dt_cache_stats_latency(&stats, 0.5e-6);
+  dt_cache_stats_latency(&stats, 1e-6);
+  dt_cache_stats_latency(&stats, 3e-6);
+  dt_cache_stats_latency(&stats, 1e-3);
+  assert_int_equal(stats.latency[0], 1);
+  assert_int_equal(stats.latency[1], 1);
+  assert_int_equal(stats.latency[2], 1);
+  assert_int_equal(stats.latency[10], 1);
+
+  TR_STEP("verify that the last bucket takes everything longer");
+  dt_cache_stats_latency(&stats, 1000.0);
+  assert_int_equal(stats.latency[DT_CACHE_LATENCY_BUCKETS - 1], 1);
+}
+
+static void test_cache_counters(void **state)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 64, 16);
+
+  TR_STEP("verify that the first get is a miss and the second one a hit");
+  dt_cache_entry_t *entry = dt_cache_get(&cache, 1, 'w');
+  dt_cache_release(&cache, entry);
+  entry = dt_cache_get(&cache, 1, 'r');
+  dt_cache_release(&cache, entry);
+  assert_int_equal(cache.stats.misses, 1);
+  assert_int_equal(cache.stats.hits, 1);
+  assert_int_equal(dt_cache_size(&cache), 1);
+  uint64_t filled = 0;
+  for(int k = 0; k < DT_CACHE_LATENCY_BUCKETS; k++) filled += cache.stats.latency[k];
+  assert_int_equal(filled, 1);
+
+  TR_STEP("verify that garbage collection counts the evicted entries");
+  dt_cache_gc(&cache, 0.0f);
+  assert_int_equal(cache.stats.evictions, 1);
+  assert_int_equal(dt_cache_size(&cache), 0);
+
+  dt_cache_cleanup(&cache);
+}
+
+static void test_registry(void **state)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 64, 1024);
+  dt_cache_stats_init();
+
+  TR_STEP("verify that a registered cache is reported with its counters");
+  dt_cache_stats_register_cache("test \"cache\"", &cache, TRUE);
+  dt_cache_entry_t *entry = dt_cache_get(&cache, 7, 'w');
+  dt_cache_release(&cache, entry);
+  GList *reports = dt_cache_stats_collect();
+  assert_int_equal(g_list_length(reports), 1);
+  const dt_cache_report_t *report = (dt_cache_report_t *)reports->data;
+  assert_string_equal(report->name, "test \"cache\"");
+  assert_int_equal(report->entries, 1);
+  assert_int_equal(report->quota, 1024);
+  assert_int_equal(report->stats.misses, 1);
+  assert_int_equal(report->stats.resident, 1);
+
+  TR_STEP("verify that the json line escapes the name and holds the counters");
+  gchar *json = dt_cache_stats_json(reports);
+  assert_non_null(strstr(json, "\"name\":\"test \\\"cache\\\"\""));
+  assert_non_null(strstr(json, "\"misses\":1,"));
+  assert_null(strchr(json, '\n'));
+  g_free(json);
+  dt_cache_stats_free(reports);
+
+  TR_STEP("verify that an unregistered cache is gone");
+  dt_cache_stats_unregister(&cache);
+  reports = dt_cache_stats_collect();
+  assert_null(reports);
+
+  dt_cache_stats_cleanup();
+  dt_cache_cleanup(&cache);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_latency_buckets),
+    cmocka_unit_test(test_cache_counters),
+    cmocka_unit_test(test_registry)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
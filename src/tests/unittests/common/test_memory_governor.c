@@ -0,0 +1,217 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the shrink policy of common/memory_governor.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/memory_governor.c"
+
+typedef struct fake_client_t
+{
+  size_t held;
+  size_t asked; // what the last shrink asked for
+  int calls;
+  int order;    // when it was asked, among all clients
+} fake_client_t;
+
+static int _asked = 0;
+static void *_unregister_on_shrink = NULL; // what the next shrink unregisters
+
+static size_t _fake_usage(void *data)
+{
+  return ((fake_client_t *)data)->held;
+}
+
+static size_t _fake_shrink(void *data, size_t bytes)
+{
+  fake_client_t *c = (fake_client_t *)data;
+  const size_t freed = MIN(bytes, c->held);
+  c->asked = bytes;
+  c->calls++;
+  c->order = ++_asked;
+  c->held -= freed;
+  if(_unregister_on_shrink)
+  {
+    void *other = _unregister_on_shrink;
+    _unregister_on_shrink = NULL;
+    dt_memory_governor_unregister(other);
+  }
+  return freed;
+}
+
+// the watcher thread isn't started, checks only happen when the test calls them
+static int setup(void **state)
+{
+  dt_pthread_mutex_init(&_governor_mutex, NULL);
+  pthread_cond_init(&_governor_cond, NULL);
+  _governor_initialized = TRUE;
+  _asked = 0;
+  _unregister_on_shrink = NULL;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  _governor_initialized = FALSE;
+  g_list_free_full(_governor_clients, _client_free);
+  _governor_clients = NULL;
+  _governor_budget = 0;
+  pthread_cond_destroy(&_governor_cond);
+  dt_pthread_mutex_destroy(&_governor_mutex);
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_no_pressure(void **state)
+{
+  if(!_current_usage() || _current_pressure() >= DT_MEMORY_GOVERNOR_PSI) skip();
+
+  fake_client_t a = { .held = 1 << 20 };
+  dt_memory_governor_register("a", _fake_usage, _fake_shrink, &a);
+
+  TR_STEP("verify that nothing is asked for well within the budget");
+  _governor_budget = 100 * _current_usage();
+  dt_memory_governor_check();
+  assert_int_equal(a.calls, 0);
+  assert_int_equal(a.held, 1 << 20);
+}
+
+static void test_biggest_first(void **state)
+{
+  const size_t usage = _current_usage();
+  if(!usage) skip();
+
+  // the biggest one can free all that is needed alone
+  fake_client_t small = { .held = usage / 2 }, big = { .held = 4 * usage }, unknown = { 0 };
+  dt_memory_governor_register("small", _fake_usage, _fake_shrink, &small);
+  dt_memory_governor_register("unknown", NULL, _fake_shrink, &unknown);
+  dt_memory_governor_register("big", _fake_usage, _fake_shrink, &big);
+
+  TR_STEP("verify that above the high mark the biggest client is asked down to the low mark");
+  _governor_budget = (size_t)(usage / 0.95);
+  dt_memory_governor_check();
+  assert_int_equal(big.calls, 1);
+  assert_int_equal(big.order, 1);
+  // our resident set moves a bit between the two looks at it
+  const size_t needed = usage - (size_t)(DT_MEMORY_GOVERNOR_LOW * _governor_budget);
+  assert_in_range(big.asked, needed / 2, 2 * needed);
+  assert_int_equal(big.held, 4 * usage - big.asked);
+
+  TR_STEP("verify that the others are left alone once enough is freed");
+  assert_int_equal(small.calls, 0);
+  assert_int_equal(unknown.calls, 0);
+}
+
+static void test_all_in_order(void **state)
+{
+  const size_t usage = _current_usage();
+  if(!usage) skip();
+
+  // together they can't free what is needed
+  fake_client_t a = { .held = 3 << 10 }, b = { .held = 2 << 10 }, c = { .held = 1 << 10 }, unknown = { 0 };
+  dt_memory_governor_register("b", _fake_usage, _fake_shrink, &b);
+  dt_memory_governor_register("unknown", NULL, _fake_shrink, &unknown);
+  dt_memory_governor_register("a", _fake_usage, _fake_shrink, &a);
+  dt_memory_governor_register("c", _fake_usage, _fake_shrink, &c);
+
+  TR_STEP("verify that far over budget every client is asked, the biggest first, unknown sizes last");
+  _governor_budget = usage / 4;
+  dt_memory_governor_check();
+  assert_int_equal(a.order, 1);
+  assert_int_equal(b.order, 2);
+  assert_int_equal(c.order, 3);
+  assert_int_equal(unknown.order, 4);
+  assert_int_equal(a.held + b.held + c.held, 0);
+
+  TR_STEP("verify that each one is asked for what the ones before couldn't free");
+  assert_int_equal(b.asked, a.asked - (3 << 10));
+  assert_int_equal(c.asked, b.asked - (2 << 10));
+  assert_int_equal(unknown.asked, c.asked - (1 << 10));
+}
+
+static void test_unregister(void **state)
+{
+  const size_t usage = _current_usage();
+  if(!usage) skip();
+
+  fake_client_t a = { .held = 1 << 20 }, b = { .held = 1 << 20 };
+  dt_memory_governor_register("a", _fake_usage, _fake_shrink, &a);
+  dt_memory_governor_register("b", _fake_usage, _fake_shrink, &b);
+  dt_memory_governor_unregister(&a);
+
+  TR_STEP("verify that an unregistered client isn't asked anymore");
+  _governor_budget = usage / 4;
+  dt_memory_governor_check();
+  assert_int_equal(a.calls, 0);
+  assert_int_equal(b.calls, 1);
+}
+
+static void test_unregister_while_shrinking(void **state)
+{
+  const size_t usage = _current_usage();
+  if(!usage) skip();
+
+  // a can't free what is needed, b would be next
+  fake_client_t a = { .held = 2 << 10 }, b = { .held = 1 << 10 }, c = { .held = 1 << 20 };
+  dt_memory_governor_register("a", _fake_usage, _fake_shrink, &a);
+  dt_memory_governor_register("b", _fake_usage, _fake_shrink, &b);
+
+  TR_STEP("verify that a client unregistered during a check isn't asked anymore");
+  _unregister_on_shrink = &b;
+  _governor_budget = usage / 4;
+  dt_memory_governor_check();
+  assert_int_equal(a.calls, 1);
+  assert_int_equal(b.calls, 0);
+  assert_int_equal(g_list_length(_governor_clients), 1);
+
+  TR_STEP("verify that the next check asks the clients registered meanwhile");
+  _unregister_on_shrink = NULL;
+  dt_memory_governor_register("c", _fake_usage, _fake_shrink, &c);
+  dt_memory_governor_check();
+  assert_int_equal(c.calls, 1);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_no_pressure, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_biggest_first, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_all_in_order, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_unregister, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_unregister_while_shrinking, setup, teardown)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,189 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the fp16 lines of develop/pixelpipe_cache.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "develop/pixelpipe_cache.c"
+
+// not a multiple of 4, so both the vector blocks and the tail are used
+#define N 1027
+
+// smallest normal half float
+#define HALF_MIN_NORMAL 6.103515625e-05f
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_half_exact(void **state)
+{
+  TR_STEP("verify that every finite half float survives unpack and pack unchanged");
+  uint16_t *half = malloc(sizeof(uint16_t) * 65536);
+  uint16_t *again = malloc(sizeof(uint16_t) * 65536);
+  float *f = malloc(sizeof(float) * 65536);
+  size_t n = 0;
+  for(uint32_t h = 0; h < 65536; h++)
+    if((h & 0x7c00) != 0x7c00) half[n++] = h;
+
+  _cache_unpack(f, half, n);
+  _cache_pack(again, f, n);
+  for(size_t k = 0; k < n; k++) assert_int_equal(again[k], half[k]);
+
+  free(half);
+  free(again);
+  free(f);
+}
+
+static void test_round_trip_error(void **state)
+{
+  float in[N], out[N];
+  uint16_t packed[N];
+
+  TR_STEP("verify the round trip error: half an ulp of a 10 bit mantissa, relative for normals");
+  for(int e = -14; e < 16; e++)
+  {
+    for(int k = 0; k < N; k++) in[k] = ldexpf(1.0f + (float)k / N, e) * (k & 1 ? -1.0f : 1.0f);
+    _cache_pack(packed, in, N);
+    _cache_unpack(out, packed, N);
+    for(int k = 0; k < N; k++)
+    {
+      if(fabsf(in[k]) > 65504.0f) continue;
+      assert_true(fabsf(out[k] - in[k]) <= ldexpf(fabsf(in[k]), -11));
+      assert_true(signbit(out[k]) == signbit(in[k]));
+    }
+  }
+
+  TR_STEP("verify the round trip error: absolute for subnormals");
+  for(int k = 0; k < N; k++) in[k] = HALF_MIN_NORMAL * (float)k / N;
+  _cache_pack(packed, in, N);
+  _cache_unpack(out, packed, N);
+  for(int k = 0; k < N; k++) assert_true(fabsf(out[k] - in[k]) <= ldexpf(1.0f, -25));
+}
+
+static void test_clamp(void **state)
+{
+  float in[N], out[N];
+  uint16_t packed[N];
+
+  TR_STEP("verify that values beyond the half range clamp to the largest finite half");
+  for(int k = 0; k < N; k++) in[k] = (k & 1 ? -1.0f : 1.0f) * (65504.0f + 1000.0f * k);
+  _cache_pack(packed, in, N);
+  _cache_unpack(out, packed, N);
+  for(int k = 0; k < N; k++) assert_true(out[k] == (k & 1 ? -65504.0f : 65504.0f));
+
+  TR_STEP("verify that zeros keep their sign");
+  for(int k = 0; k < N; k++) in[k] = k & 1 ? -0.0f : 0.0f;
+  _cache_pack(packed, in, N);
+  _cache_unpack(out, packed, N);
+  for(int k = 0; k < N; k++)
+  {
+    assert_true(out[k] == 0.0f);
+    assert_true(signbit(out[k]) == signbit(in[k]));
+  }
+}
+
+static void test_scalar_matches(void **state)
+{
+  float in[N];
+  uint16_t packed[N];
+
+  TR_STEP("verify that the block path rounds like the scalar one");
+  for(int k = 0; k < N; k++) in[k] = ldexpf((float)k * 0.7311f, k % 37 - 24) * (k & 2 ? -1.0f : 1.0f);
+  _cache_pack(packed, in, N);
+  for(int k = 0; k < N; k++)
+    assert_int_equal(packed[k], _cache_float_to_half(CLAMPS(in[k], -DT_CACHE_HALF_MAX, DT_CACHE_HALF_MAX)));
+}
+
+static void test_read_back(void **state)
+{
+  dt_dev_pixelpipe_cache_t cache;
+  dt_iop_buffer_dsc_t fdsc = { .channels = 4, .datatype = TYPE_FLOAT };
+  dt_iop_buffer_dsc_t *dsc = &fdsc;
+  const size_t size = 4 * sizeof(float) * N;
+  float *buf;
+  float in[4 * N];
+
+  // three lines and no budget, like an export pipe but with half floats
+  assert_int_equal(dt_dev_pixelpipe_cache_init(&cache, 3, 0, 0), 1);
+  dt_dev_pixelpipe_cache_set_half_float(&cache, 1);
+
+  TR_STEP("verify that a new float line is stored packed and handed out as floats");
+  for(int k = 0; k < 4 * N; k++) in[k] = ldexpf(1.0f + (float)k / N, k % 29 - 14);
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 1, 1, size, (void **)&buf, &dsc), 1);
+  assert_non_null(buf);
+  assert_true(cache.packed[_cache_lookup(&cache, 1)]);
+  memcpy(buf, in, size);
+
+  TR_STEP("verify that the line is still in its scratch buffer while it is the input of the next one");
+  dsc = &fdsc;
+  float *next;
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 2, 2, size, (void **)&next, &dsc), 1);
+  assert_ptr_not_equal(next, buf);
+  float *again;
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 1, 1, size, (void **)&again, &dsc), 0);
+  assert_ptr_equal(again, buf);
+
+  TR_STEP("verify that the line is packed once its scratch buffer is taken, and unpacked on the next hit");
+  dsc = &fdsc;
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 3, 3, size, (void **)&next, &dsc), 1);
+  dsc = &fdsc;
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 2, 2, size, (void **)&next, &dsc), 0);
+  assert_int_equal(_cache_scratch_find(&cache, _cache_lookup(&cache, 1)), -1);
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 1, 1, size, (void **)&again, &dsc), 0);
+  assert_non_null(again);
+  assert_int_equal(dsc->datatype, TYPE_FLOAT);
+  for(int k = 0; k < 4 * N; k++) assert_true(fabsf(again[k] - in[k]) <= ldexpf(fabsf(in[k]), -11));
+
+  TR_STEP("verify that a line which doesn't hold floats is never packed");
+  dt_iop_buffer_dsc_t udsc = { .channels = 1, .datatype = TYPE_UINT16 };
+  dsc = &udsc;
+  assert_int_equal(dt_dev_pixelpipe_cache_get(&cache, 4, 4, size, (void **)&next, &dsc), 1);
+  assert_false(cache.packed[_cache_lookup(&cache, 4)]);
+
+  dt_dev_pixelpipe_cache_cleanup(&cache);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_half_exact),
+    cmocka_unit_test(test_round_trip_error),
+    cmocka_unit_test(test_clamp),
+    cmocka_unit_test(test_scalar_matches),
+    cmocka_unit_test(test_read_back)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
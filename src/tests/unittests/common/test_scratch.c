@@ -0,0 +1,134 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/scratch.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "common/scratch.c"
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_heap_fallback(void **state)
+{
+  TR_STEP("verify that without a current arena memory comes from the heap, aligned");
+  float *buf = dt_scratch_alloc_float(1000);
+  assert_non_null(buf);
+  assert_int_equal((uintptr_t)buf % 64, 0);
+  buf[999] = 1.0f;
+  dt_scratch_free(buf);
+  dt_scratch_free(NULL);
+}
+
+static void test_reuse(void **state)
+{
+  dt_scratch_t *arena = dt_scratch_new();
+  dt_scratch_t *previous = dt_scratch_begin(arena);
+  assert_null(previous);
+
+  TR_STEP("verify that a freed block is handed out again for a similar size");
+  void *a = dt_scratch_alloc(1 << 20);
+  assert_int_equal((uintptr_t)a % 64, 0);
+  dt_scratch_free(a);
+  void *b = dt_scratch_alloc((1 << 20) - 4096);
+  assert_ptr_equal(a, b);
+  assert_int_equal(arena->stats.misses, 1);
+  assert_int_equal(arena->stats.hits, 1);
+
+  TR_STEP("verify that a block in use isn't handed out twice");
+  void *c = dt_scratch_alloc(1 << 20);
+  assert_ptr_not_equal(b, c);
+
+  TR_STEP("verify that a block much larger than the request is left alone");
+  dt_scratch_free(c);
+  void *d = dt_scratch_alloc(1 << 16);
+  assert_ptr_not_equal(c, d);
+  dt_scratch_free(b);
+  dt_scratch_free(d);
+
+  dt_scratch_end(previous);
+  assert_int_equal(arena->blocks->len, 3);
+  assert_int_equal(dt_scratch_retained(arena), 2 * (1 << 20) + (1 << 16));
+
+  TR_STEP("verify that releasing the arena frees its idle blocks");
+  dt_scratch_release(arena);
+  assert_int_equal(arena->blocks->len, 0);
+  assert_int_equal(dt_scratch_retained(arena), 0);
+  dt_scratch_destroy(arena);
+}
+
+static void test_reset(void **state)
+{
+  dt_scratch_t *arena = dt_scratch_new();
+  arena->limit = 1 << 20;
+  dt_scratch_t *previous = dt_scratch_begin(arena);
+
+  TR_STEP("verify that a reset keeps blocks the module didn't free out of reuse");
+  void *leak = dt_scratch_alloc(1 << 20);
+  dt_scratch_end(previous);
+  assert_int_equal(((dt_scratch_block_t *)((char *)leak - DT_SCRATCH_HEADER))->in_use, TRUE);
+  previous = dt_scratch_begin(arena);
+  void *a = dt_scratch_alloc(1 << 20);
+  assert_ptr_not_equal(a, leak);
+
+  TR_STEP("verify that a reset trims the idle blocks to the limit, oldest first");
+  dt_scratch_free(leak);
+  dt_scratch_free(a);
+  dt_scratch_end(previous);
+  assert_int_equal(arena->blocks->len, 1);
+  assert_ptr_equal((char *)g_ptr_array_index(arena->blocks, 0) + DT_SCRATCH_HEADER, a);
+  assert_int_equal(arena->stats.evictions, 1);
+
+  TR_STEP("verify that a shrink request of the governor empties the arena");
+  assert_int_equal(_governor_shrink(arena, SIZE_MAX), 1 << 20);
+  assert_int_equal(dt_scratch_retained(arena), 0);
+
+  TR_STEP("verify that a block still in use outlives its arena");
+  previous = dt_scratch_begin(arena);
+  float *late = dt_scratch_alloc_float(1000);
+  dt_scratch_end(previous);
+  dt_scratch_destroy(arena);
+  late[999] = 1.0f;
+  dt_scratch_free(late);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_heap_fallback),
+    cmocka_unit_test(test_reuse),
+    cmocka_unit_test(test_reset)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,169 @@
+/*
+    This file is part of darktable,
+    Copyright (C) 2020 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for develop/stage_cache.c
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/tracing.h"
+
+#include "develop/stage_cache.c"
+
+static const dt_iop_buffer_dsc_t rgb = { .channels = 4, .datatype = TYPE_FLOAT };
+
+static int setup(void **state)
+{
+  dt_dev_stage_cache_init();
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_dev_stage_cache_cleanup();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_exact(void **state)
+{
+  const dt_iop_roi_t roi = { 0, 0, 4, 2, 0.5f };
+  float in[4 * 2 * 4], out[4 * 2 * 4] = { 0.0f };
+  for(int k = 0; k < 4 * 2 * 4; k++) in[k] = k;
+
+  TR_STEP("verify that a stored stage is found again with the same roi only");
+  dt_dev_stage_cache_put(42, &roi, in, sizeof(in), &rgb);
+  assert_true(dt_dev_stage_cache_available(42, &roi, &rgb));
+  assert_false(dt_dev_stage_cache_available(43, &roi, &rgb));
+  const dt_iop_roi_t shifted = { 1, 0, 4, 2, 0.5f };
+  assert_false(dt_dev_stage_cache_available(42, &shifted, &rgb));
+
+  TR_STEP("verify that the data and its format are copied out");
+  dt_iop_buffer_dsc_t dsc = { 0 };
+  assert_int_equal(dt_dev_stage_cache_get(42, &roi, out, sizeof(out), &dsc), 0);
+  assert_memory_equal(in, out, sizeof(in));
+  assert_int_equal(dsc.channels, 4);
+  assert_int_equal(_stage_stats.hits, 1);
+
+  TR_STEP("verify that storing the same roi again replaces the entry");
+  dt_dev_stage_cache_put(42, &roi, in, sizeof(in), &rgb);
+  assert_int_equal(g_list_length(_stage_lru), 1);
+  assert_int_equal(_stage_allmem, sizeof(in));
+  dt_dev_stage_cache_flush();
+  assert_int_equal(_stage_allmem, 0);
+}
+
+static void test_larger_entry(void **state)
+{
+  const dt_iop_roi_t full = { 0, 0, 100, 80, 1.0f };
+  float *in = calloc(100 * 80 * 4, sizeof(float));
+  dt_dev_stage_cache_put(7, &full, in, 100 * 80 * 4 * sizeof(float), &rgb);
+  free(in);
+
+  TR_STEP("verify that a smaller scale inside the entry can be scaled down from it");
+  const dt_iop_roi_t half = { 10, 10, 40, 30, 0.5f };
+  assert_true(dt_dev_stage_cache_available(7, &half, &rgb));
+
+  TR_STEP("verify that rois reaching outside or at a larger scale can't");
+  const dt_iop_roi_t outside = { 20, 0, 40, 30, 0.5f };
+  assert_false(dt_dev_stage_cache_available(7, &outside, &rgb));
+  const dt_iop_roi_t larger = { 0, 0, 20, 20, 2.0f };
+  assert_false(dt_dev_stage_cache_available(7, &larger, &rgb));
+
+  TR_STEP("verify that raw data is never resampled");
+  const dt_iop_buffer_dsc_t raw = { .channels = 1, .datatype = TYPE_FLOAT };
+  assert_false(dt_dev_stage_cache_available(7, &half, &raw));
+  dt_dev_stage_cache_flush();
+}
+
+static void test_eviction(void **state)
+{
+  const size_t limit = _stage_limit;
+  float buf[64] = { 0.0f };
+  _stage_limit = 2 * sizeof(buf);
+
+  TR_STEP("verify that the least recently used entry goes first");
+  const dt_iop_roi_t roi = { 0, 0, 4, 4, 1.0f };
+  dt_dev_stage_cache_put(1, &roi, buf, sizeof(buf), &rgb);
+  dt_dev_stage_cache_put(2, &roi, buf, sizeof(buf), &rgb);
+  dt_iop_buffer_dsc_t dsc;
+  assert_int_equal(dt_dev_stage_cache_get(1, &roi, buf, sizeof(buf), &dsc), 0);
+  dt_dev_stage_cache_put(3, &roi, buf, sizeof(buf), &rgb);
+  assert_true(dt_dev_stage_cache_available(1, &roi, &rgb));
+  assert_false(dt_dev_stage_cache_available(2, &roi, &rgb));
+  assert_true(dt_dev_stage_cache_available(3, &roi, &rgb));
+  assert_int_equal(_stage_stats.evictions, 1);
+
+  TR_STEP("verify that an entry larger than the whole cache isn't stored");
+  float big[256] = { 0.0f };
+  const dt_iop_roi_t big_roi = { 0, 0, 8, 8, 1.0f };
+  dt_dev_stage_cache_put(4, &big_roi, big, sizeof(big), &rgb);
+  assert_false(dt_dev_stage_cache_available(4, &big_roi, &rgb));
+
+  dt_dev_stage_cache_flush();
+  _stage_limit = limit;
+}
+
+static void test_wanted(void **state)
+{
+  const dt_iop_roi_t roi = { 0, 0, 2, 2, 1.0f };
+  float buf[2 * 2 * 4] = { 0.0f };
+  int a, b;
+
+  TR_STEP("verify that a stage is only wanted by pipes other than the one asking");
+  assert_false(dt_dev_stage_cache_wanted(5, &b));
+  dt_dev_stage_cache_want(5, &a);
+  assert_true(dt_dev_stage_cache_wanted(5, &b));
+  assert_false(dt_dev_stage_cache_wanted(5, &a));
+  assert_false(dt_dev_stage_cache_wanted(6, &b));
+
+  TR_STEP("verify that storing the stage answers the request");
+  dt_dev_stage_cache_put(5, &roi, buf, sizeof(buf), &rgb);
+  assert_false(dt_dev_stage_cache_wanted(5, &b));
+
+  TR_STEP("verify that only the latest requests are remembered");
+  for(int k = 0; k <= DT_STAGE_CACHE_WANTED; k++) dt_dev_stage_cache_want(100 + k, &a);
+  assert_false(dt_dev_stage_cache_wanted(100, &b));
+  assert_true(dt_dev_stage_cache_wanted(100 + DT_STAGE_CACHE_WANTED, &b));
+  dt_dev_stage_cache_flush();
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main()
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_exact),
+    cmocka_unit_test(test_larger_entry),
+    cmocka_unit_test(test_eviction),
+    cmocka_unit_test(test_wanted)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -89,6 +89,10 @@ darktable.print_log:add_parameter("message","string",[[The string to display.]])
 darktable.print_error:set_text([[This function is similar to]]..my_tostring(darktable.print_log)..[[ but adds an ERROR prefix for clarity.]])
 darktable.print_error:add_parameter("message","string",[[The string to display.]])
 
+darktable.cache_stats:set_text([[Returns the statistics of darktable's caches: the image cache, the mipmap caches and each of their levels and the pixelpipe caches of the darkroom.]]..para()..
+[[The table maps the name of each cache to a table with the fields entries, quota, hits, misses, evictions, lock_wait (in microseconds), resident (in bytes) and latency. latency is a histogram of the time it took to fill missed entries, its k-th element counts the ones which took less than 2^(k-1) microseconds.]])
+darktable.cache_stats:add_return("table","The statistics of all caches")
+
 darktable.register_event:set_text([[This function registers a callback to be called when a given event happens.]]..para()..
 [[Events are documented ]]..node_to_string(events,[[in the event section.]]))
 darktable.register_event:add_parameter("event_type","string",[[The name of the event to register to.]])